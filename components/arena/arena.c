@@ -0,0 +1,175 @@
+#include <string.h>
+#include <stdlib.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "arena.h"
+
+#define ARENA_ALIGN     8
+#define ARENA_HDR       8       // block size in front of each block, keeps the alignment
+
+typedef struct {
+    TaskHandle_t owner;
+    size_t used;
+    size_t last;                // offset of the newest block (its header)
+    size_t peak;
+} arena_t;
+
+static uint8_t s_mem[CONFIG_ARENA_COUNT][CONFIG_ARENA_SIZE] __attribute__((aligned(ARENA_ALIGN)));
+static arena_t s_arenas[CONFIG_ARENA_COUNT];
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static arena_stats_t s_stats;
+static __thread arena_t *t_arena;
+
+static inline int slot_of(arena_t *a)
+{
+    return a - s_arenas;
+}
+
+// Arena holding p, NULL for heap blocks
+static inline arena_t *arena_of(const void *p)
+{
+    const uint8_t *b = p, *base = &s_mem[0][0];
+    if (b < base || b >= base + sizeof(s_mem)) {
+        return NULL;
+    }
+    return &s_arenas[(b - base) / CONFIG_ARENA_SIZE];
+}
+
+static void *spill(size_t size)
+{
+    void *p = malloc(size);
+    if (t_arena && p) {
+        __atomic_add_fetch(&s_stats.spills, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&s_stats.spill_bytes, size, __ATOMIC_RELAXED);
+    }
+    return p;
+}
+
+void *arena_alloc(size_t size)
+{
+    arena_t *a = t_arena;
+    size_t need = ARENA_HDR + ((size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1));
+    if (a == NULL || size == 0 || need > CONFIG_ARENA_SIZE - a->used) {
+        return spill(size);
+    }
+    uint8_t *hdr = s_mem[slot_of(a)] + a->used;
+    *(uint32_t *)hdr = size;
+    a->last = a->used;
+    a->used += need;
+    if (a->used > a->peak) {
+        a->peak = a->used;
+    }
+    return hdr + ARENA_HDR;
+}
+
+void *arena_calloc(size_t n, size_t size)
+{
+    if (size && n > SIZE_MAX / size) {
+        return NULL;
+    }
+    void *p = arena_alloc(n * size);
+    if (p) {
+        memset(p, 0, n * size);
+    }
+    return p;
+}
+
+void *arena_realloc(void *p, size_t size)
+{
+    if (p == NULL) {
+        return arena_alloc(size);
+    }
+    arena_t *a = arena_of(p);
+    if (a == NULL) {
+        return realloc(p, size);
+    }
+    uint8_t *hdr = (uint8_t *)p - ARENA_HDR;
+    size_t old = *(uint32_t *)hdr;
+    size_t off = hdr - s_mem[slot_of(a)];
+    if (a == t_arena && off == a->last) {
+        size_t need = ARENA_HDR + ((size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1));
+        if (need <= CONFIG_ARENA_SIZE - off) {
+            *(uint32_t *)hdr = size;
+            a->used = off + need;
+            if (a->used > a->peak) {
+                a->peak = a->used;
+            }
+            return p;
+        }
+    }
+    void *n = arena_alloc(size);
+    if (n) {
+        memcpy(n, p, old < size ? old : size);
+    }
+    return n;
+}
+
+void arena_free(void *p)
+{
+    // Arena blocks go all at once when the command returns
+    if (arena_of(p) == NULL) {
+        free(p);
+    }
+}
+
+void arena_enter(arena_scope_t *scope)
+{
+    arena_t *a = t_arena;
+    scope->outer = a == NULL;
+    if (a == NULL) {
+        taskENTER_CRITICAL(&s_mux);
+        for (int i = 0; i < CONFIG_ARENA_COUNT; i++) {
+            if (s_arenas[i].owner == NULL) {
+                a = &s_arenas[i];
+                a->owner = xTaskGetCurrentTaskHandle();
+                a->used = a->last = a->peak = 0;
+                break;
+            }
+        }
+        taskEXIT_CRITICAL(&s_mux);
+        if (a == NULL) {
+            if (CONFIG_ARENA_COUNT > 0) {
+                __atomic_add_fetch(&s_stats.misses, 1, __ATOMIC_RELAXED);
+            }
+            scope->slot = -1;
+            return;
+        }
+        t_arena = a;
+    }
+    scope->slot = slot_of(a);
+    scope->mark = a->used;
+    scope->last = a->last;
+    scope->peak = a->peak;
+    a->peak = a->used;
+}
+
+size_t arena_leave(arena_scope_t *scope)
+{
+    if (scope->slot < 0) {
+        return 0;
+    }
+    arena_t *a = &s_arenas[scope->slot];
+    size_t used = a->peak - scope->mark;
+    taskENTER_CRITICAL(&s_mux);
+    if (a->peak > s_stats.high) {
+        s_stats.high = a->peak;
+    }
+    taskEXIT_CRITICAL(&s_mux);
+    if (scope->peak > a->peak) {
+        a->peak = scope->peak;
+    }
+    a->used = scope->mark;
+    a->last = scope->last;
+    if (scope->outer) {
+        t_arena = NULL;
+        __atomic_store_n(&a->owner, NULL, __ATOMIC_RELEASE);
+    }
+    return used;
+}
+
+void arena_get_stats(arena_stats_t *stats)
+{
+    taskENTER_CRITICAL(&s_mux);
+    *stats = s_stats;
+    taskEXIT_CRITICAL(&s_mux);
+}
@@ -0,0 +1,56 @@
+/*
+    Command scratch memory.
+
+    The dispatcher gives every command call a bump arena, reserved at boot
+    (CONFIG_ARENA_COUNT of CONFIG_ARENA_SIZE bytes, 0 for none), and
+    resets it when the command returns: buffers that live for one command
+    no longer cut holes in the heap. A command nested in another one (`run`, `bg` in a script)
+    shares the arena of its task from a mark. arena_alloc() falls back to
+    malloc() when the task has no arena or it is full, so callers always
+    release with arena_free(), a no-op for arena blocks.
+
+    Memory from the arena must not outlive the command (no handing it to
+    another task that keeps it).
+*/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int slot;                   // -1: no arena, everything went to the heap
+    bool outer;                 // first scope of the task, owns the arena
+    size_t mark;
+    size_t last;
+    size_t peak;
+} arena_scope_t;
+
+typedef struct {
+    uint32_t high;              // most bytes used in one arena since boot
+    uint32_t misses;            // commands that started with every arena taken
+    uint32_t spills;            // allocations that did not fit
+    uint32_t spill_bytes;
+} arena_stats_t;
+
+void *arena_alloc(size_t size);
+void *arena_calloc(size_t n, size_t size);
+// Grows in place when p is the newest block of the arena
+void *arena_realloc(void *p, size_t size);
+void arena_free(void *p);
+
+// Dispatcher side: bracket a command call, leave returns the most bytes the call used
+void arena_enter(arena_scope_t *scope);
+size_t arena_leave(arena_scope_t *scope);
+
+void arena_get_stats(arena_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
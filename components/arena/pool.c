@@ -0,0 +1,41 @@
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "pool.h"
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void *pool_alloc(pool_t *pool)
+{
+    void *p = NULL;
+    taskENTER_CRITICAL(&s_mux);
+    if (pool->free) {
+        p = pool->free;
+        pool->free = pool->free->next;
+    } else if (pool->fresh < pool->count) {
+        p = pool->mem + pool->fresh++ * pool->block;
+    }
+    if (p) {
+        if (++pool->used > pool->peak) {
+            pool->peak = pool->used;
+        }
+    } else {
+        pool->spills++;
+    }
+    taskEXIT_CRITICAL(&s_mux);
+    return p ? p : malloc(pool->block);
+}
+
+void pool_free(pool_t *pool, void *p)
+{
+    uint8_t *b = p;
+    if (b < pool->mem || b >= pool->mem + pool->count * pool->block) {
+        free(p);
+        return;
+    }
+    pool_block_t *blk = p;
+    taskENTER_CRITICAL(&s_mux);
+    blk->next = pool->free;
+    pool->free = blk;
+    pool->used--;
+    taskEXIT_CRITICAL(&s_mux);
+}
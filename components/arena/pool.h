@@ -0,0 +1,52 @@
+/*
+    Fixed-size object pools.
+
+    A pool hands out blocks of one size from static storage, for objects
+    that are created and destroyed all the time (frames, record sinks):
+    no heap traffic, no fragmentation, and the count is bounded. When the
+    pool is empty pool_alloc() falls back to malloc(), pool_free() tells
+    the two apart.
+
+        POOL_DEFINE(s_frames, frame_t, 16);
+        frame_t *f = pool_alloc(&s_frames);
+        ...
+        pool_free(&s_frames, f);
+
+    Usable from any task, not from an ISR.
+*/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pool_block {
+    struct pool_block *next;
+} pool_block_t;
+
+typedef struct {
+    uint8_t *mem;
+    size_t block;
+    size_t count;
+    size_t fresh;               // blocks from here on were never handed out
+    pool_block_t *free;
+    uint32_t used;
+    uint32_t peak;
+    uint32_t spills;            // allocations served by the heap
+} pool_t;
+
+#define POOL_BLOCK_SIZE(type)   ((sizeof(type) + 7) & ~(size_t)7)
+
+#define POOL_DEFINE(name, type, n) \
+    static uint8_t name##_mem[(n) * POOL_BLOCK_SIZE(type)] __attribute__((aligned(8))); \
+    static pool_t name = { .mem = name##_mem, .block = POOL_BLOCK_SIZE(type), .count = (n) }
+
+void *pool_alloc(pool_t *pool);
+void pool_free(pool_t *pool, void *p);
+
+#ifdef __cplusplus
+}
+#endif
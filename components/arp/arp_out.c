@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "arp_out.h"
+
+static const char *TAG = "ARP SCAN";
+
+void arp_out_host(result_sink_t *sink, uint32_t ip, const uint8_t mac[6])
+{
+    const uint8_t *b = (const uint8_t *)&ip;
+    if (sink) {
+        result_rec_t rec;
+        result_begin(&rec, sink, RESULT_ARP_HOST);
+        result_bytes(&rec, b, 4);
+        result_bytes(&rec, mac, 6);
+        result_end(&rec);
+        return;
+    }
+    ESP_LOGI(TAG, "%u.%u.%u.%u's MAC address is %02X:%02X:%02X:%02X:%02X:%02X", b[0], b[1], b[2], b[3],
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+void arp_out_done(result_sink_t *sink, uint32_t hosts, uint32_t requests, uint32_t ms)
+{
+    if (sink) {
+        result_rec_t rec;
+        result_begin(&rec, sink, RESULT_SCAN_SUMMARY);
+        result_str(&rec, "arp");
+        result_uint(&rec, hosts);
+        result_uint(&rec, ms);
+        result_end(&rec);
+        return;
+    }
+    ESP_LOGI(TAG, "%" PRIu32 " devices are on local network (%" PRIu32 " requests in %" PRIu32 " ms, %" PRIu32 "/s)",
+             hosts, requests, ms, ms ? (uint32_t)((uint64_t)requests * 1000 / ms) : 0);
+}
@@ -0,0 +1,21 @@
+/*
+    Output of scan-arp: a host that answered, then the summary. A record
+    when the command has a sink, the log line otherwise. No lwIP in here,
+    the host tests (test/host) check both against their golden files.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "result.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ip in network order
+void arp_out_host(result_sink_t *sink, uint32_t ip, const uint8_t mac[6]);
+void arp_out_done(result_sink_t *sink, uint32_t hosts, uint32_t requests, uint32_t ms);
+
+#ifdef __cplusplus
+}
+#endif
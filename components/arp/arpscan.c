@@ -1,11 +1,11 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
-#include "driver/gpio.h"
-#include "nvs_flash.h"
 #include "esp_netif.h"
 #include "esp_console.h"
+#include "dispatch.h"
 #include "esp_event.h"
+#include "esp_timer.h"
 #include "esp_netif_net_stack.h"
 #include "argtable3/argtable3.h"
 #include "lwip/ip4_addr.h"
@@ -14,6 +14,11 @@
 #include <stdio.h>
 #include <inttypes.h>
 #include "arpscan.h"
+#include "arp_out.h"
+#include "result.h"
+#include "jobs.h"
+#include "perf.h"
+#include "arena.h"
 
 // Define
 #define ARPTIMEOUT 5000
@@ -96,15 +101,18 @@ int arpScan(int argc, char **argv) {
     uint32_t normal_mask = switch_ip_orientation(&ip_info.netmask.addr);
     maxSubnetDevice = UINT32_MAX - normal_mask - 1; // The total count of IPs to scan
 
-    // Initialize device information storing database
-    deviceInfos = calloc(maxSubnetDevice, sizeof(deviceInfo));
+    // Initialize device information storing database (command arena, heap for large subnets)
+    deviceInfos = arena_calloc(maxSubnetDevice, sizeof(deviceInfo));
     if(deviceInfos == NULL){
         ESP_LOGI(TAG, "Not enough space for storing information");
         return 1;
     }
 
     uint32_t onlineDevicesCount = 0;
+    uint32_t requestCount = 0; // ARP requests sent, for the rate in the summary
     ESP_LOGI(TAG, "%" PRIu32 " ips to scan", maxSubnetDevice);
+    result_sink_t *sink = result_sink_current();
+    int64_t start_us = esp_timer_get_time();
 
     // Ips
     char char_target_ip[IP4ADDR_STRLEN_MAX];
@@ -113,50 +121,56 @@ int arpScan(int argc, char **argv) {
     last_ip.addr = (target_ipp.addr)|(~ip_info.netmask.addr); // Calculate last IP in subnet
 
     // Scan loop for 5 at a time
-    while(target_ip.addr != last_ip.addr){
+    while(target_ip.addr != last_ip.addr && !job_cancelled()){
         esp_ip4_addr_t currAddrs[5]; // Save current loop IP
         int currCount = 0; // For checking ARP table use
 
         // Send 5 ARP requests at a time because ARP table has a limit size
+        PERF_BEGIN(send);
         for(int i = 0; i < 5; i++){
             nextIP(&target_ip); // Get next IP
             if(target_ip.addr != last_ip.addr){
                 esp_ip4addr_ntoa(&target_ip, char_target_ip, IP4ADDR_STRLEN_MAX);
                 currAddrs[i] = target_ip;
                 etharp_request(netif, (const ip4_addr_t *)&target_ip); // Cast for compatibility
-                ESP_LOGI(TAG, "Success sending ARP to %s", char_target_ip);
+                if (!sink) {
+                    ESP_LOGI(TAG, "Success sending ARP to %s", char_target_ip);
+                }
                 currCount++;
+                requestCount++;
             }
             else break; // IP is last IP in subnet then break
         }
+        PERF_END(send, "arp.send");
 
         // Wait for response
+        PERF_BEGIN(wait);
         vTaskDelay(ARPTIMEOUT / portTICK_PERIOD_MS);
+        PERF_END(wait, "arp.wait");
 
         // Find received ARP response in ARP table
+        PERF_BEGIN(collect);
         for(int i = 0; i < currCount; i++){
             ip4_addr_t *ipaddr_ret = NULL;
             struct eth_addr *eth_ret = NULL;
-            char mac[20], char_currIP[IP4ADDR_STRLEN_MAX];
 
             unsigned int currentIpCount = switch_ip_orientation(&currAddrs[i].addr) - switch_ip_orientation(&target_ipp.addr) - 1; // Calculate the number of IP
             if(etharp_find_addr(NULL, (const ip4_addr_t *)&currAddrs[i], &eth_ret, (const ip4_addr_t **)&ipaddr_ret) != -1){ // Find in ARP table
-                // Print MAC result for IP
-                sprintf(mac, "%02X:%02X:%02X:%02X:%02X:%02X", eth_ret->addr[0], eth_ret->addr[1], eth_ret->addr[2], eth_ret->addr[3], eth_ret->addr[4], eth_ret->addr[5]);
-                esp_ip4addr_ntoa(&currAddrs[i], char_currIP, IP4ADDR_STRLEN_MAX);
-                ESP_LOGI(TAG, "%s's MAC address is %s", char_currIP, mac);
                 onlineDevicesCount++;
+                arp_out_host(sink, currAddrs[i].addr, eth_ret->addr);
             }
-        }        
+        }
+        PERF_END(collect, "arp.collect");
     }
 
     // Update deviceCount
     deviceCount = onlineDevicesCount;
     // Print network scanning result
-    ESP_LOGI(TAG, "%" PRIu32 " devices are on local network", onlineDevicesCount);
+    arp_out_done(sink, onlineDevicesCount, requestCount, (esp_timer_get_time() - start_us) / 1000);
 
     // Free allocated memory
-    free(deviceInfos);
+    arena_free(deviceInfos);
+    deviceInfos = NULL;
     return 0;
 }
 
@@ -169,5 +183,5 @@ void module_arp_scan(void)
         .hint = NULL,
         .func = &arpScan,
     };
-    ESP_ERROR_CHECK( esp_console_cmd_register(&arp_cmd) );
+    ESP_ERROR_CHECK( dispatch_register(&arp_cmd) );
 }
@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "sdkconfig.h"
+#include "argtable3/argtable3.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "dispatch.h"
+#include "pipeline.h"
+#include "async_out.h"
+
+#define RING_SIZE       CONFIG_ASYNC_OUT_RING_SIZE
+#define RING_MASK       (RING_SIZE - 1)
+#define CHUNK_SIZE      CONFIG_ASYNC_OUT_CHUNK
+#define WRITE_MAX       (CHUNK_SIZE - 4)        // longer writes are split, a record always fits a chunk
+#define HDR_COMMIT      0x80000000u
+#define LOG_LINE_MAX    160                     // ESP_LOG lines formatted on the caller's stack
+#define FILE_BUF_SIZE   256
+#ifdef CONFIG_ESP_CONSOLE_UART_BAUDRATE
+#define LINE_BPS        (CONFIG_ESP_CONSOLE_UART_BAUDRATE / 10)     // 8N1
+#else
+#define LINE_BPS        0
+#endif
+
+_Static_assert((RING_SIZE & RING_MASK) == 0, "CONFIG_ASYNC_OUT_RING_SIZE must be a power of two");
+
+static const char *TAG = "async_out";
+
+/* Ring of records: a 32-bit header (length | HDR_COMMIT once the bytes are
+ * in) then the bytes, padded to 4 so headers are aligned and never wrap.
+ * s_reserve and s_read are free-running byte counters. The drain zeroes
+ * what it consumed, so a header not yet written reads as uncommitted. */
+static uint8_t s_ring[RING_SIZE] __attribute__((aligned(4)));
+static uint32_t s_reserve;      // producers, CAS
+static uint32_t s_read;         // drain only
+static uint32_t s_written;      // drain only, records before this are out to the UART
+static bool s_drain_idle;       // drain asleep, the next producer wakes it
+
+static uint8_t s_chunk[CHUNK_SIZE];
+static SemaphoreHandle_t s_drain_lock;     // one consumer at a time (drain task, flush at shutdown)
+static StaticSemaphore_t s_drain_lock_buf;
+static TaskHandle_t s_drain_task;
+static int s_uart_fd = -1;
+static FILE *s_file;            // stdout/stderr of the tasks using the default console
+static vprintf_like_t s_log_vprintf;
+
+static async_out_stats_t s_stats;
+static uint32_t s_reported_drops;
+static int64_t s_window_start;
+static uint32_t s_window_bytes;
+
+static inline uint32_t *ring_hdr(uint32_t pos)
+{
+    return (uint32_t *)(s_ring + (pos & RING_MASK));
+}
+
+static void ring_copy_in(uint32_t pos, const void *data, size_t len)
+{
+    uint32_t off = pos & RING_MASK;
+    size_t first = len < RING_SIZE - off ? len : RING_SIZE - off;
+    memcpy(s_ring + off, data, first);
+    memcpy(s_ring, (const uint8_t *)data + first, len - first);
+}
+
+static void ring_copy_out(uint32_t pos, void *out, size_t len)
+{
+    uint32_t off = pos & RING_MASK;
+    size_t first = len < RING_SIZE - off ? len : RING_SIZE - off;
+    memcpy(out, s_ring + off, first);
+    memcpy((uint8_t *)out + first, s_ring, len - first);
+}
+
+static void ring_zero(uint32_t pos, size_t len)
+{
+    uint32_t off = pos & RING_MASK;
+    size_t first = len < RING_SIZE - off ? len : RING_SIZE - off;
+    memset(s_ring + off, 0, first);
+    memset(s_ring, 0, len - first);
+}
+
+static bool ring_put(const char *data, size_t len)
+{
+    uint32_t need = (4 + len + 3) & ~3u;
+    uint32_t pos = __atomic_load_n(&s_reserve, __ATOMIC_RELAXED);
+    do {
+        uint32_t used = pos - __atomic_load_n(&s_read, __ATOMIC_ACQUIRE);
+        if (used + need > RING_SIZE) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&s_reserve, &pos, pos + need, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    ring_copy_in(pos + 4, data, len);
+    __atomic_store_n(ring_hdr(pos), len | HDR_COMMIT, __ATOMIC_RELEASE);
+    return true;
+}
+
+size_t async_out_write(const char *data, size_t len)
+{
+    if (s_drain_task == NULL) {
+        return 0;
+    }
+    size_t done = 0;
+    while (done < len) {
+        size_t n = len - done < WRITE_MAX ? len - done : WRITE_MAX;
+        if (!ring_put(data + done, n)) {
+            __atomic_fetch_add(&s_stats.dropped_bytes, len - done, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&s_stats.dropped_writes, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        done += n;
+    }
+    __atomic_fetch_add(&s_stats.bytes_in, done, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s_stats.writes, 1, __ATOMIC_RELAXED);
+    if (__atomic_exchange_n(&s_drain_idle, false, __ATOMIC_ACQ_REL)) {
+        xTaskNotifyGive(s_drain_task);
+    }
+    return done;
+}
+
+/* ---- drain ---- */
+
+static void uart_out(const uint8_t *data, size_t len)
+{
+    int64_t t0 = esp_timer_get_time();
+    size_t off = 0;
+    while (off < len) {
+        ssize_t n = write(s_uart_fd, data + off, len - off);
+        if (n <= 0) {
+            break;
+        }
+        off += n;
+    }
+    int64_t t1 = esp_timer_get_time();
+    s_stats.busy_us += t1 - t0;
+    s_stats.bytes_out += len;
+    s_stats.chunks++;
+
+    if (t1 - s_window_start >= 1000000) {
+        uint32_t bps = (uint64_t)s_window_bytes * 1000000 / (t1 - s_window_start);
+        if (bps > s_stats.peak_bps) {
+            s_stats.peak_bps = bps;
+        }
+        s_window_start = t1;
+        s_window_bytes = 0;
+    }
+    s_window_bytes += len;
+}
+
+// Move every published record to the UART, with the drain lock held; false if nothing was there
+static bool drain_once(void)
+{
+    uint32_t rd = s_read;
+    uint32_t end = __atomic_load_n(&s_reserve, __ATOMIC_ACQUIRE);
+    if (end - rd > s_stats.high_water) {
+        s_stats.high_water = end - rd;
+    }
+    size_t len = 0;
+    uint32_t drops = __atomic_load_n(&s_stats.dropped_bytes, __ATOMIC_RELAXED);
+    if (drops != s_reported_drops) {
+        len = snprintf((char *)s_chunk, CHUNK_SIZE, "\n[async_out: %" PRIu32 " bytes dropped]\n",
+                       drops - s_reported_drops);
+        s_reported_drops = drops;
+    }
+
+    bool any = len > 0;
+    while (rd != end) {
+        uint32_t hdr = __atomic_load_n(ring_hdr(rd), __ATOMIC_ACQUIRE);
+        if (!(hdr & HDR_COMMIT)) {
+            break;      // reserved but still being copied, next round
+        }
+        uint32_t n = hdr & ~HDR_COMMIT;
+        if (len + n > CHUNK_SIZE) {
+            uart_out(s_chunk, len);
+            __atomic_store_n(&s_written, rd, __ATOMIC_RELEASE);
+            len = 0;
+        }
+        ring_copy_out(rd + 4, s_chunk + len, n);
+        len += n;
+        uint32_t need = (4 + n + 3) & ~3u;
+        ring_zero(rd, need);
+        rd += need;
+        __atomic_store_n(&s_read, rd, __ATOMIC_RELEASE);
+        any = true;
+    }
+    if (len > 0) {
+        uart_out(s_chunk, len);
+    }
+    __atomic_store_n(&s_written, rd, __ATOMIC_RELEASE);
+    return any;
+}
+
+static void drain_task(void *arg)
+{
+    while (true) {
+        xSemaphoreTake(s_drain_lock, portMAX_DELAY);
+        bool any = drain_once();
+        xSemaphoreGive(s_drain_lock);
+        if (any) {
+            continue;
+        }
+        __atomic_store_n(&s_drain_idle, true, __ATOMIC_SEQ_CST);
+        // A producer may have published between drain_once() and the flag without waking us
+        if (__atomic_load_n(&s_reserve, __ATOMIC_SEQ_CST) != s_read) {
+            __atomic_store_n(&s_drain_idle, false, __ATOMIC_RELAXED);
+            continue;
+        }
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    }
+}
+
+bool async_out_flush(uint32_t timeout_ms)
+{
+    if (s_drain_task == NULL) {
+        return true;
+    }
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    uint32_t target = __atomic_load_n(&s_reserve, __ATOMIC_ACQUIRE);
+    // s_read moves before the chunk is written, s_written after
+    while ((int32_t)(target - __atomic_load_n(&s_written, __ATOMIC_ACQUIRE)) > 0) {
+        if (esp_timer_get_time() >= deadline) {
+            return false;
+        }
+        xTaskNotifyGive(s_drain_task);
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return true;
+}
+
+static void shutdown_handler(void)
+{
+    // Restart: no scheduling guarantees left, drain from here
+    if (xSemaphoreTake(s_drain_lock, pdMS_TO_TICKS(100)) == pdTRUE) {
+        while (drain_once()) {
+        }
+        xSemaphoreGive(s_drain_lock);
+    }
+}
+
+/* ---- producers: stdio and log ---- */
+
+static int file_write(void *cookie, const char *data, int len)
+{
+    async_out_write(data, len);
+    return len;     // dropped bytes are accounted, never an error for the caller
+}
+
+static int log_vprintf(const char *fmt, va_list ap)
+{
+    // Jobs and TCP sessions keep their log lines in their own output
+    if (stdout != s_file) {
+        return s_log_vprintf(fmt, ap);
+    }
+    char line[LOG_LINE_MAX];
+    va_list copy;
+    va_copy(copy, ap);
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    if (n >= (int)sizeof(line)) {
+        char *big = malloc(n + 1);
+        if (big) {
+            vsnprintf(big, n + 1, fmt, copy);
+            async_out_write(big, n);
+            free(big);
+            va_end(copy);
+            return n;
+        }
+        n = sizeof(line) - 1;
+    }
+    va_end(copy);
+    if (n > 0) {
+        async_out_write(line, n);
+    }
+    return n;
+}
+
+esp_err_t async_out_start(void)
+{
+#ifdef CONFIG_IDF_TARGET_LINUX
+    return ESP_ERR_NOT_SUPPORTED;
+#else
+    if (s_drain_task) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    fflush(stdout);
+    s_uart_fd = fileno(_GLOBAL_REENT->_stdout);
+    s_file = funopen(NULL, NULL, file_write, NULL, NULL);
+    if (s_uart_fd < 0 || s_file == NULL) {
+        return ESP_FAIL;
+    }
+    setvbuf(s_file, NULL, _IOLBF, FILE_BUF_SIZE);
+    s_drain_lock = xSemaphoreCreateMutexStatic(&s_drain_lock_buf);
+    s_window_start = esp_timer_get_time();
+    if (pipeline_task_create(drain_task, "async_out", 3072, NULL, CONFIG_ASYNC_OUT_PRIORITY, &s_drain_task) != pdPASS) {
+        fclose(s_file);
+        s_file = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Tasks created from now on inherit the global streams, app_main switches too
+    _GLOBAL_REENT->_stdout = s_file;
+    _GLOBAL_REENT->_stderr = s_file;
+    stdout = s_file;
+    stderr = s_file;
+    s_log_vprintf = esp_log_set_vprintf(log_vprintf);
+    esp_register_shutdown_handler(shutdown_handler);
+    ESP_LOGI(TAG, "Console output through a %d B ring", RING_SIZE);
+    return ESP_OK;
+#endif
+}
+
+void async_out_get_stats(async_out_stats_t *stats)
+{
+    *stats = s_stats;
+}
+
+static struct {
+    struct arg_lit *reset;
+    struct arg_int *bench;
+    struct arg_end *end;
+} outbuf_args;
+
+// Push bytes through the ring as 64-byte lines, report what reached the UART per second
+static void outbuf_bench(int total)
+{
+    char line[64];
+    memset(line, '.', sizeof(line));
+    line[sizeof(line) - 1] = '\n';
+    async_out_flush(1000);
+
+    async_out_stats_t before;
+    async_out_get_stats(&before);
+    int64_t t0 = esp_timer_get_time();
+    int64_t produce_us = 0;
+    for (int sent = 0; sent < total; sent += sizeof(line)) {
+        snprintf(line, 16, "bench %7d ", sent);
+        line[14] = ' ';
+        int64_t w0 = esp_timer_get_time();
+        async_out_write(line, sizeof(line));
+        produce_us += esp_timer_get_time() - w0;
+    }
+    bool drained = async_out_flush(30000);
+    int64_t elapsed = esp_timer_get_time() - t0;
+
+    async_out_stats_t after;
+    async_out_get_stats(&after);
+    uint32_t out = after.bytes_out - before.bytes_out;
+    uint32_t busy = after.busy_us - before.busy_us;
+    uint32_t writes = after.writes - before.writes;
+    printf("bench: %d B in %lld ms%s, %" PRIu32 " B/s end to end, %" PRIu32 " B/s while writing\n",
+           total, elapsed / 1000, drained ? "" : " (not drained)",
+           elapsed ? (uint32_t)((uint64_t)out * 1000000 / elapsed) : 0,
+           busy ? (uint32_t)((uint64_t)out * 1000000 / busy) : 0);
+    printf("       %" PRIu32 " B dropped, %lld ns per write on the producer side\n",
+           after.dropped_bytes - before.dropped_bytes, writes ? produce_us * 1000 / writes : 0);
+}
+
+static int outbuf_cmd(int argc, char **argv)
+{
+    if (arg_parse(argc, argv, (void **)&outbuf_args) != 0) {
+        arg_print_errors(stderr, outbuf_args.end, argv[0]);
+        return 1;
+    }
+    if (s_drain_task == NULL) {
+        printf("async output not started\n");
+        return 1;
+    }
+    if (outbuf_args.bench->count) {
+        outbuf_bench(outbuf_args.bench->ival[0]);
+        return 0;
+    }
+    async_out_stats_t st;
+    async_out_get_stats(&st);
+    printf("ring      %d B, %" PRIu32 " B waiting, high water %" PRIu32 " B\n",
+           RING_SIZE, __atomic_load_n(&s_reserve, __ATOMIC_RELAXED) - s_read, st.high_water);
+    printf("in        %" PRIu32 " B in %" PRIu32 " writes\n", st.bytes_in, st.writes);
+    printf("dropped   %" PRIu32 " B in %" PRIu32 " writes\n", st.dropped_bytes, st.dropped_writes);
+    printf("out       %" PRIu32 " B in %" PRIu32 " chunks (%" PRIu32 " B avg)\n",
+           st.bytes_out, st.chunks, st.chunks ? st.bytes_out / st.chunks : 0);
+    printf("ceiling   %" PRIu32 " B/s while writing, peak %" PRIu32 " B/s over 1 s, line %d B/s\n",
+           st.busy_us ? (uint32_t)((uint64_t)st.bytes_out * 1000000 / st.busy_us) : 0,
+           st.peak_bps, LINE_BPS);
+    if (outbuf_args.reset->count) {
+        memset(&s_stats, 0, sizeof(s_stats));
+        s_reported_drops = 0;
+    }
+    return 0;
+}
+
+void module_async_out(void)
+{
+    outbuf_args.reset = arg_lit0("r", "reset", "Reset the counters after printing them");
+    outbuf_args.bench = arg_int0("b", "bench", "<bytes>", "Measure the throughput with this many bytes");
+    outbuf_args.end = arg_end(2);
+    const esp_console_cmd_t outbuf_def = {
+        .command = "outbuf",
+        .help = "Asynchronous console output counters and throughput",
+        .hint = NULL,
+        .func = &outbuf_cmd,
+        .argtable = &outbuf_args
+    };
+    ESP_ERROR_CHECK(dispatch_register(&outbuf_def));
+}
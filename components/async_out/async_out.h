@@ -0,0 +1,56 @@
+/*
+    Asynchronous console output.
+
+    After async_out_start(), the default stdout/stderr of every task (the
+    REPL included) and ESP_LOG lines append to a lock-free byte ring instead
+    of writing to the UART: a producer reserves space with one CAS, copies
+    its bytes and publishes them, it never waits for the serial line. A
+    drain task gathers the published writes into chunks of
+    CONFIG_ASYNC_OUT_CHUNK bytes and writes them to the UART. When the ring
+    is full the write is dropped and counted; the drain prints how many
+    bytes were lost. Tasks with their own stdout (jobs, TCP sessions) are
+    not affected.
+
+    Not usable from an ISR.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t bytes_in;          // accepted by async_out_write()
+    uint32_t writes;
+    uint32_t dropped_bytes;     // ring full
+    uint32_t dropped_writes;
+    uint32_t bytes_out;         // written to the UART
+    uint32_t chunks;
+    uint32_t high_water;        // most bytes waiting in the ring
+    uint32_t busy_us;           // time the drain spent writing
+    uint32_t peak_bps;          // best one-second drain rate
+} async_out_stats_t;
+
+// Route stdout/stderr/ESP_LOG through the ring, call early in app_main before creating tasks
+esp_err_t async_out_start(void);
+
+// Append bytes, returns how many were accepted: less than len once the ring fills, 0 when not started
+size_t async_out_write(const char *data, size_t len);
+
+// Wait until everything written so far was handed to the UART driver, false on timeout.
+// The UART FIFO may still be sending: before sleeping, follow with uart_wait_tx_idle_polling()
+bool async_out_flush(uint32_t timeout_ms);
+
+void async_out_get_stats(async_out_stats_t *stats);
+
+// `outbuf` command
+void module_async_out(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,78 @@
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "boot.h"
+
+#define LAZY_NONE       0
+#define LAZY_RUNNING    1
+#define LAZY_DONE       2
+
+static const char *TAG = "boot";
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static boot_phase_t s_phases[BOOT_MAX_PHASES];
+static size_t s_count;
+static int64_t s_last_mark;
+
+static void record(const char *name, int64_t at_us, uint32_t took_us, bool lazy)
+{
+    taskENTER_CRITICAL(&s_mux);
+    if (s_count < BOOT_MAX_PHASES) {
+        s_phases[s_count++] = (boot_phase_t){ .name = name, .at_us = at_us, .took_us = took_us, .lazy = lazy };
+    }
+    taskEXIT_CRITICAL(&s_mux);
+}
+
+void boot_mark(const char *name)
+{
+    int64_t now = esp_timer_get_time();
+    record(name, now, now - s_last_mark, false);
+    s_last_mark = now;
+}
+
+esp_err_t lazy_once(lazy_t *lazy, esp_err_t (*init)(void))
+{
+    for (;;) {
+        uint8_t state = LAZY_NONE;
+        if (__atomic_compare_exchange_n(&lazy->state, &state, LAZY_RUNNING, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        if (state == LAZY_DONE) {
+            return ESP_OK;
+        }
+        // Another task is running it: wait, it may fail and leave it to us
+        vTaskDelay(1);
+    }
+
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t err = init();
+    if (err == ESP_OK) {
+        uint32_t took = esp_timer_get_time() - t0;
+        record(lazy->name, t0, took, true);
+        ESP_LOGD(TAG, "%s initialized in %" PRIu32 " us", lazy->name, took);
+    } else {
+        ESP_LOGE(TAG, "%s init failed: %s", lazy->name, esp_err_to_name(err));
+    }
+    __atomic_store_n(&lazy->state, err == ESP_OK ? LAZY_DONE : LAZY_NONE, __ATOMIC_RELEASE);
+    return err;
+}
+
+bool lazy_done(const lazy_t *lazy)
+{
+    return __atomic_load_n(&lazy->state, __ATOMIC_ACQUIRE) == LAZY_DONE;
+}
+
+bool boot_phase(size_t i, boot_phase_t *phase)
+{
+    bool found = false;
+    taskENTER_CRITICAL(&s_mux);
+    if (i < s_count) {
+        *phase = s_phases[i];
+        found = true;
+    }
+    taskEXIT_CRITICAL(&s_mux);
+    return found;
+}
@@ -0,0 +1,58 @@
+/*
+    Boot timeline and lazy one-time initialization.
+
+    app_main only registers commands, so the prompt (or the autorun job)
+    comes up right after reset. The heavy init a module needs — NVS, netif,
+    event loop, Wi-Fi driver — runs the first time one of its commands
+    needs it:
+
+        static lazy_t s_stack = LAZY_INIT("wifi.stack");
+        esp_err_t err = lazy_once(&s_stack, stack_init);
+
+    lazy_once() runs the function once even when several tasks get there at
+    the same time (the others wait for it to finish), and again on the next
+    call if it failed. boot_mark() stamps the end of a boot phase. Both go
+    to the timeline printed by `boottime`; lazy inits appear with the time
+    of their first use and how long they took. Times are esp_timer times,
+    the ROM and second stage bootloader are not counted.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BOOT_MAX_PHASES     16
+
+typedef struct {
+    const char *name;
+    uint8_t state;
+} lazy_t;
+
+#define LAZY_INIT(label)    { .name = (label) }
+
+typedef struct {
+    const char *name;
+    int64_t at_us;              // end of the phase, start for a lazy init
+    uint32_t took_us;
+    bool lazy;
+} boot_phase_t;
+
+// End of a boot phase started at the previous mark
+void boot_mark(const char *name);
+
+// Run init unless it already succeeded, its error otherwise
+esp_err_t lazy_once(lazy_t *lazy, esp_err_t (*init)(void));
+bool lazy_done(const lazy_t *lazy);
+
+// Phase i of the timeline, in the order they happened; false past the end
+bool boot_phase(size_t i, boot_phase_t *phase);
+
+#ifdef __cplusplus
+}
+#endif
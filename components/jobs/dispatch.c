@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "argtable3/argtable3.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "result.h"
+#include "arena.h"
+#include "dispatch.h"
+#include "perf.h"
+
+static const char *TAG = "dispatch";
+
+typedef struct {
+    const char *name;
+    const char *help;
+    const char *hint;
+    void *argtable;
+    esp_console_cmd_func_t func;
+    SemaphoreHandle_t busy;     // one call of a command at a time
+    StaticSemaphore_t busy_buf;
+    dispatch_prof_t prof;       // written under busy
+    perf_hist_t *latency;       // allocated on the first call
+} dispatch_cmd_t;
+
+// Filled at startup before any command runs, read-only afterwards
+static dispatch_cmd_t s_cmds[DISPATCH_MAX_CMDS];
+static size_t s_num_cmds;
+
+#if CONFIG_DISPATCH_PROFILE
+static TaskHandle_t s_heap_monitor;     // the local minimum free size is global, one call at a time owns it
+
+static void prof_begin(uint32_t *free_before, bool *monitor)
+{
+    TaskHandle_t none = NULL;
+    *monitor = __atomic_compare_exchange_n(&s_heap_monitor, &none, xTaskGetCurrentTaskHandle(), false,
+                                           __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    if (*monitor && heap_caps_monitor_local_minimum_free_size_start() != ESP_OK) {
+        __atomic_store_n(&s_heap_monitor, NULL, __ATOMIC_RELEASE);
+        *monitor = false;
+    }
+    *free_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+}
+
+static void prof_end(dispatch_prof_t *p, uint32_t free_before, bool monitor)
+{
+    uint32_t free_after = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    uint32_t min_free = free_after < free_before ? free_after : free_before;
+    if (monitor) {
+        min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+        heap_caps_monitor_local_minimum_free_size_stop();
+        __atomic_store_n(&s_heap_monitor, NULL, __ATOMIC_RELEASE);
+    }
+    uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    uint32_t stack = uxTaskGetStackHighWaterMark(NULL);
+    int32_t kept = (int32_t)(free_before - free_after);
+
+    if (p->calls++ == 0) {
+        p->heap_kept_max = kept;
+        p->min_free = min_free;
+        p->min_largest = largest;
+        p->min_stack = stack;
+    }
+    p->heap_kept += kept;
+    if (kept > p->heap_kept_max) {
+        p->heap_kept_max = kept;
+    }
+    if (min_free < p->min_free) {
+        p->min_free = min_free;
+    }
+    if (largest < p->min_largest) {
+        p->min_largest = largest;
+    }
+    if (stack < p->min_stack) {
+        p->min_stack = stack;
+    }
+}
+#endif
+
+static int dispatch_call(void *context, int argc, char **argv)
+{
+    dispatch_cmd_t *cmd = context;
+    // Already running in a job or another session: fail now rather than freeze the caller's prompt
+    if (xSemaphoreTake(cmd->busy, 0) != pdTRUE) {
+        printf("%s: busy, already running elsewhere\n", cmd->name);
+        return 1;
+    }
+    // `output json|cbor`: records go to this task's stdout, NULL in text mode or under the agent's sink
+    result_sink_t *console = result_console_open();
+    arena_scope_t scratch;
+    arena_enter(&scratch);
+#if CONFIG_DISPATCH_PROFILE
+    uint32_t free_before;
+    bool monitor;
+    prof_begin(&free_before, &monitor);
+#endif
+#if CONFIG_DISPATCH_PERF
+    int64_t t0 = esp_timer_get_time();
+#endif
+    int ret = cmd->func(argc, argv);
+    uint32_t arena_used = arena_leave(&scratch);
+#if CONFIG_DISPATCH_PERF
+    uint32_t us = esp_timer_get_time() - t0;
+    if (cmd->latency == NULL) {
+        cmd->latency = calloc(1, sizeof(perf_hist_t));
+    }
+    if (cmd->latency) {
+        perf_hist_add(cmd->latency, us);
+    }
+#endif
+#if CONFIG_DISPATCH_PROFILE
+    prof_end(&cmd->prof, free_before, monitor);
+    if (arena_used > cmd->prof.arena_max) {
+        cmd->prof.arena_max = arena_used;
+    }
+#else
+    (void)arena_used;
+#endif
+    result_console_close(console);
+    xSemaphoreGive(cmd->busy);
+    return ret;
+}
+
+esp_err_t dispatch_register(const esp_console_cmd_t *cmd)
+{
+    if (cmd->func == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_num_cmds >= DISPATCH_MAX_CMDS) {
+        ESP_LOGE(TAG, "Too many commands, raise DISPATCH_MAX_CMDS");
+        return ESP_ERR_NO_MEM;
+    }
+    dispatch_cmd_t *d = &s_cmds[s_num_cmds];
+    d->name = cmd->command;
+    d->help = cmd->help;
+    d->hint = cmd->hint;
+    d->argtable = cmd->argtable;
+    d->func = cmd->func;
+    d->busy = xSemaphoreCreateMutexStatic(&d->busy_buf);
+
+    esp_console_cmd_t wrapped = *cmd;
+    wrapped.func = NULL;
+    wrapped.func_w_context = dispatch_call;
+    wrapped.context = d;
+    esp_err_t err = esp_console_cmd_register(&wrapped);
+    if (err == ESP_OK) {
+        s_num_cmds++;
+    }
+    return err;
+}
+
+esp_err_t dispatch_run(const char *line, int *ret)
+{
+    char *buf = strdup(line);
+    char **argv = malloc(DISPATCH_MAX_ARGS * sizeof(char *));
+    if (buf == NULL || argv == NULL) {
+        free(buf);
+        free(argv);
+        return ESP_ERR_NO_MEM;
+    }
+
+    size_t argc = esp_console_split_argv(buf, argv, DISPATCH_MAX_ARGS);
+    esp_err_t err = dispatch_run_argv(argc, argv, ret);
+    free(argv);
+    free(buf);
+    return err;
+}
+
+esp_err_t dispatch_run_argv(int argc, char **argv, int *ret)
+{
+    if (argc <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < s_num_cmds; i++) {
+        if (strcmp(s_cmds[i].name, argv[0]) == 0) {
+            *ret = dispatch_call(&s_cmds[i], argc, argv);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+size_t dispatch_count(void)
+{
+    return s_num_cmds;
+}
+
+const char *dispatch_prof(size_t i, dispatch_prof_t *prof)
+{
+    if (i >= s_num_cmds) {
+        return NULL;
+    }
+    *prof = s_cmds[i].prof;
+    return s_cmds[i].name;
+}
+
+perf_hist_t *dispatch_latency(size_t i)
+{
+    return i < s_num_cmds ? s_cmds[i].latency : NULL;
+}
+
+void dispatch_prof_reset(void)
+{
+    for (size_t i = 0; i < s_num_cmds; i++) {
+        memset(&s_cmds[i].prof, 0, sizeof(s_cmds[i].prof));
+    }
+}
+
+// Same layout as esp_console's help, but it works without esp_console_init (TCP-only console)
+static int help_cmd(int argc, char **argv)
+{
+    for (size_t i = 0; i < s_num_cmds; i++) {
+        const dispatch_cmd_t *d = &s_cmds[i];
+        printf("%s ", d->name);
+        if (d->hint) {
+            printf("%s\n", d->hint);
+        } else if (d->argtable) {
+            arg_print_syntax(stdout, d->argtable, "\n");
+        } else {
+            printf("\n");
+        }
+        if (d->help) {
+            printf("  %s\n", d->help);
+        }
+        if (d->argtable) {
+            arg_print_glossary(stdout, d->argtable, "  %-20s %s\n");
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+void dispatch_register_help(void)
+{
+    const esp_console_cmd_t help_def = {
+        .command = "help",
+        .help = "Print the list of registered commands",
+        .hint = NULL,
+        .func = &help_cmd,
+    };
+    ESP_ERROR_CHECK(dispatch_register(&help_def));
+}
@@ -0,0 +1,71 @@
+/*
+    Command dispatcher.
+
+    Commands are registered through dispatch_register(), which registers them
+    with esp_console as well (REPL and help are unchanged) but routes every
+    call through the dispatcher. dispatch_run() runs a command line from any
+    task: unlike esp_console_run(), which splits the line into one shared
+    buffer, it works on the caller's copy, so the REPL, the agent and
+    background jobs can run commands at the same time. Argtables are static,
+    so two runs of the same command are serialized. Each call also opens the
+    console result sink of the `output` mode (see result.h).
+
+    With CONFIG_DISPATCH_PROFILE, every call records the heap it kept, the
+    lowest free heap and largest free block around it and the stack high
+    water mark of the task that ran it (`memprof`). Other tasks allocate at
+    the same time, so single deltas are noisy; the sums over many calls are
+    what shows a leak or fragmentation. The peak use of the scratch arena
+    each call runs with (see arena.h) is recorded as well. With
+    CONFIG_DISPATCH_PERF every call is also timed into a latency histogram
+    of the command (see perf.h).
+*/
+#pragma once
+
+#include "esp_err.h"
+#include "esp_console.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "perf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DISPATCH_MAX_CMDS   48
+#define DISPATCH_MAX_ARGS   32
+
+typedef struct {
+    uint32_t calls;
+    int32_t heap_kept;          // free heap before - after, summed over the calls
+    int32_t heap_kept_max;      // worst single call
+    uint32_t min_free;          // lowest free heap while it ran
+    uint32_t min_largest;       // smallest largest free block after a call
+    uint32_t min_stack;         // lowest stack high water mark after a call (bytes)
+    uint32_t arena_max;         // most scratch arena bytes used by a call (see arena.h)
+} dispatch_prof_t;
+
+// Drop-in replacement for esp_console_cmd_register()
+esp_err_t dispatch_register(const esp_console_cmd_t *cmd);
+
+// Run a command line, ESP_ERR_NOT_FOUND for an unknown command, ESP_ERR_INVALID_ARG for an empty line
+esp_err_t dispatch_run(const char *line, int *ret);
+
+// Same with a line already split, argv[argc] must be NULL (argv may be reordered, not the strings)
+esp_err_t dispatch_run_argv(int argc, char **argv, int *ret);
+
+// `help` listing the dispatcher's commands, replaces esp_console_register_help_command()
+void dispatch_register_help(void);
+
+// Number of registered commands
+size_t dispatch_count(void);
+
+// Name and profile of command i, NULL past the end
+const char *dispatch_prof(size_t i, dispatch_prof_t *prof);
+void dispatch_prof_reset(void);
+
+// Latency histogram of command i, NULL if it never ran (or without CONFIG_DISPATCH_PERF)
+perf_hist_t *dispatch_latency(size_t i);
+
+#ifdef __cplusplus
+}
+#endif
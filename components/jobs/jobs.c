@@ -0,0 +1,490 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "argtable3/argtable3.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "dispatch.h"
+#include "jobs.h"
+#include "pipeline.h"
+
+#define JOB_LINE_MAX        256
+#define JOB_KILL_GRACE_MS   3000    // time given to a job to notice kill before giving up
+#define JOB_MIN_STACK       2048
+
+static const char *TAG = "jobs";
+
+typedef enum {
+    JOB_FREE = 0,
+    JOB_RUNNING,
+    JOB_DONE,
+} job_state_t;
+
+typedef struct {
+    job_state_t state;
+    uint32_t id;
+    TaskHandle_t task;
+    SemaphoreHandle_t done;     // given once the job ended, stays given
+    StaticSemaphore_t done_buf;
+    volatile bool cancel;
+    int ret;
+    int64_t start_us;
+    int64_t end_us;
+    FILE *out;
+    size_t head;                // ring: oldest byte
+    size_t len;                 // ring: bytes buffered
+    uint32_t dropped;           // overwritten before anyone read them
+    char line[JOB_LINE_MAX];
+} job_t;
+
+static job_t s_jobs[CONFIG_JOBS_MAX];
+static uint8_t s_out[CONFIG_JOBS_MAX][CONFIG_JOBS_OUTPUT_SIZE];
+static SemaphoreHandle_t s_lock;
+static StaticSemaphore_t s_lock_buf;
+static uint32_t s_next_id = 1;
+static __thread job_t *t_job;
+
+bool job_cancelled(void)
+{
+    return t_job != NULL && t_job->cancel;
+}
+
+/* ---- output ring, newest bytes win ---- */
+
+static int job_out_write(void *cookie, const char *data, int len)
+{
+    job_t *job = cookie;
+    uint8_t *ring = s_out[job - s_jobs];
+    const size_t size = CONFIG_JOBS_OUTPUT_SIZE;
+    size_t n = len;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (n > size) {
+        job->dropped += n - size;
+        data += n - size;
+        n = size;
+    }
+    if (job->len + n > size) {
+        size_t over = job->len + n - size;
+        job->head = (job->head + over) % size;
+        job->len -= over;
+        job->dropped += over;
+    }
+    size_t tail = (job->head + job->len) % size;
+    size_t first = n < size - tail ? n : size - tail;
+    memcpy(ring + tail, data, first);
+    memcpy(ring, data + first, n - first);
+    job->len += n;
+    xSemaphoreGive(s_lock);
+    return len;
+}
+
+// Take up to max buffered bytes of job id, 0 if none or the slot was reused
+static size_t job_out_read(job_t *job, uint32_t id, char *buf, size_t max)
+{
+    const size_t size = CONFIG_JOBS_OUTPUT_SIZE;
+    uint8_t *ring = s_out[job - s_jobs];
+    size_t n = 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (job->id == id && job->state != JOB_FREE) {
+        n = job->len < max ? job->len : max;
+        size_t first = n < size - job->head ? n : size - job->head;
+        memcpy(buf, ring + job->head, first);
+        memcpy(buf + first, ring, n - first);
+        job->head = (job->head + n) % size;
+        job->len -= n;
+    }
+    xSemaphoreGive(s_lock);
+    return n;
+}
+
+/* ---- job table ---- */
+
+static const char *job_state_name(const job_t *job)
+{
+    if (job->state == JOB_RUNNING) {
+        return job->cancel ? "stopping" : "running";
+    }
+    return job->cancel ? "killed" : "done";
+}
+
+// A free slot, else the oldest finished job is dropped. Called with s_lock held
+static job_t *job_alloc(void)
+{
+    job_t *pick = NULL;
+    for (int i = 0; i < CONFIG_JOBS_MAX; i++) {
+        job_t *job = &s_jobs[i];
+        if (job->state == JOB_FREE) {
+            return job;
+        }
+        if (job->state == JOB_DONE && (pick == NULL || job->id < pick->id)) {
+            pick = job;
+        }
+    }
+    return pick;
+}
+
+static job_t *job_find(uint32_t id)
+{
+    for (int i = 0; i < CONFIG_JOBS_MAX; i++) {
+        if (s_jobs[i].state != JOB_FREE && s_jobs[i].id == id) {
+            return &s_jobs[i];
+        }
+    }
+    return NULL;
+}
+
+static void job_task(void *arg)
+{
+    job_t *job = arg;
+    t_job = job;
+
+    // stdout is per task: printf and ESP_LOG of the command land in the ring
+    job->out = funopen(job, NULL, job_out_write, NULL, NULL);
+    FILE *console_out = stdout;
+    if (job->out) {
+        setvbuf(job->out, NULL, _IOLBF, 128);
+        stdout = job->out;
+    }
+
+    int ret = 0;
+    esp_err_t err = dispatch_run(job->line, &ret);
+    if (err == ESP_ERR_NOT_FOUND) {
+        printf("Unrecognized command\n");
+        ret = -1;
+    } else if (err != ESP_OK) {
+        printf("Command failed: %s\n", esp_err_to_name(err));
+        ret = -1;
+    }
+
+    if (job->out) {
+        stdout = console_out;
+        fclose(job->out);
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    job->out = NULL;
+    job->ret = ret;
+    job->end_us = esp_timer_get_time();
+    job->task = NULL;
+    job->state = JOB_DONE;
+    xSemaphoreGive(s_lock);
+    xSemaphoreGive(job->done);
+    vTaskDelete(NULL);
+}
+
+// Rebuild a command line from argv, quoting what esp_console_split_argv would split or unescape
+static bool join_args(int argc, char **argv, char *out, size_t size)
+{
+    size_t n = 0;
+    for (int i = 0; i < argc; i++) {
+        const char *a = argv[i];
+        bool quote = *a == '\0' || strpbrk(a, " \"\\") != NULL;
+        if (n + strlen(a) * 2 + 4 > size) {
+            return false;
+        }
+        if (i > 0) {
+            out[n++] = ' ';
+        }
+        if (quote) {
+            out[n++] = '"';
+        }
+        for (; *a; a++) {
+            if (quote && (*a == '"' || *a == '\\')) {
+                out[n++] = '\\';
+            }
+            out[n++] = *a;
+        }
+        if (quote) {
+            out[n++] = '"';
+        }
+    }
+    out[n] = '\0';
+    return true;
+}
+
+/* ---- commands ---- */
+
+static int bg_cmd(int argc, char **argv)
+{
+    uint32_t stack = CONFIG_JOBS_STACK_SIZE;
+    int prio = CONFIG_JOBS_PRIORITY;
+    int i = 1;
+    for (; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-s") == 0) {
+            stack = strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "-p") == 0) {
+            prio = atoi(argv[i + 1]);
+        } else {
+            break;
+        }
+    }
+    if (i >= argc) {
+        printf("usage: bg [-s <stack>] [-p <prio>] <command> [args...]\n");
+        return 1;
+    }
+    if (stack < JOB_MIN_STACK) {
+        stack = JOB_MIN_STACK;
+    }
+    if (prio < 1 || prio >= configMAX_PRIORITIES) {
+        printf("bg: priority must be 1..%d\n", configMAX_PRIORITIES - 1);
+        return 1;
+    }
+    char line[JOB_LINE_MAX];
+    if (!join_args(argc - i, argv + i, line, sizeof(line))) {
+        printf("bg: command line longer than %d bytes\n", JOB_LINE_MAX - 1);
+        return 1;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    job_t *job = job_alloc();
+    if (job == NULL) {
+        xSemaphoreGive(s_lock);
+        printf("bg: %d jobs already running\n", CONFIG_JOBS_MAX);
+        return 1;
+    }
+    strcpy(job->line, line);
+    job->id = s_next_id++;
+    job->state = JOB_RUNNING;
+    job->cancel = false;
+    job->ret = 0;
+    job->head = 0;
+    job->len = 0;
+    job->dropped = 0;
+    job->start_us = esp_timer_get_time();
+    job->end_us = 0;
+    xSemaphoreTake(job->done, 0);
+    uint32_t id = job->id;
+
+    char name[configMAX_TASK_NAME_LEN];
+    snprintf(name, sizeof(name), "job%" PRIu32, id);
+    if (pipeline_task_create(job_task, name, stack, job, prio, &job->task) != pdPASS) {
+        job->state = JOB_FREE;
+        xSemaphoreGive(s_lock);
+        printf("bg: cannot create task (stack %" PRIu32 ")\n", stack);
+        return 1;
+    }
+    xSemaphoreGive(s_lock);
+    printf("[%" PRIu32 "] %s\n", id, job->line);
+    return 0;
+}
+
+static int jobs_cmd(int argc, char **argv)
+{
+    int64_t now = esp_timer_get_time();
+    int n = 0;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_JOBS_MAX; i++) {
+        const job_t *job = &s_jobs[i];
+        if (job->state == JOB_FREE) {
+            continue;
+        }
+        if (n++ == 0) {
+            printf("ID    STATE      CODE     TIME    OUT  COMMAND\n");
+        }
+        int64_t ms = ((job->state == JOB_RUNNING ? now : job->end_us) - job->start_us) / 1000;
+        char code[12] = "-";
+        if (job->state == JOB_DONE) {
+            snprintf(code, sizeof(code), "%d", job->ret);
+        }
+        printf("%-5" PRIu32 " %-9s %5s %8lld ms %5u B  %s\n", job->id, job_state_name(job),
+               code, ms, (unsigned)job->len, job->line);
+    }
+    xSemaphoreGive(s_lock);
+    if (n == 0) {
+        printf("No jobs\n");
+    }
+    return 0;
+}
+
+static struct {
+    struct arg_int *id;
+    struct arg_int *timeout;
+    struct arg_end *end;
+} wait_args;
+
+static int wait_cmd(int argc, char **argv)
+{
+    if (arg_parse(argc, argv, (void **)&wait_args) != 0) {
+        arg_print_errors(stderr, wait_args.end, argv[0]);
+        return 1;
+    }
+    uint32_t id = wait_args.id->ival[0];
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    job_t *job = job_find(id);
+    xSemaphoreGive(s_lock);
+    if (job == NULL) {
+        printf("wait: no job %" PRIu32 "\n", id);
+        return 1;
+    }
+
+    int64_t deadline = wait_args.timeout->count ?
+                       esp_timer_get_time() + (int64_t)wait_args.timeout->ival[0] * 1000000 : INT64_MAX;
+    char buf[128];
+    bool done = false;
+    while (true) {
+        size_t n;
+        while ((n = job_out_read(job, id, buf, sizeof(buf))) > 0) {
+            fwrite(buf, 1, n, stdout);
+        }
+        if (done) {
+            break;
+        }
+        // A finished job's slot can go to the next bg: its semaphore is then the new job's
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        bool reused = job->id != id;
+        xSemaphoreGive(s_lock);
+        if (reused) {
+            break;
+        }
+        if (xSemaphoreTake(job->done, pdMS_TO_TICKS(100)) == pdTRUE) {
+            xSemaphoreGive(job->done);
+            done = true;    // one more pass for the last output
+            continue;
+        }
+        if (esp_timer_get_time() > deadline) {
+            printf("\n[%" PRIu32 "] still running\n", id);
+            return 1;
+        }
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (job->id == id && job->state == JOB_DONE) {
+        if (job->dropped) {
+            printf("[%" PRIu32 "] %" PRIu32 " bytes of output lost (ring of %d bytes)\n",
+                   id, job->dropped, CONFIG_JOBS_OUTPUT_SIZE);
+        }
+        printf("[%" PRIu32 "] %s, exit code %d\n", id, job_state_name(job), job->ret);
+        job->state = JOB_FREE;
+    } else if (job->id != id) {
+        printf("[%" PRIu32 "] done, its slot went to job %" PRIu32 " before its status was read\n", id, job->id);
+    }
+    xSemaphoreGive(s_lock);
+    return 0;
+}
+
+static struct {
+    struct arg_int *id;
+    struct arg_end *end;
+} kill_args;
+
+static int kill_cmd(int argc, char **argv)
+{
+    if (arg_parse(argc, argv, (void **)&kill_args) != 0) {
+        arg_print_errors(stderr, kill_args.end, argv[0]);
+        return 1;
+    }
+    uint32_t id = kill_args.id->ival[0];
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    job_t *job = job_find(id);
+    if (job == NULL || job->state != JOB_RUNNING) {
+        xSemaphoreGive(s_lock);
+        printf("kill: no running job %" PRIu32 "\n", id);
+        return 1;
+    }
+    job->cancel = true;
+    xSemaphoreGive(s_lock);
+
+    if (xSemaphoreTake(job->done, pdMS_TO_TICKS(JOB_KILL_GRACE_MS)) == pdTRUE) {
+        xSemaphoreGive(job->done);
+        printf("[%" PRIu32 "] stopped\n", id);
+        return 0;
+    }
+    /* No forced delete: a task deleted in the middle of a command would leak
+     * its sockets, heap blocks and any lock it holds. The job stops at its
+     * next job_cancelled() check. */
+    printf("[%" PRIu32 "] still running, it stops at its next cancellation point\n", id);
+    return 1;
+}
+
+static struct {
+    struct arg_str *mode;
+    struct arg_end *end;
+} affinity_args;
+
+static int affinity_cmd(int argc, char **argv)
+{
+    if (arg_parse(argc, argv, (void **)&affinity_args) != 0) {
+        arg_print_errors(stderr, affinity_args.end, argv[0]);
+        return 1;
+    }
+    if (affinity_args.mode->count) {
+        const char *mode = affinity_args.mode->sval[0];
+        if (strcmp(mode, "on") != 0 && strcmp(mode, "off") != 0) {
+            printf("affinity: expected on or off\n");
+            return 1;
+        }
+        if (!pipeline_set_pinned(strcmp(mode, "on") == 0)) {
+            printf("affinity: single-core chip, tasks are not pinned\n");
+            return 1;
+        }
+    }
+    if (pipeline_pinned()) {
+        printf("Processing tasks on core %d, radio and lwIP on core %d\n", PIPELINE_APP_CORE, PIPELINE_PROTO_CORE);
+    } else {
+        printf("Processing tasks not pinned\n");
+    }
+    return 0;
+}
+
+void module_jobs(void)
+{
+    s_lock = xSemaphoreCreateMutexStatic(&s_lock_buf);
+    for (int i = 0; i < CONFIG_JOBS_MAX; i++) {
+        s_jobs[i].done = xSemaphoreCreateBinaryStatic(&s_jobs[i].done_buf);
+    }
+
+    const esp_console_cmd_t bg_def = {
+        .command = "bg",
+        .help = "Run a command in the background, prints its job id",
+        .hint = "[-s <stack>] [-p <prio>] <command> [args...]",
+        .func = &bg_cmd,
+    };
+    ESP_ERROR_CHECK(dispatch_register(&bg_def));
+
+    const esp_console_cmd_t jobs_def = {
+        .command = "jobs",
+        .help = "List background jobs",
+        .hint = NULL,
+        .func = &jobs_cmd,
+    };
+    ESP_ERROR_CHECK(dispatch_register(&jobs_def));
+
+    wait_args.id = arg_int1(NULL, NULL, "<id>", "Job id");
+    wait_args.timeout = arg_int0("t", "timeout", "<s>", "Give up after this many seconds");
+    wait_args.end = arg_end(2);
+    const esp_console_cmd_t wait_def = {
+        .command = "wait",
+        .help = "Print a job's output until it ends, then free its slot",
+        .hint = NULL,
+        .func = &wait_cmd,
+        .argtable = &wait_args
+    };
+    ESP_ERROR_CHECK(dispatch_register(&wait_def));
+
+    kill_args.id = arg_int1(NULL, NULL, "<id>", "Job id");
+    kill_args.end = arg_end(1);
+    const esp_console_cmd_t kill_def = {
+        .command = "kill",
+        .help = "Ask a background job to stop",
+        .hint = NULL,
+        .func = &kill_cmd,
+        .argtable = &kill_args
+    };
+    ESP_ERROR_CHECK(dispatch_register(&kill_def));
+
+    affinity_args.mode = arg_str0(NULL, NULL, "on|off", "Pin new processing tasks to the application core");
+    affinity_args.end = arg_end(1);
+    const esp_console_cmd_t affinity_def = {
+        .command = "affinity",
+        .help = "Show or set the core of new jobs, sessions and workers",
+        .hint = NULL,
+        .func = &affinity_cmd,
+        .argtable = &affinity_args
+    };
+    ESP_ERROR_CHECK(dispatch_register(&affinity_def));
+}
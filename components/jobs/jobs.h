@@ -0,0 +1,27 @@
+/*
+    Background jobs.
+
+    `bg <command>` runs any registered command in its own task and returns
+    the prompt immediately. A fixed table of CONFIG_JOBS_MAX slots, each with
+    a ring buffer of CONFIG_JOBS_OUTPUT_SIZE bytes, keeps the newest output
+    of the job (its stdout, so printf and ESP_LOG). `jobs` lists them,
+    `wait <id>` streams the output until the job ends and frees its slot,
+    `kill <id>` asks it to stop.
+*/
+#pragma once
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void module_jobs(void);
+
+// True when the job running the calling task was asked to stop (kill);
+// long-running commands check it between steps
+bool job_cancelled(void);
+
+#ifdef __cplusplus
+}
+#endif
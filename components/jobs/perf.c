@@ -0,0 +1,99 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "perf.h"
+
+// Histograms are updated from several tasks and both cores, the critical section is a few stores
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static perf_phase_t *s_phases;
+
+static inline int bucket_of(uint32_t us)
+{
+    if (us == 0) {
+        return 0;
+    }
+    int octave = 31 - __builtin_clz(us);
+    int half = octave > 0 ? (us >> (octave - 1)) & 1 : 0;
+    return 1 + 2 * octave + half;
+}
+
+// First value above bucket i
+static uint64_t bucket_limit(int i)
+{
+    if (i == 0) {
+        return 1;
+    }
+    int octave = (i - 1) / 2;
+    uint64_t low = 1ull << octave;
+    uint64_t step = octave > 0 ? 1ull << (octave - 1) : 1;
+    return (i - 1) % 2 ? low * 2 : low + step;
+}
+
+void perf_hist_add(perf_hist_t *h, uint32_t us)
+{
+    int b = bucket_of(us);
+    taskENTER_CRITICAL(&s_mux);
+    h->count++;
+    h->sum_us += us;
+    if (us > h->max_us) {
+        h->max_us = us;
+    }
+    h->buckets[b]++;
+    taskEXIT_CRITICAL(&s_mux);
+}
+
+uint32_t perf_hist_percentile(const perf_hist_t *h, uint32_t permille)
+{
+    if (h->count == 0) {
+        return 0;
+    }
+    // Rank of the value, 1-based, rounded up
+    uint64_t rank = ((uint64_t)h->count * permille + 999) / 1000;
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < PERF_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t limit = bucket_limit(i) - 1;
+            return limit < h->max_us ? limit : h->max_us;
+        }
+    }
+    return h->max_us;
+}
+
+void perf_hist_reset(perf_hist_t *h)
+{
+    taskENTER_CRITICAL(&s_mux);
+    memset(h, 0, sizeof(*h));
+    taskEXIT_CRITICAL(&s_mux);
+}
+
+void perf_hist_copy(perf_hist_t *dst, perf_hist_t *src, bool reset)
+{
+    taskENTER_CRITICAL(&s_mux);
+    *dst = *src;
+    if (reset) {
+        memset(src, 0, sizeof(*src));
+    }
+    taskEXIT_CRITICAL(&s_mux);
+}
+
+void perf_phase_add(perf_phase_t *phase, uint32_t us)
+{
+    perf_hist_add(&phase->hist, us);
+    if (!phase->linked) {
+        taskENTER_CRITICAL(&s_mux);
+        if (!phase->linked) {
+            phase->next = s_phases;
+            s_phases = phase;
+            phase->linked = true;
+        }
+        taskEXIT_CRITICAL(&s_mux);
+    }
+}
+
+perf_phase_t *perf_phases(void)
+{
+    return s_phases;
+}
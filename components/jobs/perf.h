@@ -0,0 +1,67 @@
+/*
+    Latency histograms.
+
+    The dispatcher times every command call (CONFIG_DISPATCH_PERF). Modules
+    can time named phases of their own with
+
+        PERF_BEGIN(send);
+        ...
+        PERF_END(send, "arp.send");
+
+    Each PERF_END site owns a static histogram, registered the first time
+    it records. Without CONFIG_DISPATCH_PERF the macros expand to nothing.
+    Buckets are half octaves of microseconds, so percentiles are upper
+    bounds within ~40%; count, mean and max are exact.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_timer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PERF_BUCKETS    65      // 0 us, then 2 per octave up to 2^32 us
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t buckets[PERF_BUCKETS];
+} perf_hist_t;
+
+typedef struct perf_phase {
+    const char *name;
+    struct perf_phase *next;
+    bool linked;
+    perf_hist_t hist;
+} perf_phase_t;
+
+void perf_hist_add(perf_hist_t *h, uint32_t us);
+// Upper bound of the bucket holding the permille-th value, 0 when empty
+uint32_t perf_hist_percentile(const perf_hist_t *h, uint32_t permille);
+void perf_hist_reset(perf_hist_t *h);
+// Consistent copy of a live histogram, reset in the same critical section when asked
+void perf_hist_copy(perf_hist_t *dst, perf_hist_t *src, bool reset);
+
+void perf_phase_add(perf_phase_t *phase, uint32_t us);
+// Phases that recorded at least once, newest first
+perf_phase_t *perf_phases(void);
+
+#if CONFIG_DISPATCH_PERF
+#define PERF_BEGIN(id)          int64_t perf_t0_##id = esp_timer_get_time()
+#define PERF_END(id, label)     do { \
+        static perf_phase_t perf_phase_##id = { .name = (label) }; \
+        perf_phase_add(&perf_phase_##id, esp_timer_get_time() - perf_t0_##id); \
+    } while (0)
+#else
+#define PERF_BEGIN(id)          do { } while (0)
+#define PERF_END(id, label)     do { } while (0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
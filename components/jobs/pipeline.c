@@ -0,0 +1,40 @@
+#include "sdkconfig.h"
+#include "pipeline.h"
+
+#if CONFIG_PIPELINE_PIN && !CONFIG_FREERTOS_UNICORE
+static volatile bool s_pinned = true;
+#else
+static volatile bool s_pinned = false;
+#endif
+
+BaseType_t pipeline_app_core(void)
+{
+#if !CONFIG_FREERTOS_UNICORE
+    if (s_pinned) {
+        return PIPELINE_APP_CORE;
+    }
+#endif
+    return tskNO_AFFINITY;
+}
+
+bool pipeline_pinned(void)
+{
+    return s_pinned;
+}
+
+bool pipeline_set_pinned(bool on)
+{
+#if CONFIG_FREERTOS_UNICORE
+    if (on) {
+        return false;
+    }
+#endif
+    s_pinned = on;
+    return true;
+}
+
+BaseType_t pipeline_task_create(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                                UBaseType_t prio, TaskHandle_t *task)
+{
+    return xTaskCreatePinnedToCore(fn, name, stack, arg, prio, task, pipeline_app_core());
+}
@@ -0,0 +1,39 @@
+/*
+    Core placement of the processing tasks.
+
+    On the dual-core ESP32 the Wi-Fi driver and lwIP (radio RX, capture,
+    ARP and ICMP) run on the protocol core, core 0 (see sdkconfig). With
+    CONFIG_PIPELINE_PIN the tasks that parse, aggregate and print — REPL,
+    jobs, TCP sessions, agent, sniffer worker, output drain — are created
+    on the application core, core 1, so a burst of console work never
+    delays the radio. `affinity on|off` switches it for the tasks created
+    afterwards, to compare the throughput both ways. On single-core chips
+    (ESP32-C3, CONFIG_FREERTOS_UNICORE) everything runs unpinned.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIPELINE_PROTO_CORE     0       // PRO_CPU: Wi-Fi, lwIP
+#define PIPELINE_APP_CORE       1       // APP_CPU: parsing and output
+
+// Core for a new processing task, tskNO_AFFINITY when not pinning
+BaseType_t pipeline_app_core(void);
+
+bool pipeline_pinned(void);
+// False when pinning is not available on this chip
+bool pipeline_set_pinned(bool on);
+
+// xTaskCreate() on pipeline_app_core()
+BaseType_t pipeline_task_create(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                                UBaseType_t prio, TaskHandle_t *task);
+
+#ifdef __cplusplus
+}
+#endif
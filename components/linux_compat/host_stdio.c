@@ -0,0 +1,99 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "esp_log.h"
+#include "host_stdio.h"
+
+// This file needs glibc's process-wide streams behind the macros
+#undef stdout
+#undef stderr
+#undef vprintf
+
+typedef struct {
+    void *cookie;
+    int (*readfn)(void *, char *, int);
+    int (*writefn)(void *, const char *, int);
+    int (*closefn)(void *);
+} host_cookie_t;
+
+static __thread FILE *t_stdout;
+static __thread FILE *t_stderr;
+
+FILE **host_stdout_slot(void)
+{
+    if (t_stdout == NULL) {
+        t_stdout = stdout;
+    }
+    return &t_stdout;
+}
+
+FILE **host_stderr_slot(void)
+{
+    if (t_stderr == NULL) {
+        t_stderr = stderr;
+    }
+    return &t_stderr;
+}
+
+int host_puts(const char *s)
+{
+    FILE *out = *host_stdout_slot();
+    return fputs(s, out) < 0 ? EOF : fputc('\n', out);
+}
+
+static ssize_t cookie_read(void *c, char *buf, size_t size)
+{
+    host_cookie_t *h = c;
+    int n = h->readfn(h->cookie, buf, size);
+    return n < 0 ? -1 : n;
+}
+
+// fopencookie wants 0, not -1, for a failed write
+static ssize_t cookie_write(void *c, const char *buf, size_t size)
+{
+    host_cookie_t *h = c;
+    int n = h->writefn(h->cookie, buf, size);
+    return n < 0 ? 0 : n;
+}
+
+static int cookie_close(void *c)
+{
+    host_cookie_t *h = c;
+    int ret = h->closefn ? h->closefn(h->cookie) : 0;
+    free(h);
+    return ret;
+}
+
+FILE *funopen(const void *cookie, int (*readfn)(void *, char *, int),
+              int (*writefn)(void *, const char *, int),
+              fpos_t (*seekfn)(void *, fpos_t, int), int (*closefn)(void *))
+{
+    // seekfn: no caller seeks a console stream
+    host_cookie_t *h = malloc(sizeof(*h));
+    if (h == NULL) {
+        return NULL;
+    }
+    *h = (host_cookie_t){ .cookie = (void *)cookie, .readfn = readfn, .writefn = writefn, .closefn = closefn };
+    cookie_io_functions_t io = {
+        .read = readfn ? cookie_read : NULL,
+        .write = writefn ? cookie_write : NULL,
+        .close = cookie_close,
+    };
+    FILE *f = fopencookie(h, readfn && writefn ? "r+" : writefn ? "w" : "r", io);
+    if (f == NULL) {
+        free(h);
+    }
+    return f;
+}
+
+// ESP_LOG lines follow the task's stdout, as they do with newlib
+static int log_vprintf(const char *fmt, va_list ap)
+{
+    return vfprintf(*host_stdout_slot(), fmt, ap);
+}
+
+__attribute__((constructor)) static void host_stdio_init(void)
+{
+    esp_log_set_vprintf(log_vprintf);
+}
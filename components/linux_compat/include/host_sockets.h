@@ -0,0 +1,25 @@
+/*
+    lwIP sockets for the Linux host build.
+
+    On the chips <sys/socket.h> and friends are lwIP's, and close() and
+    fcntl() reach lwIP through the VFS. On the linux target they are the
+    host's: the socket modules include this header instead, so socket(),
+    connect(), select()... are lwIP's (LWIP_COMPAT_SOCKETS) and run over the
+    TAP netif of wifi_sim, like on a board. close() and fcntl() on those
+    descriptors are sent to lwIP too, for the including file only: include
+    it in files whose descriptors are all sockets.
+*/
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "lwip/inet.h"
+
+#if !LWIP_POSIX_SOCKETS_IO_NAMES
+#undef close
+#undef fcntl
+#define close(s)            lwip_close(s)
+#define fcntl(s, cmd, val)  lwip_fcntl(s, cmd, val)
+#endif
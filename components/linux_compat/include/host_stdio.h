@@ -0,0 +1,39 @@
+/*
+    newlib stdio behaviour for the Linux host build.
+
+    On the chips every task has its own stdout/stderr (newlib reent), which
+    jobs, TCP sessions and the agent rely on: they point stdout at their own
+    stream and printf lands there. glibc has one stdout for the process and
+    no funopen(). The top-level CMakeLists force-includes this header in the
+    project's components on the linux target only: stdout and stderr become
+    per-thread (each FreeRTOS task is a pthread there), printf and friends
+    write to them, and funopen() is built on fopencookie().
+*/
+#pragma once
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+FILE **host_stdout_slot(void);
+FILE **host_stderr_slot(void);
+int host_puts(const char *s);
+
+FILE *funopen(const void *cookie, int (*readfn)(void *, char *, int),
+              int (*writefn)(void *, const char *, int),
+              fpos_t (*seekfn)(void *, fpos_t, int), int (*closefn)(void *));
+
+#ifdef __cplusplus
+}
+#endif
+
+#undef stdout
+#undef stderr
+#define stdout              (*host_stdout_slot())
+#define stderr              (*host_stderr_slot())
+#define printf(...)         fprintf(stdout, __VA_ARGS__)
+#define vprintf(fmt, ap)    vfprintf(stdout, fmt, ap)
+#define puts(s)             host_puts(s)
+#define putchar(c)          fputc((c), stdout)
@@ -0,0 +1,476 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <time.h>
+#include "sdkconfig.h"
+#include "soc/soc_caps.h"
+#include "argtable3/argtable3.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#if SOC_LIGHT_SLEEP_SUPPORTED
+#include "esp_sleep.h"
+#include "driver/uart.h"
+#endif
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "dispatch.h"
+#include "pipeline.h"
+#include "async_out.h"
+#include "result.h"
+#include "result_json.h"
+#include "wifi_mgr.h"
+#include "monitor_sched.h"
+#include "monitor.h"
+
+#define MONITOR_RTC_MAGIC       0x4D4F4E31      // "MON1"
+#define MONITOR_ENTRY_HDR       6               // time (s, u32 LE) + record length (u16 LE)
+#define MONITOR_STACK           6144            // runs scan-wifi and scan-arp
+#define MONITOR_PRIORITY        2
+#define MONITOR_MIN_SLEEP_MS    100             // shorter waits are not worth a light sleep
+#define MONITOR_UART_AWAKE_MS   30000           // after a key press, time to type a command
+#define MONITOR_IDLE_POLL_MS    1000            // awake: re-check the radio state this often
+#define MONITOR_STOP_WAIT_MS    30000
+
+#define DEFAULT_HEARTBEAT_S     60
+#define DEFAULT_SCAN_S          300
+#define DEFAULT_ARP_S           0
+#define MAX_PERIOD_S            (UINT32_MAX / 1000)     // the scheduler counts in ms on 32 bits
+
+static const char *TAG = "monitor";
+
+typedef struct {
+    uint32_t magic;
+    uint32_t head;              // oldest entry
+    uint32_t len;               // bytes used
+    uint32_t entries;
+    uint32_t dropped;           // entries overwritten when full
+    uint8_t data[CONFIG_MONITOR_RTC_BUF_SIZE];
+} rtc_log_t;
+
+typedef struct {
+    const char *name;
+    const char *line;           // command run, NULL for the heartbeat
+} monitor_job_t;
+
+static const monitor_job_t s_jobs[] = {
+    { "heartbeat", NULL },
+    { "scan", "scan-wifi" },
+    { "arp", "scan-arp" },
+};
+
+static const uint32_t s_state_ua[MONITOR_STATE_COUNT] = {
+    [MONITOR_STATE_ACTIVE] = CONFIG_MONITOR_ACTIVE_UA,
+    [MONITOR_STATE_IDLE] = CONFIG_MONITOR_IDLE_UA,
+    [MONITOR_STATE_SLEEP] = CONFIG_MONITOR_SLEEP_UA,
+};
+
+// Not cleared by a reset or deep sleep: checked by magic and bounds at boot
+static RTC_NOINIT_ATTR rtc_log_t s_log;
+
+// s_log, s_sched and the buffers below
+static SemaphoreHandle_t s_lock;
+static StaticSemaphore_t s_lock_buf;
+static monitor_sched_t s_sched;
+static const monitor_job_t *s_task_job[MONITOR_SCHED_MAX_TASKS];
+static char s_line[RESULT_JSON_LINE_MAX];
+static uint8_t s_rec[RESULT_REC_MAX];
+
+static result_sink_t s_sink;
+static TaskHandle_t s_task;
+static SemaphoreHandle_t s_done;
+static StaticSemaphore_t s_done_buf;
+static volatile bool s_running;
+static uint32_t s_wakeups;
+static uint64_t s_awake_until;
+
+static inline uint64_t now_ms(void)
+{
+    // esp_timer keeps counting across light sleep
+    return esp_timer_get_time() / 1000;
+}
+
+/* ---- RTC ring, called with s_lock held ---- */
+
+static void log_reset(void)
+{
+    memset(&s_log, 0, offsetof(rtc_log_t, data));
+    s_log.magic = MONITOR_RTC_MAGIC;
+}
+
+static bool log_valid(void)
+{
+    return s_log.magic == MONITOR_RTC_MAGIC && s_log.head < CONFIG_MONITOR_RTC_BUF_SIZE &&
+           s_log.len <= CONFIG_MONITOR_RTC_BUF_SIZE && (s_log.len == 0) == (s_log.entries == 0);
+}
+
+static void log_put(uint32_t off, const void *src, size_t n)
+{
+    const uint8_t *p = src;
+    for (size_t i = 0; i < n; i++) {
+        s_log.data[(off + i) % CONFIG_MONITOR_RTC_BUF_SIZE] = p[i];
+    }
+}
+
+static void log_get(uint32_t off, void *dst, size_t n)
+{
+    uint8_t *p = dst;
+    for (size_t i = 0; i < n; i++) {
+        p[i] = s_log.data[(off + i) % CONFIG_MONITOR_RTC_BUF_SIZE];
+    }
+}
+
+// Time and record length of the entry at off
+static void log_entry(uint32_t off, uint32_t *time_s, uint16_t *len)
+{
+    uint8_t hdr[MONITOR_ENTRY_HDR];
+    log_get(off, hdr, sizeof(hdr));
+    *time_s = hdr[0] | hdr[1] << 8 | hdr[2] << 16 | (uint32_t)hdr[3] << 24;
+    *len = hdr[4] | hdr[5] << 8;
+}
+
+static void log_drop_oldest(void)
+{
+    uint32_t time_s;
+    uint16_t len;
+    log_entry(s_log.head, &time_s, &len);
+    size_t n = MONITOR_ENTRY_HDR + len;
+    if (n > s_log.len) {
+        log_reset();    // corrupted
+        return;
+    }
+    s_log.head = (s_log.head + n) % CONFIG_MONITOR_RTC_BUF_SIZE;
+    s_log.len -= n;
+    s_log.entries--;
+    s_log.dropped++;
+}
+
+static void log_append(const uint8_t *rec, size_t n)
+{
+    size_t need = MONITOR_ENTRY_HDR + n;
+    if (need > CONFIG_MONITOR_RTC_BUF_SIZE) {
+        return;
+    }
+    while (CONFIG_MONITOR_RTC_BUF_SIZE - s_log.len < need) {
+        log_drop_oldest();
+    }
+    uint32_t t = time(NULL);
+    const uint8_t hdr[MONITOR_ENTRY_HDR] = { t, t >> 8, t >> 16, t >> 24, n, n >> 8 };
+    uint32_t tail = (s_log.head + s_log.len) % CONFIG_MONITOR_RTC_BUF_SIZE;
+    log_put(tail, hdr, sizeof(hdr));
+    log_put(tail + MONITOR_ENTRY_HDR, rec, n);
+    s_log.len += need;
+    s_log.entries++;
+}
+
+/* Sink of the monitor task: whole records, split with the JSON renderer */
+static int log_write(void *ctx, const uint8_t *data, size_t len, bool compressed)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    size_t pos = 0;
+    while (pos < len) {
+        size_t n = result_json(data + pos, len - pos, s_line, sizeof(s_line));
+        if (n == 0) {
+            break;
+        }
+        log_append(data + pos, n);
+        pos += n;
+    }
+    xSemaphoreGive(s_lock);
+    return 0;
+}
+
+/* ---- monitor task ---- */
+
+static void heartbeat(void)
+{
+    uint64_t now = now_ms();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint32_t duty = monitor_sched_duty_permille(&s_sched, now);
+    uint32_t ua = monitor_sched_avg_ua(&s_sched, now, s_state_ua);
+    xSemaphoreGive(s_lock);
+
+    result_rec_t rec;
+    result_begin(&rec, &s_sink, RESULT_HEARTBEAT);
+    result_uint(&rec, now / 1000);
+    result_uint(&rec, esp_get_free_heap_size());
+    result_uint(&rec, duty);
+    result_uint(&rec, ua);
+    result_uint(&rec, s_wakeups);
+    result_end(&rec);
+}
+
+static void enter_state(monitor_state_t state)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    monitor_sched_enter(&s_sched, state, now_ms());
+    xSemaphoreGive(s_lock);
+}
+
+#if SOC_LIGHT_SLEEP_SUPPORTED
+static void monitor_light_sleep(uint64_t wait_ms)
+{
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
+    esp_sleep_enable_timer_wakeup(wait_ms * 1000);
+#if CONFIG_ESP_CONSOLE_UART_DEFAULT || CONFIG_ESP_CONSOLE_UART_CUSTOM
+    // A key press wakes the chip and keeps it up for the console
+    uart_set_wakeup_threshold(CONFIG_ESP_CONSOLE_UART_NUM, 3);
+    esp_sleep_enable_uart_wakeup(CONFIG_ESP_CONSOLE_UART_NUM);
+#endif
+    fflush(stdout);
+    async_out_flush(1000);
+#if CONFIG_ESP_CONSOLE_UART_DEFAULT || CONFIG_ESP_CONSOLE_UART_CUSTOM
+    uart_wait_tx_idle_polling(CONFIG_ESP_CONSOLE_UART_NUM);
+#endif
+    esp_light_sleep_start();
+    s_wakeups++;
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_UART) {
+        s_awake_until = now_ms() + MONITOR_UART_AWAKE_MS;
+    }
+}
+#endif
+
+static void monitor_task(void *arg)
+{
+    result_sink_set_current(&s_sink);
+    bool modem_sleep = false;
+    while (s_running) {
+        uint64_t now = now_ms();
+        int i;
+        while (s_running && (i = monitor_sched_due(&s_sched, now)) >= 0) {
+            enter_state(MONITOR_STATE_ACTIVE);
+            const monitor_job_t *job = s_task_job[i];
+            if (job->line) {
+                int ret;
+                if (dispatch_run(job->line, &ret) != ESP_OK || ret != 0) {
+                    ESP_LOGW(TAG, "%s failed", job->line);
+                }
+            } else {
+                heartbeat();
+            }
+            result_sink_flush(&s_sink);
+            now = now_ms();
+            xSemaphoreTake(s_lock, portMAX_DELAY);
+            monitor_sched_done(&s_sched, i, now);
+            xSemaphoreGive(s_lock);
+        }
+        if (!s_running) {
+            break;
+        }
+
+        uint64_t wait = monitor_sched_wait_ms(&s_sched, now);
+        bool radio = wifi_mgr_state() != WIFI_MGR_OFF;
+#if SOC_LIGHT_SLEEP_SUPPORTED
+        // Forced light sleep would drop an association: only with the driver off
+        if (!radio && wait >= MONITOR_MIN_SLEEP_MS && now >= s_awake_until) {
+            enter_state(MONITOR_STATE_SLEEP);
+            monitor_light_sleep(wait);
+            continue;
+        }
+#endif
+        if (radio && !modem_sleep) {
+            modem_sleep = esp_wifi_set_ps(WIFI_PS_MAX_MODEM) == ESP_OK;
+        } else if (!radio) {
+            modem_sleep = false;
+        }
+        enter_state(MONITOR_STATE_IDLE);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait < MONITOR_IDLE_POLL_MS ? wait : MONITOR_IDLE_POLL_MS));
+    }
+
+    enter_state(MONITOR_STATE_IDLE);
+    if (modem_sleep) {
+        esp_wifi_set_ps(WIFI_PS_MIN_MODEM);     // default of the driver
+    }
+    result_sink_set_current(NULL);
+    result_sink_finish(&s_sink);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_task = NULL;
+    xSemaphoreGive(s_lock);
+    xSemaphoreGive(s_done);
+    vTaskDelete(NULL);
+}
+
+/* ---- command ---- */
+
+static void monitor_status(void)
+{
+    uint64_t now = now_ms();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_task) {
+        uint64_t ms[MONITOR_STATE_COUNT];
+        for (int i = 0; i < MONITOR_STATE_COUNT; i++) {
+            ms[i] = s_sched.state_ms[i] + (i == (int)s_sched.state ? now - s_sched.since_ms : 0);
+        }
+        uint32_t duty = monitor_sched_duty_permille(&s_sched, now);
+        printf("Running: duty cycle %" PRIu32 ".%" PRIu32 "%%, ~%" PRIu32 " uA average, %" PRIu32 " wake-ups\n",
+               duty / 10, duty % 10, monitor_sched_avg_ua(&s_sched, now, s_state_ua), s_wakeups);
+        printf("Active %" PRIu64 " s, idle %" PRIu64 " s, light sleep %" PRIu64 " s\n",
+               ms[MONITOR_STATE_ACTIVE] / 1000, ms[MONITOR_STATE_IDLE] / 1000, ms[MONITOR_STATE_SLEEP] / 1000);
+        printf("%-10s %8s %6s %8s %8s\n", "Task", "Period", "Runs", "Skipped", "Next");
+        for (size_t i = 0; i < s_sched.count; i++) {
+            const monitor_task_t *t = &s_sched.tasks[i];
+            uint64_t next = t->next_ms > now ? (t->next_ms - now) / 1000 : 0;
+            printf("%-10s %6" PRIu32 " s %6" PRIu32 " %8" PRIu32 " %6" PRIu64 " s\n",
+                   t->name, t->period_ms / 1000, t->runs, t->skipped, next);
+        }
+    } else {
+        printf("Stopped\n");
+    }
+    printf("RTC buffer: %" PRIu32 " records, %" PRIu32 "/%d B, %" PRIu32 " dropped\n",
+           s_log.entries, s_log.len, CONFIG_MONITOR_RTC_BUF_SIZE, s_log.dropped);
+    xSemaphoreGive(s_lock);
+}
+
+static void monitor_dump(void)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint32_t off = s_log.head;
+    for (uint32_t i = 0; i < s_log.entries; i++) {
+        uint32_t time_s;
+        uint16_t len;
+        log_entry(off, &time_s, &len);
+        size_t n = len < sizeof(s_rec) ? len : sizeof(s_rec);
+        log_get(off + MONITOR_ENTRY_HDR, s_rec, n);
+        if (result_json(s_rec, n, s_line, sizeof(s_line)) == 0) {
+            snprintf(s_line, sizeof(s_line), "{\"type\":\"invalid\"}\n");
+        }
+        printf("%" PRIu32 " %s", time_s, s_line);
+        off = (off + MONITOR_ENTRY_HDR + len) % CONFIG_MONITOR_RTC_BUF_SIZE;
+    }
+    xSemaphoreGive(s_lock);
+}
+
+static int monitor_start(const int period_s[])
+{
+    size_t n_jobs = sizeof(s_jobs) / sizeof(s_jobs[0]);
+    for (size_t i = 0; i < n_jobs; i++) {
+        if (period_s[i] < 0 || (uint32_t)period_s[i] > MAX_PERIOD_S) {
+            printf("monitor: %s period must be 0 (off) to %" PRIu32 " s\n", s_jobs[i].name, (uint32_t)MAX_PERIOD_S);
+            return 1;
+        }
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_task) {
+        xSemaphoreGive(s_lock);
+        printf("monitor: already running\n");
+        return 1;
+    }
+    uint64_t now = now_ms();
+    monitor_sched_init(&s_sched, now);
+    for (size_t i = 0; i < n_jobs; i++) {
+        if (period_s[i] == 0) {
+            continue;
+        }
+        // Spread the first runs a little so they don't all start the same second
+        int t = monitor_sched_add(&s_sched, s_jobs[i].name, (uint32_t)period_s[i] * 1000, now + i * 1000);
+        if (t >= 0) {
+            s_task_job[t] = &s_jobs[i];
+        }
+    }
+    xSemaphoreGive(s_lock);
+    if (s_sched.count == 0) {
+        printf("monitor: every period is 0\n");
+        return 1;
+    }
+    result_sink_init(&s_sink, log_write, NULL, false);
+    xSemaphoreTake(s_done, 0);
+    s_wakeups = 0;
+    s_awake_until = 0;
+    s_running = true;
+    if (pipeline_task_create(monitor_task, "monitor", MONITOR_STACK, NULL, MONITOR_PRIORITY, &s_task) != pdPASS) {
+        s_running = false;
+        result_sink_finish(&s_sink);
+        printf("monitor: cannot create task\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int monitor_stop(void)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_task == NULL) {
+        xSemaphoreGive(s_lock);
+        printf("monitor: not running\n");
+        return 1;
+    }
+    s_running = false;
+    xTaskNotifyGive(s_task);
+    xSemaphoreGive(s_lock);
+    // A scan in progress finishes first
+    if (xSemaphoreTake(s_done, pdMS_TO_TICKS(MONITOR_STOP_WAIT_MS)) != pdTRUE) {
+        printf("monitor: task still busy, it stops after its current run\n");
+        return 1;
+    }
+    monitor_status();
+    return 0;
+}
+
+static struct {
+    struct arg_str *action;
+    struct arg_int *heartbeat;
+    struct arg_int *scan;
+    struct arg_int *arp;
+    struct arg_end *end;
+} monitor_args;
+
+static int monitor_cmd(int argc, char **argv)
+{
+    if (arg_parse(argc, argv, (void **)&monitor_args) != 0) {
+        arg_print_errors(stderr, monitor_args.end, argv[0]);
+        return 1;
+    }
+    const char *action = monitor_args.action->count ? monitor_args.action->sval[0] : "status";
+    if (strcmp(action, "start") == 0) {
+        int period_s[] = {
+            monitor_args.heartbeat->count ? monitor_args.heartbeat->ival[0] : DEFAULT_HEARTBEAT_S,
+            monitor_args.scan->count ? monitor_args.scan->ival[0] : DEFAULT_SCAN_S,
+            monitor_args.arp->count ? monitor_args.arp->ival[0] : DEFAULT_ARP_S,
+        };
+        return monitor_start(period_s);
+    } else if (strcmp(action, "stop") == 0) {
+        return monitor_stop();
+    } else if (strcmp(action, "status") == 0) {
+        monitor_status();
+    } else if (strcmp(action, "dump") == 0) {
+        monitor_dump();
+    } else if (strcmp(action, "clear") == 0) {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        log_reset();
+        xSemaphoreGive(s_lock);
+    } else {
+        printf("monitor: unknown action %s\n", action);
+        return 1;
+    }
+    return 0;
+}
+
+void module_monitor(void)
+{
+    s_lock = xSemaphoreCreateMutexStatic(&s_lock_buf);
+    s_done = xSemaphoreCreateBinaryStatic(&s_done_buf);
+    if (log_valid()) {
+        ESP_LOGI(TAG, "%" PRIu32 " records kept in RTC memory", s_log.entries);
+    } else {
+        log_reset();
+    }
+
+    monitor_args.action = arg_str0(NULL, NULL, "start|stop|status|dump|clear", "Default: status");
+    monitor_args.heartbeat = arg_int0("b", "heartbeat", "<s>", "Heartbeat period (s), 0 = off, default 60");
+    monitor_args.scan = arg_int0("s", "scan", "<s>", "Wi-Fi scan period (s), 0 = off, default 300");
+    monitor_args.arp = arg_int0("a", "arp", "<s>", "ARP sweep period (s, needs join), 0 = off, default 0");
+    monitor_args.end = arg_end(4);
+
+    const esp_console_cmd_t cmd = {
+        .command = "monitor",
+        .help = "Periodic heartbeat, scan and ARP sweep with light sleep in between, results kept in RTC memory",
+        .hint = NULL,
+        .func = &monitor_cmd,
+        .argtable = &monitor_args
+    };
+    ESP_ERROR_CHECK(dispatch_register(&cmd));
+}
@@ -0,0 +1,26 @@
+/*
+    Low-power monitor.
+
+    `monitor start` runs periodic tasks (heartbeat, Wi-Fi scan, ARP sweep)
+    from a task of its own and sleeps between them: forced light sleep
+    when the Wi-Fi driver is off, modem sleep (WIFI_PS_MAX_MODEM) while
+    associated, since forced light sleep would drop the link. Records of
+    the tasks go to a ring in RTC memory instead of the console and
+    survive sleep; `monitor dump` prints them as JSON lines. The schedule
+    itself is monitor_sched.h.
+
+    During light sleep the console (UART and TCP) is not served: a key
+    press on the UART wakes the chip and keeps it awake for a while, long
+    enough to type `monitor stop`.
+*/
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void module_monitor(void);
+
+#ifdef __cplusplus
+}
+#endif
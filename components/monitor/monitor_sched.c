@@ -0,0 +1,112 @@
+/*
+    Plain C, no IDF header: see monitor_sched.h.
+*/
+#include <string.h>
+#include "monitor_sched.h"
+
+void monitor_sched_init(monitor_sched_t *s, uint64_t now_ms)
+{
+    memset(s, 0, sizeof(*s));
+    s->state = MONITOR_STATE_IDLE;
+    s->since_ms = now_ms;
+}
+
+int monitor_sched_add(monitor_sched_t *s, const char *name, uint32_t period_ms, uint64_t first_ms)
+{
+    if (period_ms == 0 || s->count >= MONITOR_SCHED_MAX_TASKS) {
+        return -1;
+    }
+    monitor_task_t *t = &s->tasks[s->count];
+    memset(t, 0, sizeof(*t));
+    t->name = name;
+    t->period_ms = period_ms;
+    t->next_ms = first_ms;
+    return s->count++;
+}
+
+int monitor_sched_due(const monitor_sched_t *s, uint64_t now_ms)
+{
+    int pick = -1;
+    for (size_t i = 0; i < s->count; i++) {
+        const monitor_task_t *t = &s->tasks[i];
+        if (t->next_ms > now_ms + MONITOR_SCHED_COALESCE_MS) {
+            continue;
+        }
+        if (pick < 0 || t->next_ms < s->tasks[pick].next_ms) {
+            pick = i;
+        }
+    }
+    return pick;
+}
+
+void monitor_sched_done(monitor_sched_t *s, int i, uint64_t now_ms)
+{
+    monitor_task_t *t = &s->tasks[i];
+    t->runs++;
+    t->next_ms += t->period_ms;
+    if (t->next_ms <= now_ms) {
+        uint64_t missed = (now_ms - t->next_ms) / t->period_ms + 1;
+        t->skipped += missed;
+        t->next_ms += missed * t->period_ms;
+    }
+}
+
+uint64_t monitor_sched_wait_ms(const monitor_sched_t *s, uint64_t now_ms)
+{
+    uint64_t next = UINT64_MAX;
+    for (size_t i = 0; i < s->count; i++) {
+        if (s->tasks[i].next_ms < next) {
+            next = s->tasks[i].next_ms;
+        }
+    }
+    if (next == UINT64_MAX) {
+        return next;
+    }
+    return next > now_ms ? next - now_ms : 0;
+}
+
+void monitor_sched_enter(monitor_sched_t *s, monitor_state_t state, uint64_t now_ms)
+{
+    if (now_ms > s->since_ms) {
+        s->state_ms[s->state] += now_ms - s->since_ms;
+    }
+    s->state = state;
+    s->since_ms = now_ms;
+}
+
+// Time per state including the one in progress
+static void totals(const monitor_sched_t *s, uint64_t now_ms, uint64_t ms[MONITOR_STATE_COUNT], uint64_t *total)
+{
+    *total = 0;
+    for (int i = 0; i < MONITOR_STATE_COUNT; i++) {
+        ms[i] = s->state_ms[i];
+        if (i == (int)s->state && now_ms > s->since_ms) {
+            ms[i] += now_ms - s->since_ms;
+        }
+        *total += ms[i];
+    }
+}
+
+uint32_t monitor_sched_duty_permille(const monitor_sched_t *s, uint64_t now_ms)
+{
+    uint64_t ms[MONITOR_STATE_COUNT], total;
+    totals(s, now_ms, ms, &total);
+    if (total == 0) {
+        return 1000;
+    }
+    return (ms[MONITOR_STATE_ACTIVE] + ms[MONITOR_STATE_IDLE]) * 1000 / total;
+}
+
+uint32_t monitor_sched_avg_ua(const monitor_sched_t *s, uint64_t now_ms, const uint32_t ua[MONITOR_STATE_COUNT])
+{
+    uint64_t ms[MONITOR_STATE_COUNT], total;
+    totals(s, now_ms, ms, &total);
+    if (total == 0) {
+        return ua[s->state];
+    }
+    uint64_t charge = 0;    // uA x ms
+    for (int i = 0; i < MONITOR_STATE_COUNT; i++) {
+        charge += ms[i] * ua[i];
+    }
+    return charge / total;
+}
@@ -0,0 +1,69 @@
+/*
+    Duty-cycle scheduler of the monitor, plain C (builds on the host).
+
+    Periodic tasks have a period and a next due time. Everything takes the
+    current time as an argument, so the logic runs the same against
+    esp_timer on the device and against a simulated clock on the host.
+    Tasks due within MONITOR_SCHED_COALESCE_MS of each other run in the
+    same wake-up instead of waking the chip twice. Missed periods (a task
+    ran longer than its period) are skipped, not run in a burst.
+
+    The scheduler also accounts the time spent in each power state, for the
+    duty cycle and an average current from per-state currents.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MONITOR_SCHED_MAX_TASKS     4
+#define MONITOR_SCHED_COALESCE_MS   2000
+
+typedef enum {
+    MONITOR_STATE_ACTIVE = 0,   // a task runs, radio on
+    MONITOR_STATE_IDLE,         // awake between tasks (modem sleep when associated)
+    MONITOR_STATE_SLEEP,        // light sleep
+    MONITOR_STATE_COUNT,
+} monitor_state_t;
+
+typedef struct {
+    const char *name;
+    uint32_t period_ms;
+    uint64_t next_ms;
+    uint32_t runs;
+    uint32_t skipped;           // periods missed because the previous run was late
+} monitor_task_t;
+
+typedef struct {
+    monitor_task_t tasks[MONITOR_SCHED_MAX_TASKS];
+    size_t count;
+    monitor_state_t state;
+    uint64_t since_ms;          // start of the current state
+    uint64_t state_ms[MONITOR_STATE_COUNT];
+} monitor_sched_t;
+
+void monitor_sched_init(monitor_sched_t *s, uint64_t now_ms);
+// First run at first_ms, returns the task index or -1 when full or period is 0
+int monitor_sched_add(monitor_sched_t *s, const char *name, uint32_t period_ms, uint64_t first_ms);
+
+// Index of the task to run now (the most overdue, or one due within the coalescing window), -1 if none
+int monitor_sched_due(const monitor_sched_t *s, uint64_t now_ms);
+// Task i finished at now_ms: next due time on its period grid after now
+void monitor_sched_done(monitor_sched_t *s, int i, uint64_t now_ms);
+// Time until the next task is due, 0 if one is due, UINT64_MAX without tasks
+uint64_t monitor_sched_wait_ms(const monitor_sched_t *s, uint64_t now_ms);
+
+// Close the current state at now_ms and enter state
+void monitor_sched_enter(monitor_sched_t *s, monitor_state_t state, uint64_t now_ms);
+// Time spent awake (active + idle) in per mille of the total
+uint32_t monitor_sched_duty_permille(const monitor_sched_t *s, uint64_t now_ms);
+// Average current in uA from the current of each state in uA
+uint32_t monitor_sched_avg_ua(const monitor_sched_t *s, uint64_t now_ms, const uint32_t ua[MONITOR_STATE_COUNT]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,764 @@
+/*
+    Reverse agent channel to proxy_srv.py.
+
+    proxy_start opens one persistent outbound TCP connection and keeps it up
+    with exponential backoff. Everything travels on it as framed, multiplexed
+    streams (see agent.h): console commands and their output, and TCP tunnels
+    opened by the server on the local network. The link task owns the socket
+    and the tunnels (select() loop), commands run one at a time on the exec
+    task with their stdout redirected into OUT frames.
+*/
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "sdkconfig.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include "host_sockets.h"       // lwIP over the TAP netif, not the host's stack
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+#include "errno.h"
+#include "argtable3/argtable3.h"
+#include "esp_console.h"
+#include "dispatch.h"
+#include "pipeline.h"
+#include "esp_log.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_mac.h"
+#endif
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "network.h"
+#include "agent.h"
+#include "result.h"
+
+#define AGENT_MAX_TUNNELS       4
+#define AGENT_CMD_QUEUE_LEN     4
+#define AGENT_LINK_STACK        4096
+#define AGENT_EXEC_STACK        6144
+#define AGENT_TASK_PRIO         5
+#define AGENT_BACKOFF_MIN_MS    1000
+#define AGENT_BACKOFF_MAX_MS    60000
+#define AGENT_PING_MS           15000   // idle time before a PING is sent
+#define AGENT_DEAD_MS           45000   // silence before the link is dropped
+#define AGENT_RX_TIMEOUT_MS     5000    // rest of a frame once its first byte is in
+#define AGENT_OUT_BUF_SIZE      512     // exec stdout buffer, one OUT frame per flush
+
+static const char *TAG = "AGENT";
+
+typedef enum {
+    TUN_FREE = 0,
+    TUN_CONNECTING,
+    TUN_OPEN,
+} tunnel_state_t;
+
+typedef struct {
+    tunnel_state_t state;
+    int sock;
+    uint16_t chan;
+    uint32_t tx_credit;     // bytes we may still send to the server on this chan
+    uint8_t *pend;          // server bytes the target has not taken yet, AGENT_TUNNEL_WINDOW long
+    uint16_t pend_off;
+    uint16_t pend_len;
+    uint64_t bytes_up;
+    uint64_t bytes_down;
+} agent_tunnel_t;
+
+typedef struct {
+    uint16_t chan;
+    uint8_t flags;          // AGENT_CMDX_*
+    char line[CONFIG_CONSOLE_MAX_COMMAND_LINE_LENGTH];
+} agent_cmd_t;
+
+static struct sockaddr_in s_srv_addr;
+static volatile bool s_enabled;
+static volatile int s_sock = -1;
+static TaskHandle_t s_link_task;
+static TaskHandle_t s_exec_task;
+static QueueHandle_t s_cmd_queue;
+static SemaphoreHandle_t s_tx_lock;
+static agent_tunnel_t s_tunnels[AGENT_MAX_TUNNELS];
+static uint8_t s_rx_payload[AGENT_MAX_PAYLOAD];
+static uint8_t s_tun_buf[AGENT_MAX_PAYLOAD];
+static uint32_t s_reconnects;
+static int64_t s_connected_since;
+
+static int send_all(int sock, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    while (len > 0) {
+        int n = send(sock, p, len, 0);
+        if (n < 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// -1 when the peer closed or failed, -2 when SO_RCVTIMEO expired mid-frame
+static int recv_full(int sock, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+    while (len > 0) {
+        int n = recv(sock, p, len, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return -2;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+bool agent_connected(void)
+{
+    return s_sock >= 0;
+}
+
+int agent_send_frame(uint8_t type, uint16_t chan, const void *payload, size_t len)
+{
+    if (len > AGENT_MAX_PAYLOAD || s_tx_lock == NULL) {
+        return -1;
+    }
+    uint8_t hdr[AGENT_HDR_LEN] = {
+        type, chan >> 8, chan & 0xFF, len >> 8, len & 0xFF
+    };
+    int ret = -1;
+    xSemaphoreTake(s_tx_lock, portMAX_DELAY);
+    int sock = s_sock;
+    if (sock >= 0 && send_all(sock, hdr, sizeof(hdr)) == 0 &&
+        (len == 0 || send_all(sock, payload, len) == 0)) {
+        ret = 0;
+    }
+    xSemaphoreGive(s_tx_lock);
+    return ret;
+}
+
+static void send_u32(uint8_t type, uint16_t chan, uint32_t v)
+{
+    uint8_t b[4] = { v >> 24, v >> 16, v >> 8, v };
+    agent_send_frame(type, chan, b, sizeof(b));
+}
+
+/* ---- command execution ---- */
+
+static int exec_out_write(void *cookie, const char *data, int len)
+{
+    uint16_t chan = (uint16_t)(uintptr_t)cookie;
+    int off = 0;
+    while (off < len) {
+        int chunk = len - off > AGENT_MAX_PAYLOAD ? AGENT_MAX_PAYLOAD : len - off;
+        if (agent_send_frame(AGENT_F_OUT, chan, data + off, chunk) != 0) {
+            break;  // link lost: drop the output, the command still completes
+        }
+        off += chunk;
+    }
+    return len;
+}
+
+static int exec_rec_write(void *ctx, const uint8_t *data, size_t len, bool compressed)
+{
+    uint16_t chan = (uint16_t)(uintptr_t)ctx;
+    return agent_send_frame(compressed ? AGENT_F_ZREC : AGENT_F_REC, chan, data, len);
+}
+
+static void agent_exec_task(void *arg)
+{
+    static agent_cmd_t cmd;
+    static result_sink_t sink;
+    FILE *console_out = stdout;
+
+    while (xQueueReceive(s_cmd_queue, &cmd, portMAX_DELAY) == pdTRUE) {
+        FILE *out = funopen((void *)(uintptr_t)cmd.chan, NULL, exec_out_write, NULL, NULL);
+        if (out == NULL) {
+            send_u32(AGENT_F_END, cmd.chan, (uint32_t)-1);
+            continue;
+        }
+        setvbuf(out, NULL, _IOFBF, AGENT_OUT_BUF_SIZE);
+        // stdout is per task in ESP-IDF newlib: printf and ESP_LOG of the command land in out
+        stdout = out;
+
+        bool records = (cmd.flags & AGENT_CMDX_RECORDS) &&
+                       result_sink_init(&sink, exec_rec_write, (void *)(uintptr_t)cmd.chan,
+                                        cmd.flags & AGENT_CMDX_COMPRESS);
+        if (records) {
+            result_sink_set_current(&sink);
+        }
+
+        int ret = 0;
+        esp_err_t err = dispatch_run(cmd.line, &ret);
+        if (err == ESP_ERR_NOT_FOUND) {
+            printf("Unrecognized command\n");
+            ret = -1;
+        } else if (err != ESP_OK) {
+            printf("Internal error: %s\n", esp_err_to_name(err));
+            ret = -1;
+        }
+
+        if (records) {
+            result_sink_set_current(NULL);
+            result_sink_finish(&sink);
+        }
+        fflush(out);
+        stdout = console_out;
+        fclose(out);
+        send_u32(AGENT_F_END, cmd.chan, (uint32_t)ret);
+    }
+}
+
+/* ---- tunnels ---- */
+
+static agent_tunnel_t *tunnel_find(uint16_t chan)
+{
+    for (int i = 0; i < AGENT_MAX_TUNNELS; i++) {
+        if (s_tunnels[i].state != TUN_FREE && s_tunnels[i].chan == chan) {
+            return &s_tunnels[i];
+        }
+    }
+    return NULL;
+}
+
+static void tunnel_close(agent_tunnel_t *t, bool notify)
+{
+    if (notify) {
+        agent_send_frame(AGENT_F_CLOSE, t->chan, NULL, 0);
+    }
+    ESP_LOGI(TAG, "tunnel %u closed, up %" PRIu64 " B, down %" PRIu64 " B",
+             t->chan, t->bytes_up, t->bytes_down);
+    close(t->sock);
+    free(t->pend);
+    t->pend = NULL;
+    t->pend_len = 0;
+    t->state = TUN_FREE;
+    t->sock = -1;
+}
+
+static void tunnel_close_all(void)
+{
+    for (int i = 0; i < AGENT_MAX_TUNNELS; i++) {
+        if (s_tunnels[i].state != TUN_FREE) {
+            tunnel_close(&s_tunnels[i], false);
+        }
+    }
+}
+
+static void tunnel_open(uint16_t chan, const uint8_t *p, size_t len)
+{
+    agent_tunnel_t *t = NULL;
+    for (int i = 0; i < AGENT_MAX_TUNNELS && t == NULL; i++) {
+        if (s_tunnels[i].state == TUN_FREE) {
+            t = &s_tunnels[i];
+        }
+    }
+    if (len != 6 || t == NULL || tunnel_find(chan) != NULL) {
+        send_u32(AGENT_F_OPEN_FAIL, chan, len != 6 ? EINVAL : ENOSPC);
+        return;
+    }
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons((p[4] << 8) | p[5]),
+    };
+    memcpy(&addr.sin_addr.s_addr, p, 4);
+
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (sock < 0) {
+        send_u32(AGENT_F_OPEN_FAIL, chan, errno);
+        return;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS) {
+        send_u32(AGENT_F_OPEN_FAIL, chan, errno);
+        close(sock);
+        return;
+    }
+    *t = (agent_tunnel_t) {
+        .state = TUN_CONNECTING,
+        .sock = sock,
+        .chan = chan,
+        .tx_credit = AGENT_TUNNEL_WINDOW,
+    };
+}
+
+/* Non-blocking connect finished: report the outcome to the server */
+static void tunnel_connected(agent_tunnel_t *t)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(t->sock, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err != 0) {
+        send_u32(AGENT_F_OPEN_FAIL, t->chan, err);
+        close(t->sock);
+        t->state = TUN_FREE;
+        return;
+    }
+    // The socket stays non-blocking: a slow target must not hold up the other channels
+    t->state = TUN_OPEN;
+    agent_send_frame(AGENT_F_OPEN_OK, t->chan, NULL, 0);
+}
+
+/* Bytes the target took: give the server its credit back */
+static void tunnel_ack(agent_tunnel_t *t, size_t n)
+{
+    if (n > 0) {
+        t->bytes_down += n;
+        send_u32(AGENT_F_WINDOW, t->chan, n);
+    }
+}
+
+/* Server -> target without waiting on the target. What it does not take now
+ * waits in pend[] until select() reports the socket writable. Credit is only
+ * returned for bytes written, so a server that keeps to its window never has
+ * more than AGENT_TUNNEL_WINDOW bytes pending; one that does not is cut off. */
+static int tunnel_write(agent_tunnel_t *t, const uint8_t *p, size_t len)
+{
+    size_t sent = 0;
+    if (t->pend_len == 0) {
+        int n = send(t->sock, p, len, MSG_DONTWAIT);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+        sent = n > 0 ? n : 0;
+        tunnel_ack(t, sent);
+    }
+    size_t rest = len - sent;
+    if (rest == 0) {
+        return 0;
+    }
+    if (t->pend_len + rest > AGENT_TUNNEL_WINDOW) {
+        ESP_LOGW(TAG, "tunnel %u: server overran its window", t->chan);
+        return -1;
+    }
+    if (t->pend == NULL) {
+        t->pend = malloc(AGENT_TUNNEL_WINDOW);
+        if (t->pend == NULL) {
+            return -1;
+        }
+        t->pend_off = 0;
+    }
+    if (t->pend_off + t->pend_len + rest > AGENT_TUNNEL_WINDOW) {
+        memmove(t->pend, t->pend + t->pend_off, t->pend_len);
+        t->pend_off = 0;
+    }
+    memcpy(t->pend + t->pend_off + t->pend_len, p + sent, rest);
+    t->pend_len += rest;
+    return 0;
+}
+
+/* Target writable again: push what is pending */
+static void tunnel_flush(agent_tunnel_t *t)
+{
+    int n = send(t->sock, t->pend + t->pend_off, t->pend_len, MSG_DONTWAIT);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            tunnel_close(t, true);
+        }
+        return;
+    }
+    t->pend_off = t->pend_len == n ? 0 : t->pend_off + n;
+    t->pend_len -= n;
+    tunnel_ack(t, n);
+}
+
+/* Target -> server, bounded by the credit the server granted */
+static void tunnel_pump(agent_tunnel_t *t)
+{
+    size_t want = t->tx_credit < sizeof(s_tun_buf) ? t->tx_credit : sizeof(s_tun_buf);
+    int n = recv(t->sock, s_tun_buf, want, MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        tunnel_close(t, true);
+        return;
+    }
+    if (n > 0) {
+        t->tx_credit -= n;
+        t->bytes_up += n;
+        agent_send_frame(AGENT_F_DATA, t->chan, s_tun_buf, n);
+    }
+}
+
+/* ---- link ---- */
+
+static void handle_frame(uint8_t type, uint16_t chan, const uint8_t *p, size_t len)
+{
+    agent_tunnel_t *t;
+
+    switch (type) {
+    case AGENT_F_CMD:
+    case AGENT_F_CMDX: {
+        static agent_cmd_t cmd;
+        cmd.flags = 0;
+        if (type == AGENT_F_CMDX) {
+            if (len == 0) {
+                break;
+            }
+            cmd.flags = p[0];
+            p++;
+            len--;
+        }
+        size_t n = len < sizeof(cmd.line) - 1 ? len : sizeof(cmd.line) - 1;
+        cmd.chan = chan;
+        memcpy(cmd.line, p, n);
+        cmd.line[n] = '\0';
+        if (xQueueSend(s_cmd_queue, &cmd, 0) != pdTRUE) {
+            const char busy[] = "agent busy\n";
+            agent_send_frame(AGENT_F_OUT, chan, busy, sizeof(busy) - 1);
+            send_u32(AGENT_F_END, chan, (uint32_t)-1);
+        }
+        break;
+    }
+    case AGENT_F_OPEN:
+        tunnel_open(chan, p, len);
+        break;
+    case AGENT_F_DATA:
+        t = tunnel_find(chan);
+        if (t == NULL || t->state != TUN_OPEN) {
+            break;
+        }
+        if (tunnel_write(t, p, len) != 0) {
+            tunnel_close(t, true);
+        }
+        break;
+    case AGENT_F_WINDOW:
+        t = tunnel_find(chan);
+        if (t != NULL && len == 4) {
+            t->tx_credit += ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+        }
+        break;
+    case AGENT_F_CLOSE:
+        t = tunnel_find(chan);
+        if (t != NULL) {
+            tunnel_close(t, false);
+        }
+        break;
+    case AGENT_F_PING:
+        agent_send_frame(AGENT_F_PONG, chan, p, len);
+        break;
+    default:
+        break;
+    }
+}
+
+static int read_frame(int sock)
+{
+    uint8_t hdr[AGENT_HDR_LEN];
+    uint16_t len = 0;
+    int err = recv_full(sock, hdr, sizeof(hdr));
+    if (err == 0) {
+        len = (hdr[3] << 8) | hdr[4];
+        if (len > sizeof(s_rx_payload)) {
+            ESP_LOGW(TAG, "oversized frame (%u bytes), resync by reconnecting", len);
+            return -1;
+        }
+        if (len > 0) {
+            err = recv_full(sock, s_rx_payload, len);
+        }
+    }
+    if (err == -2) {
+        ESP_LOGW(TAG, "frame stalled for %d ms, reconnecting", AGENT_RX_TIMEOUT_MS);
+    }
+    if (err != 0) {
+        return -1;
+    }
+    handle_frame(hdr[0], (hdr[1] << 8) | hdr[2], s_rx_payload, len);
+    return 0;
+}
+
+static int link_connect(void)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (sock < 0) {
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr *)&s_srv_addr, sizeof(s_srv_addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // select() says a frame has started, its remaining bytes get this long
+    struct timeval rx_timeout = {
+        .tv_sec = AGENT_RX_TIMEOUT_MS / 1000,
+        .tv_usec = (AGENT_RX_TIMEOUT_MS % 1000) * 1000,
+    };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &rx_timeout, sizeof(rx_timeout));
+    return sock;
+}
+
+static void link_serve(int sock)
+{
+    int64_t last_rx = esp_timer_get_time();
+    int64_t last_ping = last_rx;
+
+    while (s_enabled) {
+        fd_set rfds, wfds;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        FD_SET(sock, &rfds);
+        int maxfd = sock;
+        for (int i = 0; i < AGENT_MAX_TUNNELS; i++) {
+            agent_tunnel_t *t = &s_tunnels[i];
+            if (t->state == TUN_CONNECTING) {
+                FD_SET(t->sock, &wfds);
+            } else if (t->state == TUN_OPEN) {
+                if (t->tx_credit > 0) {
+                    FD_SET(t->sock, &rfds);
+                }
+                if (t->pend_len > 0) {
+                    FD_SET(t->sock, &wfds);
+                }
+            } else {
+                continue;
+            }
+            if (t->sock > maxfd) {
+                maxfd = t->sock;
+            }
+        }
+
+        struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+        int n = select(maxfd + 1, &rfds, &wfds, NULL, &tv);
+        if (n < 0) {
+            ESP_LOGW(TAG, "select() erreur, errno=%d (%s)", errno, strerror(errno));
+            return;
+        }
+
+        int64_t now = esp_timer_get_time();
+        if (FD_ISSET(sock, &rfds)) {
+            if (read_frame(sock) != 0) {
+                return;
+            }
+            last_rx = now;
+        }
+        for (int i = 0; i < AGENT_MAX_TUNNELS; i++) {
+            agent_tunnel_t *t = &s_tunnels[i];
+            if (t->state == TUN_CONNECTING) {
+                if (FD_ISSET(t->sock, &wfds)) {
+                    tunnel_connected(t);
+                }
+                continue;
+            }
+            if (t->state == TUN_OPEN && t->pend_len > 0 && FD_ISSET(t->sock, &wfds)) {
+                tunnel_flush(t);
+            }
+            if (t->state == TUN_OPEN && FD_ISSET(t->sock, &rfds)) {
+                tunnel_pump(t);
+            }
+        }
+
+        if (now - last_rx > (int64_t)AGENT_DEAD_MS * 1000) {
+            ESP_LOGW(TAG, "server silent for %d s, reconnecting", AGENT_DEAD_MS / 1000);
+            return;
+        }
+        if (now - last_rx > (int64_t)AGENT_PING_MS * 1000 &&
+            now - last_ping > (int64_t)AGENT_PING_MS * 1000) {
+            agent_send_frame(AGENT_F_PING, 0, NULL, 0);
+            last_ping = now;
+        }
+    }
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+/* No eFuse MAC on the host: a locally administered address from a hash of
+ * the hostname (FNV-1a) and the pid, so that several host agents talking
+ * to one server say HELLO with different ids */
+static void agent_host_mac(uint8_t mac[6])
+{
+    char host[64] = "";
+    gethostname(host, sizeof(host) - 1);
+    uint32_t h = 2166136261u;
+    for (const char *p = host; *p; p++) {
+        h = (h ^ (uint8_t)*p) * 16777619u;
+    }
+    uint32_t pid = (uint32_t)getpid();
+    mac[0] = 0x02;
+    mac[1] = h >> 16;
+    mac[2] = h >> 8;
+    mac[3] = h;
+    mac[4] = pid >> 8;
+    mac[5] = pid;
+}
+#endif
+
+static void agent_link_task(void *arg)
+{
+    uint32_t backoff_ms = AGENT_BACKOFF_MIN_MS;
+
+    while (s_enabled) {
+        int sock = link_connect();
+        if (sock < 0) {
+            // Exponential backoff with up to 25% jitter so agents don't reconnect in lockstep
+            uint32_t delay = backoff_ms + esp_random() % (backoff_ms / 4 + 1);
+            ESP_LOGW(TAG, "connect failed, retry in %" PRIu32 " ms", delay);
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(delay));
+            backoff_ms = backoff_ms * 2 > AGENT_BACKOFF_MAX_MS ? AGENT_BACKOFF_MAX_MS : backoff_ms * 2;
+            continue;
+        }
+
+        backoff_ms = AGENT_BACKOFF_MIN_MS;
+        s_sock = sock;
+        s_connected_since = esp_timer_get_time();
+        ESP_LOGI(TAG, "connected to %s:%u", inet_ntoa(s_srv_addr.sin_addr), ntohs(s_srv_addr.sin_port));
+
+        uint8_t mac[6];
+        char id[18];
+#if CONFIG_IDF_TARGET_LINUX
+        agent_host_mac(mac);
+#else
+        esp_read_mac(mac, ESP_MAC_WIFI_STA);
+#endif
+        snprintf(id, sizeof(id), "%02x:%02x:%02x:%02x:%02x:%02x",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+        agent_send_frame(AGENT_F_HELLO, 0, id, strlen(id));
+
+        link_serve(sock);
+
+        xSemaphoreTake(s_tx_lock, portMAX_DELAY);
+        s_sock = -1;
+        xSemaphoreGive(s_tx_lock);
+        tunnel_close_all();
+        shutdown(sock, SHUT_RDWR);
+        close(sock);
+        if (s_enabled) {
+            s_reconnects++;
+            ESP_LOGW(TAG, "link lost");
+        }
+    }
+    ESP_LOGI(TAG, "stopped");
+    s_link_task = NULL;
+    vTaskDelete(NULL);
+}
+
+/* ---- commands ---- */
+
+static struct {
+    struct arg_str *host;
+    struct arg_int *port;
+    struct arg_end *end;
+} agent_args;
+
+static int proxy_start_cmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&agent_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, agent_args.end, argv[0]);
+        return 1;
+    }
+    if (s_enabled || s_link_task != NULL) {
+        printf("Agent already started, use proxy_stop first\n");
+        return 1;
+    }
+
+    memset(&s_srv_addr, 0, sizeof(s_srv_addr));
+    s_srv_addr.sin_family = AF_INET;
+    s_srv_addr.sin_port = htons(agent_args.port->ival[0]);
+    if (inet_pton(AF_INET, agent_args.host->sval[0], &s_srv_addr.sin_addr) != 1) {
+        printf("ERR: invalid host %s\n", agent_args.host->sval[0]);
+        return 1;
+    }
+
+    if (s_tx_lock == NULL) {
+        s_tx_lock = xSemaphoreCreateMutex();
+        s_cmd_queue = xQueueCreate(AGENT_CMD_QUEUE_LEN, sizeof(agent_cmd_t));
+        if (s_tx_lock == NULL || s_cmd_queue == NULL ||
+            pipeline_task_create(agent_exec_task, "agent_exec", AGENT_EXEC_STACK, NULL,
+                                 AGENT_TASK_PRIO - 1, &s_exec_task) != pdPASS) {
+            ESP_LOGE(TAG, "Memory allocation failed");
+            return 1;
+        }
+        for (int i = 0; i < AGENT_MAX_TUNNELS; i++) {
+            s_tunnels[i].sock = -1;
+        }
+    }
+
+    s_enabled = true;
+    s_reconnects = 0;
+    if (xTaskCreate(agent_link_task, "agent_link", AGENT_LINK_STACK, NULL,
+                    AGENT_TASK_PRIO, &s_link_task) != pdPASS) {
+        s_enabled = false;
+        return 1;
+    }
+    return 0;
+}
+
+static int proxy_stop_cmd(int argc, char **argv)
+{
+    if (!s_enabled) {
+        printf("Agent not started\n");
+        return 1;
+    }
+    s_enabled = false;
+    // Interrupt a backoff sleep, the select() loop notices within a second
+    if (s_link_task != NULL) {
+        xTaskNotifyGive(s_link_task);
+    }
+    return 0;
+}
+
+static int proxy_status_cmd(int argc, char **argv)
+{
+    if (!s_enabled) {
+        printf("Agent stopped\n");
+        return 0;
+    }
+    if (agent_connected()) {
+        printf("Connected to %s:%u for %lld s, %" PRIu32 " reconnects\n",
+               inet_ntoa(s_srv_addr.sin_addr), ntohs(s_srv_addr.sin_port),
+               (esp_timer_get_time() - s_connected_since) / 1000000, s_reconnects);
+    } else {
+        printf("Connecting to %s:%u...\n", inet_ntoa(s_srv_addr.sin_addr), ntohs(s_srv_addr.sin_port));
+    }
+    for (int i = 0; i < AGENT_MAX_TUNNELS; i++) {
+        const agent_tunnel_t *t = &s_tunnels[i];
+        if (t->state != TUN_FREE) {
+            printf("  tunnel %u %s up %" PRIu64 " B down %" PRIu64 " B credit %" PRIu32 " pending %u B\n",
+                   t->chan, t->state == TUN_OPEN ? "open" : "connecting",
+                   t->bytes_up, t->bytes_down, t->tx_credit, t->pend_len);
+        }
+    }
+    return 0;
+}
+
+void module_agent(void)
+{
+    agent_args.host = arg_str1(NULL, NULL, "<host>", "Host address to manage proxy");
+    agent_args.port = arg_int1(NULL, NULL, "<port>", "Port associated");
+    agent_args.end = arg_end(2);
+    const esp_console_cmd_t start_cmd = {
+        .command = "proxy_start",
+        .help = "Connect back to proxy_srv and keep the agent link up",
+        .hint = NULL,
+        .func = &proxy_start_cmd,
+        .argtable = &agent_args
+    };
+    ESP_ERROR_CHECK(dispatch_register(&start_cmd));
+
+    const esp_console_cmd_t stop_cmd = {
+        .command = "proxy_stop",
+        .help = "Disconnect from proxy_srv and stop reconnecting",
+        .hint = NULL,
+        .func = &proxy_stop_cmd,
+    };
+    ESP_ERROR_CHECK(dispatch_register(&stop_cmd));
+
+    const esp_console_cmd_t status_cmd = {
+        .command = "proxy_status",
+        .help = "Show agent link state and open tunnels",
+        .hint = NULL,
+        .func = &proxy_status_cmd,
+    };
+    ESP_ERROR_CHECK(dispatch_register(&status_cmd));
+}
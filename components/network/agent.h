@@ -0,0 +1,56 @@
+/*
+    Wire format of the agent channel between the ESP32 and proxy_srv.py.
+
+    Every frame is a 5-byte header followed by its payload:
+
+        type:u8 | chan:u16 (big endian) | len:u16 (big endian) | payload[len]
+
+    chan multiplexes independent streams on the one TCP connection: a
+    command and its output share a chan chosen by the server, tunnels use
+    the chan given in their OPEN frame. Channel 0 is the control stream.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AGENT_HDR_LEN           5
+#define AGENT_MAX_PAYLOAD       1460
+#define AGENT_TUNNEL_WINDOW     8192    // initial credit per tunnel and direction
+
+typedef enum {
+    AGENT_F_HELLO       = 0x00,     // agent -> srv  agent id (MAC string)
+    AGENT_F_CMD         = 0x01,     // srv -> agent  command line to run
+    AGENT_F_OUT         = 0x02,     // agent -> srv  command output bytes
+    AGENT_F_END         = 0x03,     // agent -> srv  command done, i32 return code
+    AGENT_F_REC         = 0x04,     // agent -> srv  CBOR result records (result.h)
+    AGENT_F_ZREC        = 0x05,     // agent -> srv  LZSS compressed CBOR records
+    AGENT_F_CMDX        = 0x06,     // srv -> agent  flags:u8 + command line
+    AGENT_F_OPEN        = 0x10,     // srv -> agent  open tunnel: ip[4] port:u16
+    AGENT_F_OPEN_OK     = 0x11,     // agent -> srv
+    AGENT_F_OPEN_FAIL   = 0x12,     // agent -> srv  i32 errno
+    AGENT_F_DATA        = 0x13,     // both          tunnel bytes
+    AGENT_F_CLOSE       = 0x14,     // both          tunnel closed
+    AGENT_F_WINDOW      = 0x15,     // both          u32 credit returned for chan
+    AGENT_F_PING        = 0x20,     // both
+    AGENT_F_PONG        = 0x21,     // both
+} agent_frame_type_t;
+
+/* AGENT_F_CMDX flags */
+#define AGENT_CMDX_RECORDS      0x01    // emit result records instead of text
+#define AGENT_CMDX_COMPRESS     0x02    // compress the record stream
+
+// Send one frame on the agent link, returns 0 on success, -1 when not connected
+int agent_send_frame(uint8_t type, uint16_t chan, const void *payload, size_t len);
+
+// True while the agent link to the server is up
+bool agent_connected(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -3,9 +3,26 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
 // ping module
 void module_ping(void);
 void module_proxy(void);
+void module_proxy_pool(void);
+void module_socks(void);
+void module_agent(void);
+
+// Decode \r \n \t \\ \0 \xHH escapes into a binary buffer, returns its length
+size_t unescape_payload(const char *src, uint8_t *dest, size_t max_len);
+
+// Keep-alive pool: returns a pooled socket to addr if one is healthy, else a new connection
+int proxy_pool_acquire(const struct sockaddr_in *addr, bool *reused);
+// Park the socket for reuse when keep is set, close it otherwise
+void proxy_pool_release(int sock, const struct sockaddr_in *addr, bool keep);
+void proxy_pool_flush(void);
 
 
 #endif // NETWORK_H
\ No newline at end of file
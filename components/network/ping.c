@@ -8,11 +8,39 @@
 #include "lwip/netdb.h"
 #include "lwip/sockets.h"
 #include "esp_console.h"
+#include "dispatch.h"
 #include "esp_event.h"
 #include "argtable3/argtable3.h"
 #include "protocol_examples_common.h"
 #include "ping/ping_sock.h"
-
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "result.h"
+#include "ping_out.h"
+
+/* Passed to the ping callbacks, which run in the ping task */
+typedef struct {
+    result_sink_t *sink;        // sink of the calling command, NULL for text
+    SemaphoreHandle_t done;     // given by on_ping_end
+} ping_ctx_t;
+
+// Target address as raw bytes (4 for IPv4, 16 for IPv6) and as text
+static void ping_ip(const ip_addr_t *addr, ping_ip_t *ip)
+{
+    ip->len = 0;
+    ipaddr_ntoa_r(addr, ip->text, sizeof(ip->text));
+#ifdef CONFIG_LWIP_IPV6
+    if (IP_IS_V6(addr)) {
+        memcpy(ip->addr, ip_2_ip6(addr)->addr, 16);
+        ip->len = 16;
+        return;
+    }
+#endif
+#ifdef CONFIG_LWIP_IPV4
+    memcpy(ip->addr, &ip_2_ip4(addr)->addr, 4);
+    ip->len = 4;
+#endif
+}
 
 static void cmd_ping_on_ping_success(esp_ping_handle_t hdl, void *args)
 {
@@ -20,22 +48,27 @@ static void cmd_ping_on_ping_success(esp_ping_handle_t hdl, void *args)
     uint16_t seqno;
     uint32_t elapsed_time, recv_len;
     ip_addr_t target_addr;
+    ping_ip_t ip;
     esp_ping_get_profile(hdl, ESP_PING_PROF_SEQNO, &seqno, sizeof(seqno));
     esp_ping_get_profile(hdl, ESP_PING_PROF_TTL, &ttl, sizeof(ttl));
     esp_ping_get_profile(hdl, ESP_PING_PROF_IPADDR, &target_addr, sizeof(target_addr));
     esp_ping_get_profile(hdl, ESP_PING_PROF_SIZE, &recv_len, sizeof(recv_len));
     esp_ping_get_profile(hdl, ESP_PING_PROF_TIMEGAP, &elapsed_time, sizeof(elapsed_time));
-    printf("%" PRIu32 " bytes from %s icmp_seq=%" PRIu16 " ttl=%" PRIu16 " time=%" PRIu32 " ms\n",
-           recv_len, ipaddr_ntoa((ip_addr_t*)&target_addr), seqno, ttl, elapsed_time);
+    ping_ctx_t *ctx = args;
+    ping_ip(&target_addr, &ip);
+    ping_out_reply(ctx->sink, &ip, seqno, ttl, elapsed_time, recv_len);
 }
 
 static void cmd_ping_on_ping_timeout(esp_ping_handle_t hdl, void *args)
 {
     uint16_t seqno;
     ip_addr_t target_addr;
+    ping_ip_t ip;
     esp_ping_get_profile(hdl, ESP_PING_PROF_SEQNO, &seqno, sizeof(seqno));
     esp_ping_get_profile(hdl, ESP_PING_PROF_IPADDR, &target_addr, sizeof(target_addr));
-    printf("From %s icmp_seq=%d timeout\n",ipaddr_ntoa((ip_addr_t*)&target_addr), seqno);
+    ping_ctx_t *ctx = args;
+    ping_ip(&target_addr, &ip);
+    ping_out_timeout(ctx->sink, &ip, seqno);
 }
 
 static void cmd_ping_on_ping_end(esp_ping_handle_t hdl, void *args)
@@ -44,33 +77,21 @@ static void cmd_ping_on_ping_end(esp_ping_handle_t hdl, void *args)
     uint32_t transmitted;
     uint32_t received;
     uint32_t total_time_ms;
-    uint32_t loss;
+    ping_ip_t ip;
 
     esp_ping_get_profile(hdl, ESP_PING_PROF_REQUEST, &transmitted, sizeof(transmitted));
     esp_ping_get_profile(hdl, ESP_PING_PROF_REPLY, &received, sizeof(received));
     esp_ping_get_profile(hdl, ESP_PING_PROF_IPADDR, &target_addr, sizeof(target_addr));
     esp_ping_get_profile(hdl, ESP_PING_PROF_DURATION, &total_time_ms, sizeof(total_time_ms));
 
-    if (transmitted > 0) {
-        loss = (uint32_t)((1 - ((float)received) / transmitted) * 100);
-    } else {
-        loss = 0;
-    }
-#ifdef CONFIG_LWIP_IPV4
-    if (IP_IS_V4(&target_addr)) {
-        printf("\n--- %s ping statistics ---\n", inet_ntoa(*ip_2_ip4(&target_addr)));
-    }
-#endif
-#ifdef CONFIG_LWIP_IPV6
-    if (IP_IS_V6(&target_addr)) {
-        printf("\n--- %s ping statistics ---\n", inet6_ntoa(*ip_2_ip6(&target_addr)));
-    }
-#endif
-    printf("%" PRIu32 " packets transmitted, %" PRIu32 " received, %" PRIu32 "%% packet loss, time %" PRIu32 "ms\n",
-           transmitted, received, loss, total_time_ms);
+    ping_ctx_t *ctx = args;
+    ping_ip(&target_addr, &ip);
+    ping_out_done(ctx->sink, &ip, transmitted, received, total_time_ms);
+
     // delete the ping sessions, so that we clean up all resources and can create a new ping session
     // we don't have to call delete function in the callback, instead we can call delete function from other tasks
     esp_ping_delete_session(hdl);
+    xSemaphoreGive(ctx->done);
 }
 
 static struct {
@@ -156,17 +177,37 @@ static int do_ping_cmd(int argc, char **argv)
     }
     config.target_addr = target_addr;
 
+    // The command waits for the end of the session
+    if (config.count == ESP_PING_COUNT_INFINITE) {
+        printf("ping: count must be > 0\n");
+        return 1;
+    }
+
     /* set callback functions */
+    StaticSemaphore_t done_buf;
+    ping_ctx_t ctx = {
+        .sink = result_sink_current(),
+        .done = xSemaphoreCreateBinaryStatic(&done_buf),
+    };
     esp_ping_callbacks_t cbs = {
-        .cb_args = NULL,
+        .cb_args = &ctx,
         .on_ping_success = cmd_ping_on_ping_success,
         .on_ping_timeout = cmd_ping_on_ping_timeout,
         .on_ping_end = cmd_ping_on_ping_end
     };
     esp_ping_handle_t ping;
-    esp_ping_new_session(&config, &cbs, &ping);
+    if (esp_ping_new_session(&config, &cbs, &ping) != ESP_OK) {
+        printf("ping: failed to create session\n");
+        vSemaphoreDelete(ctx.done);
+        return 1;
+    }
     esp_ping_start(ping);
 
+    // Wait for the session to end: ctx lives on this stack and the caller's
+    // sink must stay valid until the last record is written
+    xSemaphoreTake(ctx.done, portMAX_DELAY);
+    vSemaphoreDelete(ctx.done);
+
     return 0;
 }
 
@@ -188,5 +229,5 @@ void module_ping(void)
         .func = &do_ping_cmd,
         .argtable = &ping_args
     };
-    ESP_ERROR_CHECK(esp_console_cmd_register(&ping_cmd));
+    ESP_ERROR_CHECK(dispatch_register(&ping_cmd));
 }
\ No newline at end of file
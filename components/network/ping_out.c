@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include "ping_out.h"
+
+static void put_ip(result_rec_t *rec, const ping_ip_t *ip)
+{
+    if (ip->len) {
+        result_bytes(rec, ip->addr, ip->len);
+    } else {
+        result_null(rec);
+    }
+}
+
+void ping_out_reply(result_sink_t *sink, const ping_ip_t *ip, uint16_t seq, uint8_t ttl, uint32_t ms, uint32_t size)
+{
+    if (sink) {
+        result_rec_t rec;
+        result_begin(&rec, sink, RESULT_PING_REPLY);
+        put_ip(&rec, ip);
+        result_uint(&rec, seq);
+        result_uint(&rec, ttl);
+        result_uint(&rec, ms);
+        result_uint(&rec, size);
+        result_end(&rec);
+        return;
+    }
+    printf("%" PRIu32 " bytes from %s icmp_seq=%" PRIu16 " ttl=%" PRIu16 " time=%" PRIu32 " ms\n",
+           size, ip->text, seq, (uint16_t)ttl, ms);
+}
+
+void ping_out_timeout(result_sink_t *sink, const ping_ip_t *ip, uint16_t seq)
+{
+    if (sink) {
+        result_rec_t rec;
+        result_begin(&rec, sink, RESULT_PING_TIMEOUT);
+        put_ip(&rec, ip);
+        result_uint(&rec, seq);
+        result_end(&rec);
+        return;
+    }
+    printf("From %s icmp_seq=%d timeout\n", ip->text, seq);
+}
+
+void ping_out_done(result_sink_t *sink, const ping_ip_t *ip, uint32_t transmitted, uint32_t received, uint32_t ms)
+{
+    if (sink) {
+        result_rec_t rec;
+        result_begin(&rec, sink, RESULT_PING_SUMMARY);
+        put_ip(&rec, ip);
+        result_uint(&rec, transmitted);
+        result_uint(&rec, received);
+        result_uint(&rec, ms);
+        result_end(&rec);
+        return;
+    }
+    uint32_t loss = 0;
+    if (transmitted > 0) {
+        loss = (uint32_t)((1 - ((float)received) / transmitted) * 100);
+    }
+    if (ip->len) {
+        printf("\n--- %s ping statistics ---\n", ip->text);
+    }
+    printf("%" PRIu32 " packets transmitted, %" PRIu32 " received, %" PRIu32 "%% packet loss, time %" PRIu32 "ms, %" PRIu32 " pkt/s\n",
+           transmitted, received, loss, ms, ms ? (uint32_t)((uint64_t)received * 1000 / ms) : 0);
+}
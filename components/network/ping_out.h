@@ -0,0 +1,28 @@
+/*
+    Output of ping: each reply or timeout, then the statistics. A record
+    when the command has a sink, the usual ping line otherwise. The
+    address comes in already converted, so there is no lwIP in here and
+    the host tests (test/host) check every line against golden files.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "result.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint8_t addr[16];           // network order
+    uint8_t len;                // 4 or 16, 0 for none (null in the record)
+    char text[46];              // as printed
+} ping_ip_t;
+
+void ping_out_reply(result_sink_t *sink, const ping_ip_t *ip, uint16_t seq, uint8_t ttl, uint32_t ms, uint32_t size);
+void ping_out_timeout(result_sink_t *sink, const ping_ip_t *ip, uint16_t seq);
+void ping_out_done(result_sink_t *sink, const ping_ip_t *ip, uint32_t transmitted, uint32_t received, uint32_t ms);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,44 +1,325 @@
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include "sdkconfig.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include "host_sockets.h"       // lwIP over the TAP netif, not the host's stack
+#else
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <unistd.h>
+#endif
 #include "errno.h"
 #include "argtable3/argtable3.h"
 #include "esp_console.h"
+#include "dispatch.h"
+#include "arena.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "network.h"
 
 #define SSID CONFIG_SSID
 
 #define MAX_PROXY_RETRY 10
 #define RETRY_DELAY_MS 5000
 
+#define PROXY_PAYLOAD_MAX   4096  // max payload size, inline or from file
+#define PROXY_RX_BUF_SIZE   1460  // one TCP segment per recv()
+#define PROXY_OUT_BUF_SIZE  4096  // sink buffer, flushed in large writes
+#define PROXY_DELIM_MAX     16    // longest --delim
+#define PROXY_RX_TIMEOUT_MS 5000
+
 const char *TAG_PROXY = "PROXY";
 
-void unescape_payload(const char *src, char *dest, size_t max_len) {
+static const char b64_table[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* Decode \r \n \t \\ \0 and \xHH escapes. Output is binary, the return
+ * value is the number of bytes written to dest (no NUL terminator). */
+size_t unescape_payload(const char *src, uint8_t *dest, size_t max_len)
+{
     size_t i = 0, j = 0;
-    while (src[i] != '\0' && j < max_len - 1) {
-        if (src[i] == '\\' && src[i+1] == 'r') {
-            dest[j++] = '\r';
-            i += 2;
-        } else if (src[i] == '\\' && src[i+1] == 'n') {
-            dest[j++] = '\n';
-            i += 2;
-        } else {
-            dest[j++] = src[i++];
+    while (src[i] != '\0' && j < max_len) {
+        if (src[i] != '\\' || src[i+1] == '\0') {
+            dest[j++] = (uint8_t)src[i++];
+            continue;
+        }
+        switch (src[i+1]) {
+        case 'r':  dest[j++] = '\r'; i += 2; break;
+        case 'n':  dest[j++] = '\n'; i += 2; break;
+        case 't':  dest[j++] = '\t'; i += 2; break;
+        case '0':  dest[j++] = '\0'; i += 2; break;
+        case '\\': dest[j++] = '\\'; i += 2; break;
+        case 'x': {
+            int hi = hex_value(src[i+2]);
+            int lo = hi < 0 ? -1 : hex_value(src[i+3]);
+            if (lo < 0) {
+                // Not a valid \xHH, keep the backslash literally
+                dest[j++] = (uint8_t)src[i++];
+                break;
+            }
+            dest[j++] = (uint8_t)((hi << 4) | lo);
+            i += 4;
+            break;
+        }
+        default:
+            dest[j++] = (uint8_t)src[i++];
+            break;
+        }
+    }
+    return j;
+}
+
+/* Read a binary payload from a VFS path. Returns its size or -1. */
+static int load_payload_file(const char *path, uint8_t *dest, size_t max_len)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        ESP_LOGE(TAG_PROXY, "Cannot open %s, errno=%d (%s)", path, errno, strerror(errno));
+        return -1;
+    }
+    size_t n = fread(dest, 1, max_len, f);
+    if (n == max_len && fgetc(f) != EOF) {
+        ESP_LOGW(TAG_PROXY, "%s is larger than %d bytes, truncated", path, PROXY_PAYLOAD_MAX);
+    }
+    fclose(f);
+    return (int)n;
+}
+
+/* Response sink: bytes are encoded according to the output mode and
+ * accumulated, then written to the console or an upstream socket in
+ * PROXY_OUT_BUF_SIZE chunks. */
+typedef enum {
+    PROXY_OUT_RAW = 0,
+    PROXY_OUT_HEX,
+    PROXY_OUT_B64,
+} proxy_out_mode_t;
+
+typedef struct {
+    proxy_out_mode_t mode;
+    int fd;                 // upstream socket, -1 for the console
+    bool failed;
+    size_t len;
+    uint8_t carry[3];       // base64 bytes waiting for a full triplet
+    size_t carry_len;
+    uint8_t buf[PROXY_OUT_BUF_SIZE];
+} proxy_sink_t;
+
+static void sink_flush(proxy_sink_t *sink)
+{
+    if (sink->len == 0 || sink->failed) {
+        sink->len = 0;
+        return;
+    }
+    if (sink->fd < 0) {
+        fwrite(sink->buf, 1, sink->len, stdout);
+        fflush(stdout);
+    } else {
+        size_t off = 0;
+        while (off < sink->len) {
+            int n = send(sink->fd, sink->buf + off, sink->len - off, 0);
+            if (n < 0) {
+                ESP_LOGW(TAG_PROXY, "upstream send() erreur, errno=%d (%s)", errno, strerror(errno));
+                sink->failed = true;
+                break;
+            }
+            off += n;
+        }
+    }
+    sink->len = 0;
+}
+
+static inline void sink_reserve(proxy_sink_t *sink, size_t n)
+{
+    if (sink->len + n > sizeof(sink->buf)) {
+        sink_flush(sink);
+    }
+}
+
+static void sink_b64_triplet(proxy_sink_t *sink, const uint8_t *in, size_t n)
+{
+    uint32_t v = (uint32_t)in[0] << 16;
+    if (n > 1) v |= (uint32_t)in[1] << 8;
+    if (n > 2) v |= in[2];
+    sink_reserve(sink, 4);
+    uint8_t *o = sink->buf + sink->len;
+    o[0] = b64_table[(v >> 18) & 0x3F];
+    o[1] = b64_table[(v >> 12) & 0x3F];
+    o[2] = n > 1 ? b64_table[(v >> 6) & 0x3F] : '=';
+    o[3] = n > 2 ? b64_table[v & 0x3F] : '=';
+    sink->len += 4;
+}
+
+static void sink_write(proxy_sink_t *sink, const uint8_t *data, size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t i = 0;
+
+    switch (sink->mode) {
+    case PROXY_OUT_RAW:
+        while (i < n) {
+            size_t room = sizeof(sink->buf) - sink->len;
+            size_t chunk = n - i < room ? n - i : room;
+            memcpy(sink->buf + sink->len, data + i, chunk);
+            sink->len += chunk;
+            i += chunk;
+            if (sink->len == sizeof(sink->buf)) {
+                sink_flush(sink);
+            }
+        }
+        break;
+    case PROXY_OUT_HEX:
+        for (; i < n; i++) {
+            sink_reserve(sink, 2);
+            sink->buf[sink->len++] = hex[data[i] >> 4];
+            sink->buf[sink->len++] = hex[data[i] & 0x0F];
+        }
+        break;
+    case PROXY_OUT_B64:
+        while (sink->carry_len > 0 && sink->carry_len < 3 && i < n) {
+            sink->carry[sink->carry_len++] = data[i++];
         }
+        if (sink->carry_len == 3) {
+            sink_b64_triplet(sink, sink->carry, 3);
+            sink->carry_len = 0;
+        }
+        for (; i + 3 <= n; i += 3) {
+            sink_b64_triplet(sink, data + i, 3);
+        }
+        while (i < n) {
+            sink->carry[sink->carry_len++] = data[i++];
+        }
+        break;
+    }
+}
+
+static void sink_finish(proxy_sink_t *sink)
+{
+    if (sink->mode == PROXY_OUT_B64 && sink->carry_len > 0) {
+        sink_b64_triplet(sink, sink->carry, sink->carry_len);
+        sink->carry_len = 0;
+    }
+    if (sink->mode != PROXY_OUT_RAW && sink->fd < 0) {
+        sink_reserve(sink, 1);
+        sink->buf[sink->len++] = '\n';
     }
-    dest[j] = '\0';
+    sink_flush(sink);
+}
+
+static int parse_out_mode(const char *s, proxy_out_mode_t *mode)
+{
+    if (strcmp(s, "raw") == 0) {
+        *mode = PROXY_OUT_RAW;
+    } else if (strcmp(s, "hex") == 0) {
+        *mode = PROXY_OUT_HEX;
+    } else if (strcmp(s, "b64") == 0 || strcmp(s, "base64") == 0) {
+        *mode = PROXY_OUT_B64;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* Parse "<ip>:<port>" into a sockaddr */
+static int parse_host_port(const char *s, struct sockaddr_in *addr)
+{
+    char host[16];
+    const char *colon = strrchr(s, ':');
+    if (colon == NULL || colon - s >= (int)sizeof(host)) {
+        return -1;
+    }
+    memcpy(host, s, colon - s);
+    host[colon - s] = '\0';
+    int port = atoi(colon + 1);
+    if (port <= 0 || port > 65535) {
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr->sin_addr) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+static int open_tcp(const struct sockaddr_in *addr)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (sock < 0) {
+        return -1;
+    }
+    if (connect(sock, (const struct sockaddr *)addr, sizeof(*addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* Response framing: the response ends after expect_len bytes or right
+ * after the delimiter, so the receive timeout is only a safety net. */
+typedef struct {
+    size_t expect_len;          // 0 when not length framed
+    size_t delim_len;           // 0 when not delimiter framed
+    uint8_t delim[PROXY_DELIM_MAX];
+    uint8_t win[PROXY_DELIM_MAX];
+    size_t win_len;
+} proxy_frame_t;
+
+/* Returns how many bytes of the chunk belong to the response and sets
+ * *done once the delimiter has been seen. */
+static size_t frame_scan_delim(proxy_frame_t *f, const uint8_t *chunk, size_t n, bool *done)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (f->win_len == f->delim_len) {
+            memmove(f->win, f->win + 1, f->delim_len - 1);
+            f->win_len--;
+        }
+        f->win[f->win_len++] = chunk[i];
+        if (f->win_len == f->delim_len && memcmp(f->win, f->delim, f->delim_len) == 0) {
+            *done = true;
+            return i + 1;
+        }
+    }
+    return n;
+}
+
+static int send_all(int sock, const uint8_t *buf, int len)
+{
+    int off = 0;
+    while (off < len) {
+        int sent = send(sock, buf + off, len - off, 0);
+        if (sent < 0) {
+            return -1;
+        }
+        off += sent;
+    }
+    return off;
 }
 
 static struct {
     struct arg_str *host;
-    struct arg_str *payload;
     struct arg_int *port;
+    struct arg_str *payload;
+    struct arg_str *file;
+    struct arg_str *out;
+    struct arg_str *relay;
+    struct arg_lit *keep;
+    struct arg_int *len;
+    struct arg_str *delim;
+    struct arg_int *timeout;
     struct arg_end *end;
 } pxy_args;
 
@@ -49,71 +330,209 @@ static int request(int argc, char **argv){
         arg_print_errors(stderr, pxy_args.end, argv[0]);
         return 1;
     }
-    if (pxy_args.host->count > 0 || pxy_args.payload->count > 0 || pxy_args.host->count > 0) {
-        ESP_LOGE(TAG_PROXY, "ERR: arg fail");
-        return 1;  
+    if (pxy_args.payload->count == 0 && pxy_args.file->count == 0) {
+        ESP_LOGE(TAG_PROXY, "ERR: need <payload> or --file");
+        return 1;
+    }
+
+    proxy_out_mode_t mode = PROXY_OUT_RAW;
+    if (pxy_args.out->count > 0 && parse_out_mode(pxy_args.out->sval[0], &mode) != 0) {
+        ESP_LOGE(TAG_PROXY, "ERR: output mode must be raw|hex|b64");
+        return 1;
     }
 
-    int len;
     struct sockaddr_in dest_addr = {
         .sin_family = AF_INET,
         .sin_port = htons(pxy_args.port->ival[0]),
-        .sin_addr.s_addr = inet_addr(pxy_args.host->sval[0]),
     };
+    if (inet_pton(AF_INET, pxy_args.host->sval[0], &dest_addr.sin_addr) != 1) {
+        ESP_LOGE(TAG_PROXY, "ERR: invalid host %s", pxy_args.host->sval[0]);
+        return 1;
+    }
 
-    int dest_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
-    if (dest_sock < 0) {
-        printf("ERR: socket fail\n");
+    struct sockaddr_in relay_addr;
+    if (pxy_args.relay->count > 0 && parse_host_port(pxy_args.relay->sval[0], &relay_addr) != 0) {
+        ESP_LOGE(TAG_PROXY, "ERR: relay must be <ip>:<port>");
         return 1;
     }
 
-    if (connect(dest_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) != 0) {
-        ESP_LOGE(TAG_PROXY, "Connexion échouée %d", dest_sock);
-        printf("ERR: connect fail\n");
-        close(dest_sock);
+    proxy_frame_t frame = { 0 };
+    if (pxy_args.len->count > 0) {
+        if (pxy_args.len->ival[0] <= 0) {
+            ESP_LOGE(TAG_PROXY, "ERR: --len must be positive");
+            return 1;
+        }
+        frame.expect_len = pxy_args.len->ival[0];
+    }
+    if (pxy_args.delim->count > 0) {
+        frame.delim_len = unescape_payload(pxy_args.delim->sval[0], frame.delim, sizeof(frame.delim));
+        if (frame.delim_len == 0) {
+            ESP_LOGE(TAG_PROXY, "ERR: empty --delim");
+            return 1;
+        }
+    }
+    bool keep = pxy_args.keep->count > 0;
+    int timeout_ms = pxy_args.timeout->count > 0 ? pxy_args.timeout->ival[0] : PROXY_RX_TIMEOUT_MS;
+    // 0 means "no timeout" for SO_RCVTIMEO: a silent peer would hang the command
+    if (timeout_ms < 1) {
+        ESP_LOGE(TAG_PROXY, "ERR: --timeout must be at least 1 ms");
         return 1;
     }
 
-    struct timeval timeout = {.tv_sec = 5, .tv_usec = 0};
-    setsockopt(dest_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    // Scratch for this request only: the command arena, not the heap
+    uint8_t *payload = arena_alloc(PROXY_PAYLOAD_MAX);
+    uint8_t *rx_buf = arena_alloc(PROXY_RX_BUF_SIZE);
+    proxy_sink_t *sink = arena_alloc(sizeof(proxy_sink_t));
+    if (payload == NULL || rx_buf == NULL || sink == NULL) {
+        ESP_LOGE(TAG_PROXY, "Memory allocation failed");
+        arena_free(payload);
+        arena_free(rx_buf);
+        arena_free(sink);
+        return 1;
+    }
 
-    char real_payload[1024];
-    unescape_payload(pxy_args.payload->sval[0], real_payload, sizeof(real_payload));
-    int payload_len = strlen(real_payload);
+    int ret = 1;
+    int dest_sock = -1;
+    bool reusable = false;
+    memset(sink, 0, offsetof(proxy_sink_t, buf));
+    sink->mode = mode;
+    sink->fd = -1;
 
-    ESP_LOGI(TAG_PROXY, "Sending %d bytes...", payload_len);
-    int sent = send(dest_sock, real_payload, payload_len, 0);
+    int payload_len;
+    if (pxy_args.file->count > 0) {
+        payload_len = load_payload_file(pxy_args.file->sval[0], payload, PROXY_PAYLOAD_MAX);
+        if (payload_len < 0) {
+            goto cleanup;
+        }
+    } else {
+        payload_len = unescape_payload(pxy_args.payload->sval[0], payload, PROXY_PAYLOAD_MAX);
+    }
+
+    if (pxy_args.relay->count > 0) {
+        sink->fd = open_tcp(&relay_addr);
+        if (sink->fd < 0) {
+            printf("ERR: relay connect fail\n");
+            goto cleanup;
+        }
+    }
+
+    bool reused = false;
+    int64_t t_start = esp_timer_get_time();
+    dest_sock = keep ? proxy_pool_acquire(&dest_addr, &reused) : open_tcp(&dest_addr);
+    if (dest_sock < 0) {
+        ESP_LOGE(TAG_PROXY, "Connexion échouée, errno=%d", errno);
+        printf("ERR: connect fail\n");
+        goto cleanup;
+    }
+
+    struct timeval timeout = {.tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000};
+    setsockopt(dest_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    ESP_LOGI(TAG_PROXY, "Sending %d bytes (%s, connect %lld ms)...", payload_len,
+             reused ? "pooled" : "new", (esp_timer_get_time() - t_start) / 1000);
+    int64_t t_sent = esp_timer_get_time();
+    int sent = send_all(dest_sock, payload, payload_len);
+    if (sent < 0 && reused) {
+        // The pooled peer went away since the health check, retry once on a fresh socket
+        proxy_pool_release(dest_sock, &dest_addr, false);
+        dest_sock = open_tcp(&dest_addr);
+        if (dest_sock < 0) {
+            printf("ERR: connect fail\n");
+            goto cleanup;
+        }
+        setsockopt(dest_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        t_sent = esp_timer_get_time();
+        sent = send_all(dest_sock, payload, payload_len);
+    }
     if (sent < 0) {
         ESP_LOGW(TAG_PROXY, "Erreur d'envoi payload, errno=%d (%s)", errno, strerror(errno));
     }
-    char rx_buf[1024];
-    int total_received = 0;
 
-    while ((len = recv(dest_sock, rx_buf, sizeof(rx_buf) - 1, 0)) > 0) {
-        rx_buf[len] = 0;
-        total_received += len;
-        ESP_LOGI(TAG_PROXY, "%s", rx_buf);
+    int len = 0;
+    int64_t t_first = 0;
+    size_t total_received = 0;
+    bool framed_done = false;
+    bool trailing = false;
+    while (!framed_done) {
+        size_t want = PROXY_RX_BUF_SIZE;
+        if (frame.expect_len > 0 && frame.expect_len - total_received < want) {
+            want = frame.expect_len - total_received;
+        }
+        len = recv(dest_sock, rx_buf, want, 0);
+        if (len <= 0) {
+            break;
+        }
+        if (total_received == 0) {
+            t_first = esp_timer_get_time();
+        }
+        size_t used = len;
+        if (frame.delim_len > 0) {
+            used = frame_scan_delim(&frame, rx_buf, len, &framed_done);
+            trailing = used < (size_t)len;
+        }
+        total_received += used;
+        if (frame.expect_len > 0 && total_received == frame.expect_len) {
+            framed_done = true;
+        }
+        sink_write(sink, rx_buf, used);
+    }
+    int64_t t_end = esp_timer_get_time();
+    sink_finish(sink);
+
+    if (framed_done) {
+        // Bytes past the delimiter would be read as the next response
+        reusable = keep && !trailing;
+    } else if (len == 0) {
+        reusable = false;   // peer closed
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        reusable = keep;
+        if (frame.expect_len > 0 || frame.delim_len > 0) {
+            ESP_LOGW(TAG_PROXY, "Response frame incomplete after %d ms", timeout_ms);
+            reusable = false;
+        }
+    } else {
+        ESP_LOGW(TAG_PROXY, "recv() erreur, errno=%d (%s)", errno, strerror(errno));
     }
 
     if (total_received == 0) {
         printf("NO RESPONSE\n");
+    } else {
+        ESP_LOGI(TAG_PROXY, "%u bytes received, ttfb %lld ms, total %lld ms",
+                 (unsigned)total_received, (t_first - t_sent) / 1000, (t_end - t_sent) / 1000);
     }
+    ret = 0;
 
-    if (len < 0) {
-        ESP_LOGW(TAG_PROXY, "recv() erreur, errno=%d (%s)", errno, strerror(errno));
+cleanup:
+    if (dest_sock >= 0) {
+        if (keep) {
+            proxy_pool_release(dest_sock, &dest_addr, reusable);
+        } else {
+            close(dest_sock);
+        }
     }
-
-    close(dest_sock);
+    if (sink->fd >= 0) {
+        close(sink->fd);
+    }
+    arena_free(payload);
+    arena_free(rx_buf);
+    arena_free(sink);
     ESP_LOGW(TAG_PROXY, "END OF REQUEST");
-    return 0;
+    return ret;
 }
 
 void module_proxy(void)
 {
-    pxy_args.host = arg_str0(NULL, NULL, "<host>", "Host address");
-    pxy_args.port = arg_int0(NULL, NULL, "<port>", "Target Port");
-    pxy_args.payload = arg_str0(NULL, NULL, "<payload>", "Payload");
-    pxy_args.end = arg_end(1);
+    pxy_args.host = arg_str1(NULL, NULL, "<host>", "Host address");
+    pxy_args.port = arg_int1(NULL, NULL, "<port>", "Target Port");
+    pxy_args.payload = arg_str0(NULL, NULL, "<payload>", "Payload, accepts \\r \\n \\t \\\\ \\0 \\xHH");
+    pxy_args.file = arg_str0("f", "file", "<path>", "Send a binary payload read from a file");
+    pxy_args.out = arg_str0("o", "out", "<raw|hex|b64>", "Response output encoding");
+    pxy_args.relay = arg_str0("r", "relay", "<ip:port>", "Stream the response to an upstream socket");
+    pxy_args.keep = arg_lit0("k", "keep", "Reuse a pooled keep-alive connection and keep it open");
+    pxy_args.len = arg_int0("l", "len", "<n>", "Response is exactly <n> bytes");
+    pxy_args.delim = arg_str0("d", "delim", "<str>", "Response ends with <str> (escapes accepted)");
+    pxy_args.timeout = arg_int0("t", "timeout", "<ms>", "Receive timeout (>= 1), default 5000");
+    pxy_args.end = arg_end(3);
     const esp_console_cmd_t proxy_cmd = {
         .command = "proxy",
         .help = "send tcp/ip payload",
@@ -121,5 +540,5 @@ void module_proxy(void)
         .func = &request,
         .argtable = &pxy_args
     };
-    ESP_ERROR_CHECK(esp_console_cmd_register(&proxy_cmd));
-}
\ No newline at end of file
+    ESP_ERROR_CHECK(dispatch_register(&proxy_cmd));
+}
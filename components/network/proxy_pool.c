@@ -0,0 +1,240 @@
+/*
+    Keep-alive pool for the proxy command.
+
+    Sockets opened with --keep are parked here once their response has been
+    framed, keyed by (ip, port). A later request to the same peer takes the
+    idle socket back instead of doing a new TCP handshake.
+*/
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "sdkconfig.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include "host_sockets.h"       // lwIP over the TAP netif, not the host's stack
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+#include "errno.h"
+#include "argtable3/argtable3.h"
+#include "esp_console.h"
+#include "dispatch.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "network.h"
+
+#define PROXY_POOL_SIZE        4
+#define PROXY_POOL_IDLE_MS     30000   // idle sockets older than this are closed
+
+static const char *TAG = "PROXY_POOL";
+
+typedef struct {
+    int sock;               // -1 when the slot is free
+    uint32_t ip;            // network order
+    uint16_t port;          // network order
+    bool busy;              // handed out to a request
+    uint32_t uses;
+    int64_t last_used_us;
+} pool_entry_t;
+
+static pool_entry_t s_pool[PROXY_POOL_SIZE] = {
+    [0 ... PROXY_POOL_SIZE - 1] = { .sock = -1 },
+};
+static SemaphoreHandle_t s_pool_lock;
+static StaticSemaphore_t s_pool_lock_buf;
+
+static void pool_lock(void)
+{
+    xSemaphoreTake(s_pool_lock, portMAX_DELAY);
+}
+
+static void pool_unlock(void)
+{
+    xSemaphoreGive(s_pool_lock);
+}
+
+static void entry_close(pool_entry_t *e)
+{
+    close(e->sock);
+    e->sock = -1;
+    e->busy = false;
+    e->uses = 0;
+}
+
+/* An idle keep-alive socket is healthy when the peer has not closed it
+ * and no stray bytes are pending (those would corrupt the next response). */
+static bool entry_healthy(const pool_entry_t *e)
+{
+    uint8_t b;
+    int n = recv(e->sock, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return true;
+    }
+    return false;
+}
+
+/* Close idle sockets past their timeout, called with the lock held */
+static void pool_expire(int64_t now)
+{
+    for (int i = 0; i < PROXY_POOL_SIZE; i++) {
+        pool_entry_t *e = &s_pool[i];
+        if (e->sock >= 0 && !e->busy &&
+            now - e->last_used_us > (int64_t)PROXY_POOL_IDLE_MS * 1000) {
+            entry_close(e);
+        }
+    }
+}
+
+int proxy_pool_acquire(const struct sockaddr_in *addr, bool *reused)
+{
+    *reused = false;
+    pool_lock();
+    pool_expire(esp_timer_get_time());
+    for (int i = 0; i < PROXY_POOL_SIZE; i++) {
+        pool_entry_t *e = &s_pool[i];
+        if (e->sock < 0 || e->busy ||
+            e->ip != addr->sin_addr.s_addr || e->port != addr->sin_port) {
+            continue;
+        }
+        if (!entry_healthy(e)) {
+            ESP_LOGD(TAG, "dropping stale socket %d", e->sock);
+            entry_close(e);
+            continue;
+        }
+        e->busy = true;
+        e->uses++;
+        int sock = e->sock;
+        pool_unlock();
+        *reused = true;
+        return sock;
+    }
+    pool_unlock();
+
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (sock < 0) {
+        return -1;
+    }
+    if (connect(sock, (const struct sockaddr *)addr, sizeof(*addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+void proxy_pool_release(int sock, const struct sockaddr_in *addr, bool keep)
+{
+    pool_lock();
+    pool_entry_t *slot = NULL;
+    for (int i = 0; i < PROXY_POOL_SIZE; i++) {
+        if (s_pool[i].sock == sock) {
+            slot = &s_pool[i];
+            break;
+        }
+    }
+
+    if (!keep) {
+        if (slot) {
+            entry_close(slot);
+        } else {
+            close(sock);
+        }
+        pool_unlock();
+        return;
+    }
+
+    if (slot == NULL) {
+        // New socket: take a free slot, or evict the least recently used idle one
+        for (int i = 0; i < PROXY_POOL_SIZE; i++) {
+            pool_entry_t *e = &s_pool[i];
+            if (e->sock < 0) {
+                slot = e;
+                break;
+            }
+            if (!e->busy && (slot == NULL || e->last_used_us < slot->last_used_us)) {
+                slot = e;
+            }
+        }
+        if (slot == NULL) {
+            close(sock);
+            pool_unlock();
+            return;
+        }
+        if (slot->sock >= 0) {
+            entry_close(slot);
+        }
+        slot->sock = sock;
+        slot->ip = addr->sin_addr.s_addr;
+        slot->port = addr->sin_port;
+        slot->uses = 1;
+    }
+    slot->busy = false;
+    slot->last_used_us = esp_timer_get_time();
+    pool_unlock();
+}
+
+void proxy_pool_flush(void)
+{
+    pool_lock();
+    for (int i = 0; i < PROXY_POOL_SIZE; i++) {
+        if (s_pool[i].sock >= 0 && !s_pool[i].busy) {
+            entry_close(&s_pool[i]);
+        }
+    }
+    pool_unlock();
+}
+
+static struct {
+    struct arg_lit *flush;
+    struct arg_end *end;
+} pool_args;
+
+static int pool_cmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&pool_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, pool_args.end, argv[0]);
+        return 1;
+    }
+    if (pool_args.flush->count > 0) {
+        proxy_pool_flush();
+    }
+
+    pool_lock();
+    int64_t now = esp_timer_get_time();
+    pool_expire(now);
+    int n = 0;
+    for (int i = 0; i < PROXY_POOL_SIZE; i++) {
+        const pool_entry_t *e = &s_pool[i];
+        if (e->sock < 0) {
+            continue;
+        }
+        char ip[INET_ADDRSTRLEN];
+        struct in_addr in = { .s_addr = e->ip };
+        inet_ntop(AF_INET, &in, ip, sizeof(ip));
+        printf("%s:%u\t%s\tuses=%" PRIu32 "\tidle=%lld ms\n", ip, ntohs(e->port),
+               e->busy ? "busy" : "idle", e->uses, (now - e->last_used_us) / 1000);
+        n++;
+    }
+    pool_unlock();
+    printf("%d/%d pooled connections\n", n, PROXY_POOL_SIZE);
+    return 0;
+}
+
+void module_proxy_pool(void)
+{
+    s_pool_lock = xSemaphoreCreateMutexStatic(&s_pool_lock_buf);
+    pool_args.flush = arg_lit0(NULL, "flush", "Close all idle pooled connections");
+    pool_args.end = arg_end(1);
+    const esp_console_cmd_t pool_cmd_def = {
+        .command = "proxy_pool",
+        .help = "List keep-alive connections used by proxy --keep",
+        .hint = NULL,
+        .func = &pool_cmd,
+        .argtable = &pool_args
+    };
+    ESP_ERROR_CHECK(dispatch_register(&pool_cmd_def));
+}
@@ -0,0 +1,485 @@
+/*
+    SOCKS5 server (RFC 1928, CONNECT only) for pivoting through the ESP32.
+
+    A listener task accepts clients and hands them to a fixed set of worker
+    tasks through a queue, so the number of relayed connections is capped at
+    SOCKS_MAX_CONN. Every worker owns a preallocated slot (handshake buffer,
+    counters). Data is relayed with the lwIP netconn API: received pbufs are
+    written to the other side without an intermediate user buffer. It is not
+    zero-copy: netconn_write() copies each pbuf into the send buffer
+    (NETCONN_COPY), since the pbuf is freed long before the peer acks it.
+    A FIN from one side is passed on as a half-close and the other direction
+    keeps flowing. Workers sleep on a task notification raised by the
+    netconn callback.
+*/
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include "lwip/api.h"
+#include "lwip/ip_addr.h"
+#include "argtable3/argtable3.h"
+#include "esp_console.h"
+#include "dispatch.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "network.h"
+
+#define SOCKS_DEFAULT_PORT      1080
+#define SOCKS_MAX_CONN          4
+#define SOCKS_WORKER_STACK      3072
+#define SOCKS_TASK_PRIO         5
+#define SOCKS_HS_TIMEOUT_MS     5000
+#define SOCKS_IDLE_WAKE_MS      1000
+#define SOCKS_HS_BUF_SIZE       (4 + 1 + 255 + 2)   // largest CONNECT request
+
+#define SOCKS_VER               0x05
+#define SOCKS_CMD_CONNECT       0x01
+#define SOCKS_ATYP_IPV4         0x01
+#define SOCKS_ATYP_DOMAIN       0x03
+#define SOCKS_ATYP_IPV6         0x04
+
+#define SOCKS_REP_OK            0x00
+#define SOCKS_REP_FAILURE       0x01
+#define SOCKS_REP_HOST_UNREACH  0x04
+#define SOCKS_REP_CONN_REFUSED  0x05
+#define SOCKS_REP_CMD_UNSUPP    0x07
+#define SOCKS_REP_ATYP_UNSUPP   0x08
+
+static const char *TAG = "SOCKS5";
+
+typedef struct {
+    TaskHandle_t task;
+    struct netconn *client;
+    struct netconn *remote;
+    char target[48];
+    uint64_t bytes_up;          // client -> remote
+    uint64_t bytes_down;        // remote -> client
+    int64_t start_us;
+    uint8_t hs[SOCKS_HS_BUF_SIZE];
+    size_t hs_len;
+} socks_slot_t;
+
+static socks_slot_t s_slots[SOCKS_MAX_CONN];
+static struct netconn *s_listener;
+static QueueHandle_t s_accept_queue;
+static TaskHandle_t s_listen_task;
+static volatile bool s_running;
+static uint16_t s_port;
+static uint32_t s_total_conn;
+static uint32_t s_rejected_conn;
+static uint64_t s_total_bytes;
+
+/* Called from the tcpip thread on every netconn event: wake whichever
+ * worker owns the connection. */
+static void socks_netconn_cb(struct netconn *conn, enum netconn_evt evt, u16_t len)
+{
+    if (evt != NETCONN_EVT_RCVPLUS && evt != NETCONN_EVT_ERROR) {
+        return;
+    }
+    for (int i = 0; i < SOCKS_MAX_CONN; i++) {
+        socks_slot_t *slot = &s_slots[i];
+        if (slot->task != NULL && (slot->client == conn || slot->remote == conn)) {
+            xTaskNotifyGive(slot->task);
+            return;
+        }
+    }
+}
+
+/* Accumulate handshake bytes until at least need are buffered */
+static bool hs_fill(socks_slot_t *slot, size_t need)
+{
+    while (slot->hs_len < need) {
+        struct netbuf *nb;
+        if (netconn_recv(slot->client, &nb) != ERR_OK) {
+            return false;
+        }
+        void *data;
+        u16_t len;
+        netbuf_first(nb);
+        do {
+            netbuf_data(nb, &data, &len);
+            if (slot->hs_len + len > sizeof(slot->hs)) {
+                netbuf_delete(nb);
+                return false;
+            }
+            memcpy(slot->hs + slot->hs_len, data, len);
+            slot->hs_len += len;
+        } while (netbuf_next(nb) >= 0);
+        netbuf_delete(nb);
+    }
+    return true;
+}
+
+static void hs_consume(socks_slot_t *slot, size_t n)
+{
+    memmove(slot->hs, slot->hs + n, slot->hs_len - n);
+    slot->hs_len -= n;
+}
+
+static void send_reply(socks_slot_t *slot, uint8_t rep)
+{
+    uint8_t reply[10] = { SOCKS_VER, rep, 0x00, SOCKS_ATYP_IPV4 };
+    if (rep == SOCKS_REP_OK) {
+        ip_addr_t local;
+        u16_t port;
+        if (netconn_getaddr(slot->remote, &local, &port, 1) == ERR_OK && IP_IS_V4(&local)) {
+            memcpy(&reply[4], &ip_2_ip4(&local)->addr, 4);
+            reply[8] = port >> 8;
+            reply[9] = port & 0xFF;
+        }
+    }
+    netconn_write(slot->client, reply, sizeof(reply), NETCONN_COPY);
+}
+
+/* Method negotiation and CONNECT request. Returns true with slot->remote
+ * connected, or false after replying with an error. */
+static bool socks_handshake(socks_slot_t *slot)
+{
+    netconn_set_recvtimeout(slot->client, SOCKS_HS_TIMEOUT_MS);
+
+    // VER NMETHODS METHODS...
+    if (!hs_fill(slot, 2) || slot->hs[0] != SOCKS_VER || !hs_fill(slot, 2 + slot->hs[1])) {
+        return false;
+    }
+    bool no_auth = memchr(slot->hs + 2, 0x00, slot->hs[1]) != NULL;
+    hs_consume(slot, 2 + slot->hs[1]);
+    const uint8_t method[2] = { SOCKS_VER, no_auth ? 0x00 : 0xFF };
+    netconn_write(slot->client, method, sizeof(method), NETCONN_COPY);
+    if (!no_auth) {
+        return false;
+    }
+
+    // VER CMD RSV ATYP DST.ADDR DST.PORT
+    if (!hs_fill(slot, 5) || slot->hs[0] != SOCKS_VER) {
+        return false;
+    }
+    size_t addr_len;
+    switch (slot->hs[3]) {
+    case SOCKS_ATYP_IPV4:   addr_len = 4; break;
+    case SOCKS_ATYP_DOMAIN: addr_len = 1 + slot->hs[4]; break;
+    case SOCKS_ATYP_IPV6:   addr_len = 16; break;
+    default:
+        send_reply(slot, SOCKS_REP_ATYP_UNSUPP);
+        return false;
+    }
+    if (!hs_fill(slot, 4 + addr_len + 2)) {
+        return false;
+    }
+    if (slot->hs[1] != SOCKS_CMD_CONNECT) {
+        send_reply(slot, SOCKS_REP_CMD_UNSUPP);
+        return false;
+    }
+
+    ip_addr_t dst;
+    const uint8_t *a = slot->hs + 4;
+    uint16_t port = (a[addr_len] << 8) | a[addr_len + 1];
+    if (slot->hs[3] == SOCKS_ATYP_IPV4) {
+        IP_ADDR4(&dst, a[0], a[1], a[2], a[3]);
+    } else if (slot->hs[3] == SOCKS_ATYP_DOMAIN) {
+        char name[256];
+        memcpy(name, a + 1, a[0]);
+        name[a[0]] = '\0';
+        if (netconn_gethostbyname(name, &dst) != ERR_OK) {
+            ESP_LOGW(TAG, "cannot resolve %s", name);
+            send_reply(slot, SOCKS_REP_HOST_UNREACH);
+            return false;
+        }
+    } else {
+#if CONFIG_LWIP_IPV6
+        IP_ADDR6(&dst, lwip_htonl((a[0] << 24) | (a[1] << 16) | (a[2] << 8) | a[3]),
+                       lwip_htonl((a[4] << 24) | (a[5] << 16) | (a[6] << 8) | a[7]),
+                       lwip_htonl((a[8] << 24) | (a[9] << 16) | (a[10] << 8) | a[11]),
+                       lwip_htonl((a[12] << 24) | (a[13] << 16) | (a[14] << 8) | a[15]));
+#else
+        send_reply(slot, SOCKS_REP_ATYP_UNSUPP);
+        return false;
+#endif
+    }
+    snprintf(slot->target, sizeof(slot->target), "%s:%u", ipaddr_ntoa(&dst), port);
+
+#if CONFIG_LWIP_IPV6
+    enum netconn_type type = IP_IS_V6(&dst) ? NETCONN_TCP_IPV6 : NETCONN_TCP;
+#else
+    enum netconn_type type = NETCONN_TCP;
+#endif
+    slot->remote = netconn_new_with_callback(type, socks_netconn_cb);
+    if (slot->remote == NULL) {
+        send_reply(slot, SOCKS_REP_FAILURE);
+        return false;
+    }
+    err_t err = netconn_connect(slot->remote, &dst, port);
+    if (err != ERR_OK) {
+        ESP_LOGW(TAG, "connect %s failed (%d)", slot->target, err);
+        send_reply(slot, err == ERR_RST ? SOCKS_REP_CONN_REFUSED : SOCKS_REP_HOST_UNREACH);
+        return false;
+    }
+    send_reply(slot, SOCKS_REP_OK);
+    hs_consume(slot, 4 + addr_len + 2);
+    return true;
+}
+
+/* Forward everything pending on src to dst. Returns 1 once src has sent
+ * its FIN, -1 on a reset or a failed write. */
+static int relay_pending(struct netconn *src, struct netconn *dst, uint64_t *counter)
+{
+    for (;;) {
+        struct pbuf *p;
+        err_t err = netconn_recv_tcp_pbuf_flags(src, &p, NETCONN_DONTBLOCK);
+        if (err == ERR_WOULDBLOCK) {
+            return 0;
+        }
+        if (err == ERR_CLSD) {
+            return 1;
+        }
+        if (err != ERR_OK) {
+            return -1;
+        }
+        for (struct pbuf *q = p; q != NULL; q = q->next) {
+            u8_t flags = NETCONN_COPY | (q->next ? NETCONN_MORE : 0);
+            if (netconn_write(dst, q->payload, q->len, flags) != ERR_OK) {
+                pbuf_free(p);
+                return -1;
+            }
+            *counter += q->len;
+        }
+        pbuf_free(p);
+    }
+}
+
+static void slot_release(socks_slot_t *slot)
+{
+    int64_t ms = (esp_timer_get_time() - slot->start_us) / 1000;
+    ESP_LOGI(TAG, "%s closed: up %" PRIu64 " B, down %" PRIu64 " B, %lld ms",
+             slot->target, slot->bytes_up, slot->bytes_down, ms);
+    s_total_bytes += slot->bytes_up + slot->bytes_down;
+    if (slot->remote) {
+        netconn_close(slot->remote);
+        netconn_delete(slot->remote);
+    }
+    netconn_close(slot->client);
+    netconn_delete(slot->client);
+    slot->remote = NULL;
+    slot->client = NULL;
+}
+
+static void socks_worker_task(void *arg)
+{
+    socks_slot_t *slot = (socks_slot_t *)arg;
+    struct netconn *conn;
+
+    while (xQueueReceive(s_accept_queue, &conn, portMAX_DELAY) == pdTRUE && conn != NULL) {
+        slot->remote = NULL;
+        slot->hs_len = 0;
+        slot->bytes_up = 0;
+        slot->bytes_down = 0;
+        slot->start_us = esp_timer_get_time();
+        strlcpy(slot->target, "?", sizeof(slot->target));
+        slot->client = conn;
+
+        if (socks_handshake(slot)) {
+            ESP_LOGI(TAG, "relaying to %s", slot->target);
+            // Request bytes that arrived after the CONNECT header go first
+            if (slot->hs_len > 0) {
+                netconn_write(slot->remote, slot->hs, slot->hs_len, NETCONN_COPY);
+                slot->bytes_up += slot->hs_len;
+            }
+            bool up = true;
+            bool down = true;
+            while (s_running && (up || down)) {
+                int r = up ? relay_pending(slot->client, slot->remote, &slot->bytes_up) : 0;
+                if (r > 0) {
+                    // Client done sending: pass the FIN on, the reply keeps coming
+                    netconn_shutdown(slot->remote, 0, 1);
+                    up = false;
+                }
+                if (r >= 0 && down) {
+                    r = relay_pending(slot->remote, slot->client, &slot->bytes_down);
+                    if (r > 0) {
+                        netconn_shutdown(slot->client, 0, 1);
+                        down = false;
+                    }
+                }
+                if (r < 0) {
+                    break;
+                }
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SOCKS_IDLE_WAKE_MS));
+            }
+        }
+        slot_release(slot);
+    }
+    slot->task = NULL;
+    vTaskDelete(NULL);
+}
+
+static int active_count(void)
+{
+    int n = 0;
+    for (int i = 0; i < SOCKS_MAX_CONN; i++) {
+        if (s_slots[i].client != NULL) {
+            n++;
+        }
+    }
+    return n;
+}
+
+static void socks_listen_task(void *arg)
+{
+    ESP_LOGI(TAG, "listening on port %u, %d connections max", s_port, SOCKS_MAX_CONN);
+    while (s_running) {
+        struct netconn *conn;
+        if (netconn_accept(s_listener, &conn) != ERR_OK) {
+            continue;   // timeout, re-check s_running
+        }
+        s_total_conn++;
+        if (active_count() + uxQueueMessagesWaiting(s_accept_queue) >= SOCKS_MAX_CONN ||
+            xQueueSend(s_accept_queue, &conn, 0) != pdTRUE) {
+            s_rejected_conn++;
+            ESP_LOGW(TAG, "connection cap reached, rejecting client");
+            netconn_close(conn);
+            netconn_delete(conn);
+        }
+    }
+
+    // Wake up every worker with a NULL connection so they exit
+    struct netconn *stop = NULL;
+    for (int i = 0; i < SOCKS_MAX_CONN; i++) {
+        xQueueSend(s_accept_queue, &stop, portMAX_DELAY);
+    }
+    netconn_close(s_listener);
+    netconn_delete(s_listener);
+    s_listener = NULL;
+    s_listen_task = NULL;
+    vTaskDelete(NULL);
+}
+
+static int socks_start(uint16_t port)
+{
+    if (s_running || s_listen_task != NULL) {
+        printf("SOCKS5 server already running on port %u\n", s_port);
+        return 1;
+    }
+    for (int i = 0; i < SOCKS_MAX_CONN; i++) {
+        if (s_slots[i].task != NULL) {
+            printf("SOCKS5 server still stopping, try again\n");
+            return 1;
+        }
+    }
+
+    if (s_accept_queue == NULL) {
+        s_accept_queue = xQueueCreate(SOCKS_MAX_CONN, sizeof(struct netconn *));
+        if (s_accept_queue == NULL) {
+            return 1;
+        }
+    }
+    xQueueReset(s_accept_queue);
+
+    s_listener = netconn_new_with_callback(NETCONN_TCP, socks_netconn_cb);
+    if (s_listener == NULL) {
+        return 1;
+    }
+    if (netconn_bind(s_listener, IP_ADDR_ANY, port) != ERR_OK ||
+        netconn_listen_with_backlog(s_listener, SOCKS_MAX_CONN) != ERR_OK) {
+        ESP_LOGE(TAG, "cannot listen on port %u", port);
+        netconn_delete(s_listener);
+        s_listener = NULL;
+        return 1;
+    }
+    netconn_set_recvtimeout(s_listener, SOCKS_IDLE_WAKE_MS);
+
+    s_port = port;
+    s_running = true;
+    for (int i = 0; i < SOCKS_MAX_CONN; i++) {
+        memset(&s_slots[i], 0, sizeof(s_slots[i]));
+        xTaskCreate(socks_worker_task, "socks_w", SOCKS_WORKER_STACK, &s_slots[i],
+                    SOCKS_TASK_PRIO, &s_slots[i].task);
+    }
+    xTaskCreate(socks_listen_task, "socks_l", SOCKS_WORKER_STACK, NULL, SOCKS_TASK_PRIO, &s_listen_task);
+    return 0;
+}
+
+static struct {
+    struct arg_int *port;
+    struct arg_end *end;
+} socks_args;
+
+static int socks_start_cmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&socks_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, socks_args.end, argv[0]);
+        return 1;
+    }
+    int port = socks_args.port->count > 0 ? socks_args.port->ival[0] : SOCKS_DEFAULT_PORT;
+    if (port <= 0 || port > 65535) {
+        printf("ERR: invalid port\n");
+        return 1;
+    }
+    return socks_start((uint16_t)port);
+}
+
+static int socks_stop_cmd(int argc, char **argv)
+{
+    if (!s_running) {
+        printf("SOCKS5 server not running\n");
+        return 1;
+    }
+    s_running = false;
+    for (int i = 0; i < SOCKS_MAX_CONN; i++) {
+        if (s_slots[i].task != NULL) {
+            xTaskNotifyGive(s_slots[i].task);
+        }
+    }
+    ESP_LOGI(TAG, "stopping");
+    return 0;
+}
+
+static int socks_stat_cmd(int argc, char **argv)
+{
+    int64_t now = esp_timer_get_time();
+    printf("SOCKS5 %s, port %u, %" PRIu32 " accepted, %" PRIu32 " rejected, %" PRIu64 " B relayed\n",
+           s_running ? "running" : "stopped", s_port, s_total_conn, s_rejected_conn, s_total_bytes);
+    for (int i = 0; i < SOCKS_MAX_CONN; i++) {
+        const socks_slot_t *slot = &s_slots[i];
+        if (slot->client == NULL) {
+            continue;
+        }
+        int64_t ms = (now - slot->start_us) / 1000;
+        uint64_t kbps = ms > 0 ? (slot->bytes_up + slot->bytes_down) * 8 / (uint64_t)ms : 0;
+        printf("  [%d] %-21s up %" PRIu64 " B  down %" PRIu64 " B  %lld s  %" PRIu64 " kbit/s\n",
+               i, slot->target, slot->bytes_up, slot->bytes_down, ms / 1000, kbps);
+    }
+    return 0;
+}
+
+void module_socks(void)
+{
+    socks_args.port = arg_int0("p", "port", "<port>", "Listening port, default 1080");
+    socks_args.end = arg_end(1);
+    const esp_console_cmd_t start_cmd = {
+        .command = "socks_start",
+        .help = "Start a SOCKS5 server (CONNECT) in the background",
+        .hint = NULL,
+        .func = &socks_start_cmd,
+        .argtable = &socks_args
+    };
+    ESP_ERROR_CHECK(dispatch_register(&start_cmd));
+
+    const esp_console_cmd_t stop_cmd = {
+        .command = "socks_stop",
+        .help = "Stop the SOCKS5 server and drop its connections",
+        .hint = NULL,
+        .func = &socks_stop_cmd,
+    };
+    ESP_ERROR_CHECK(dispatch_register(&stop_cmd));
+
+    const esp_console_cmd_t stat_cmd = {
+        .command = "socks_stat",
+        .help = "Show SOCKS5 per-connection throughput counters",
+        .hint = NULL,
+        .func = &socks_stat_cmd,
+    };
+    ESP_ERROR_CHECK(dispatch_register(&stat_cmd));
+}
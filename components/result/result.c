@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "result.h"
+#include "result_json.h"
+#include "pool.h"
+
+#define LZ_MIN_MATCH    3
+#define LZ_MAX_MATCH    (LZ_MIN_MATCH + 63)     // 6-bit length field
+#define LZ_MAX_PROBES   16
+#define LZ_NONE         0xFFFF
+
+#define CONSOLE_SINK_POOL   2       // REPL + one job or session, more come from the heap
+
+static const char *TAG = "result";
+
+static __thread result_sink_t *t_current_sink;
+static volatile result_output_t s_output = RESULT_OUTPUT_TEXT;
+
+typedef struct {
+    result_sink_t sink;
+    FILE *out;                  // stdout of the task that ran the command
+    result_output_t mode;
+    char line[RESULT_JSON_LINE_MAX];
+} console_sink_t;
+
+POOL_DEFINE(s_console_sinks, console_sink_t, CONSOLE_SINK_POOL);
+
+result_sink_t *result_sink_current(void)
+{
+    return t_current_sink;
+}
+
+void result_sink_set_current(result_sink_t *sink)
+{
+    t_current_sink = sink;
+}
+
+/* ---- LZSS ----
+ * A block is a sequence of groups: one flag byte then up to 8 items, bit i
+ * (LSB first) set for a literal byte, clear for a 2-byte match
+ *   b0 = distance-1 (low 8 bits), b1 = (distance-1) >> 8 << 6 | (length - 3)
+ * with distance 1..1024 and length 3..66. Matches may reach back into
+ * previous blocks of the same stream. */
+
+static inline uint8_t lz_hash(const uint8_t *p)
+{
+    return (uint8_t)((p[0] << 4) ^ (p[1] << 2) ^ p[2]);
+}
+
+static inline void lz_insert(result_lz_t *lz, size_t pos)
+{
+    uint8_t h = lz_hash(lz->win + pos);
+    lz->prev[pos] = lz->head[h];
+    lz->head[h] = pos;
+}
+
+size_t result_lz_compress(result_lz_t *lz, const uint8_t *in, size_t len, uint8_t *out)
+{
+    memcpy(lz->win + lz->hist_len, in, len);
+    size_t end = lz->hist_len + len;
+
+    memset(lz->head, 0xFF, sizeof(lz->head));
+    for (size_t i = 0; i < lz->hist_len && i + 2 < end; i++) {
+        lz_insert(lz, i);
+    }
+
+    size_t pos = lz->hist_len;
+    size_t out_len = 0;
+    size_t flag_pos = 0;
+    int bit = 8;
+    while (pos < end) {
+        size_t best_len = 0, best_dist = 0;
+        if (pos + 2 < end) {
+            size_t max_len = end - pos < LZ_MAX_MATCH ? end - pos : LZ_MAX_MATCH;
+            uint16_t cand = lz->head[lz_hash(lz->win + pos)];
+            for (int probes = 0; cand != LZ_NONE && probes < LZ_MAX_PROBES; probes++) {
+                size_t dist = pos - cand;
+                if (dist > RESULT_LZ_WINDOW) {
+                    break;
+                }
+                size_t l = 0;
+                while (l < max_len && lz->win[cand + l] == lz->win[pos + l]) {
+                    l++;
+                }
+                if (l > best_len) {
+                    best_len = l;
+                    best_dist = dist;
+                    if (l == max_len) {
+                        break;
+                    }
+                }
+                cand = lz->prev[cand];
+            }
+        }
+
+        if (bit == 8) {
+            flag_pos = out_len++;
+            out[flag_pos] = 0;
+            bit = 0;
+        }
+        if (best_len >= LZ_MIN_MATCH) {
+            size_t d = best_dist - 1;
+            out[out_len++] = d & 0xFF;
+            out[out_len++] = ((d >> 8) << 6) | (best_len - LZ_MIN_MATCH);
+            for (size_t k = 0; k < best_len; k++, pos++) {
+                if (pos + 2 < end) {
+                    lz_insert(lz, pos);
+                }
+            }
+        } else {
+            out[flag_pos] |= 1 << bit;
+            out[out_len++] = lz->win[pos];
+            if (pos + 2 < end) {
+                lz_insert(lz, pos);
+            }
+            pos++;
+        }
+        bit++;
+    }
+
+    size_t keep = end < RESULT_LZ_WINDOW ? end : RESULT_LZ_WINDOW;
+    memmove(lz->win, lz->win + end - keep, keep);
+    lz->hist_len = keep;
+    return out_len;
+}
+
+/* ---- sink ---- */
+
+bool result_sink_init(result_sink_t *sink, result_write_fn_t write, void *ctx, bool compress)
+{
+    sink->write = write;
+    sink->ctx = ctx;
+    sink->lock = xSemaphoreCreateMutexStatic(&sink->lock_buf);
+    sink->records = 0;
+    sink->raw_bytes = 0;
+    sink->wire_bytes = 0;
+    sink->len = 0;
+    sink->lz = NULL;
+    sink->batch = true;
+    if (compress) {
+        sink->lz = malloc(sizeof(result_lz_t));
+        if (sink->lz == NULL) {
+            return false;
+        }
+        sink->lz->hist_len = 0;
+    }
+    return true;
+}
+
+/* Called with the sink lock held */
+static void sink_flush_locked(result_sink_t *sink)
+{
+    if (sink->len == 0) {
+        return;
+    }
+    if (sink->lz) {
+        size_t n = result_lz_compress(sink->lz, sink->buf, sink->len, sink->lz->out);
+        sink->write(sink->ctx, sink->lz->out, n, true);
+        sink->wire_bytes += n;
+    } else {
+        sink->write(sink->ctx, sink->buf, sink->len, false);
+        sink->wire_bytes += sink->len;
+    }
+    sink->len = 0;
+}
+
+void result_sink_flush(result_sink_t *sink)
+{
+    xSemaphoreTake(sink->lock, portMAX_DELAY);
+    sink_flush_locked(sink);
+    xSemaphoreGive(sink->lock);
+}
+
+void result_sink_finish(result_sink_t *sink)
+{
+    result_sink_flush(sink);
+    ESP_LOGD(TAG, "%" PRIu32 " records, %" PRIu32 " B cbor, %" PRIu32 " B on wire",
+             sink->records, sink->raw_bytes, sink->wire_bytes);
+    free(sink->lz);
+    sink->lz = NULL;
+    vSemaphoreDelete(sink->lock);
+}
+
+/* ---- console output ---- */
+
+result_output_t result_output_get(void)
+{
+    return s_output;
+}
+
+void result_output_set(result_output_t mode)
+{
+    s_output = mode;
+}
+
+/* Called with the sink lock held, data is a run of whole records */
+static int console_write(void *ctx, const uint8_t *data, size_t len, bool compressed)
+{
+    console_sink_t *cs = ctx;
+    if (cs->mode == RESULT_OUTPUT_CBOR) {
+        const uint8_t head[3] = { RESULT_FRAME_START, len >> 8, len & 0xFF };
+        fwrite(head, 1, sizeof(head), cs->out);
+        fwrite(data, 1, len, cs->out);
+    } else {
+        size_t pos = 0;
+        while (pos < len) {
+            size_t n = result_json(data + pos, len - pos, cs->line, sizeof(cs->line));
+            if (n == 0) {
+                break;
+            }
+            fputs(cs->line, cs->out);
+            pos += n;
+        }
+    }
+    fflush(cs->out);
+    return 0;
+}
+
+result_sink_t *result_console_open(void)
+{
+    result_output_t mode = s_output;
+    if (mode == RESULT_OUTPUT_TEXT || t_current_sink != NULL) {
+        return NULL;
+    }
+    console_sink_t *cs = pool_alloc(&s_console_sinks);
+    if (cs == NULL) {
+        ESP_LOGW(TAG, "no memory for the console sink, text output");
+        return NULL;
+    }
+    cs->out = stdout;
+    cs->mode = mode;
+    result_sink_init(&cs->sink, console_write, cs, false);
+    // Records are few and interactive, don't hold them back
+    cs->sink.batch = false;
+    t_current_sink = &cs->sink;
+    return &cs->sink;
+}
+
+void result_console_close(result_sink_t *sink)
+{
+    if (sink == NULL) {
+        return;
+    }
+    t_current_sink = NULL;
+    result_sink_finish(sink);
+    pool_free(&s_console_sinks, sink);     // first member of its console_sink_t
+}
+
+/* ---- CBOR record encoding ---- */
+
+static void put_head(result_rec_t *rec, uint8_t major, uint64_t v)
+{
+    uint8_t tmp[9];
+    size_t n;
+    if (v < 24) {
+        tmp[0] = major << 5 | v;
+        n = 1;
+    } else if (v <= 0xFF) {
+        tmp[0] = major << 5 | 24;
+        tmp[1] = v;
+        n = 2;
+    } else if (v <= 0xFFFF) {
+        tmp[0] = major << 5 | 25;
+        tmp[1] = v >> 8;
+        tmp[2] = v;
+        n = 3;
+    } else if (v <= 0xFFFFFFFF) {
+        tmp[0] = major << 5 | 26;
+        for (int i = 0; i < 4; i++) {
+            tmp[1 + i] = v >> (24 - 8 * i);
+        }
+        n = 5;
+    } else {
+        tmp[0] = major << 5 | 27;
+        for (int i = 0; i < 8; i++) {
+            tmp[1 + i] = v >> (56 - 8 * i);
+        }
+        n = 9;
+    }
+    if (rec->len + n > sizeof(rec->buf)) {
+        rec->len = sizeof(rec->buf) + 1;    // overflow, dropped in result_end
+        return;
+    }
+    memcpy(rec->buf + rec->len, tmp, n);
+    rec->len += n;
+}
+
+static void put_raw(result_rec_t *rec, const void *data, size_t n)
+{
+    if (rec->len + n > sizeof(rec->buf)) {
+        rec->len = sizeof(rec->buf) + 1;
+        return;
+    }
+    memcpy(rec->buf + rec->len, data, n);
+    rec->len += n;
+}
+
+void result_begin(result_rec_t *rec, result_sink_t *sink, result_type_t type)
+{
+    rec->sink = sink;
+    rec->count = 0;
+    rec->len = 1;   // array header, patched in result_end
+    result_uint(rec, type);
+}
+
+void result_uint(result_rec_t *rec, uint64_t v)
+{
+    put_head(rec, 0, v);
+    rec->count++;
+}
+
+void result_int(result_rec_t *rec, int64_t v)
+{
+    if (v >= 0) {
+        put_head(rec, 0, v);
+    } else {
+        put_head(rec, 1, (uint64_t)(-1 - v));
+    }
+    rec->count++;
+}
+
+void result_strn(result_rec_t *rec, const char *s, size_t n)
+{
+    put_head(rec, 3, n);
+    put_raw(rec, s, n);
+    rec->count++;
+}
+
+void result_str(result_rec_t *rec, const char *s)
+{
+    result_strn(rec, s, strlen(s));
+}
+
+void result_bytes(result_rec_t *rec, const uint8_t *b, size_t n)
+{
+    put_head(rec, 2, n);
+    put_raw(rec, b, n);
+    rec->count++;
+}
+
+void result_null(result_rec_t *rec)
+{
+    const uint8_t null = 0xF6;
+    put_raw(rec, &null, 1);
+    rec->count++;
+}
+
+void result_end(result_rec_t *rec)
+{
+    result_sink_t *sink = rec->sink;
+    if (rec->len > sizeof(rec->buf) || rec->count >= 24) {
+        ESP_LOGW(TAG, "record too large, dropped");
+        return;
+    }
+    rec->buf[0] = 0x80 | rec->count;
+
+    xSemaphoreTake(sink->lock, portMAX_DELAY);
+    if (sink->len + rec->len > sizeof(sink->buf)) {
+        sink_flush_locked(sink);
+    }
+    memcpy(sink->buf + sink->len, rec->buf, rec->len);
+    sink->len += rec->len;
+    sink->records++;
+    sink->raw_bytes += rec->len;
+    if (!sink->batch) {
+        sink_flush_locked(sink);
+    }
+    xSemaphoreGive(sink->lock);
+}
@@ -0,0 +1,124 @@
+/*
+    Typed result records.
+
+    Commands that produce data (scan-wifi, scan-arp, sniffer_wifi, ping)
+    describe each result as a record: a type and a fixed sequence of fields.
+    When the running task has a result sink (the agent installs one for
+    commands sent by proxy_srv), records are encoded as CBOR arrays
+    [type, field1, field2, ...] and written to the sink, optionally through
+    a streaming LZSS compressor. Without a sink, commands print text as
+    usual.
+
+    The `output json|cbor|text` setting gives local consoles (UART, TCP,
+    jobs) the same records: the dispatcher opens a console sink around
+    each command, which writes every record to the task's stdout as one
+    JSON line, or as a CBOR frame 0x1E <len:2 big endian> <records>.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Record types, field order is the wire schema (see proxy_srv.py RECORD_SCHEMAS) */
+typedef enum {
+    RESULT_WIFI_AP      = 1,    // ssid, bssid[6], rssi, authmode, channel
+    RESULT_ARP_HOST     = 2,    // ip[4], mac[6]
+    RESULT_SNIFF_MGMT   = 3,    // subtype, da[6], sa[6], bssid[6], ssid, rssi, channel
+    RESULT_SNIFF_EAPOL  = 4,    // da[6], sa[6], rssi, frame bytes
+    RESULT_PING_REPLY   = 5,    // ip, seq, ttl, time_ms, size
+    RESULT_PING_TIMEOUT = 6,    // ip, seq
+    RESULT_PING_SUMMARY = 7,    // ip, transmitted, received, time_ms
+    RESULT_SCAN_SUMMARY = 8,    // kind (text), count, duration_ms
+    RESULT_WIFI_LINK    = 9,    // ssid, ip[4], rssi, channel
+    RESULT_CHIP         = 10,   // model, cores, revision, flash_mb, idf
+    RESULT_HEARTBEAT    = 11,   // uptime_s, free_heap, duty_permille, avg_ua, wakeups
+    RESULT_WIFI_EVENT   = 12,   // event, bssid[6], ssid, rssi, channel, prev_channel, twin[6]
+} result_type_t;
+
+typedef enum {
+    RESULT_OUTPUT_TEXT,
+    RESULT_OUTPUT_JSON,
+    RESULT_OUTPUT_CBOR,
+} result_output_t;
+
+#define RESULT_FRAME_START      0x1E    // CBOR output frame marker (ASCII RS)
+
+#define RESULT_SINK_BUF_SIZE    1024    // records are batched up to this size
+#define RESULT_REC_MAX          256     // largest encoded record
+#define RESULT_LZ_WINDOW        1024    // compressor history
+
+/* Streaming LZSS compressor: history survives between blocks so every
+ * block can reference earlier records. */
+typedef struct {
+    uint8_t win[RESULT_LZ_WINDOW + RESULT_SINK_BUF_SIZE];
+    size_t hist_len;
+    uint16_t head[256];
+    uint16_t prev[RESULT_LZ_WINDOW + RESULT_SINK_BUF_SIZE];
+    uint8_t out[RESULT_SINK_BUF_SIZE + RESULT_SINK_BUF_SIZE / 8 + 1];
+} result_lz_t;
+
+/* Writes one encoded block (compressed or not) to the transport */
+typedef int (*result_write_fn_t)(void *ctx, const uint8_t *data, size_t len, bool compressed);
+
+typedef struct result_sink {
+    result_write_fn_t write;
+    void *ctx;
+    SemaphoreHandle_t lock;     // records may come from Wi-Fi or ping tasks
+    StaticSemaphore_t lock_buf;
+    result_lz_t *lz;            // NULL when not compressing
+    bool batch;                 // false: every record is written right away
+    uint32_t records;
+    uint32_t raw_bytes;         // CBOR bytes produced
+    uint32_t wire_bytes;        // bytes handed to write()
+    size_t len;
+    uint8_t buf[RESULT_SINK_BUF_SIZE];
+} result_sink_t;
+
+/* One record being encoded on the caller's stack */
+typedef struct {
+    result_sink_t *sink;
+    uint8_t count;
+    size_t len;
+    uint8_t buf[RESULT_REC_MAX];
+} result_rec_t;
+
+// Set up a sink; compress allocates the LZSS state, returns false if that failed
+bool result_sink_init(result_sink_t *sink, result_write_fn_t write, void *ctx, bool compress);
+// Flush batched records and release the compressor
+void result_sink_finish(result_sink_t *sink);
+void result_sink_flush(result_sink_t *sink);
+
+// Sink of the calling task, NULL when records should be printed as text
+result_sink_t *result_sink_current(void);
+void result_sink_set_current(result_sink_t *sink);
+
+void result_begin(result_rec_t *rec, result_sink_t *sink, result_type_t type);
+void result_uint(result_rec_t *rec, uint64_t v);
+void result_int(result_rec_t *rec, int64_t v);
+void result_str(result_rec_t *rec, const char *s);
+void result_strn(result_rec_t *rec, const char *s, size_t n);
+void result_bytes(result_rec_t *rec, const uint8_t *b, size_t n);
+void result_null(result_rec_t *rec);
+void result_end(result_rec_t *rec);
+
+// Global output mode of the consoles
+result_output_t result_output_get(void);
+void result_output_set(result_output_t mode);
+
+// Console sink for the calling task, NULL in text mode or when the task already has a sink
+result_sink_t *result_console_open(void);
+void result_console_close(result_sink_t *sink);
+
+// LZSS block compressor used by the sink, out must hold len + len / 8 + 1 bytes
+size_t result_lz_compress(result_lz_t *lz, const uint8_t *in, size_t len, uint8_t *out);
+
+#ifdef __cplusplus
+}
+#endif
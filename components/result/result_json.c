@@ -0,0 +1,208 @@
+/*
+    CBOR record -> JSON line.
+
+    Only plain C, no IDF header: the converter can be built and checked on
+    the host. Field names are the ones of proxy_srv.py RECORD_SCHEMAS.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "result_json.h"
+
+#define JSON_MAX_FIELDS 8
+
+typedef struct {
+    const char *name;
+    const char *fields[JSON_MAX_FIELDS];
+} json_schema_t;
+
+// Index = record type, keep in sync with result_type_t
+static const json_schema_t s_schemas[] = {
+    [1]  = { "wifi_ap",      { "ssid", "bssid", "rssi", "authmode", "channel" } },
+    [2]  = { "arp_host",     { "ip", "mac" } },
+    [3]  = { "sniff_mgmt",   { "subtype", "da", "sa", "bssid", "ssid", "rssi", "channel" } },
+    [4]  = { "sniff_eapol",  { "da", "sa", "rssi", "frame" } },
+    [5]  = { "ping_reply",   { "ip", "seq", "ttl", "time_ms", "size" } },
+    [6]  = { "ping_timeout", { "ip", "seq" } },
+    [7]  = { "ping_summary", { "ip", "transmitted", "received", "time_ms" } },
+    [8]  = { "scan_summary", { "kind", "count", "duration_ms" } },
+    [9]  = { "wifi_link",    { "ssid", "ip", "rssi", "channel" } },
+    [10] = { "chip",         { "model", "cores", "revision", "flash_mb", "idf" } },
+    [11] = { "heartbeat",    { "uptime_s", "free_heap", "duty_permille", "avg_ua", "wakeups" } },
+    [12] = { "wifi_event",   { "event", "bssid", "ssid", "rssi", "channel", "prev_channel", "twin" } },
+};
+#define NUM_SCHEMAS (sizeof(s_schemas) / sizeof(s_schemas[0]))
+
+typedef struct {
+    char *out;
+    size_t size;
+    size_t len;
+    bool overflow;
+} json_buf_t;
+
+static void put(json_buf_t *b, const char *s, size_t n)
+{
+    if (b->len + n >= b->size) {
+        b->overflow = true;
+        return;
+    }
+    memcpy(b->out + b->len, s, n);
+    b->len += n;
+}
+
+static void puts_(json_buf_t *b, const char *s)
+{
+    put(b, s, strlen(s));
+}
+
+static void putf(json_buf_t *b, const char *fmt, unsigned long long v, bool neg)
+{
+    char tmp[24];
+    int n = neg ? snprintf(tmp, sizeof(tmp), "-%llu", v + 1) : snprintf(tmp, sizeof(tmp), fmt, v);
+    put(b, tmp, n);
+}
+
+static void put_string(json_buf_t *b, const uint8_t *s, size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    put(b, "\"", 1);
+    for (size_t i = 0; i < n; i++) {
+        uint8_t c = s[i];
+        if (c == '"' || c == '\\') {
+            char esc[2] = { '\\', (char)c };
+            put(b, esc, 2);
+        } else if (c < 0x20) {
+            char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+            put(b, esc, 6);
+        } else {
+            put(b, (const char *)&c, 1);
+        }
+    }
+    put(b, "\"", 1);
+}
+
+static void put_bytes(json_buf_t *b, const char *field, const uint8_t *p, size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    bool mac = n == 6 && (strcmp(field, "bssid") == 0 || strcmp(field, "mac") == 0 ||
+                          strcmp(field, "da") == 0 || strcmp(field, "sa") == 0 ||
+                          strcmp(field, "twin") == 0);
+    bool ip4 = n == 4 && strcmp(field, "ip") == 0;
+    put(b, "\"", 1);
+    for (size_t i = 0; i < n; i++) {
+        if (ip4) {
+            putf(b, i ? ".%llu" : "%llu", p[i], false);
+            continue;
+        }
+        if (mac && i) {
+            put(b, ":", 1);
+        }
+        char h[2] = { hex[p[i] >> 4], hex[p[i] & 15] };
+        put(b, h, 2);
+    }
+    put(b, "\"", 1);
+}
+
+// Major type and argument of the item at in[*pos], false if truncated or unsupported
+static bool get_head(const uint8_t *in, size_t len, size_t *pos, uint8_t *major, uint64_t *arg)
+{
+    if (*pos >= len) {
+        return false;
+    }
+    uint8_t ib = in[(*pos)++];
+    *major = ib >> 5;
+    uint8_t ai = ib & 31;
+    if (ai < 24) {
+        *arg = ai;
+        return true;
+    }
+    if (ai > 27) {
+        return false;
+    }
+    size_t n = 1u << (ai - 24);
+    if (*pos + n > len) {
+        return false;
+    }
+    *arg = 0;
+    for (size_t i = 0; i < n; i++) {
+        *arg = *arg << 8 | in[(*pos)++];
+    }
+    return true;
+}
+
+size_t result_json(const uint8_t *in, size_t len, char *out, size_t size)
+{
+    json_buf_t b = { .out = out, .size = size };
+    size_t pos = 0;
+    uint8_t major;
+    uint64_t count, type;
+    if (!get_head(in, len, &pos, &major, &count) || major != 4 || count == 0) {
+        return 0;
+    }
+    if (!get_head(in, len, &pos, &major, &type) || major != 0) {
+        return 0;
+    }
+    const json_schema_t *schema = type < NUM_SCHEMAS && s_schemas[type].name ? &s_schemas[type] : NULL;
+    if (schema) {
+        puts_(&b, "{\"type\":\"");
+        puts_(&b, schema->name);
+        puts_(&b, "\"");
+    } else {
+        putf(&b, "{\"type\":\"type%llu\"", type, false);
+    }
+
+    for (uint64_t i = 0; i + 1 < count; i++) {
+        char key[8];
+        const char *field = schema && i < JSON_MAX_FIELDS ? schema->fields[i] : NULL;
+        if (field == NULL) {
+            snprintf(key, sizeof(key), "f%u", (unsigned)(i + 1));
+            field = key;
+        }
+        puts_(&b, ",\"");
+        puts_(&b, field);
+        puts_(&b, "\":");
+
+        uint64_t arg;
+        if (!get_head(in, len, &pos, &major, &arg)) {
+            return 0;
+        }
+        switch (major) {
+        case 0:
+            putf(&b, "%llu", arg, false);
+            break;
+        case 1:
+            putf(&b, NULL, arg, true);
+            break;
+        case 2:
+        case 3:
+            if (arg > len - pos) {
+                return 0;
+            }
+            if (major == 2) {
+                put_bytes(&b, field, in + pos, arg);
+            } else {
+                put_string(&b, in + pos, arg);
+            }
+            pos += arg;
+            break;
+        case 7:
+            if (arg != 22) {
+                return 0;
+            }
+            puts_(&b, "null");
+            break;
+        default:
+            return 0;
+        }
+    }
+    puts_(&b, "}\n");
+    if (b.overflow) {
+        // Too long for the line: keep the record boundary, replace its content
+        b.len = 0;
+        b.overflow = false;
+        putf(&b, "{\"type\":\"type%llu\",\"truncated\":true}\n", type, false);
+    }
+    out[b.len] = '\0';
+    return pos;
+}
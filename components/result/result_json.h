@@ -0,0 +1,21 @@
+/*
+    JSON rendering of result records, plain C (builds on the host).
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RESULT_JSON_LINE_MAX    512     // longest line written, longer records are marked truncated
+
+// Render the CBOR record at the start of in as one JSON object line ("{...}\n",
+// NUL-terminated) into out, returns the bytes of in consumed, 0 if malformed
+size_t result_json(const uint8_t *in, size_t len, char *out, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include "argtable3/argtable3.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "dispatch.h"
+#include "jobs.h"
+#include "script.h"
+
+#define SCRIPT_VAR_NAME     16
+#define SCRIPT_VAR_VALUE    64
+#define SCRIPT_EXPAND_SIZE  512     // substituted arguments of one operation
+#define SCRIPT_PATH_MAX     64
+
+static const char *TAG = "script";
+
+typedef enum {
+    OP_CMD,
+    OP_SET,
+    OP_REPEAT,
+    OP_END,
+    OP_SLEEP,
+    OP_ECHO,
+} op_type_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t argc;
+    uint16_t line;          // source line, for errors
+    uint16_t jump;          // REPEAT: its END, END: its REPEAT
+    uint16_t first_arg;     // index in script_t.args
+    uint32_t dollar;        // bit i: argument i contains '$'
+} script_op_t;
+
+typedef struct {
+    char *src;              // file contents, split in place
+    char **args;            // arguments of all operations
+    size_t nargs;
+    script_op_t *ops;
+    size_t nops;
+} script_t;
+
+typedef struct {
+    char name[SCRIPT_VAR_NAME];
+    char value[SCRIPT_VAR_VALUE];
+} script_var_t;
+
+typedef struct {
+    const script_t *sc;
+    const char *file;
+    int npos;
+    const char **pos;       // $1..$9
+    script_var_t vars[SCRIPT_MAX_VARS];
+    size_t nvars;
+    char expand[SCRIPT_EXPAND_SIZE];
+} script_ctx_t;
+
+static const char *s_base_path = "";
+
+static void script_free(script_t *sc)
+{
+    if (sc) {
+        free(sc->src);
+        free(sc->args);
+        free(sc->ops);
+        free(sc);
+    }
+}
+
+/* ---- parsing, done once per run ---- */
+
+static script_t *script_parse(const char *file, char *src)
+{
+    script_t *sc = calloc(1, sizeof(script_t));
+    char **argv = malloc(DISPATCH_MAX_ARGS * sizeof(char *));
+    uint16_t open[SCRIPT_MAX_DEPTH];
+    int depth = 0;
+    if (sc == NULL || argv == NULL) {
+        printf("%s: out of memory\n", file);
+        goto fail;
+    }
+    sc->src = src;
+
+    char *line = src;
+    for (int lineno = 1; line != NULL; lineno++) {
+        char *next = strchr(line, '\n');
+        if (next) {
+            *next++ = '\0';
+        }
+        size_t len = strlen(line);
+        if (len > 0 && line[len - 1] == '\r') {
+            line[len - 1] = '\0';
+        }
+        int argc = esp_console_split_argv(line, argv, DISPATCH_MAX_ARGS);
+        line = next;
+        if (argc == 0 || argv[0][0] == '#') {
+            continue;
+        }
+
+        script_op_t op = { .type = OP_CMD, .argc = argc, .line = lineno };
+        const char *err = NULL;
+        if (strcmp(argv[0], "set") == 0) {
+            op.type = OP_SET;
+            err = argc == 3 ? NULL : "usage: set <name> <value>";
+            if (!err && strlen(argv[1]) >= SCRIPT_VAR_NAME) {
+                err = "variable name too long";
+            }
+        } else if (strcmp(argv[0], "repeat") == 0) {
+            op.type = OP_REPEAT;
+            err = argc == 2 ? NULL : "usage: repeat <count>";
+            if (!err && depth == SCRIPT_MAX_DEPTH) {
+                err = "repeat nested too deep";
+            }
+        } else if (strcmp(argv[0], "end") == 0) {
+            op.type = OP_END;
+            err = depth > 0 ? NULL : "end without repeat";
+        } else if (strcmp(argv[0], "sleep") == 0) {
+            op.type = OP_SLEEP;
+            err = argc == 2 ? NULL : "usage: sleep <ms>";
+        } else if (strcmp(argv[0], "echo") == 0) {
+            op.type = OP_ECHO;
+        } else if (strcmp(argv[0], "run") == 0) {
+            err = "run cannot be nested";
+        }
+        if (err == NULL && sc->nops == SCRIPT_MAX_OPS) {
+            err = "script too long";
+        }
+        if (err) {
+            printf("%s:%d: %s\n", file, lineno, err);
+            goto fail;
+        }
+
+        // Keep the operation's arguments, the first one (the keyword) only for commands
+        int skip = op.type == OP_CMD ? 0 : 1;
+        op.argc = argc - skip;
+        op.first_arg = sc->nargs;
+        if (op.argc > 0) {
+            char **args = realloc(sc->args, (sc->nargs + op.argc) * sizeof(char *));
+            if (args == NULL) {
+                printf("%s: out of memory\n", file);
+                goto fail;
+            }
+            sc->args = args;
+        }
+        for (int i = 0; i < op.argc; i++) {
+            sc->args[sc->nargs++] = argv[skip + i];
+            if (strchr(argv[skip + i], '$')) {
+                op.dollar |= 1u << i;
+            }
+        }
+
+        if (op.type == OP_REPEAT) {
+            open[depth++] = sc->nops;
+        } else if (op.type == OP_END) {
+            op.jump = open[--depth];
+        }
+        script_op_t *ops = realloc(sc->ops, (sc->nops + 1) * sizeof(script_op_t));
+        if (ops == NULL) {
+            printf("%s: out of memory\n", file);
+            goto fail;
+        }
+        sc->ops = ops;
+        if (op.type == OP_END) {
+            sc->ops[op.jump].jump = sc->nops;
+        }
+        sc->ops[sc->nops++] = op;
+    }
+    if (depth > 0) {
+        printf("%s:%d: repeat without end\n", file, sc->ops[open[depth - 1]].line);
+        goto fail;
+    }
+    free(argv);
+    return sc;
+
+fail:
+    free(argv);
+    if (sc) {
+        script_free(sc);
+    } else {
+        free(src);
+    }
+    return NULL;
+}
+
+/* ---- execution ---- */
+
+static const char *var_get(const script_ctx_t *ctx, const char *name, size_t len)
+{
+    if (len == 1 && name[0] >= '1' && name[0] <= '9') {
+        int i = name[0] - '1';
+        return i < ctx->npos ? ctx->pos[i] : "";
+    }
+    for (size_t i = 0; i < ctx->nvars; i++) {
+        if (strlen(ctx->vars[i].name) == len && strncmp(ctx->vars[i].name, name, len) == 0) {
+            return ctx->vars[i].value;
+        }
+    }
+    return "";
+}
+
+static bool var_set(script_ctx_t *ctx, const char *name, const char *value)
+{
+    script_var_t *v = NULL;
+    for (size_t i = 0; i < ctx->nvars; i++) {
+        if (strcmp(ctx->vars[i].name, name) == 0) {
+            v = &ctx->vars[i];
+        }
+    }
+    if (v == NULL) {
+        if (ctx->nvars == SCRIPT_MAX_VARS) {
+            return false;
+        }
+        v = &ctx->vars[ctx->nvars++];
+        strlcpy(v->name, name, sizeof(v->name));
+    }
+    strlcpy(v->value, value, sizeof(v->value));
+    return true;
+}
+
+// Substitute $name, ${name}, $1..$9 and $$ into out, returns the length written or -1 when out is too small
+static int expand(const script_ctx_t *ctx, const char *in, char *out, size_t size)
+{
+    size_t n = 0;
+    while (*in) {
+        if (n + 1 >= size) {
+            return -1;
+        }
+        if (*in != '$') {
+            out[n++] = *in++;
+            continue;
+        }
+        in++;
+        const char *name = in;
+        size_t len;
+        if (*in == '$') {
+            out[n++] = '$';
+            in++;
+            continue;
+        } else if (*in == '{') {
+            name = ++in;
+            len = strcspn(in, "}");
+            in += len + (in[len] == '}');
+        } else if (*in >= '1' && *in <= '9') {
+            len = 1;
+            in++;
+        } else {
+            for (len = 0; isalnum((unsigned char)in[len]) || in[len] == '_'; len++) {
+            }
+            in += len;
+        }
+        for (const char *v = var_get(ctx, name, len); *v; v++) {
+            if (n + 1 >= size) {
+                return -1;
+            }
+            out[n++] = *v;
+        }
+    }
+    out[n] = '\0';
+    return n;
+}
+
+static void expand_error(const script_ctx_t *ctx, const script_op_t *op)
+{
+    printf("%s:%d: arguments longer than %d bytes once substituted\n",
+           ctx->file, op->line, SCRIPT_EXPAND_SIZE - 1);
+}
+
+// Argument i of op, substituted into the context buffer when it has variables, NULL if it overflows
+static const char *op_arg(script_ctx_t *ctx, const script_op_t *op, int i)
+{
+    const char *raw = ctx->sc->args[op->first_arg + i];
+    if (!(op->dollar & (1u << i))) {
+        return raw;
+    }
+    if (expand(ctx, raw, ctx->expand, sizeof(ctx->expand)) < 0) {
+        return NULL;
+    }
+    return ctx->expand;
+}
+
+static void script_sleep(uint32_t ms)
+{
+    while (ms > 0 && !job_cancelled()) {
+        uint32_t step = ms < 100 ? ms : 100;
+        vTaskDelay(pdMS_TO_TICKS(step));
+        ms -= step;
+    }
+}
+
+static int run_cmd(script_ctx_t *ctx, const script_op_t *op)
+{
+    char *argv[DISPATCH_MAX_ARGS + 1];
+    size_t used = 0;
+    for (int i = 0; i < op->argc; i++) {
+        const char *raw = ctx->sc->args[op->first_arg + i];
+        if (!(op->dollar & (1u << i))) {
+            argv[i] = (char *)raw;
+            continue;
+        }
+        // All substituted arguments of the command share the one buffer
+        int n = expand(ctx, raw, ctx->expand + used, sizeof(ctx->expand) - used);
+        if (n < 0) {
+            expand_error(ctx, op);
+            return -1;
+        }
+        argv[i] = ctx->expand + used;
+        used += n + 1;
+    }
+    argv[op->argc] = NULL;
+
+    int ret = 0;
+    esp_err_t err = dispatch_run_argv(op->argc, argv, &ret);
+    if (err == ESP_ERR_NOT_FOUND) {
+        printf("%s:%d: unknown command '%s'\n", ctx->file, op->line, argv[0]);
+        return -1;
+    }
+    if (err != ESP_OK) {
+        printf("%s:%d: %s\n", ctx->file, op->line, esp_err_to_name(err));
+        return -1;
+    }
+    if (ret != 0) {
+        printf("%s:%d: '%s' returned %d\n", ctx->file, op->line, argv[0], ret);
+    }
+    return ret;
+}
+
+static int script_exec(script_ctx_t *ctx, bool keep_going)
+{
+    const script_t *sc = ctx->sc;
+    int32_t left[SCRIPT_MAX_DEPTH];     // iterations left per open repeat
+    int depth = 0;
+    int status = 0;
+
+    size_t pc = 0;
+    while (pc < sc->nops) {
+        if (job_cancelled()) {
+            printf("%s: stopped\n", ctx->file);
+            return 1;
+        }
+        const script_op_t *op = &sc->ops[pc];
+        switch (op->type) {
+        case OP_REPEAT: {
+            const char *arg = op_arg(ctx, op, 0);
+            if (arg == NULL) {
+                expand_error(ctx, op);
+                return 1;
+            }
+            int32_t count = atoi(arg);
+            if (count <= 0) {
+                pc = op->jump + 1;
+                continue;
+            }
+            left[depth++] = count;
+            break;
+        }
+        case OP_END:
+            if (--left[depth - 1] > 0) {
+                pc = op->jump + 1;
+                continue;
+            }
+            depth--;
+            break;
+        case OP_SET: {
+            const char *value = op_arg(ctx, op, 1);
+            if (value == NULL) {
+                expand_error(ctx, op);
+                return 1;
+            }
+            if (!var_set(ctx, ctx->sc->args[op->first_arg], value)) {
+                printf("%s:%d: more than %d variables\n", ctx->file, op->line, SCRIPT_MAX_VARS);
+                return 1;
+            }
+            break;
+        }
+        case OP_SLEEP: {
+            const char *arg = op_arg(ctx, op, 0);
+            if (arg == NULL) {
+                expand_error(ctx, op);
+                return 1;
+            }
+            script_sleep(strtoul(arg, NULL, 10));
+            break;
+        }
+        case OP_ECHO:
+            for (int i = 0; i < op->argc; i++) {
+                const char *arg = op_arg(ctx, op, i);
+                if (arg == NULL) {
+                    printf("\n");
+                    expand_error(ctx, op);
+                    return 1;
+                }
+                printf(i ? " %s" : "%s", arg);
+            }
+            printf("\n");
+            break;
+        case OP_CMD:
+            if (run_cmd(ctx, op) != 0) {
+                status = 1;
+                if (!keep_going) {
+                    return status;
+                }
+            }
+            break;
+        }
+        pc++;
+    }
+    return status;
+}
+
+static char *script_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        printf("run: cannot open %s\n", path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *src = NULL;
+    if (size < 0 || size > SCRIPT_MAX_SIZE) {
+        printf("run: %s is larger than %d bytes\n", path, SCRIPT_MAX_SIZE);
+    } else if ((src = malloc(size + 1)) != NULL) {
+        size = fread(src, 1, size, f);
+        src[size] = '\0';
+    }
+    fclose(f);
+    return src;
+}
+
+static struct {
+    struct arg_lit *keep;
+    struct arg_str *file;
+    struct arg_str *args;
+    struct arg_end *end;
+} run_args;
+
+static int run_cmd_func(int argc, char **argv)
+{
+    if (arg_parse(argc, argv, (void **)&run_args) != 0) {
+        arg_print_errors(stderr, run_args.end, argv[0]);
+        return 1;
+    }
+    const char *file = run_args.file->sval[0];
+    char path[SCRIPT_PATH_MAX];
+    if (file[0] == '/') {
+        strlcpy(path, file, sizeof(path));
+    } else {
+        snprintf(path, sizeof(path), "%s/%s", s_base_path, file);
+    }
+
+    char *src = script_load(path);
+    if (src == NULL) {
+        return 1;
+    }
+    script_t *sc = script_parse(file, src);
+    if (sc == NULL) {
+        return 1;
+    }
+    script_ctx_t *ctx = calloc(1, sizeof(script_ctx_t));
+    if (ctx == NULL) {
+        script_free(sc);
+        return 1;
+    }
+    ctx->sc = sc;
+    ctx->file = file;
+    ctx->npos = run_args.args->count;
+    ctx->pos = run_args.args->sval;
+    ESP_LOGD(TAG, "%s: %u operations, %u arguments", file, (unsigned)sc->nops, (unsigned)sc->nargs);
+
+    int ret = script_exec(ctx, run_args.keep->count > 0);
+    free(ctx);
+    script_free(sc);
+    return ret;
+}
+
+void module_script(const char *base_path)
+{
+    s_base_path = base_path;
+    run_args.keep = arg_lit0("k", "keep-going", "Continue after a failing command");
+    run_args.file = arg_str1(NULL, NULL, "<file>", "Script, relative to the data partition");
+    run_args.args = arg_strn(NULL, NULL, "<arg>", 0, 9, "Values of $1..$9");
+    run_args.end = arg_end(2);
+    const esp_console_cmd_t run_def = {
+        .command = "run",
+        .help = "Run a script of commands (set, repeat/end, sleep, echo)",
+        .hint = NULL,
+        .func = &run_cmd_func,
+        .argtable = &run_args
+    };
+    ESP_ERROR_CHECK(dispatch_register(&run_def));
+}
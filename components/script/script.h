@@ -0,0 +1,34 @@
+/*
+    Command scripts.
+
+    `run <file> [args...]` executes a text file of console commands, one per
+    line, with a few statements of its own:
+
+        # comment
+        set host 192.168.1.1        variable, used as $host or ${host}
+        repeat 3                    loop (nestable), count may be a variable
+            ping -c 1 $host
+            sleep 500               milliseconds
+        end
+        echo done on $1             $1..$9 are the arguments of run
+
+    The file is parsed once into a list of pre-tokenized operations; loops
+    only substitute variables in the arguments that contain a '$'.
+*/
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SCRIPT_MAX_SIZE     8192    // bytes of script source
+#define SCRIPT_MAX_OPS      256
+#define SCRIPT_MAX_DEPTH    8       // nested repeat
+#define SCRIPT_MAX_VARS     16
+
+// Register `run`, relative file names are looked up in base_path
+void module_script(const char *base_path);
+
+#ifdef __cplusplus
+}
+#endif
@@ -13,17 +13,27 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <inttypes.h>
 #include "esp_log.h"
 #include "esp_console.h"
+#include "dispatch.h"
 #include "esp_chip_info.h"
+#if !CONFIG_IDF_TARGET_LINUX
 #include "esp_flash.h"
+#endif
 #include "argtable3/argtable3.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "esp_heap_caps.h"
 #include "cmd_system.h"
+#include "system_out.h"
+#include "result.h"
+#include "jobs.h"
+#include "arena.h"
+#include "boot.h"
 #include "sdkconfig.h"
 
 #ifdef CONFIG_FREERTOS_USE_STATS_FORMATTING_FUNCTIONS
@@ -39,15 +49,40 @@ static void register_restart(void);
 #if WITH_TASKS_INFO
 static void register_tasks(void);
 #endif
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+static void register_top(void);
+#endif
+#if CONFIG_DISPATCH_PROFILE
+static void register_memprof(void);
+#endif
+#if CONFIG_DISPATCH_PERF
+static void register_perf(void);
+#endif
+static void register_boottime(void);
 static void register_log_level(void);
+static void register_output(void);
 
 void register_system_common(void)
 {
-    //register_free();
-    //register_heap();
+    register_free();
+    register_heap();
+#if WITH_TASKS_INFO
+    register_tasks();
+#endif
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    register_top();
+#endif
+#if CONFIG_DISPATCH_PROFILE
+    register_memprof();
+#endif
+#if CONFIG_DISPATCH_PERF
+    register_perf();
+#endif
+    register_boottime();
     register_version();
     register_restart();
-    //register_log_level();
+    register_output();
+    register_log_level();
 }
 
 
@@ -78,26 +113,25 @@ static int get_version(int argc, char **argv)
         case CHIP_ESP32C2:
             model = "ESP32-C2";
             break;
+#if CONFIG_IDF_TARGET_LINUX
+        case CHIP_POSIX_LINUX:
+            model = "Linux";
+            break;
+#endif
         default:
             model = "Unknown";
             break;
     }
 
+#if CONFIG_IDF_TARGET_LINUX
+    flash_size = 0;                 // no flash on the host
+#else
     if(esp_flash_get_size(NULL, &flash_size) != ESP_OK) {
         printf("Get flash size failed");
         return 1;
     }
-    printf("IDF Version:%s\r\n", esp_get_idf_version());
-    printf("Chip info:\r\n");
-    printf("\tmodel:%s\r\n", model);
-    printf("\tcores:%d\r\n", info.cores);
-    printf("\tfeature:%s%s%s%s%"PRIu32"%s\r\n",
-           info.features & CHIP_FEATURE_WIFI_BGN ? "/802.11bgn" : "",
-           info.features & CHIP_FEATURE_BLE ? "/BLE" : "",
-           info.features & CHIP_FEATURE_BT ? "/BT" : "",
-           info.features & CHIP_FEATURE_EMB_FLASH ? "/Embedded-Flash:" : "/External-Flash:",
-           flash_size / (1024 * 1024), " MB");
-    printf("\trevision number:%d\r\n", info.revision);
+#endif
+    system_out_chip(result_sink_current(), model, &info, flash_size, esp_get_idf_version());
     return 0;
 }
 
@@ -109,7 +143,7 @@ static void register_version(void)
         .hint = NULL,
         .func = &get_version,
     };
-    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    ESP_ERROR_CHECK( dispatch_register(&cmd) );
 }
 
 /** 'restart' command restarts the program */
@@ -128,7 +162,7 @@ static void register_restart(void)
         .hint = NULL,
         .func = &restart,
     };
-    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    ESP_ERROR_CHECK( dispatch_register(&cmd) );
 }
 
 /** 'free' command prints available heap memory */
@@ -147,7 +181,7 @@ static void register_free(void)
         .hint = NULL,
         .func = &free_mem,
     };
-    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    ESP_ERROR_CHECK( dispatch_register(&cmd) );
 }
 
 /* 'heap' command prints minumum heap size */
@@ -155,6 +189,10 @@ static int heap_size(int argc, char **argv)
 {
     uint32_t heap_size = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
     printf("min heap size: %"PRIu32"\n", heap_size);
+    // free vs largest block: how fragmented the heap is
+    printf("free: %"PRIu32", largest free block: %"PRIu32"\n",
+           (uint32_t)heap_caps_get_free_size(MALLOC_CAP_DEFAULT),
+           (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
     return 0;
 }
 
@@ -166,7 +204,7 @@ static void register_heap(void)
         .hint = NULL,
         .func = &heap_size,
     };
-    ESP_ERROR_CHECK( esp_console_cmd_register(&heap_cmd) );
+    ESP_ERROR_CHECK( dispatch_register(&heap_cmd) );
 
 }
 
@@ -200,11 +238,326 @@ static void register_tasks(void)
         .hint = NULL,
         .func = &tasks_info,
     };
-    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    ESP_ERROR_CHECK( dispatch_register(&cmd) );
 }
 
 #endif // WITH_TASKS_INFO
 
+/** 'top' command shows the CPU use of each task over an interval */
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+
+#define TOP_SPARE_TASKS 4     // room for tasks created between sizing and snapshot
+
+static struct {
+    struct arg_int *delay;
+    struct arg_int *count;
+    struct arg_end *end;
+} top_args;
+
+typedef struct {
+    const char *name;
+    uint32_t delta;
+    UBaseType_t prio;
+    uint32_t hwm;
+    int core;
+} top_row_t;
+
+static int top_row_cmp(const void *a, const void *b)
+{
+    const top_row_t *ra = a, *rb = b;
+    return ra->delta < rb->delta ? 1 : ra->delta > rb->delta ? -1 : 0;
+}
+
+/* Snapshot of every task. uxTaskGetSystemState() returns 0 when the buffer
+ * is too small, so it is grown to the current task count and retried. */
+static UBaseType_t top_snapshot(TaskStatus_t **buf, UBaseType_t *cap, configRUN_TIME_COUNTER_TYPE *total)
+{
+    for (;;) {
+        UBaseType_t n = uxTaskGetSystemState(*buf, *cap, total);
+        if (n > 0) {
+            return n;
+        }
+        UBaseType_t want = uxTaskGetNumberOfTasks() + TOP_SPARE_TASKS;
+        TaskStatus_t *grown = realloc(*buf, want * sizeof(TaskStatus_t));
+        if (grown == NULL) {
+            return 0;
+        }
+        *buf = grown;
+        *cap = want;
+    }
+}
+
+static int top_cmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &top_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, top_args.end, argv[0]);
+        return 1;
+    }
+    int delay_ms = top_args.delay->count ? top_args.delay->ival[0] : 1000;
+    int count = top_args.count->count ? top_args.count->ival[0] : 1;
+    if (delay_ms < 100) {
+        delay_ms = 100;
+    }
+
+    UBaseType_t cap_before = uxTaskGetNumberOfTasks() + TOP_SPARE_TASKS;
+    UBaseType_t cap_after = cap_before;
+    UBaseType_t cap_rows = cap_before;
+    TaskStatus_t *before = malloc(cap_before * sizeof(TaskStatus_t));
+    TaskStatus_t *after = malloc(cap_after * sizeof(TaskStatus_t));
+    top_row_t *rows = malloc(cap_rows * sizeof(top_row_t));
+    configRUN_TIME_COUNTER_TYPE total_before, total_after;
+    UBaseType_t n_before = 0;
+    if (before && after && rows) {
+        n_before = top_snapshot(&before, &cap_before, &total_before);
+    }
+    if (n_before == 0) {
+        free(before);
+        free(after);
+        free(rows);
+        ESP_LOGE(TAG, "failed to allocate buffer for top");
+        return 1;
+    }
+    int ret = 0;
+
+    for (int iter = 0; iter < count && !job_cancelled(); iter++) {
+        vTaskDelay(pdMS_TO_TICKS(delay_ms));
+        UBaseType_t n_after = top_snapshot(&after, &cap_after, &total_after);
+        if (n_after > cap_rows) {
+            top_row_t *grown = realloc(rows, n_after * sizeof(top_row_t));
+            if (grown) {
+                rows = grown;
+                cap_rows = n_after;
+            } else {
+                n_after = 0;
+            }
+        }
+        if (n_after == 0) {
+            ESP_LOGE(TAG, "failed to allocate buffer for top");
+            ret = 1;
+            break;
+        }
+        // The counters of all cores share one time base
+        uint32_t elapsed = (uint32_t)(total_after - total_before) * portNUM_PROCESSORS;
+        size_t n_rows = 0;
+        for (UBaseType_t i = 0; i < n_after; i++) {
+            uint32_t prev = 0;
+            for (UBaseType_t j = 0; j < n_before; j++) {
+                if (before[j].xHandle == after[i].xHandle) {
+                    prev = before[j].ulRunTimeCounter;
+                    break;
+                }
+            }
+            top_row_t *r = &rows[n_rows++];
+            r->name = after[i].pcTaskName;
+            r->delta = (uint32_t)after[i].ulRunTimeCounter - prev;
+            r->prio = after[i].uxCurrentPriority;
+            r->hwm = after[i].usStackHighWaterMark;
+#ifdef CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+            r->core = after[i].xCoreID;
+#else
+            r->core = -1;
+#endif
+        }
+        qsort(rows, n_rows, sizeof(top_row_t), top_row_cmp);
+
+        printf("%-16s %5s %4s %4s %6s\n", "Task", "CPU%", "Prio", "Core", "HWM");
+        for (size_t i = 0; i < n_rows; i++) {
+            uint32_t permille = elapsed ? (uint64_t)rows[i].delta * 1000 / elapsed : 0;
+            char core[8] = "-";
+            if (rows[i].core >= 0 && rows[i].core < portNUM_PROCESSORS) {
+                snprintf(core, sizeof(core), "%d", rows[i].core);
+            }
+            printf("%-16s %3"PRIu32".%"PRIu32" %4u %4s %6"PRIu32"\n", rows[i].name, permille / 10, permille % 10,
+                   (unsigned)rows[i].prio, core, rows[i].hwm);
+        }
+        printf("free heap %"PRIu32", largest block %"PRIu32"\n\n",
+               (uint32_t)heap_caps_get_free_size(MALLOC_CAP_DEFAULT),
+               (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
+
+        // This round's end is the next round's start
+        TaskStatus_t *t = before;
+        UBaseType_t c = cap_before;
+        before = after;
+        cap_before = cap_after;
+        after = t;
+        cap_after = c;
+        n_before = n_after;
+        total_before = total_after;
+    }
+    free(before);
+    free(after);
+    free(rows);
+    return ret;
+}
+
+static void register_top(void)
+{
+    top_args.delay = arg_int0("d", "delay", "<ms>", "Sampling interval (default 1000)");
+    top_args.count = arg_int0("n", "count", "<n>", "Number of intervals (default 1)");
+    top_args.end = arg_end(2);
+
+    const esp_console_cmd_t cmd = {
+        .command = "top",
+        .help = "CPU use, priority, core and stack high water mark of each task over an interval",
+        .hint = NULL,
+        .func = &top_cmd,
+        .argtable = &top_args
+    };
+    ESP_ERROR_CHECK( dispatch_register(&cmd) );
+}
+
+#endif // CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+
+/** 'memprof' command prints the heap and stack profile of each command */
+#if CONFIG_DISPATCH_PROFILE
+
+static struct {
+    struct arg_lit *reset;
+    struct arg_end *end;
+} memprof_args;
+
+static int memprof_cmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &memprof_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, memprof_args.end, argv[0]);
+        return 1;
+    }
+    printf("%-18s %6s %8s %8s %8s %8s %6s %6s\n", "Command", "Calls", "Kept", "MaxKept", "MinFree", "MinBlock",
+           "Stack", "Arena");
+    dispatch_prof_t p;
+    const char *name;
+    for (size_t i = 0; (name = dispatch_prof(i, &p)) != NULL; i++) {
+        if (p.calls == 0) {
+            continue;
+        }
+        printf("%-18s %6"PRIu32" %8"PRIi32" %8"PRIi32" %8"PRIu32" %8"PRIu32" %6"PRIu32" %6"PRIu32"\n",
+               name, p.calls, p.heap_kept, p.heap_kept_max, p.min_free, p.min_largest, p.min_stack, p.arena_max);
+    }
+    arena_stats_t a;
+    arena_get_stats(&a);
+    printf("Arenas: %d x %d B, peak %"PRIu32" B, %"PRIu32" calls without one, %"PRIu32" allocations (%"PRIu32" B) on the heap\n",
+           CONFIG_ARENA_COUNT, CONFIG_ARENA_SIZE, a.high, a.misses, a.spills, a.spill_bytes);
+    if (memprof_args.reset->count) {
+        dispatch_prof_reset();
+    }
+    return 0;
+}
+
+static void register_memprof(void)
+{
+    memprof_args.reset = arg_lit0("r", "reset", "Reset the profiles after printing them");
+    memprof_args.end = arg_end(1);
+
+    const esp_console_cmd_t cmd = {
+        .command = "memprof",
+        .help = "Heap kept, lowest free heap, smallest largest block and stack high water mark per command",
+        .hint = NULL,
+        .func = &memprof_cmd,
+        .argtable = &memprof_args
+    };
+    ESP_ERROR_CHECK( dispatch_register(&cmd) );
+}
+
+#endif // CONFIG_DISPATCH_PROFILE
+
+/** 'perf' command prints the latency of each command and module phase */
+#if CONFIG_DISPATCH_PERF
+
+static struct {
+    struct arg_lit *reset;
+    struct arg_end *end;
+} perf_args;
+
+static void perf_row(const char *name, const perf_hist_t *h)
+{
+    printf("%-18s %7"PRIu32" %10"PRIu32" %10"PRIu32" %10"PRIu32" %10"PRIu32"\n", name, h->count,
+           (uint32_t)(h->sum_us / h->count), perf_hist_percentile(h, 500), perf_hist_percentile(h, 990), h->max_us);
+}
+
+static int perf_cmd(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &perf_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, perf_args.end, argv[0]);
+        return 1;
+    }
+    // Copies taken under the histogram lock: they keep changing while we print
+    perf_hist_t *h = malloc(sizeof(perf_hist_t));
+    if (h == NULL) {
+        return 1;
+    }
+    printf("%-18s %7s %10s %10s %10s %10s  (us)\n", "Command", "Count", "Mean", "p50", "p99", "Max");
+    for (size_t i = 0; i < dispatch_count(); i++) {
+        perf_hist_t *latency = dispatch_latency(i);
+        dispatch_prof_t unused;
+        if (latency == NULL) {
+            continue;
+        }
+        perf_hist_copy(h, latency, perf_args.reset->count > 0);
+        if (h->count) {
+            perf_row(dispatch_prof(i, &unused), h);
+        }
+    }
+    bool header = false;
+    for (perf_phase_t *p = perf_phases(); p; p = p->next) {
+        perf_hist_copy(h, &p->hist, perf_args.reset->count > 0);
+        if (h->count == 0) {
+            continue;
+        }
+        if (!header) {
+            printf("%-18s\n", "Phase");
+            header = true;
+        }
+        perf_row(p->name, h);
+    }
+    free(h);
+    return 0;
+}
+
+static void register_perf(void)
+{
+    perf_args.reset = arg_lit0("r", "reset", "Reset the histograms after printing them");
+    perf_args.end = arg_end(1);
+
+    const esp_console_cmd_t cmd = {
+        .command = "perf",
+        .help = "Count, mean, p50, p99 and max latency of each command and module phase",
+        .hint = NULL,
+        .func = &perf_cmd,
+        .argtable = &perf_args
+    };
+    ESP_ERROR_CHECK( dispatch_register(&cmd) );
+}
+
+#endif // CONFIG_DISPATCH_PERF
+
+/** 'boottime' command prints the boot phases and the lazy inits done since */
+
+static int boottime_cmd(int argc, char **argv)
+{
+    boot_phase_t p;
+    printf("%-14s %8s %8s  (ms since start)\n", "Phase", "At", "Took");
+    for (size_t i = 0; boot_phase(i, &p); i++) {
+        printf("%-14s %6"PRIu32".%"PRIu32" %6"PRIu32".%"PRIu32"%s\n", p.name,
+               (uint32_t)(p.at_us / 1000), (uint32_t)(p.at_us / 100 % 10),
+               p.took_us / 1000, p.took_us / 100 % 10, p.lazy ? "  first use" : "");
+    }
+    return 0;
+}
+
+static void register_boottime(void)
+{
+    const esp_console_cmd_t cmd = {
+        .command = "boottime",
+        .help = "Time of each boot phase and of the deferred inits (NVS, Wi-Fi stack) on first use",
+        .hint = NULL,
+        .func = &boottime_cmd,
+    };
+    ESP_ERROR_CHECK( dispatch_register(&cmd) );
+}
+
 /** log_level command changes log level via esp_log_level_set */
 
 static struct {
@@ -267,5 +620,55 @@ static void register_log_level(void)
         .func = &log_level,
         .argtable = &log_level_args
     };
-    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    ESP_ERROR_CHECK( dispatch_register(&cmd) );
+}
+
+/** 'output' command selects how commands report their results */
+
+static struct {
+    struct arg_str *mode;
+    struct arg_end *end;
+} output_args;
+
+static const char *s_output_names[] = {
+    [RESULT_OUTPUT_TEXT] = "text",
+    [RESULT_OUTPUT_JSON] = "json",
+    [RESULT_OUTPUT_CBOR] = "cbor",
+};
+
+static int output_mode(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &output_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, output_args.end, argv[0]);
+        return 1;
+    }
+    if (output_args.mode->count == 0) {
+        printf("%s\n", s_output_names[result_output_get()]);
+        return 0;
+    }
+    const char *mode_str = output_args.mode->sval[0];
+    for (result_output_t mode = RESULT_OUTPUT_TEXT; mode <= RESULT_OUTPUT_CBOR; mode++) {
+        if (strcmp(mode_str, s_output_names[mode]) == 0) {
+            result_output_set(mode);
+            return 0;
+        }
+    }
+    printf("Invalid output mode '%s', choose from text|json|cbor\n", mode_str);
+    return 1;
+}
+
+static void register_output(void)
+{
+    output_args.mode = arg_str0(NULL, NULL, "<text|json|cbor>", "Result format of the commands, prints the current one without argument");
+    output_args.end = arg_end(1);
+
+    const esp_console_cmd_t cmd = {
+        .command = "output",
+        .help = "Print command results as text, one JSON object per line, or framed CBOR records",
+        .hint = NULL,
+        .func = &output_mode,
+        .argtable = &output_args
+    };
+    ESP_ERROR_CHECK( dispatch_register(&cmd) );
 }
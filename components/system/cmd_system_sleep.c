@@ -19,6 +19,8 @@
 #include <unistd.h>
 #include "esp_log.h"
 #include "esp_console.h"
+#include "dispatch.h"
+#include "async_out.h"
 #include "esp_chip_info.h"
 #include "esp_sleep.h"
 #include "driver/rtc_io.h"
@@ -80,6 +82,10 @@ static int deep_sleep(int argc, char **argv)
 #if CONFIG_IDF_TARGET_ESP32
     rtc_gpio_isolate(GPIO_NUM_12);
 #endif //CONFIG_IDF_TARGET_ESP32
+    fflush(stdout);
+    // Same as light sleep: drain the async ring, then let the UART FIFO empty
+    async_out_flush(1000);
+    uart_wait_tx_idle_polling(CONFIG_ESP_CONSOLE_UART_NUM);
     esp_deep_sleep_start();
     return 1;
 }
@@ -112,7 +118,7 @@ void register_system_deep_sleep(void)
         .func = &deep_sleep,
         .argtable = &deep_sleep_args
     };
-    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    ESP_ERROR_CHECK( dispatch_register(&cmd) );
 }
 #endif // SOC_DEEP_SLEEP_SUPPORTED
 
@@ -164,7 +170,9 @@ static int light_sleep(int argc, char **argv)
         ESP_ERROR_CHECK( esp_sleep_enable_uart_wakeup(CONFIG_ESP_CONSOLE_UART_NUM) );
     }
     fflush(stdout);
-    fsync(fileno(stdout));
+    // stdout may be the async ring: drain it, then wait for the UART FIFO
+    async_out_flush(1000);
+    uart_wait_tx_idle_polling(CONFIG_ESP_CONSOLE_UART_NUM);
     esp_light_sleep_start();
     esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
 
@@ -209,6 +217,6 @@ void register_system_light_sleep(void)
         .func = &light_sleep,
         .argtable = &light_sleep_args
     };
-    ESP_ERROR_CHECK( esp_console_cmd_register(&cmd) );
+    ESP_ERROR_CHECK( dispatch_register(&cmd) );
 }
 #endif // SOC_LIGHT_SLEEP_SUPPORTED
@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <inttypes.h>
+#include "system_out.h"
+
+void system_out_chip(result_sink_t *sink, const char *model, const esp_chip_info_t *info,
+                     uint32_t flash_size, const char *idf_version)
+{
+    if (sink) {
+        result_rec_t rec;
+        result_begin(&rec, sink, RESULT_CHIP);
+        result_str(&rec, model);
+        result_uint(&rec, info->cores);
+        result_uint(&rec, info->revision);
+        result_uint(&rec, flash_size / (1024 * 1024));
+        result_str(&rec, idf_version);
+        result_end(&rec);
+        return;
+    }
+    printf("IDF Version:%s\r\n", idf_version);
+    printf("Chip info:\r\n");
+    printf("\tmodel:%s\r\n", model);
+    printf("\tcores:%d\r\n", info->cores);
+    printf("\tfeature:%s%s%s%s%"PRIu32"%s\r\n",
+           info->features & CHIP_FEATURE_WIFI_BGN ? "/802.11bgn" : "",
+           info->features & CHIP_FEATURE_BLE ? "/BLE" : "",
+           info->features & CHIP_FEATURE_BT ? "/BT" : "",
+           info->features & CHIP_FEATURE_EMB_FLASH ? "/Embedded-Flash:" : "/External-Flash:",
+           flash_size / (1024 * 1024), " MB");
+    printf("\trevision number:%d\r\n", info->revision);
+}
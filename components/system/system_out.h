@@ -0,0 +1,22 @@
+/*
+    Output of the system commands that have a record: `version`. A record
+    when the command has a sink, the text lines otherwise. The chip is
+    queried by the caller, so the host tests (test/host) check both
+    formats against their golden files.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "esp_chip_info.h"
+#include "result.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void system_out_chip(result_sink_t *sink, const char *model, const esp_chip_info_t *info,
+                     uint32_t flash_size, const char *idf_version);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include "sdkconfig.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include "host_sockets.h"       // lwIP over the TAP netif, not the host's stack
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+#include "argtable3/argtable3.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_netif.h"
+#include "dispatch.h"
+#include "pipeline.h"
+#include "tcp_console.h"
+
+#ifdef CONFIG_LWIP_TCP_MSS
+#define TCP_CONSOLE_BATCH   CONFIG_LWIP_TCP_MSS     // output buffer: one segment per write
+#else
+#define TCP_CONSOLE_BATCH   1460
+#endif
+#define TCP_CONSOLE_LINE_MAX    CONFIG_CONSOLE_MAX_COMMAND_LINE_LENGTH
+#define TCP_CONSOLE_CMD_NAME    24
+
+static const char *TAG = "TCP_CONSOLE";
+
+typedef struct {
+    int sock;               // -1 when the slot is free
+    uint32_t id;
+    struct sockaddr_in peer;
+    int64_t since_us;
+    uint32_t rx_bytes;
+    uint32_t tx_bytes;
+    uint32_t tx_writes;     // send() calls, tx_bytes / tx_writes is the batch size
+    uint32_t commands;
+    char running[TCP_CONSOLE_CMD_NAME];
+} session_t;
+
+static session_t s_sessions[CONFIG_TCP_CONSOLE_MAX_SESSIONS] = {
+    [0 ... CONFIG_TCP_CONSOLE_MAX_SESSIONS - 1] = { .sock = -1 },
+};
+static SemaphoreHandle_t s_lock;
+static StaticSemaphore_t s_lock_buf;
+static int s_listen = -1;
+static uint16_t s_port;
+static const char *s_prompt = "> ";
+static uint32_t s_next_id = 1;
+
+static int session_write(void *cookie, const char *data, int len)
+{
+    session_t *s = cookie;
+    int off = 0;
+    while (off < len) {
+        int n = send(s->sock, data + off, len - off, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        off += n;
+    }
+    s->tx_bytes += len;
+    s->tx_writes++;
+    return len;
+}
+
+// Run one line, false when the client asked to leave
+static bool session_exec(session_t *s, char *line)
+{
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    if (*line == '\0') {
+        return true;
+    }
+    if (strcmp(line, "exit") == 0 || strcmp(line, "quit") == 0) {
+        return false;
+    }
+
+    size_t name_len = strcspn(line, " \t");
+    if (name_len >= TCP_CONSOLE_CMD_NAME) {
+        name_len = TCP_CONSOLE_CMD_NAME - 1;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    memcpy(s->running, line, name_len);
+    s->running[name_len] = '\0';
+    s->commands++;
+    xSemaphoreGive(s_lock);
+
+    // Same messages as the esp_console REPL
+    int ret = 0;
+    esp_err_t err = dispatch_run(line, &ret);
+    if (err == ESP_ERR_NOT_FOUND) {
+        printf("Unrecognized command\n");
+    } else if (err == ESP_OK && ret != ESP_OK) {
+        printf("Command returned non-zero error code: 0x%x (%s)\n", ret, esp_err_to_name(ret));
+    } else if (err != ESP_OK && err != ESP_ERR_INVALID_ARG) {
+        printf("Internal error: %s\n", esp_err_to_name(err));
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s->running[0] = '\0';
+    xSemaphoreGive(s_lock);
+    return true;
+}
+
+static void session_task(void *arg)
+{
+    session_t *s = arg;
+    FILE *console_out = stdout, *console_err = stderr;
+    FILE *out = funopen(s, NULL, session_write, NULL, NULL);
+    char *line = malloc(TCP_CONSOLE_LINE_MAX);
+    if (out == NULL || line == NULL) {
+        ESP_LOGE(TAG, "Session %" PRIu32 ": out of memory", s->id);
+        goto done;
+    }
+    // stdout/stderr are per task: everything the commands print goes to this client
+    setvbuf(out, NULL, _IOFBF, TCP_CONSOLE_BATCH);
+    stdout = out;
+    stderr = out;
+
+    printf("ESPILON console, session %" PRIu32 ". Type 'help' to get the list of commands, 'exit' to leave.\n", s->id);
+    printf("%s", s_prompt);
+    fflush(out);
+
+    size_t len = 0;
+    bool overflow = false;
+    char buf[128];
+    while (true) {
+        int n = recv(s->sock, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            break;
+        }
+        s->rx_bytes += n;
+        for (int i = 0; i < n; i++) {
+            char c = buf[i];
+            if (c == '\r' || c == '\0') {
+                continue;
+            }
+            if (c != '\n') {
+                if (len < TCP_CONSOLE_LINE_MAX - 1) {
+                    line[len++] = c;
+                } else {
+                    overflow = true;
+                }
+                continue;
+            }
+            line[len] = '\0';
+            if (overflow) {
+                printf("Line longer than %d bytes, ignored\n", TCP_CONSOLE_LINE_MAX - 1);
+            } else if (!session_exec(s, line)) {
+                goto done;
+            }
+            len = 0;
+            overflow = false;
+            printf("%s", s_prompt);
+            fflush(out);
+        }
+    }
+
+done:
+    if (out) {
+        fflush(out);
+        stdout = console_out;
+        stderr = console_err;
+        fclose(out);
+    }
+    free(line);
+    ESP_LOGI(TAG, "Session %" PRIu32 " closed", s->id);
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    close(s->sock);
+    s->sock = -1;
+    xSemaphoreGive(s_lock);
+    vTaskDelete(NULL);
+}
+
+static void listen_task(void *arg)
+{
+    while (true) {
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        int sock = accept(s_listen, (struct sockaddr *)&peer, &peer_len);
+        if (sock < 0) {
+            ESP_LOGE(TAG, "accept failed: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            continue;
+        }
+        // Output is already batched per MSS, send each flush right away
+        int one = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        session_t *s = NULL;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        for (int i = 0; i < CONFIG_TCP_CONSOLE_MAX_SESSIONS; i++) {
+            if (s_sessions[i].sock < 0) {
+                s = &s_sessions[i];
+                memset(s, 0, sizeof(*s));
+                s->sock = sock;
+                s->id = s_next_id++;
+                s->peer = peer;
+                s->since_us = esp_timer_get_time();
+                break;
+            }
+        }
+        xSemaphoreGive(s_lock);
+        if (s == NULL) {
+            static const char busy[] = "Too many sessions\n";
+            send(sock, busy, sizeof(busy) - 1, 0);
+            close(sock);
+            continue;
+        }
+
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "tcpcon%" PRIu32, s->id);
+        if (pipeline_task_create(session_task, name, CONFIG_TCP_CONSOLE_STACK_SIZE, s,
+                                 CONFIG_TCP_CONSOLE_PRIORITY, NULL) != pdPASS) {
+            ESP_LOGE(TAG, "Cannot create session task");
+            xSemaphoreTake(s_lock, portMAX_DELAY);
+            close(sock);
+            s->sock = -1;
+            xSemaphoreGive(s_lock);
+            continue;
+        }
+        ESP_LOGI(TAG, "Session %" PRIu32 " from %s:%u", s->id, inet_ntoa(peer.sin_addr), ntohs(peer.sin_port));
+    }
+}
+
+esp_err_t tcp_console_start(uint16_t port, const char *prompt)
+{
+    if (s_lock == NULL) {
+        s_lock = xSemaphoreCreateMutexStatic(&s_lock_buf);
+    }
+    if (s_listen >= 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (prompt) {
+        s_prompt = prompt;
+    }
+    // lwIP has to be up before the first socket, a no-op when Wi-Fi already did it
+    ESP_ERROR_CHECK(esp_netif_init());
+
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "socket failed: errno %d", errno);
+        return ESP_FAIL;
+    }
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(sock, 2) != 0) {
+        ESP_LOGE(TAG, "Cannot listen on port %u: errno %d", port, errno);
+        close(sock);
+        return ESP_FAIL;
+    }
+    s_listen = sock;
+    s_port = port;
+    if (xTaskCreate(listen_task, "tcpcon_listen", 3072, NULL, CONFIG_TCP_CONSOLE_PRIORITY, NULL) != pdPASS) {
+        close(sock);
+        s_listen = -1;
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Console listening on TCP port %u", port);
+    return ESP_OK;
+}
+
+static struct {
+    struct arg_int *port;
+    struct arg_end *end;
+} start_args;
+
+static int start_cmd(int argc, char **argv)
+{
+    if (arg_parse(argc, argv, (void **)&start_args) != 0) {
+        arg_print_errors(stderr, start_args.end, argv[0]);
+        return 1;
+    }
+    uint16_t port = start_args.port->count ? start_args.port->ival[0] : CONFIG_TCP_CONSOLE_PORT;
+    esp_err_t err = tcp_console_start(port, NULL);
+    if (err == ESP_ERR_INVALID_STATE) {
+        printf("Already listening on port %u\n", s_port);
+        return 0;
+    }
+    return err == ESP_OK ? 0 : 1;
+}
+
+static int sessions_cmd(int argc, char **argv)
+{
+    if (s_listen < 0) {
+        printf("TCP console not started (tcp_console_start)\n");
+        return 0;
+    }
+    printf("Listening on port %u\n", s_port);
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_TCP_CONSOLE_MAX_SESSIONS; i++) {
+        const session_t *s = &s_sessions[i];
+        if (s->sock < 0) {
+            continue;
+        }
+        printf("[%" PRIu32 "] %s:%u  %llds  rx=%" PRIu32 " tx=%" PRIu32 " in %" PRIu32 " writes  cmds=%" PRIu32 "  %s\n",
+               s->id, inet_ntoa(s->peer.sin_addr), ntohs(s->peer.sin_port), (now - s->since_us) / 1000000,
+               s->rx_bytes, s->tx_bytes, s->tx_writes, s->commands, s->running[0] ? s->running : "-");
+    }
+    xSemaphoreGive(s_lock);
+    return 0;
+}
+
+void module_tcp_console(void)
+{
+    if (s_lock == NULL) {
+        s_lock = xSemaphoreCreateMutexStatic(&s_lock_buf);
+    }
+
+    start_args.port = arg_int0("p", "port", "<port>", "TCP port (default CONFIG_TCP_CONSOLE_PORT)");
+    start_args.end = arg_end(1);
+    const esp_console_cmd_t start_def = {
+        .command = "tcp_console_start",
+        .help = "Serve this console over TCP (connect with nc)",
+        .hint = NULL,
+        .func = &start_cmd,
+        .argtable = &start_args
+    };
+    ESP_ERROR_CHECK(dispatch_register(&start_def));
+
+    const esp_console_cmd_t sessions_def = {
+        .command = "sessions",
+        .help = "List TCP console sessions",
+        .hint = NULL,
+        .func = &sessions_cmd,
+    };
+    ESP_ERROR_CHECK(dispatch_register(&sessions_def));
+}
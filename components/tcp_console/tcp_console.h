@@ -0,0 +1,28 @@
+/*
+    Console over TCP.
+
+    Runs the same command set as the UART REPL (through the dispatcher) for
+    up to CONFIG_TCP_CONSOLE_MAX_SESSIONS clients at once, e.g.
+        rlwrap nc <esp_ip> 2323
+    Line editing stays on the client. Every session has its own task whose
+    stdout/stderr go to the socket through a buffer of one TCP MSS, flushed
+    when it is full and once the command returns.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Start listening, prompt is printed before each command line
+esp_err_t tcp_console_start(uint16_t port, const char *prompt);
+
+// `sessions` command
+void module_tcp_console(void);
+
+#ifdef __cplusplus
+}
+#endif
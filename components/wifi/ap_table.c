@@ -0,0 +1,148 @@
+#include <string.h>
+#include "ap_table.h"
+
+static const char *const s_event_names[] = { "appeared", "disappeared", "rogue_twin", "channel" };
+
+static void emit_event(ap_table_t *t, const ap_event_t *ev)
+{
+    if (t->fn) {
+        t->fn(ev, t->ctx);
+    }
+}
+
+static void emit(ap_table_t *t, ap_event_type_t type, const ap_entry_t *ap, const ap_entry_t *twin, uint8_t prev)
+{
+    const ap_event_t ev = { .type = type, .ap = ap, .twin = twin, .prev_channel = prev };
+    emit_event(t, &ev);
+}
+
+void ap_table_init(ap_table_t *t, ap_entry_t *entries, size_t capacity, uint32_t lost_after_rounds,
+                   ap_event_fn_t fn, void *ctx)
+{
+    memset(entries, 0, capacity * sizeof(ap_entry_t));
+    *t = (ap_table_t){
+        .entries = entries,
+        .capacity = capacity,
+        .lost_after_rounds = lost_after_rounds,
+        .fn = fn,
+        .ctx = ctx,
+    };
+}
+
+static ap_entry_t *find(ap_table_t *t, const uint8_t *bssid)
+{
+    for (size_t i = 0; i < t->capacity; i++) {
+        if (t->entries[i].used && memcmp(t->entries[i].bssid, bssid, 6) == 0) {
+            return &t->entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Free slot, or the one seen the longest ago, reported gone before it is reused
+static ap_entry_t *slot(ap_table_t *t)
+{
+    ap_entry_t *oldest = NULL;
+    for (size_t i = 0; i < t->capacity; i++) {
+        ap_entry_t *e = &t->entries[i];
+        if (!e->used) {
+            return e;
+        }
+        if (oldest == NULL || e->last_seen < oldest->last_seen) {
+            oldest = e;
+        }
+    }
+    if (oldest) {
+        const ap_event_t ev = { .type = AP_EVENT_DISAPPEARED, .ap = oldest, .evicted = true };
+        emit_event(t, &ev);
+        oldest->used = false;
+        t->evicted++;
+        t->count--;
+    }
+    return oldest;
+}
+
+// Another BSSID, or this one before, with the same SSID and another auth mode
+static const ap_entry_t *twin_of(const ap_table_t *t, const ap_entry_t *ap)
+{
+    if (ap->ssid[0] == '\0') {
+        return NULL;                    // hidden: nothing to compare
+    }
+    for (size_t i = 0; i < t->capacity; i++) {
+        const ap_entry_t *e = &t->entries[i];
+        if (e != ap && e->used && e->authmode != ap->authmode && strcmp(e->ssid, ap->ssid) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+void ap_table_update(ap_table_t *t, const ap_sighting_t *s, uint32_t now)
+{
+    ap_entry_t *e = find(t, s->bssid);
+    if (e == NULL) {
+        e = slot(t);
+        if (e == NULL) {
+            return;                     // capacity 0
+        }
+        memset(e, 0, sizeof(*e));
+        memcpy(e->bssid, s->bssid, 6);
+        memcpy(e->ssid, s->ssid, sizeof(e->ssid));
+        e->ssid[AP_TABLE_SSID_LEN] = '\0';
+        e->channel = s->channel;
+        e->authmode = s->authmode;
+        e->used = true;
+        e->rssi_x16 = s->rssi * 16;
+        e->first_seen = e->last_seen = now;
+        e->last_round = t->round;
+        e->sightings = 1;
+        t->count++;
+        emit(t, AP_EVENT_APPEARED, e, NULL, 0);
+        const ap_entry_t *twin = twin_of(t, e);
+        if (twin) {
+            emit(t, AP_EVENT_ROGUE_TWIN, e, twin, 0);
+        }
+        return;
+    }
+
+    e->rssi_x16 += (s->rssi * 16 - e->rssi_x16) / (1 << AP_TABLE_EWMA_SHIFT);
+    e->last_seen = now;
+    e->last_round = t->round;
+    e->sightings++;
+    if (e->ssid[0] == '\0' && s->ssid[0] != '\0') {
+        // Hidden AP named by a directed probe
+        memcpy(e->ssid, s->ssid, sizeof(e->ssid));
+        e->ssid[AP_TABLE_SSID_LEN] = '\0';
+    }
+    if (s->channel != e->channel) {
+        uint8_t prev = e->channel;
+        e->channel = s->channel;
+        e->channel_changes++;
+        emit(t, AP_EVENT_CHANNEL, e, NULL, prev);
+    }
+    if (s->authmode != e->authmode) {
+        // Same BSSID, other security: reported against its own previous state
+        ap_entry_t before = *e;
+        e->authmode = s->authmode;
+        e->auth_changes++;
+        emit(t, AP_EVENT_ROGUE_TWIN, e, &before, 0);
+    }
+}
+
+void ap_table_expire(ap_table_t *t)
+{
+    for (size_t i = 0; i < t->capacity; i++) {
+        ap_entry_t *e = &t->entries[i];
+        if (e->used && t->round - e->last_round >= t->lost_after_rounds) {
+            emit(t, AP_EVENT_DISAPPEARED, e, NULL, 0);
+            e->used = false;
+            t->count--;
+        }
+    }
+    t->round++;
+}
+
+const char *ap_event_name(ap_event_type_t type)
+{
+    return type < sizeof(s_event_names) / sizeof(s_event_names[0]) ? s_event_names[type] : "?";
+}
@@ -0,0 +1,97 @@
+/*
+    Access point table of the continuous scan, plain C (builds on the host).
+
+    One entry per BSSID in a fixed array the caller provides (the command
+    arena). Each scan result updates its entry: RSSI average (EWMA, 1/4 per
+    sighting), first and last seen, channel and auth mode. Only changes
+    come out, through the callback:
+    - appeared: a BSSID not in the table;
+    - disappeared: missed by lost_after_rounds passes in a row, the entry
+      is freed;
+    - rogue twin: an AP with the SSID of another entry but a different auth
+      mode, whether it has its own BSSID (evil twin, open copy of a WPA2
+      network) or reuses the BSSID (spoofed, downgraded); several BSSIDs
+      with the same SSID and auth are a normal multi-AP network;
+    - channel: a BSSID moved to another channel.
+    When the table is full the entry seen the longest ago is reused, and
+    reported as disappeared (with evicted set) before it is.
+    Loss is counted in passes (ap_table_expire() ends one), not in time: a
+    pass lasts the period plus the scan, which depends on the channels and
+    the dwell. Times are in seconds from any origin, for the output and the
+    eviction order, so tests can drive a fake clock.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AP_TABLE_SSID_LEN   32
+#define AP_TABLE_EWMA_SHIFT 2           // weight of a new sighting: 1/4
+
+typedef struct {
+    uint8_t bssid[6];
+    char ssid[AP_TABLE_SSID_LEN + 1];
+    uint8_t channel;
+    uint8_t authmode;
+    int8_t rssi;
+} ap_sighting_t;
+
+typedef struct {
+    uint8_t bssid[6];
+    char ssid[AP_TABLE_SSID_LEN + 1];
+    uint8_t channel;
+    uint8_t authmode;
+    bool used;
+    int16_t rssi_x16;                   // EWMA of the RSSI, 1/16 dBm
+    uint32_t first_seen;
+    uint32_t last_seen;
+    uint32_t last_round;                // pass it was last seen in
+    uint32_t sightings;
+    uint16_t channel_changes;
+    uint16_t auth_changes;
+} ap_entry_t;
+
+typedef enum {
+    AP_EVENT_APPEARED,
+    AP_EVENT_DISAPPEARED,
+    AP_EVENT_ROGUE_TWIN,
+    AP_EVENT_CHANNEL,
+} ap_event_type_t;
+
+typedef struct {
+    ap_event_type_t type;
+    const ap_entry_t *ap;
+    const ap_entry_t *twin;             // rogue twin: the entry it copies
+    uint8_t prev_channel;               // channel: where it was
+    bool evicted;                       // disappeared: pushed out of a full table, not lost
+} ap_event_t;
+
+typedef void (*ap_event_fn_t)(const ap_event_t *event, void *ctx);
+
+typedef struct {
+    ap_entry_t *entries;
+    size_t capacity;
+    size_t count;
+    uint32_t lost_after_rounds;
+    uint32_t round;                     // passes ended by ap_table_expire()
+    uint32_t evicted;                   // entries reused while the table was full
+    ap_event_fn_t fn;
+    void *ctx;
+} ap_table_t;
+
+void ap_table_init(ap_table_t *t, ap_entry_t *entries, size_t capacity, uint32_t lost_after_rounds,
+                   ap_event_fn_t fn, void *ctx);
+// One scan result
+void ap_table_update(ap_table_t *t, const ap_sighting_t *s, uint32_t now);
+// End of a full pass: entries missed by the last lost_after_rounds passes disappear
+void ap_table_expire(ap_table_t *t);
+const char *ap_event_name(ap_event_type_t type);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_console.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+#include "esp_event.h"
+#include "dispatch.h"
+#include "argtable3/argtable3.h"
+#include "freertos/FreeRTOS.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/ip4_addr.h"
+#include "dhcpserver/dhcpserver.h"
+#include "boot.h"
+#include "cmd_wifi.h"
+#include "wifi_mgr.h"
+#include "ap_wifi.h"
+
+#define AP_DEFAULT_CHANNEL  1
+
+static const char *TAG = "ap_wifi";
+
+static lazy_t s_ap_init = LAZY_INIT("wifi.ap");
+static esp_netif_t *s_ap_netif;
+static bool s_running;
+static bool s_napt;
+static int64_t s_started_at;
+
+// Table et totaux : écrits depuis les tâches Wi-Fi et lwIP, lus par la commande
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static ap_client_t s_clients[AP_MAX_CLIENTS];
+static bool s_used[AP_MAX_CLIENTS];
+static uint64_t s_rx_total, s_tx_total;
+
+// Fonctions d'origine de la netif AP, appelées après le comptage
+static netif_input_fn s_orig_input;
+static netif_linkoutput_fn s_orig_linkoutput;
+
+// Débit : relevé précédent de la commande
+static int64_t s_last_at;
+static uint64_t s_last_rx, s_last_tx;
+
+// Sous s_mux
+static ap_client_t *find(const uint8_t *mac)
+{
+    for (int i = 0; i < AP_MAX_CLIENTS; i++) {
+        if (s_used[i] && memcmp(s_clients[i].mac, mac, 6) == 0) {
+            return &s_clients[i];
+        }
+    }
+    return NULL;
+}
+
+// Trame d'un client (adresse source à l'offset 6 de l'en-tête Ethernet)
+static err_t ap_input(struct pbuf *p, struct netif *netif)
+{
+    if (p->len >= 14) {
+        const uint8_t *src = (const uint8_t *)p->payload + 6;
+        taskENTER_CRITICAL(&s_mux);
+        s_rx_total += p->tot_len;
+        ap_client_t *c = find(src);
+        if (c) {
+            c->rx_bytes += p->tot_len;
+            c->rx_packets++;
+        }
+        taskEXIT_CRITICAL(&s_mux);
+    }
+    return s_orig_input(p, netif);
+}
+
+static err_t ap_linkoutput(struct netif *netif, struct pbuf *p)
+{
+    if (p->len >= 14) {
+        const uint8_t *dst = p->payload;
+        taskENTER_CRITICAL(&s_mux);
+        s_tx_total += p->tot_len;
+        ap_client_t *c = find(dst);
+        if (c) {
+            c->tx_bytes += p->tot_len;
+            c->tx_packets++;
+        }
+        taskEXIT_CRITICAL(&s_mux);
+    }
+    return s_orig_linkoutput(netif, p);
+}
+
+// Une fois la netif AP montée (AP_START) ; elle peut être réinstallée à chaque démarrage
+static void hook_netif(void)
+{
+    struct netif *nif = esp_netif_get_netif_impl(s_ap_netif);
+    if (nif == NULL) {
+        return;
+    }
+    if (nif->input != ap_input) {
+        s_orig_input = nif->input;
+        nif->input = ap_input;
+    }
+    if (nif->linkoutput != ap_linkoutput) {
+        s_orig_linkoutput = nif->linkoutput;
+        nif->linkoutput = ap_linkoutput;
+    }
+}
+
+static void ap_event_handler(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    if (base == WIFI_EVENT && id == WIFI_EVENT_AP_START) {
+        hook_netif();
+    } else if (base == WIFI_EVENT && id == WIFI_EVENT_AP_STACONNECTED) {
+        const wifi_event_ap_staconnected_t *ev = data;
+        taskENTER_CRITICAL(&s_mux);
+        ap_client_t *c = find(ev->mac);
+        for (int i = 0; c == NULL && i < AP_MAX_CLIENTS; i++) {
+            if (!s_used[i]) {
+                s_used[i] = true;
+                c = &s_clients[i];
+            }
+        }
+        if (c) {
+            memset(c, 0, sizeof(*c));
+            memcpy(c->mac, ev->mac, 6);
+            c->aid = ev->aid;
+            c->since = esp_timer_get_time();
+        }
+        taskEXIT_CRITICAL(&s_mux);
+        ESP_LOGI(TAG, "Client %02x:%02x:%02x:%02x:%02x:%02x joined, aid %u",
+                 ev->mac[0], ev->mac[1], ev->mac[2], ev->mac[3], ev->mac[4], ev->mac[5], ev->aid);
+    } else if (base == WIFI_EVENT && id == WIFI_EVENT_AP_STADISCONNECTED) {
+        const wifi_event_ap_stadisconnected_t *ev = data;
+        ap_client_t gone = {0};
+        taskENTER_CRITICAL(&s_mux);
+        ap_client_t *c = find(ev->mac);
+        if (c) {
+            gone = *c;
+            s_used[c - s_clients] = false;
+        }
+        taskEXIT_CRITICAL(&s_mux);
+        ESP_LOGI(TAG, "Client %02x:%02x:%02x:%02x:%02x:%02x left, reason %u, in %" PRIu64 " out %" PRIu64 " bytes",
+                 ev->mac[0], ev->mac[1], ev->mac[2], ev->mac[3], ev->mac[4], ev->mac[5], ev->reason,
+                 gone.rx_bytes, gone.tx_bytes);
+    } else if (base == IP_EVENT && id == IP_EVENT_AP_STAIPASSIGNED) {
+        const ip_event_ap_staipassigned_t *ev = data;
+        taskENTER_CRITICAL(&s_mux);
+        ap_client_t *c = find(ev->mac);
+        if (c) {
+            c->ip = ev->ip.addr;
+        }
+        taskEXIT_CRITICAL(&s_mux);
+    }
+}
+
+// Netif AP et handlers, une seule fois
+static esp_err_t ap_init(void)
+{
+    esp_err_t err = wifi_stack_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+    s_ap_netif = esp_netif_create_default_wifi_ap();
+    if (s_ap_netif == NULL) {
+        return ESP_FAIL;
+    }
+    ESP_ERROR_CHECK( esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_START, &ap_event_handler, NULL) );
+    ESP_ERROR_CHECK( esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_STACONNECTED, &ap_event_handler, NULL) );
+    ESP_ERROR_CHECK( esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_STADISCONNECTED, &ap_event_handler, NULL) );
+    ESP_ERROR_CHECK( esp_event_handler_register(IP_EVENT, IP_EVENT_AP_STAIPASSIGNED, &ap_event_handler, NULL) );
+    return ESP_OK;
+}
+
+size_t ap_clients(ap_client_t *out, size_t max)
+{
+    wifi_sta_list_t list = {0};
+    bool have_rssi = s_running && esp_wifi_ap_get_sta_list(&list) == ESP_OK;
+    size_t n = 0;
+    taskENTER_CRITICAL(&s_mux);
+    for (int i = 0; i < AP_MAX_CLIENTS; i++) {
+        if (!s_used[i]) {
+            continue;
+        }
+        for (int j = 0; have_rssi && j < list.num; j++) {
+            if (memcmp(list.sta[j].mac, s_clients[i].mac, 6) == 0) {
+                s_clients[i].rssi = list.sta[j].rssi;
+            }
+        }
+        if (n < max) {
+            out[n++] = s_clients[i];
+        }
+    }
+    taskEXIT_CRITICAL(&s_mux);
+    return n;
+}
+
+bool ap_client_get(const uint8_t mac[6], ap_client_t *out)
+{
+    taskENTER_CRITICAL(&s_mux);
+    ap_client_t *c = find(mac);
+    if (c) {
+        *out = *c;
+    }
+    taskEXIT_CRITICAL(&s_mux);
+    return c != NULL;
+}
+
+void ap_totals(uint64_t *rx_bytes, uint64_t *tx_bytes)
+{
+    taskENTER_CRITICAL(&s_mux);
+    *rx_bytes = s_rx_total;
+    *tx_bytes = s_tx_total;
+    taskEXIT_CRITICAL(&s_mux);
+}
+
+// Les clients demandent le DNS de l'uplink au serveur DHCP de l'AP
+static void offer_uplink_dns(void)
+{
+    esp_netif_dns_info_t dns;
+    if (esp_netif_get_dns_info(wifi_stack_sta(), ESP_NETIF_DNS_MAIN, &dns) != ESP_OK) {
+        return;
+    }
+    uint8_t offer = OFFER_DNS;
+    esp_netif_dhcps_stop(s_ap_netif);
+    esp_netif_dhcps_option(s_ap_netif, ESP_NETIF_OP_SET, ESP_NETIF_DOMAIN_NAME_SERVER, &offer, sizeof(offer));
+    esp_netif_set_dns_info(s_ap_netif, ESP_NETIF_DNS_MAIN, &dns);
+    esp_netif_dhcps_start(s_ap_netif);
+}
+
+static int ap_start(const char *ssid, const char *pass, int channel)
+{
+    wifi_config_t cfg = {0};
+    // ssid[] fait 32 octets sans NUL obligatoire : ssid_len fait foi
+    size_t len = strlen(ssid);
+    if (len == 0 || len > sizeof(cfg.ap.ssid)) {
+        printf("ap: the SSID takes 1 to %u characters\n", (unsigned)sizeof(cfg.ap.ssid));
+        return 1;
+    }
+    if (pass && (strlen(pass) < 8 || strlen(pass) > 63)) {
+        printf("ap: the passphrase takes 8 to 63 characters\n");
+        return 1;
+    }
+    esp_err_t err = lazy_once(&s_ap_init, ap_init);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "AP init failed (%s)", esp_err_to_name(err));
+        return 1;
+    }
+    if (!s_running && wifi_mgr_acquire(WIFI_MGR_AP) != ESP_OK) {
+        return 1;
+    }
+
+    memcpy(cfg.ap.ssid, ssid, len);
+    cfg.ap.ssid_len = len;
+    if (pass) {
+        strlcpy((char *)cfg.ap.password, pass, sizeof(cfg.ap.password));
+        cfg.ap.authmode = WIFI_AUTH_WPA2_PSK;
+    } else {
+        cfg.ap.authmode = WIFI_AUTH_OPEN;
+    }
+    // En APSTA l'AP suit le canal de la station associée
+    wifi_ap_record_t uplink;
+    cfg.ap.channel = esp_wifi_sta_get_ap_info(&uplink) == ESP_OK ? uplink.primary : channel;
+    cfg.ap.max_connection = AP_MAX_CLIENTS;
+    err = esp_wifi_set_config(WIFI_IF_AP, &cfg);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "AP config refused (%s)", esp_err_to_name(err));
+        if (!s_running) {
+            wifi_mgr_release(WIFI_MGR_AP);
+        }
+        return 1;
+    }
+    if (!s_running) {
+        taskENTER_CRITICAL(&s_mux);
+        memset(s_used, 0, sizeof(s_used));
+        s_rx_total = s_tx_total = 0;
+        taskEXIT_CRITICAL(&s_mux);
+        s_started_at = s_last_at = esp_timer_get_time();
+        s_last_rx = s_last_tx = 0;
+        s_running = true;
+    }
+
+    if (wifi_mgr_connected()) {
+        offer_uplink_dns();
+    } else {
+        ESP_LOGW(TAG, "No uplink yet: clients get no route until `join`");
+    }
+#if CONFIG_LWIP_IPV4_NAPT
+    if (!s_napt) {
+        s_napt = esp_netif_napt_enable(s_ap_netif) == ESP_OK;
+    }
+#endif
+
+    esp_netif_ip_info_t ip = {0};
+    esp_netif_get_ip_info(s_ap_netif, &ip);
+    printf("AP '%s' %s on channel %u, " IPSTR ", NAPT %s\n", ssid, pass ? "WPA2" : "open",
+           cfg.ap.channel, IP2STR(&ip.ip), s_napt ? "on" : "off (CONFIG_LWIP_IPV4_NAPT)");
+    return 0;
+}
+
+static int ap_stop(void)
+{
+    if (!s_running) {
+        printf("ap: not running\n");
+        return 1;
+    }
+#if CONFIG_LWIP_IPV4_NAPT
+    if (s_napt) {
+        esp_netif_napt_disable(s_ap_netif);
+        s_napt = false;
+    }
+#endif
+    wifi_mgr_release(WIFI_MGR_AP);
+    s_running = false;
+    uint64_t rx, tx;
+    ap_totals(&rx, &tx);
+    printf("AP stopped after %" PRId64 " s, in %" PRIu64 " out %" PRIu64 " bytes\n",
+           (esp_timer_get_time() - s_started_at) / 1000000, rx, tx);
+    return 0;
+}
+
+static uint32_t kbps(uint64_t bytes, int64_t us)
+{
+    return us > 0 ? (uint32_t)(bytes * 8000 / (uint64_t)us) : 0;
+}
+
+static int ap_status(void)
+{
+    if (!s_running) {
+        printf("AP off\n");
+        return 0;
+    }
+    ap_client_t clients[AP_MAX_CLIENTS];
+    size_t n = ap_clients(clients, AP_MAX_CLIENTS);
+    int64_t now = esp_timer_get_time();
+    printf("%-17s %3s %4s %-15s %10s %10s %6s\n", "MAC", "AID", "RSSI", "IP", "IN", "OUT", "SECS");
+    for (size_t i = 0; i < n; i++) {
+        const ap_client_t *c = &clients[i];
+        char ip[16] = "-";
+        if (c->ip) {
+            esp_ip4_addr_t a = { .addr = c->ip };
+            snprintf(ip, sizeof(ip), IPSTR, IP2STR(&a));
+        }
+        printf("%02x:%02x:%02x:%02x:%02x:%02x %3u %4d %-15s %10" PRIu64 " %10" PRIu64 " %6" PRId64 "\n",
+               c->mac[0], c->mac[1], c->mac[2], c->mac[3], c->mac[4], c->mac[5], c->aid, c->rssi, ip,
+               c->rx_bytes, c->tx_bytes, (now - c->since) / 1000000);
+    }
+
+    // Débit depuis le relevé précédent, et moyen depuis le démarrage
+    uint64_t rx, tx;
+    ap_totals(&rx, &tx);
+    printf("%u client(s); in %" PRIu32 " kbit/s, out %" PRIu32 " kbit/s over the last %" PRId64 " s"
+           " (avg in %" PRIu32 ", out %" PRIu32 " kbit/s), NAPT %s\n",
+           (unsigned)n, kbps(rx - s_last_rx, now - s_last_at), kbps(tx - s_last_tx, now - s_last_at),
+           (now - s_last_at) / 1000000, kbps(rx, now - s_started_at), kbps(tx, now - s_started_at),
+           s_napt ? "on" : "off");
+    s_last_at = now;
+    s_last_rx = rx;
+    s_last_tx = tx;
+    return 0;
+}
+
+static struct {
+    struct arg_str *action;
+    struct arg_str *ssid;
+    struct arg_str *password;
+    struct arg_int *channel;
+    struct arg_end *end;
+} ap_args;
+
+static int ap_cmd(int argc, char **argv)
+{
+    if (arg_parse(argc, argv, (void **)&ap_args) != 0) {
+        arg_print_errors(stderr, ap_args.end, argv[0]);
+        return 1;
+    }
+    const char *action = ap_args.action->count ? ap_args.action->sval[0] : "status";
+    if (strcmp(action, "start") == 0) {
+        if (ap_args.ssid->count == 0) {
+            printf("ap: start needs an SSID\n");
+            return 1;
+        }
+        int channel = ap_args.channel->count ? ap_args.channel->ival[0] : AP_DEFAULT_CHANNEL;
+        if (channel < 1 || channel > 13) {
+            printf("ap: channel 1 to 13\n");
+            return 1;
+        }
+        return ap_start(ap_args.ssid->sval[0], ap_args.password->count ? ap_args.password->sval[0] : NULL,
+                        channel);
+    }
+    if (strcmp(action, "stop") == 0) {
+        return ap_stop();
+    }
+    if (strcmp(action, "status") == 0) {
+        return ap_status();
+    }
+    printf("ap: expected start, stop or status\n");
+    return 1;
+}
+
+void module_ap_wifi(void)
+{
+    ap_args.action   = arg_str0(NULL, NULL, "<start|stop|status>", "Action (default status)");
+    ap_args.ssid     = arg_str0(NULL, NULL, "<ssid>", "SSID of the AP (start)");
+    ap_args.password = arg_str0(NULL, NULL, "<pass>", "WPA2 passphrase, open AP without");
+    ap_args.channel  = arg_int0("c", "channel", "<1-13>", "Channel without an uplink (default 1)");
+    ap_args.end      = arg_end(3);
+
+    const esp_console_cmd_t cmd = {
+        .command = "ap",
+        .help = "Soft-AP next to the station, NAPT to the uplink, clients and their traffic",
+        .hint = NULL,
+        .func = &ap_cmd,
+        .argtable = &ap_args,
+    };
+    ESP_ERROR_CHECK( dispatch_register(&cmd) );
+}
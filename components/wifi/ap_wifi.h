@@ -0,0 +1,47 @@
+/*
+    Soft-AP next to the station, with NAPT and per-client counters.
+
+    `ap start <ssid> [pass]` turns the AP on (WIFI_MGR_AP, the station
+    keeps its link) and, with CONFIG_LWIP_IPV4_NAPT, forwards the clients
+    through the station's uplink: the device sits between a phone and the
+    network and sees every byte. Clients are kept in a fixed table, one
+    entry per associated station: MAC, RSSI (from the driver when read),
+    the address the DHCP server leased, and bytes and packets each way.
+    The bytes are counted at layer 2 by wrapping the AP netif's input and
+    linkoutput, so forwarded and local traffic both count; frames to
+    broadcast or multicast addresses only go into the AP totals.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AP_MAX_CLIENTS  8
+
+typedef struct {
+    uint8_t mac[6];
+    uint8_t aid;
+    int8_t rssi;                        // last read from the driver
+    uint32_t ip;                        // network order, 0 until leased
+    int64_t since;                      // esp_timer_get_time() at association
+    uint64_t rx_bytes;                  // from the client
+    uint64_t tx_bytes;                  // to the client
+    uint32_t rx_packets;
+    uint32_t tx_packets;
+} ap_client_t;
+
+// Associated clients, RSSI refreshed; returns how many were copied
+size_t ap_clients(ap_client_t *out, size_t max);
+// One client's counters, false if it is not associated
+bool ap_client_get(const uint8_t mac[6], ap_client_t *out);
+// Every frame through the AP since it started, clients or not
+void ap_totals(uint64_t *rx_bytes, uint64_t *tx_bytes);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "esp_err.h"
+#include "esp_netif.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -8,6 +11,13 @@ extern "C" {
 void register_join_wifi_cmd(void);
 void module_scan_wifi(void);
 void module_sniff_wif(void);
+// `ap`, not on the linux target (see ap_wifi.h)
+void module_ap_wifi(void);
+
+// NVS, netif, default event loop and STA netif, once, on the first Wi-Fi command (see boot.h)
+esp_err_t wifi_stack_init(void);
+// Default STA netif, NULL before wifi_stack_init()
+esp_netif_t *wifi_stack_sta(void);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "nvs.h"
+#include "mbedtls/md.h"
+#include "mbedtls/pkcs5.h"
+#include "mbedtls/sha256.h"
+#include "join_cache.h"
+
+#define JOIN_CACHE_NS       "joincache"
+#define JOIN_CACHE_VERSION  1
+#define JOIN_PASS_HASH_LEN  16
+
+static const char *TAG = "join_cache";
+
+typedef struct {
+    uint8_t version;
+    char ssid[33];                      // the key is a hash of it
+    uint8_t pass_hash[JOIN_PASS_HASH_LEN];
+    join_hint_t hint;
+} join_cache_entry_t;
+
+// Clés NVS de 15 caractères au plus : un hash du SSID
+static void cache_key(const char *ssid, char key[16])
+{
+    uint32_t h = 2166136261u;           // FNV-1a
+    for (const char *p = ssid; *p; p++) {
+        h = (h ^ (uint8_t)*p) * 16777619u;
+    }
+    snprintf(key, 16, "ap%08lx", (unsigned long)h);
+}
+
+static void pass_hash(const char *ssid, const char *pass, uint8_t out[JOIN_PASS_HASH_LEN])
+{
+    uint8_t digest[32];
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    mbedtls_sha256_update(&ctx, (const uint8_t *)ssid, strlen(ssid) + 1);
+    if (pass) {
+        mbedtls_sha256_update(&ctx, (const uint8_t *)pass, strlen(pass));
+    }
+    mbedtls_sha256_finish(&ctx, digest);
+    mbedtls_sha256_free(&ctx);
+    memcpy(out, digest, JOIN_PASS_HASH_LEN);
+}
+
+bool join_cache_get(const char *ssid, const char *pass, join_hint_t *hint)
+{
+    nvs_handle_t h;
+    if (nvs_open(JOIN_CACHE_NS, NVS_READONLY, &h) != ESP_OK) {
+        return false;                   // rien d'enregistré encore
+    }
+    char key[16];
+    cache_key(ssid, key);
+    join_cache_entry_t e;
+    size_t len = sizeof(e);
+    esp_err_t err = nvs_get_blob(h, key, &e, &len);
+    nvs_close(h);
+    if (err != ESP_OK || len != sizeof(e) || e.version != JOIN_CACHE_VERSION ||
+        strncmp(e.ssid, ssid, sizeof(e.ssid)) != 0) {
+        return false;
+    }
+    uint8_t hash[JOIN_PASS_HASH_LEN];
+    pass_hash(ssid, pass, hash);
+    if (memcmp(hash, e.pass_hash, sizeof(hash)) != 0) {
+        return false;                   // autre mot de passe : l'entrée ne sert plus
+    }
+    *hint = e.hint;
+    return true;
+}
+
+esp_err_t join_cache_put(const char *ssid, const char *pass, const join_hint_t *hint)
+{
+    join_cache_entry_t e = { .version = JOIN_CACHE_VERSION, .hint = *hint };
+    strlcpy(e.ssid, ssid, sizeof(e.ssid));
+    pass_hash(ssid, pass, e.pass_hash);
+
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(JOIN_CACHE_NS, NVS_READWRITE, &h);
+    if (err != ESP_OK) {
+        return err;
+    }
+    char key[16];
+    cache_key(ssid, key);
+    err = nvs_set_blob(h, key, &e, sizeof(e));
+    if (err == ESP_OK) {
+        err = nvs_commit(h);
+    }
+    nvs_close(h);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Cannot store %s (%s)", ssid, esp_err_to_name(err));
+    }
+    return err;
+}
+
+void join_cache_forget(const char *ssid)
+{
+    nvs_handle_t h;
+    if (nvs_open(JOIN_CACHE_NS, NVS_READWRITE, &h) != ESP_OK) {
+        return;
+    }
+    char key[16];
+    cache_key(ssid, key);
+    if (nvs_erase_key(h, key) == ESP_OK) {
+        nvs_commit(h);
+    }
+    nvs_close(h);
+}
+
+esp_err_t join_pmk_derive(const char *ssid, const char *pass, uint8_t pmk[JOIN_PMK_LEN])
+{
+    int ret = mbedtls_pkcs5_pbkdf2_hmac_ext(MBEDTLS_MD_SHA1, (const unsigned char *)pass, strlen(pass),
+                                            (const unsigned char *)ssid, strlen(ssid), 4096, JOIN_PMK_LEN, pmk);
+    return ret == 0 ? ESP_OK : ESP_FAIL;
+}
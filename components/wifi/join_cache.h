@@ -0,0 +1,43 @@
+/*
+    What `join` learnt about a network, kept in NVS for the next join.
+
+    A successful join stores, per SSID, the BSSID and channel it used, the
+    auth mode, and for WPA/WPA2-PSK the PMK (PBKDF2-SHA1 of the passphrase,
+    4096 rounds, what makes a join take seconds). The next join to that
+    SSID sets bssid/channel, so the driver probes one channel instead of
+    scanning them all, and passes the PMK as a 64-hex-digit PSK, which the
+    driver uses as is. An entry only matches the passphrase it was stored
+    with (a hash of it is kept alongside). The PMK opens the network like
+    the passphrase does: the NVS partition should be encrypted on devices
+    that leave the lab.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JOIN_PMK_LEN    32
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t authmode;                   // wifi_auth_mode_t
+    bool has_pmk;
+    uint8_t pmk[JOIN_PMK_LEN];
+} join_hint_t;
+
+// Hints stored for ssid and this passphrase (NULL for an open network), false otherwise
+bool join_cache_get(const char *ssid, const char *pass, join_hint_t *hint);
+esp_err_t join_cache_put(const char *ssid, const char *pass, const join_hint_t *hint);
+void join_cache_forget(const char *ssid);
+// PMK of WPA/WPA2-PSK: PBKDF2-HMAC-SHA1(pass, ssid, 4096, 32)
+esp_err_t join_pmk_derive(const char *ssid, const char *pass, uint8_t pmk[JOIN_PMK_LEN]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,84 +1,598 @@
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include "esp_log.h"
 #include "esp_console.h"
+#include "dispatch.h"
 #include "argtable3/argtable3.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "esp_wifi.h"
 #include "esp_netif.h"
 #include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "result.h"
+#include "perf.h"
+#include "boot.h"
+#include "cmd_wifi.h"
+#include "wifi_mgr.h"
+#include "join_cache.h"
+#include "wifi_out.h"
 
 #define JOIN_TIMEOUT_MS (10000)
+#define JOIN_SCAN_MAX       8       // BSSIDs du SSID gardés par le scan ciblé
+#define JOIN_SCAN_DWELL_MS  120
+#define JOIN_RETRY_MS       500     // pause entre deux essais sans indices
+#define LINK_TASK_STACK     3072
+#define LINK_TASK_PRIO      5
+#define LINK_BACKOFF_MIN_MS 500
+#define LINK_BACKOFF_MAX_MS 30000
+#define LINK_CONNECT_MS     10000   // reconnexion sans nouvelles : échec
+#define LINK_UNPIN_RETRIES  2       // échecs sur le BSSID fixé avant de laisser le driver choisir
+#define LINK_SAMPLE_MS      5000    // relevé du RSSI
+#define LINK_RSSI_SAMPLES   12      // une minute de tendance
+#define LINK_REASONS        8       // dernières raisons de déconnexion gardées
+#define LINK_ROAM_RSSI      (-72)   // en dessous (moyenne des 3 derniers relevés), chercher mieux
+#define LINK_ROAM_MARGIN_DB 8       // un autre BSSID doit faire au moins ça de plus
+#define LINK_ROAM_EVERY_MS  60000   // pas plus d'un scan de roaming par minute
 #define TAG "join_wifi"
 
 static EventGroupHandle_t wifi_event_group = NULL;
-static bool wifi_stack_initialized = false;
-const int CONNECTED_BIT = BIT0;
+static lazy_t s_join_init = LAZY_INIT("wifi.join");
+const int CONNECTED_BIT = BIT0;         // adresse IP obtenue
+#define LINK_BIT        BIT1            // associé, clés installées
+#define FAIL_BIT        BIT2            // déconnecté, raison dans s_reason
+#define DROP_BIT        BIT3            // déconnecté hors join : pour la tâche link
 
-// Handler WiFi STA
+static volatile uint8_t s_reason;
+static volatile bool s_joining;         // join décide lui-même des nouveaux essais
+
+/*
+    Reconnect state machine, run by the link task; the event handler only
+    flags the drop and wakes it, so a bad AP can't cause a reconnect storm
+    in the event loop. down -> backoff (exponential, 25% jitter) ->
+    connecting -> up, or back to backoff. While up the task samples the
+    RSSI and roams to a stronger BSSID of the same SSID.
+*/
+typedef enum {
+    LINK_IDLE,                          // join doesn't hold the station
+    LINK_UP,
+    LINK_BACKOFF,
+    LINK_CONNECTING,
+} link_state_t;
+
+static const char *const s_link_state_names[] = { "idle", "up", "backoff", "connecting" };
+
+static struct {
+    link_state_t state;
+    char ssid[33];
+    char pass[65];                      // to update the join cache after a roam
+    uint8_t bssid[6];
+    uint8_t channel;
+    int64_t up_since;                   // current link, 0 when down
+    int64_t up_total_us;                // previous links
+    int64_t first_up;
+    int64_t retry_at;
+    int64_t connecting_since;
+    int64_t roam_checked;
+    uint32_t backoff_ms;
+    uint32_t retries;                   // failed reconnects in a row
+    uint32_t disconnects;
+    uint32_t reconnects;
+    uint32_t roams;
+    int8_t rssi[LINK_RSSI_SAMPLES];
+    uint8_t rssi_count;
+    uint8_t rssi_head;                  // next slot
+    uint8_t reasons[LINK_REASONS];
+    uint8_t reason_count;
+} s_link;
+static SemaphoreHandle_t s_link_lock;   // s_link, pour la commande link
+static StaticSemaphore_t s_link_lock_buf;
+static SemaphoreHandle_t s_op_lock;     // join ou tâche link : un seul pilote la station
+static StaticSemaphore_t s_op_lock_buf;
+static TaskHandle_t s_link_task;
+
+#define LINK_REASON_TIMEOUT 0           // pas de réponse du driver, pas un code 802.11
+
+static void link_task(void *arg);
+
+// Where a join spent its time, in microseconds
+typedef struct {
+    int64_t scan_us;
+    int64_t pmk_us;
+    int64_t connect_us;                 // auth + assoc + 4-way: the driver reports only the end
+    int64_t dhcp_us;
+    int attempts;
+    bool cached;
+} join_timing_t;
+
+// Handler WiFi STA : note l'événement, la tâche link décide de la reconnexion
 static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
-    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        esp_wifi_connect();
-        xEventGroupClearBits(wifi_event_group, CONNECTED_BIT);
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        xEventGroupSetBits(wifi_event_group, LINK_BIT);
+        xTaskNotifyGive(s_link_task);
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        const wifi_event_sta_disconnected_t *ev = event_data;
+        s_reason = ev->reason;
+        xEventGroupClearBits(wifi_event_group, CONNECTED_BIT | LINK_BIT);
+        xEventGroupSetBits(wifi_event_group, s_joining ? FAIL_BIT : FAIL_BIT | DROP_BIT);
+        xTaskNotifyGive(s_link_task);
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         xEventGroupSetBits(wifi_event_group, CONNECTED_BIT);
     }
 }
 
-// Toutes les inits système, appelle UNE SEULE FOIS
-static void ensure_wifi_stack_init(void)
+// Handlers du join, une seule fois ; le driver est au gestionnaire (wifi_mgr.h)
+static esp_err_t join_init(void)
 {
-    if (wifi_stack_initialized)
-        return;
-
-    // Init ESP stack au besoin
-    static bool netif_inited = false;
-    if (!netif_inited) {
-        ESP_ERROR_CHECK(esp_netif_init());
-        ESP_ERROR_CHECK(esp_event_loop_create_default());
-        esp_netif_create_default_wifi_sta();
-        netif_inited = true;
+    esp_err_t err = wifi_stack_init();
+    if (err != ESP_OK) {
+        return err;
     }
 
     wifi_event_group = xEventGroupCreate();
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK( esp_wifi_init(&cfg) );
+    if (xTaskCreate(link_task, "wifi_link", LINK_TASK_STACK, NULL, LINK_TASK_PRIO, &s_link_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_ERROR_CHECK( esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &event_handler, NULL) );
     ESP_ERROR_CHECK( esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event_handler, NULL) );
     ESP_ERROR_CHECK( esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL) );
-    ESP_ERROR_CHECK( esp_wifi_set_storage(WIFI_STORAGE_RAM) );
-    ESP_ERROR_CHECK( esp_wifi_set_mode(WIFI_MODE_STA) );
-    ESP_ERROR_CHECK( esp_wifi_start() );
+    return ESP_OK;
+}
 
-    wifi_stack_initialized = true;
+static bool is_psk(uint8_t authmode)
+{
+    return authmode == WIFI_AUTH_WPA_PSK || authmode == WIFI_AUTH_WPA2_PSK ||
+           authmode == WIFI_AUTH_WPA_WPA2_PSK;
 }
 
-// Fonction de connexion WiFi (réutilisable)
-static bool wifi_join(const char *ssid, const char *pass, int timeout_ms)
+static int remaining_ms(int64_t deadline)
 {
-    ensure_wifi_stack_init();
+    int64_t left = (deadline - esp_timer_get_time()) / 1000;
+    return left > 0 ? (int)left : 0;
+}
 
+// Strongest BSSID announcing ssid, every channel; false if none answered
+static bool join_scan(const char *ssid, join_hint_t *hint, int8_t *rssi)
+{
+    if (wifi_mgr_acquire(WIFI_MGR_SCAN) != ESP_OK) {
+        return false;
+    }
+    wifi_scan_config_t cfg = {
+        .ssid = (uint8_t *)ssid,
+        .show_hidden = true,
+        .scan_type = WIFI_SCAN_TYPE_ACTIVE,
+        .scan_time.active = { .min = 0, .max = JOIN_SCAN_DWELL_MS },
+    };
+    bool found = false;
+    int8_t best = 0;
+    if (esp_wifi_scan_start(&cfg, true) == ESP_OK) {
+        wifi_ap_record_t aps[JOIN_SCAN_MAX];
+        uint16_t n = JOIN_SCAN_MAX;
+        if (esp_wifi_scan_get_ap_records(&n, aps) == ESP_OK) {
+            for (uint16_t i = 0; i < n; i++) {
+                if (!found || aps[i].rssi > best) {
+                    memcpy(hint->bssid, aps[i].bssid, 6);
+                    hint->channel = aps[i].primary;
+                    hint->authmode = aps[i].authmode;
+                    best = aps[i].rssi;
+                    found = true;
+                }
+            }
+        }
+    }
+    wifi_mgr_release(WIFI_MGR_SCAN);
+    hint->has_pmk = false;
+    if (rssi) {
+        *rssi = best;
+    }
+    return found;
+}
+// One connect, hinted or not; on failure the reason is in s_reason
+static bool join_attempt(const char *ssid, const char *pass, const join_hint_t *hint,
+                         int64_t deadline, join_timing_t *t)
+{
     wifi_config_t wifi_config = {0};
     strlcpy((char *)wifi_config.sta.ssid, ssid, sizeof(wifi_config.sta.ssid));
-    if (pass) {
+    if (hint && hint->has_pmk) {
+        // 64 chiffres hexa : le driver prend la PSK telle quelle, sans PBKDF2.
+        // password[] fait 64 octets : pas de place pour le NUL de sprintf
+        char hex[2 * JOIN_PMK_LEN + 1];
+        for (int i = 0; i < JOIN_PMK_LEN; i++) {
+            sprintf(hex + 2 * i, "%02x", hint->pmk[i]);
+        }
+        memcpy(wifi_config.sta.password, hex, 2 * JOIN_PMK_LEN);
+    } else if (pass) {
         strlcpy((char *)wifi_config.sta.password, pass, sizeof(wifi_config.sta.password));
     }
+    if (hint) {
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, hint->bssid, 6);
+        wifi_config.sta.channel = hint->channel;
+    }
 
+    xEventGroupClearBits(wifi_event_group, CONNECTED_BIT | LINK_BIT | FAIL_BIT);
     ESP_ERROR_CHECK( esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
-    ESP_ERROR_CHECK( esp_wifi_connect() );
+    t->attempts++;
+    int64_t t0 = esp_timer_get_time();
+    PERF_BEGIN(connect);
+    if (esp_wifi_connect() != ESP_OK) {
+        return false;
+    }
+    EventBits_t bits = xEventGroupWaitBits(wifi_event_group, LINK_BIT | FAIL_BIT, pdFALSE, pdFALSE,
+                                           pdMS_TO_TICKS(remaining_ms(deadline)));
+    if (!(bits & LINK_BIT)) {
+        return false;
+    }
+    PERF_END(connect, "join.connect");
+    int64_t t1 = esp_timer_get_time();
+    t->connect_us = t1 - t0;
+
+    PERF_BEGIN(dhcp);
+    bits = xEventGroupWaitBits(wifi_event_group, CONNECTED_BIT | FAIL_BIT, pdFALSE, pdFALSE,
+                               pdMS_TO_TICKS(remaining_ms(deadline)));
+    if (!(bits & CONNECTED_BIT)) {
+        return false;
+    }
+    PERF_END(dhcp, "join.dhcp");
+    t->dhcp_us = esp_timer_get_time() - t1;
+    return true;
+}
+
+static const char *reason_name(uint8_t reason)
+{
+    switch (reason) {
+    case LINK_REASON_TIMEOUT:                return "timeout";
+    case WIFI_REASON_UNSPECIFIED:            return "unspecified";
+    case WIFI_REASON_AUTH_EXPIRE:            return "auth_expire";
+    case WIFI_REASON_AUTH_LEAVE:             return "auth_leave";
+    case WIFI_REASON_ASSOC_LEAVE:            return "assoc_leave";
+    case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT: return "4way_timeout";
+    case WIFI_REASON_BEACON_TIMEOUT:         return "beacon_timeout";
+    case WIFI_REASON_NO_AP_FOUND:            return "no_ap_found";
+    case WIFI_REASON_AUTH_FAIL:              return "auth_fail";
+    case WIFI_REASON_ASSOC_FAIL:             return "assoc_fail";
+    case WIFI_REASON_HANDSHAKE_TIMEOUT:      return "handshake_timeout";
+    case WIFI_REASON_CONNECTION_FAIL:        return "connection_fail";
+    default:                                 return "other";
+    }
+}
+
+// Sous s_link_lock : le lien courant s'arrête, sa durée passe au total
+static void link_closed(int64_t now)
+{
+    if (s_link.up_since) {
+        s_link.up_total_us += now - s_link.up_since;
+        s_link.up_since = 0;
+    }
+}
+
+static void link_set_idle(void)
+{
+    xSemaphoreTake(s_link_lock, portMAX_DELAY);
+    link_closed(esp_timer_get_time());
+    s_link.state = LINK_IDLE;
+    xSemaphoreGive(s_link_lock);
+}
+
+// Associated again (join, reconnect or roam): BSSID and channel from the driver
+static void link_up(void)
+{
+    wifi_ap_record_t ap = {0};
+    esp_wifi_sta_get_ap_info(&ap);
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(s_link_lock, portMAX_DELAY);
+    s_link.state = LINK_UP;
+    memcpy(s_link.bssid, ap.bssid, 6);
+    s_link.channel = ap.primary;
+    s_link.up_since = now;
+    if (s_link.first_up == 0) {
+        s_link.first_up = now;
+    }
+    s_link.backoff_ms = LINK_BACKOFF_MIN_MS;
+    s_link.retries = 0;
+    xSemaphoreGive(s_link_lock);
+}
+
+static void link_joined(const char *ssid, const char *pass)
+{
+    xSemaphoreTake(s_link_lock, portMAX_DELAY);
+    if (strncmp(s_link.ssid, ssid, sizeof(s_link.ssid)) != 0) {
+        s_link.rssi_count = s_link.rssi_head = 0;   // autre réseau, autre tendance
+    }
+    strlcpy(s_link.ssid, ssid, sizeof(s_link.ssid));
+    strlcpy(s_link.pass, pass ? pass : "", sizeof(s_link.pass));
+    s_link.roam_checked = esp_timer_get_time();
+    xSemaphoreGive(s_link_lock);
+    link_up();
+}
+
+// Déconnecté (ou reconnexion sans réponse) : prochain essai après le backoff
+static void link_dropped(uint8_t reason, int64_t now)
+{
+    xSemaphoreTake(s_link_lock, portMAX_DELAY);
+    bool was_up = s_link.state == LINK_UP;
+    if (was_up) {
+        s_link.disconnects++;
+        s_link.backoff_ms = LINK_BACKOFF_MIN_MS;
+        link_closed(now);
+    } else {
+        s_link.retries++;
+        s_link.backoff_ms = s_link.backoff_ms * 2 > LINK_BACKOFF_MAX_MS ? LINK_BACKOFF_MAX_MS : s_link.backoff_ms * 2;
+    }
+    memmove(s_link.reasons + 1, s_link.reasons, LINK_REASONS - 1);
+    s_link.reasons[0] = reason;
+    if (s_link.reason_count < LINK_REASONS) {
+        s_link.reason_count++;
+    }
+    // Exponential backoff with up to 25% jitter, like the agent
+    uint32_t delay = s_link.backoff_ms + esp_random() % (s_link.backoff_ms / 4 + 1);
+    s_link.retry_at = now + (int64_t)delay * 1000;
+    s_link.state = LINK_BACKOFF;
+    uint32_t retries = s_link.retries;
+    xSemaphoreGive(s_link_lock);
+
+    if (was_up) {
+        ESP_LOGW(TAG, "Link lost: reason %u (%s), retry in %" PRIu32 " ms", reason, reason_name(reason), delay);
+    } else {
+        ESP_LOGW(TAG, "Reconnect %" PRIu32 " failed: reason %u (%s), retry in %" PRIu32 " ms",
+                 retries, reason, reason_name(reason), delay);
+    }
+
+    wifi_config_t cfg;
+    if (retries == LINK_UNPIN_RETRIES && esp_wifi_get_config(WIFI_IF_STA, &cfg) == ESP_OK && cfg.sta.bssid_set) {
+        // Le BSSID du join ne répond plus : n'importe quel AP du SSID fera l'affaire
+        ESP_LOGI(TAG, "Unpinning BSSID, the driver will pick an AP of '%s'", s_link.ssid);
+        cfg.sta.bssid_set = false;
+        cfg.sta.channel = 0;
+        esp_wifi_set_config(WIFI_IF_STA, &cfg);
+    }
+}
+
+static void link_retry(int64_t now)
+{
+    xSemaphoreTake(s_link_lock, portMAX_DELAY);
+    s_link.state = LINK_CONNECTING;
+    s_link.connecting_since = now;
+    s_link.reconnects++;
+    xSemaphoreGive(s_link_lock);
+    esp_wifi_connect();
+}
+
+static void link_sample(void)
+{
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return;
+    }
+    xSemaphoreTake(s_link_lock, portMAX_DELAY);
+    s_link.rssi[s_link.rssi_head] = ap.rssi;
+    s_link.rssi_head = (s_link.rssi_head + 1) % LINK_RSSI_SAMPLES;
+    if (s_link.rssi_count < LINK_RSSI_SAMPLES) {
+        s_link.rssi_count++;
+    }
+    memcpy(s_link.bssid, ap.bssid, 6);
+    s_link.channel = ap.primary;
+    xSemaphoreGive(s_link_lock);
+}
+
+// i-th most recent RSSI sample, 0 the latest
+static int link_rssi_at(unsigned i)
+{
+    return s_link.rssi[(s_link.rssi_head + LINK_RSSI_SAMPLES - 1 - i) % LINK_RSSI_SAMPLES];
+}
+
+static int link_rssi_avg(unsigned n)
+{
+    int sum = 0;
+    for (unsigned i = 0; i < n; i++) {
+        sum += link_rssi_at(i);
+    }
+    return n ? sum / (int)n : 0;
+}
 
-    int bits = xEventGroupWaitBits(
-        wifi_event_group, CONNECTED_BIT,
-        pdFALSE, pdTRUE,
-        timeout_ms / portTICK_PERIOD_MS
-    );
-    return (bits & CONNECTED_BIT) != 0;
+// Least squares slope of the samples, dB per minute
+static float link_rssi_trend(void)
+{
+    unsigned n = s_link.rssi_count;
+    if (n < 2) {
+        return 0;
+    }
+    float xm = (n - 1) / 2.0f, ym = 0, num = 0, den = 0;
+    for (unsigned i = 0; i < n; i++) {
+        ym += link_rssi_at(n - 1 - i);
+    }
+    ym /= n;
+    for (unsigned i = 0; i < n; i++) {
+        float dx = i - xm;
+        num += dx * (link_rssi_at(n - 1 - i) - ym);
+        den += dx * dx;
+    }
+    return num / den * (60000.0f / LINK_SAMPLE_MS);
+}
+
+// Weak link: a directed scan, and a move if another BSSID of the SSID is clearly stronger
+static void link_roam(int64_t now)
+{
+    if (s_link.rssi_count < 3 || link_rssi_avg(3) >= LINK_ROAM_RSSI ||
+        now - s_link.roam_checked < (int64_t)LINK_ROAM_EVERY_MS * 1000) {
+        return;
+    }
+    s_link.roam_checked = now;
+    int cur = link_rssi_avg(3);
+    join_hint_t hint;
+    int8_t best;
+    if (!join_scan(s_link.ssid, &hint, &best) || memcmp(hint.bssid, s_link.bssid, 6) == 0 ||
+        best < cur + LINK_ROAM_MARGIN_DB) {
+        ESP_LOGD(TAG, "No better AP than %d dBm", cur);
+        return;
+    }
+
+    const uint8_t *b = hint.bssid;
+    ESP_LOGI(TAG, "Roaming to %02x:%02x:%02x:%02x:%02x:%02x ch %u (%d dBm, now %d dBm)",
+             b[0], b[1], b[2], b[3], b[4], b[5], hint.channel, best, cur);
+    wifi_config_t cfg;
+    ESP_ERROR_CHECK( esp_wifi_get_config(WIFI_IF_STA, &cfg) );
+    cfg.sta.bssid_set = true;
+    memcpy(cfg.sta.bssid, hint.bssid, 6);
+    cfg.sta.channel = hint.channel;
+
+    s_joining = true;                   // pas de DROP_BIT pour ce départ voulu
+    xEventGroupClearBits(wifi_event_group, FAIL_BIT);
+    esp_wifi_disconnect();
+    xEventGroupWaitBits(wifi_event_group, FAIL_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(1000));
+    xSemaphoreTake(s_link_lock, portMAX_DELAY);
+    link_closed(esp_timer_get_time());
+    xSemaphoreGive(s_link_lock);
+    xEventGroupClearBits(wifi_event_group, CONNECTED_BIT | LINK_BIT | FAIL_BIT);
+    esp_wifi_set_config(WIFI_IF_STA, &cfg);
+    esp_wifi_connect();
+    EventBits_t bits = xEventGroupWaitBits(wifi_event_group, LINK_BIT | FAIL_BIT, pdFALSE, pdFALSE,
+                                           pdMS_TO_TICKS(LINK_CONNECT_MS));
+    s_joining = false;
+
+    if (!(bits & LINK_BIT)) {
+        link_dropped(bits & FAIL_BIT ? s_reason : LINK_REASON_TIMEOUT, esp_timer_get_time());
+        return;
+    }
+    link_up();
+    xSemaphoreTake(s_link_lock, portMAX_DELAY);
+    s_link.roams++;
+    xSemaphoreGive(s_link_lock);
+    // Le prochain join ira directement au nouvel AP
+    join_hint_t cached;
+    if (join_cache_get(s_link.ssid, s_link.pass[0] ? s_link.pass : NULL, &cached)) {
+        memcpy(cached.bssid, hint.bssid, 6);
+        cached.channel = hint.channel;
+        join_cache_put(s_link.ssid, s_link.pass[0] ? s_link.pass : NULL, &cached);
+    }
+}
+
+static void link_task(void *arg)
+{
+    for (;;) {
+        TickType_t wait = pdMS_TO_TICKS(LINK_SAMPLE_MS);
+        if (s_link.state == LINK_BACKOFF) {
+            int64_t left = s_link.retry_at - esp_timer_get_time();
+            wait = left > 0 ? pdMS_TO_TICKS(left / 1000) : 0;
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        xSemaphoreTake(s_op_lock, portMAX_DELAY);   // pas pendant un join
+        EventBits_t bits = xEventGroupClearBits(wifi_event_group, DROP_BIT);
+        int64_t now = esp_timer_get_time();
+        if (!wifi_mgr_holds(WIFI_MGR_STA)) {
+            if (s_link.state != LINK_IDLE) {
+                link_set_idle();
+            }
+        } else if (bits & DROP_BIT) {
+            link_dropped(s_reason, now);
+        } else if (s_link.state == LINK_BACKOFF) {
+            if (now >= s_link.retry_at) {
+                link_retry(now);
+            }
+        } else if (s_link.state == LINK_CONNECTING) {
+            if (xEventGroupGetBits(wifi_event_group) & LINK_BIT) {
+                ESP_LOGI(TAG, "Reconnected after %" PRIu32 " attempt(s)", s_link.retries + 1);
+                link_up();
+            } else if (now - s_link.connecting_since > (int64_t)LINK_CONNECT_MS * 1000) {
+                link_dropped(LINK_REASON_TIMEOUT, now);
+            }
+        } else if (s_link.state == LINK_UP) {
+            link_sample();
+            link_roam(now);
+        }
+        xSemaphoreGive(s_op_lock);
+    }
+}
+
+/*
+    Connexion WiFi (réutilisable). Avec une entrée du cache (join_cache.h) :
+    un seul essai sur le BSSID et le canal connus, avec la PMK ; s'il
+    échoue l'entrée est oubliée et on repart du début. Sinon : scan ciblé
+    du SSID, PMK calculée une fois, essais jusqu'au timeout, et le cache
+    est rempli si ça marche.
+*/
+static bool wifi_join(const char *ssid, const char *pass, int timeout_ms, bool fresh, join_timing_t *t)
+{
+    ESP_ERROR_CHECK( lazy_once(&s_join_init, join_init) );
+    if (wifi_mgr_acquire(WIFI_MGR_STA) != ESP_OK) {
+        return false;
+    }
+    memset(t, 0, sizeof(*t));
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+
+    xSemaphoreTake(s_op_lock, portMAX_DELAY);
+    s_joining = true;
+    xEventGroupClearBits(wifi_event_group, DROP_BIT);
+    link_set_idle();
+    if (wifi_mgr_connected()) {
+        // Quitter l'AP courant avant d'en viser un autre
+        xEventGroupClearBits(wifi_event_group, FAIL_BIT);
+        esp_wifi_disconnect();
+        xEventGroupWaitBits(wifi_event_group, FAIL_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(1000));
+    }
+
+    join_hint_t hint;
+    t->cached = !fresh && join_cache_get(ssid, pass, &hint);
+    bool ok = false;
+    if (t->cached) {
+        ok = join_attempt(ssid, pass, &hint, deadline, t);
+        if (!ok) {
+            const uint8_t *b = hint.bssid;
+            ESP_LOGW(TAG, "Cached BSSID %02x:%02x:%02x:%02x:%02x:%02x ch %u failed (reason %u), full join",
+                     b[0], b[1], b[2], b[3], b[4], b[5], hint.channel, s_reason);
+            join_cache_forget(ssid);
+            t->cached = false;
+        }
+    }
+    if (!ok && remaining_ms(deadline) > 0) {
+        int64_t t0 = esp_timer_get_time();
+        PERF_BEGIN(scan);
+        bool found = join_scan(ssid, &hint, NULL);
+        PERF_END(scan, "join.scan");
+        t->scan_us = esp_timer_get_time() - t0;
+
+        if (found && pass && is_psk(hint.authmode)) {
+            t0 = esp_timer_get_time();
+            PERF_BEGIN(pmk);
+            hint.has_pmk = join_pmk_derive(ssid, pass, hint.pmk) == ESP_OK;
+            PERF_END(pmk, "join.pmk");
+            t->pmk_us = esp_timer_get_time() - t0;
+        }
+        // AP pas vu par le scan : le driver cherchera lui-même à chaque essai
+        while (!ok && remaining_ms(deadline) > 0) {
+            ok = join_attempt(ssid, pass, found ? &hint : NULL, deadline, t);
+            if (!ok && remaining_ms(deadline) > JOIN_RETRY_MS) {
+                ESP_LOGD(TAG, "Attempt %d failed (reason %u)", t->attempts, s_reason);
+                vTaskDelay(pdMS_TO_TICKS(JOIN_RETRY_MS));
+            }
+        }
+        if (ok && found) {
+            join_cache_put(ssid, pass, &hint);
+        }
+    }
+    s_joining = false;
+
+    if (!ok) {
+        // Plus de tentatives en fond : la radio peut s'arrêter
+        wifi_mgr_release(WIFI_MGR_STA);
+        xSemaphoreGive(s_op_lock);
+        return false;
+    }
+    link_joined(ssid, pass);
+    xSemaphoreGive(s_op_lock);
+    return true;
 }
 
 // Argument parsing struct
 static struct {
     struct arg_int *timeout;
+    struct arg_lit *fresh;
     struct arg_str *ssid;
     struct arg_str *password;
     struct arg_end *end;
@@ -102,22 +616,81 @@ static int join_cmd_func(int argc, char **argv)
 
     ESP_LOGI(TAG, "Connecting to SSID: '%s'", ssid);
 
-    bool connected = wifi_join(ssid, pass, timeout);
+    join_timing_t t;
+    bool connected = wifi_join(ssid, pass, timeout, join_args.fresh->count > 0, &t);
     if (!connected) {
-        ESP_LOGW(TAG, "Connection timed out or failed");
+        ESP_LOGW(TAG, "Connection timed out or failed (reason %u)", s_reason);
         return 1;
     }
-    ESP_LOGI(TAG, "Connected successfully");
+    ESP_LOGI(TAG, "Joined in %" PRId64 " ms%s: scan %" PRId64 ", pmk %" PRId64 ", connect %" PRId64
+             ", dhcp %" PRId64 " ms, %d attempt(s)",
+             (t.scan_us + t.pmk_us + t.connect_us + t.dhcp_us) / 1000, t.cached ? " (cached)" : "",
+             t.scan_us / 1000, t.pmk_us / 1000, t.connect_us / 1000, t.dhcp_us / 1000, t.attempts);
+    esp_netif_ip_info_t ip_info = {0};
+    wifi_ap_record_t ap = {0};
+    esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"), &ip_info);
+    esp_wifi_sta_get_ap_info(&ap);
+    wifi_out_link(result_sink_current(), ssid, ip_info.ip.addr, ap.rssi, ap.primary);
+    return 0;
+}
+
+static void print_duration(const char *label, int64_t us)
+{
+    uint32_t s = (uint32_t)(us / 1000000);
+    printf("%s %" PRIu32 "h%02" PRIu32 "m%02" PRIu32 "s", label, s / 3600, s / 60 % 60, s % 60);
+}
+
+static int link_cmd(int argc, char **argv)
+{
+    xSemaphoreTake(s_link_lock, portMAX_DELAY);
+    int64_t now = esp_timer_get_time();
+    const uint8_t *b = s_link.bssid;
+    printf("state: %s", s_link_state_names[s_link.state]);
+    if (s_link.ssid[0]) {
+        printf(", '%s' %02x:%02x:%02x:%02x:%02x:%02x ch %u", s_link.ssid,
+               b[0], b[1], b[2], b[3], b[4], b[5], s_link.channel);
+    }
+    if (s_link.state == LINK_BACKOFF) {
+        int64_t left = s_link.retry_at - now;
+        printf(", retry in %" PRId64 " ms", left > 0 ? left / 1000 : 0);
+    }
+    printf("\n");
+
+    int64_t up = s_link.up_since ? now - s_link.up_since : 0;
+    print_duration("uptime:", up);
+    print_duration(", total", s_link.up_total_us + up);
+    print_duration(" of", s_link.first_up ? now - s_link.first_up : 0);
+    printf(" since the first join\n");
+
+    if (s_link.rssi_count) {
+        printf("rssi: %d dBm, avg %d, trend %+.1f dB/min over %u samples\n", link_rssi_at(0),
+               link_rssi_avg(s_link.rssi_count), link_rssi_trend(), s_link.rssi_count);
+    }
+    printf("disconnects: %" PRIu32 ", reconnects: %" PRIu32 ", roams: %" PRIu32 ", backoff %" PRIu32 " ms\n",
+           s_link.disconnects, s_link.reconnects, s_link.roams, s_link.backoff_ms);
+    if (s_link.reason_count) {
+        printf("last reasons:");
+        for (unsigned i = 0; i < s_link.reason_count; i++) {
+            printf(" %u/%s", s_link.reasons[i], reason_name(s_link.reasons[i]));
+        }
+        printf("\n");
+    }
+    xSemaphoreGive(s_link_lock);
     return 0;
 }
 
 // Fonction d'enregistrement de la commande (appelle juste dans app_main)
 void register_join_wifi_cmd(void)
 {
+    s_link_lock = xSemaphoreCreateMutexStatic(&s_link_lock_buf);
+    s_op_lock = xSemaphoreCreateMutexStatic(&s_op_lock_buf);
+    s_link.backoff_ms = LINK_BACKOFF_MIN_MS;
+
     join_args.timeout  = arg_int0(NULL, "timeout", "<ms>", "Connection timeout (ms)");
+    join_args.fresh    = arg_lit0("f", "fresh", "Ignore the cached BSSID/channel/PMK, scan again");
     join_args.ssid     = arg_str1(NULL, NULL, "<ssid>", "SSID of AP");
     join_args.password = arg_str0(NULL, NULL, "<pass>", "Password (optional)");
-    join_args.end      = arg_end(2);
+    join_args.end      = arg_end(3);
 
     const esp_console_cmd_t join_cmd = {
         .command = "join",
@@ -127,5 +700,13 @@ void register_join_wifi_cmd(void)
         .argtable = &join_args,
     };
 
-    ESP_ERROR_CHECK( esp_console_cmd_register(&join_cmd) );
+    ESP_ERROR_CHECK( dispatch_register(&join_cmd) );
+
+    const esp_console_cmd_t link = {
+        .command = "link",
+        .help = "Station link: state, uptime, RSSI trend, disconnects and their reasons, roams",
+        .hint = NULL,
+        .func = &link_cmd,
+    };
+    ESP_ERROR_CHECK( dispatch_register(&link) );
 }
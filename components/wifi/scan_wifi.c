@@ -1,137 +1,336 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include "esp_log.h"
 #include "esp_console.h"
+#include "esp_timer.h"
+#include "dispatch.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "argtable3/argtable3.h"
 #include "esp_wifi.h"
-#include "esp_netif.h"
 #include "esp_event.h"
-#include "regex.h"
 #include "cmd_wifi.h"
+#include "wifi_mgr.h"
+#include "result.h"
+#include "perf.h"
+#include "arena.h"
+#include "jobs.h"
+#include "boot.h"
+#include "ap_table.h"
+#include "wifi_out.h"
 
-#define DEFAULT_SCAN_LIST_SIZE 20
-#define USE_CHANNEL_BITMAP 1
-#define CHANNEL_LIST_SIZE 3
-#define NB_SCAN_DEFAULT 20
+#define DEFAULT_SCAN_LIST_SIZE  20
+#define SCAN_CHANNEL_MAX        13
+#define SCAN_ALL_CHANNELS       ((1u << (SCAN_CHANNEL_MAX + 1)) - 2)   // bits 1..13
+#define SCAN_ACTIVE_DWELL_MS    120     // défauts du driver
+#define SCAN_PASSIVE_DWELL_MS   360
+#define SCAN_DONE_MARGIN_MS     1000    // au-delà, le SCAN_DONE ne viendra plus
+#define WATCH_LOST_ROUNDS       3       // tours sans le voir avant "disappeared"
 static const char *TAG = "scan";
 
-static void print_auth_mode(int authmode)
+// Réglages d'un scan, canal par canal
+typedef struct {
+    uint16_t channels;          // bit n = canal n
+    bool passive;
+    uint32_t dwell_ms;          // par canal
+    bool show_hidden;
+    const char *ssid;           // probe dirigé : trouve aussi l'AP caché de ce nom
+} scan_opts_t;
+
+// Appelé à la fin de chaque canal avec ses points d'accès
+typedef void (*scan_channel_fn_t)(uint8_t channel, const wifi_ap_record_t *aps, uint16_t count, void *ctx);
+
+static lazy_t s_scan_init = LAZY_INIT("wifi.scan");
+static SemaphoreHandle_t s_scan_done;
+static StaticSemaphore_t s_scan_done_buf;
+
+static void scan_done_handler(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    xSemaphoreGive(s_scan_done);
+}
+
+static esp_err_t scan_init(void)
+{
+    s_scan_done = xSemaphoreCreateBinaryStatic(&s_scan_done_buf);
+    return esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &scan_done_handler, NULL);
+}
+
+// "1,6,11", "1-6,11" ; 0 si invalide
+static uint16_t parse_channels(const char *list)
 {
-    switch (authmode) {
-    case WIFI_AUTH_OPEN:
-        ESP_LOGI(TAG, "Authmode \tWIFI_AUTH_OPEN");
-        break;
-    case WIFI_AUTH_OWE:
-        ESP_LOGI(TAG, "Authmode \tWIFI_AUTH_OWE");
-        break;
-    case WIFI_AUTH_WEP:
-        ESP_LOGI(TAG, "Authmode \tWIFI_AUTH_WEP");
-        break;
-    case WIFI_AUTH_WPA_PSK:
-        ESP_LOGI(TAG, "Authmode \tWIFI_AUTH_WPA_PSK");
-        break;
-    case WIFI_AUTH_WPA2_PSK:
-        ESP_LOGI(TAG, "Authmode \tWIFI_AUTH_WPA2_PSK");
-        break;
-    case WIFI_AUTH_WPA_WPA2_PSK:
-        ESP_LOGI(TAG, "Authmode \tWIFI_AUTH_WPA_WPA2_PSK");
-        break;
-    case WIFI_AUTH_ENTERPRISE:
-        ESP_LOGI(TAG, "Authmode \tWIFI_AUTH_ENTERPRISE");
-        break;
-    case WIFI_AUTH_WPA3_PSK:
-        ESP_LOGI(TAG, "Authmode \tWIFI_AUTH_WPA3_PSK");
-        break;
-    case WIFI_AUTH_WPA2_WPA3_PSK:
-        ESP_LOGI(TAG, "Authmode \tWIFI_AUTH_WPA2_WPA3_PSK");
-        break;
-    case WIFI_AUTH_WPA3_ENT_192:
-        ESP_LOGI(TAG, "Authmode \tWIFI_AUTH_WPA3_ENT_192");
-        break;
-    default:
-        ESP_LOGI(TAG, "Authmode \tWIFI_AUTH_UNKNOWN");
-        break;
+    uint16_t bits = 0;
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long from = strtol(p, &end, 10), to = from;
+        if (end == p) {
+            return 0;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            to = strtol(p, &end, 10);
+            if (end == p) {
+                return 0;
+            }
+        }
+        if (from < 1 || to > SCAN_CHANNEL_MAX || from > to) {
+            return 0;
+        }
+        for (long c = from; c <= to; c++) {
+            bits |= 1u << c;
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end) {
+            return 0;
+        }
+        p = end;
     }
+    return bits;
 }
 
-/* Initialize Wi-Fi as sta and set scan method */
-static int scan_wifi(int argc, char **argv)
+/*
+    Un scan non bloquant par canal, chacun terminé par WIFI_EVENT_SCAN_DONE :
+    les résultats d'un canal sortent dès qu'il est fini, et un kill du job
+    arrête entre deux canaux. Le gestionnaire doit tenir WIFI_MGR_SCAN.
+    Renvoie le nombre de points d'accès, ou -1.
+*/
+static int scan_channels(const scan_opts_t *opts, scan_channel_fn_t fn, void *ctx)
 {
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-    
-    esp_netif_t *sta_netif = esp_netif_create_default_wifi_sta();
-    assert(sta_netif);
+    if (lazy_once(&s_scan_init, scan_init) != ESP_OK) {
+        return -1;
+    }
+    uint16_t size = DEFAULT_SCAN_LIST_SIZE;
+    wifi_ap_record_t *aps = arena_calloc(size, sizeof(wifi_ap_record_t));
+    if (aps == NULL) {
+        ESP_LOGE(TAG, "Memory allocation failed");
+        return -1;
+    }
 
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    wifi_scan_config_t config = {
+        .ssid = (uint8_t *)opts->ssid,
+        .show_hidden = opts->show_hidden,
+        .scan_type = opts->passive ? WIFI_SCAN_TYPE_PASSIVE : WIFI_SCAN_TYPE_ACTIVE,
+    };
+    if (opts->passive) {
+        config.scan_time.passive = opts->dwell_ms;
+    } else {
+        config.scan_time.active.min = opts->dwell_ms;
+        config.scan_time.active.max = opts->dwell_ms;
+    }
 
-    uint16_t number = DEFAULT_SCAN_LIST_SIZE;
-    uint16_t ap_count = 0;
+    int total = 0;
+    for (uint8_t ch = 1; ch <= SCAN_CHANNEL_MAX && total >= 0 && !job_cancelled(); ch++) {
+        if (!(opts->channels & (1u << ch))) {
+            continue;
+        }
+        config.channel = ch;
+        xSemaphoreTake(s_scan_done, 0);         // un SCAN_DONE resté d'un scan interrompu
+        PERF_BEGIN(channel);
+        esp_err_t err = esp_wifi_scan_start(&config, false);
+        if (err != ESP_OK) {
+            // Refusé pendant une connexion en cours, par exemple
+            printf("scan-wifi: channel %u: %s\n", ch, esp_err_to_name(err));
+            total = -1;
+            break;
+        }
+        if (xSemaphoreTake(s_scan_done, pdMS_TO_TICKS(opts->dwell_ms + SCAN_DONE_MARGIN_MS)) != pdTRUE) {
+            ESP_LOGW(TAG, "Channel %u: no SCAN_DONE", ch);
+            esp_wifi_scan_stop();
+            continue;
+        }
+        PERF_END(channel, "scan.channel");
 
-    // Allocation dynamique du tableau pour les points d'accès
-    wifi_ap_record_t *ap_info = malloc(number * sizeof(wifi_ap_record_t));
-    if (ap_info == NULL) {
-        ESP_LOGE(TAG, "Memory allocation failed");
-        return ESP_ERR_NO_MEM;
+        uint16_t count = 0;
+        esp_wifi_scan_get_ap_num(&count);
+        if (count > size) {
+            // Agrandit en place si possible
+            wifi_ap_record_t *grown = arena_realloc(aps, count * sizeof(wifi_ap_record_t));
+            if (grown != NULL) {
+                aps = grown;
+                size = count;
+            }
+        }
+        count = size;
+        esp_wifi_scan_get_ap_records(&count, aps);      // libère aussi la liste du driver
+        fn(ch, aps, count, ctx);
+        total += count;
     }
+    arena_free(aps); // Rien à faire si le tableau est dans l'arena
+    return total;
+}
 
-    memset(ap_info, 0, number * sizeof(wifi_ap_record_t));
+static void print_channel(uint8_t channel, const wifi_ap_record_t *aps, uint16_t count, void *ctx)
+{
+    wifi_out_aps(ctx, aps, count);
+}
 
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_start());
+/* ---- continuous mode: only the changes ---- */
 
-    ESP_LOGI(TAG, "Scanning Wi-Fi networks...");
-    ESP_ERROR_CHECK(esp_wifi_scan_start(NULL, true)); // Démarre le scan en mode blocage
+typedef struct {
+    ap_table_t table;
+    result_sink_t *sink;
+    uint32_t now;                       // s depuis le début
+    uint32_t sightings;
+    uint32_t events;
+} watch_t;
 
-    // Attente explicite pour permettre au scan de se terminer (5 secondes ici)
-    vTaskDelay(pdMS_TO_TICKS(5000)); 
+static void watch_event(const ap_event_t *ev, void *ctx)
+{
+    watch_t *w = ctx;
+    w->events++;
+    wifi_out_event(w->sink, w->now, ev);
+}
+
+static void watch_channel(uint8_t channel, const wifi_ap_record_t *aps, uint16_t count, void *ctx)
+{
+    watch_t *w = ctx;
+    for (int i = 0; i < count; i++) {
+        ap_sighting_t s = {
+            .channel = aps[i].primary,
+            .authmode = aps[i].authmode,
+            .rssi = aps[i].rssi,
+        };
+        memcpy(s.bssid, aps[i].bssid, 6);
+        memcpy(s.ssid, aps[i].ssid, AP_TABLE_SSID_LEN);
+        ap_table_update(&w->table, &s, w->now);
+    }
+    w->sightings += count;
+    if (!w->sink) {
+        fflush(stdout);
+    }
+}
 
-    ESP_ERROR_CHECK(esp_wifi_scan_get_ap_num(&ap_count));
-    if (ap_count > number) {
-        ESP_LOGW(TAG, "Too many APs, increasing buffer size");
-        number = ap_count;  // Ajuste la taille du tableau
-        ap_info = realloc(ap_info, number * sizeof(wifi_ap_record_t)); // Réalloue la mémoire si nécessaire
-        if (ap_info == NULL) {
-            ESP_LOGE(TAG, "Memory reallocation failed");
-            return ESP_ERR_NO_MEM;
+// Un scan par période jusqu'au kill du job (ou rounds tours), seuls les changements sortent
+static int scan_watch(const scan_opts_t *opts, uint32_t period_s, uint32_t rounds)
+{
+    watch_t w = { .sink = result_sink_current() };
+    ap_entry_t *entries = arena_calloc(CONFIG_SCAN_WATCH_MAX_APS, sizeof(ap_entry_t));
+    if (entries == NULL) {
+        ESP_LOGE(TAG, "Memory allocation failed");
+        return 1;
+    }
+    // Perdu en tours, pas en secondes : un tour dure la période plus le scan
+    ap_table_init(&w.table, entries, CONFIG_SCAN_WATCH_MAX_APS, WATCH_LOST_ROUNDS, watch_event, &w);
+
+    int64_t start_us = esp_timer_get_time();
+    uint32_t round = 0, busy = 0;
+    while (!job_cancelled() && (rounds == 0 || round < rounds)) {
+        w.now = (esp_timer_get_time() - start_us) / 1000000;
+        // Le Wi-Fi est rendu entre deux tours : le driver s'arrête, une capture peut passer
+        if (wifi_mgr_acquire(WIFI_MGR_SCAN) == ESP_OK) {
+            scan_channels(opts, watch_channel, &w);
+            wifi_mgr_release(WIFI_MGR_SCAN);
+            ap_table_expire(&w.table);
+        } else {
+            busy++;
+        }
+        round++;
+        if (w.sink) {
+            result_sink_flush(w.sink);
+        }
+        for (uint32_t waited = 0; waited < period_s * 10 && !job_cancelled() && (rounds == 0 || round < rounds); waited++) {
+            vTaskDelay(pdMS_TO_TICKS(100));
         }
     }
 
-    ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&number, ap_info));
+    wifi_out_watch_done(w.sink, round, busy, w.sightings, w.events, &w.table);
+    arena_free(entries);
+    return 0;
+}
 
-    ESP_LOGI(TAG, "Total APs scanned = %u, actual AP number ap_info holds = %u", ap_count, number);
+static struct {
+    struct arg_str *channels;
+    struct arg_lit *passive;
+    struct arg_int *dwell;
+    struct arg_lit *hidden;
+    struct arg_str *ssid;
+    struct arg_int *watch;
+    struct arg_int *rounds;
+    struct arg_end *end;
+} scan_args;
 
-    for (int i = 0; i < number; i++) {
-        ESP_LOGI(TAG, "SSID \t\t%s", ap_info[i].ssid);
-        ESP_LOGI(TAG, "RSSI \t\t%d", ap_info[i].rssi);
-        ESP_LOGI(TAG, "BSSID: %02X:%02X:%02X:%02X:%02X:%02X",
-                 ap_info[i].bssid[0], ap_info[i].bssid[1], ap_info[i].bssid[2],
-                 ap_info[i].bssid[3], ap_info[i].bssid[4], ap_info[i].bssid[5]);
-        print_auth_mode(ap_info[i].authmode);
-        ESP_LOGI(TAG, "Channel \t\t%d", ap_info[i].primary);
+static int scan_wifi(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&scan_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, scan_args.end, argv[0]);
+        return 1;
+    }
+    scan_opts_t opts = {
+        .channels = SCAN_ALL_CHANNELS,
+        .passive = scan_args.passive->count > 0,
+        .show_hidden = scan_args.hidden->count > 0,
+        .ssid = scan_args.ssid->count ? scan_args.ssid->sval[0] : NULL,
+    };
+    opts.dwell_ms = scan_args.dwell->count ? scan_args.dwell->ival[0] :
+                    opts.passive ? SCAN_PASSIVE_DWELL_MS : SCAN_ACTIVE_DWELL_MS;
+    if (scan_args.channels->count) {
+        opts.channels = parse_channels(scan_args.channels->sval[0]);
+        if (opts.channels == 0) {
+            printf("scan-wifi: bad channel list '%s' (1-%d, e.g. 1,6,11 or 1-6)\n",
+                   scan_args.channels->sval[0], SCAN_CHANNEL_MAX);
+            return 1;
+        }
+    }
+    if (opts.dwell_ms < 10 || opts.dwell_ms > 1500) {
+        printf("scan-wifi: dwell time must be 10-1500 ms\n");
+        return 1;
     }
 
-    free(ap_info); // Libère la mémoire après l'utilisation
+    if (scan_args.watch->count) {
+        int period = scan_args.watch->ival[0];
+        int rounds = scan_args.rounds->count ? scan_args.rounds->ival[0] : 0;
+        if (period < 1 || rounds < 0) {
+            printf("scan-wifi: watch period must be at least 1 s\n");
+            return 1;
+        }
+        return scan_watch(&opts, period, rounds);
+    }
+
+    // Driver démarré au besoin, l'association en cours est gardée
+    esp_err_t err = wifi_mgr_acquire(WIFI_MGR_SCAN);
+    if (err != ESP_OK) {
+        printf("scan-wifi: Wi-Fi busy (%s)\n", wifi_mgr_state_name(wifi_mgr_state()));
+        return 1;
+    }
 
-    ESP_ERROR_CHECK(esp_wifi_stop());
-    ESP_ERROR_CHECK(esp_wifi_deinit());
-    esp_netif_destroy(sta_netif);
-    ESP_ERROR_CHECK(esp_event_loop_delete_default());
+    result_sink_t *sink = result_sink_current();
+    wifi_out_ap_header(sink);
+    int64_t start_us = esp_timer_get_time();
+    PERF_BEGIN(scan);
+    int total = scan_channels(&opts, print_channel, sink);
+    PERF_END(scan, "scan.total");
+    uint32_t ms = (esp_timer_get_time() - start_us) / 1000;
+    wifi_mgr_release(WIFI_MGR_SCAN);
+    if (total < 0) {
+        return 1;
+    }
 
+    wifi_out_scan_done(sink, total, __builtin_popcount(opts.channels), ms);
     return 0;
 }
 
 void module_scan_wifi(void)
 {
+    scan_args.channels = arg_str0("c", "channels", "<list>", "Channels, e.g. 1,6,11 or 1-13 (default all)");
+    scan_args.passive = arg_lit0("p", "passive", "Passive scan: listen for beacons, send no probe");
+    scan_args.dwell = arg_int0("t", "dwell", "<ms>", "Time per channel (default 120 active, 360 passive)");
+    scan_args.hidden = arg_lit0("H", "hidden", "Also list APs that hide their SSID");
+    scan_args.ssid = arg_str0("s", "ssid", "<ssid>", "Probe for this SSID, finds it even when hidden");
+    scan_args.watch = arg_int0("w", "watch", "<s>", "Scan every s seconds, print only changes (until killed)");
+    scan_args.rounds = arg_int0("n", "rounds", "<n>", "With -w, stop after n scans");
+    scan_args.end = arg_end(7);
+
     const esp_console_cmd_t scan_cmd = {
         .command = "scan-wifi",
-        .help = "scan all network around us",
+        .help = "Scan channel by channel, each channel's APs printed as soon as it is done",
         .hint = NULL,
-        .func = &scan_wifi
+        .func = &scan_wifi,
+        .argtable = &scan_args
     };
 
-    ESP_ERROR_CHECK( esp_console_cmd_register(&scan_cmd) );
+    ESP_ERROR_CHECK( dispatch_register(&scan_cmd) );
 }
@@ -1,12 +1,29 @@
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include "esp_log.h"
 #include "esp_wifi.h"
 #include "esp_console.h"
+#include "dispatch.h"
 #include "argtable3/argtable3.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
+#include "result.h"
+#include "jobs.h"
+#include "arena.h"
+#include "pipeline.h"
+#include "cmd_wifi.h"
+#include "wifi_mgr.h"
+#include "wifi_out.h"
+
+#define SNIFF_FRAME_BYTES   96      // en-tête management + SSID, ou les 64 octets EAPOL affichés
+#define SNIFF_WORKER_STACK  4096
+#define SNIFF_WORKER_PRIO   5
+#define SNIFF_STOP          0xFF
 
 // Log tag
 static const char *TAG = "WiFi_Sniffer";
@@ -14,120 +31,165 @@ static const char *TAG = "WiFi_Sniffer";
 // Déclaration de la fonction stop_sniffer avant son utilisation
 void stop_sniffer(void);
 
-// Fonction pour extraire le SSID des trames Beacon ou Probe Response
-void extract_ssid(const uint8_t *payload, uint16_t length) {
-    if (length < 36) {
-        ESP_LOGW(TAG, "Trame trop courte pour contenir un SSID");
-        return;
-    }
-
-    uint8_t ssid_length = payload[37]; // Longueur du SSID
-
-    if (ssid_length > 0 && (37 + ssid_length < length)) {
-        printf("SSID : ");
-        for (int i = 0; i < ssid_length; i++) {
-            printf("%c", payload[38 + i]);
-        }
-        printf("\n");
-    } else {
-        ESP_LOGW(TAG, "Aucun SSID ou longueur invalide");
-    }
-}
+/* Pipeline : le callback (tâche Wi-Fi, coeur protocole) ne fait que filtrer
+ * et copier la trame dans la file ; le worker (coeur applicatif, voir
+ * pipeline.h) l'analyse et l'affiche. */
+typedef struct {
+    uint8_t type;                   // wifi_promiscuous_pkt_type_t, SNIFF_STOP pour finir
+    int8_t rssi;
+    uint8_t channel;
+    uint16_t length;                // octets copiés dans payload
+    uint8_t payload[SNIFF_FRAME_BYTES];
+} sniff_frame_t;
+
+// Sink de la commande en cours, capturé au démarrage : le worker n'est pas la tâche de la commande
+static result_sink_t *s_sink;
+static FILE *s_out;
+static QueueHandle_t s_queue;
+static StaticQueue_t s_queue_buf;
+static SemaphoreHandle_t s_worker_done;
+static StaticSemaphore_t s_worker_done_buf;
+static volatile uint32_t s_captured, s_dropped, s_processed;
+static uint32_t s_max_depth;
 
 // Fonction pour analyser une trame Beacon ou Probe Response
-void analyze_beacon_or_probe(const uint8_t *payload, uint16_t length) {
-    uint8_t frame_control = payload[0];
+void analyze_beacon_or_probe(const sniff_frame_t *rx) {
+    uint8_t frame_control = rx->payload[0];
     uint8_t type = (frame_control >> 2) & 0x03;  // Type de trame (0x00 pour management, 0x01 pour contrôle, 0x02 pour données)
     uint8_t subtype = (frame_control >> 4) & 0x0F;  // Sous-type de trame (0x08 pour Beacon, 0x04 pour Probe Request, etc.)
 
     if (type == 0x00 && (subtype == 0x08 || subtype == 0x04 || subtype == 0x05)) { // Beacon ou Probe Request/Response
-        ESP_LOGI(TAG, "Type de trame : %s, Sous-type : 0x%02x", (subtype == 0x08) ? "Beacon" : (subtype == 0x04) ? "Probe Request" : "Probe Response", subtype);
-
-        // Extraire et afficher les informations sur les adresses MAC
-        printf("Adresse Destination : %02x:%02x:%02x:%02x:%02x:%02x\n", payload[4], payload[5], payload[6], payload[7], payload[8], payload[9]);
-        printf("Adresse Source : %02x:%02x:%02x:%02x:%02x:%02x\n", payload[10], payload[11], payload[12], payload[13], payload[14], payload[15]);
-        printf("Adresse BSSID : %02x:%02x:%02x:%02x:%02x:%02x\n", payload[16], payload[17], payload[18], payload[19], payload[20], payload[21]);
-
-        // Si c'est un Beacon ou Probe Response, extraire le SSID
-        if (subtype == 0x08 || subtype == 0x05) {  // Beacon ou Probe Response
-            extract_ssid(payload, length);
-        }
+        wifi_out_mgmt(s_sink, rx->payload, rx->length, rx->rssi, rx->channel);
     }
 }
 
 // Fonction pour analyser les trames de données (par exemple, un EAPOL dans le cas d'un handshake WPA)
-void analyze_data_frame(const uint8_t *payload, uint16_t length) {
+void analyze_data_frame(const sniff_frame_t *rx) {
+    const uint8_t *payload = rx->payload;
+    uint16_t length = rx->length;
     uint8_t frame_control = payload[0];
     uint8_t type = (frame_control >> 2) & 0x03;  // Type de trame
     uint8_t subtype = (frame_control >> 4) & 0x0F;  // Sous-type de trame
 
     // Afficher les trames EAPOL (handshake WPA)
     if (type == 0x02 && subtype == 0x08) {  // Data frame, subtype 0x08 (EAPOL)
-        if (length > 34 && payload[30] == 0x88 && payload[31] == 0x8E) {
-            ESP_LOGI(TAG, "Trame EAPOL détectée (HandShake WPA/WPA2)");
-
-            // Afficher le payload EAPOL
-            printf("EAPOL Payload : ");
-            for (int i = 0; i < length && i < 64; i++) {
-                printf("%02x ", payload[i]);
-            }
-            printf("\n\n");
+        // En-tête QoS data (26 octets) + LLC/SNAP : ethertype aux octets 32-33
+        if (length > 36 && payload[32] == 0x88 && payload[33] == 0x8E) {
+            wifi_out_eapol(s_sink, payload, length, rx->rssi);
         }
     }
 }
 
-// Fonction de callback pour la capture des trames
+// Fonction de callback pour la capture des trames : filtre et copie, rien d'autre
 void promiscuous_callback(void *buf, wifi_promiscuous_pkt_type_t type) {
     wifi_promiscuous_pkt_t *pkt = (wifi_promiscuous_pkt_t *)buf;
-    uint8_t *payload = pkt->payload;
+    const uint8_t *payload = pkt->payload;
     uint16_t length = pkt->rx_ctrl.sig_len;
+    uint8_t subtype = (payload[0] >> 4) & 0x0F;
+    QueueHandle_t queue = s_queue;
+    if (queue == NULL) {
+        return;     // entre deux captures
+    }
 
-    // Analyser les trames Beacon et Probe Response
-    if (type == 0) {  // Type de trame management (Beacon, Probe Request/Response)
-        analyze_beacon_or_probe(payload, length);
+    // Beacon, Probe Request/Response ou EAPOL (handshake WPA/WPA2)
+    bool mgmt = type == WIFI_PKT_MGMT && (subtype == 0x08 || subtype == 0x04 || subtype == 0x05);
+    bool eapol = type == WIFI_PKT_DATA && subtype == 0x08 && length > 36 && payload[32] == 0x88 && payload[33] == 0x8E;
+    if (!mgmt && !eapol) {
+        return;
+    }
+    sniff_frame_t frame = {
+        .type = type,
+        .rssi = pkt->rx_ctrl.rssi,
+        .channel = pkt->rx_ctrl.channel,
+        .length = length < SNIFF_FRAME_BYTES ? length : SNIFF_FRAME_BYTES,
+    };
+    memcpy(frame.payload, payload, frame.length);
+    s_captured++;
+    if (xQueueSend(queue, &frame, 0) != pdTRUE) {
+        s_dropped++;
     }
+}
 
-    // Analyser les trames de données (pour capturer les handshakes WPA/WPA2)
-    if (type == 2) {  // Type de trame data (Data)
-        analyze_data_frame(payload, length);
+// Analyse et sortie, sur le stdout de la commande
+static void sniff_worker(void *arg) {
+    stdout = s_out;
+    sniff_frame_t frame;
+    while (xQueueReceive(s_queue, &frame, portMAX_DELAY) == pdTRUE && frame.type != SNIFF_STOP) {
+        uint32_t depth = uxQueueMessagesWaiting(s_queue) + 1;
+        if (depth > s_max_depth) {
+            s_max_depth = depth;
+        }
+        if (frame.type == WIFI_PKT_MGMT) {
+            analyze_beacon_or_probe(&frame);
+        } else {
+            analyze_data_frame(&frame);
+        }
+        s_processed++;
     }
+    fflush(stdout);
+    xSemaphoreGive(s_worker_done);
+    vTaskDelete(NULL);
 }
 
 // Fonction pour initialiser le Wi-Fi en mode promiscuous
 void wifi_init_promiscuous(int duration_seconds) {
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-
-    // Initialisation du Wi-Fi
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-
-    // Configuration du Wi-Fi en mode station
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-
-    // Activation du mode promiscuous
-    ESP_ERROR_CHECK(esp_wifi_set_promiscuous(true));
+    // Driver démarré au besoin, l'association en cours est gardée ; une capture à la fois
+    if (wifi_mgr_acquire(WIFI_MGR_PROMISC) != ESP_OK) {
+        printf("sniffer_wifi: Wi-Fi busy (%s)\n", wifi_mgr_state_name(wifi_mgr_state()));
+        return;
+    }
 
-    // Configuration du callback pour les trames capturées
+    // File des trames dans l'arena de la commande, puis le worker
+    s_sink = result_sink_current();
+    s_out = stdout;
+    s_captured = s_dropped = s_processed = s_max_depth = 0;
+    uint8_t *storage = arena_alloc(CONFIG_SNIFF_QUEUE_LEN * sizeof(sniff_frame_t));
+    if (storage == NULL) {
+        ESP_LOGE(TAG, "Memory allocation failed");
+        wifi_mgr_release(WIFI_MGR_PROMISC);
+        return;
+    }
+    s_queue = xQueueCreateStatic(CONFIG_SNIFF_QUEUE_LEN, sizeof(sniff_frame_t), storage, &s_queue_buf);
+    s_worker_done = xSemaphoreCreateBinaryStatic(&s_worker_done_buf);
+    if (pipeline_task_create(sniff_worker, "sniff_w", SNIFF_WORKER_STACK, NULL, SNIFF_WORKER_PRIO, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Cannot create the sniffer worker");
+        wifi_mgr_release(WIFI_MGR_PROMISC);
+        vQueueDelete(s_queue);
+        s_queue = NULL;
+        arena_free(storage);
+        return;
+    }
     esp_wifi_set_promiscuous_rx_cb(promiscuous_callback);
 
-    // Démarrage du Wi-Fi
-    ESP_ERROR_CHECK(esp_wifi_start());
-
-    ESP_LOGI(TAG, "Mode promiscuous activé.");
+    ESP_LOGI(TAG, "Mode promiscuous activé, worker %s.", pipeline_pinned() ? "sur le coeur applicatif" : "non épinglé");
+    int64_t start_us = esp_timer_get_time();
 
-    // Attendre pendant la durée spécifiée avant d'arrêter le sniffer
-    vTaskDelay(pdMS_TO_TICKS(duration_seconds * 1000));
+    // Attendre pendant la durée spécifiée avant d'arrêter le sniffer (ou un kill du job)
+    for (int waited = 0; waited < duration_seconds * 10 && !job_cancelled(); waited++) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
 
-    // Arrêter le mode promiscuous
+    // Arrêter le mode promiscuous, puis le worker une fois la file vidée
     stop_sniffer();
+    const sniff_frame_t stop = { .type = SNIFF_STOP };
+    xQueueSend(s_queue, &stop, portMAX_DELAY);
+    xSemaphoreTake(s_worker_done, portMAX_DELAY);
+    uint32_t ms = (esp_timer_get_time() - start_us) / 1000;
+    vSemaphoreDelete(s_worker_done);
+    QueueHandle_t queue = s_queue;
+    s_queue = NULL;
+    vQueueDelete(queue);
+    s_sink = NULL;
+    arena_free(storage);
+
+    ESP_LOGI(TAG, "%" PRIu32 " trames capturées, %" PRIu32 " traitées, %" PRIu32 " perdues (file de %d, pic %" PRIu32 "), %" PRIu32 " trames/s",
+             s_captured, s_processed, s_dropped, CONFIG_SNIFF_QUEUE_LEN, s_max_depth,
+             ms ? (uint32_t)((uint64_t)s_processed * 1000 / ms) : 0);
 }
 
 void stop_sniffer(void) {
     ESP_LOGI(TAG, "Arrêt du mode promiscuous Wi-Fi");
-    ESP_ERROR_CHECK(esp_wifi_set_promiscuous(false));
-    ESP_ERROR_CHECK(esp_wifi_stop());
-    ESP_ERROR_CHECK(esp_wifi_deinit());
+    wifi_mgr_release(WIFI_MGR_PROMISC);
 }
 
 // Définition des arguments pour la commande sniffer
@@ -165,5 +227,5 @@ void module_sniff_wif(void)
         .argtable = &sniffer_args
     };
 
-    ESP_ERROR_CHECK(esp_console_cmd_register(&sniff_cmd));
+    ESP_ERROR_CHECK(dispatch_register(&sniff_cmd));
 }
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_console.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "dispatch.h"
+#include "boot.h"
+#include "cmd_wifi.h"
+#include "wifi_mgr.h"
+
+#define HELD(state)         (1u << (state))
+#define EXCLUSIVE           (HELD(WIFI_MGR_SCAN) | HELD(WIFI_MGR_PROMISC))
+
+static const char *TAG = "wifi_mgr";
+
+static const char *const s_names[WIFI_MGR_STATE_COUNT] = { "off", "sta", "scan", "promisc", "ap" };
+
+static SemaphoreHandle_t s_lock;
+static StaticSemaphore_t s_lock_buf;
+static lazy_t s_driver = LAZY_INIT("wifi.driver");
+static uint32_t s_held;                 // HELD() bits of the running activities
+static bool s_started;
+static volatile bool s_connected;
+static wifi_mgr_timing_t s_timing[WIFI_MGR_STATE_COUNT];
+static wifi_mgr_timing_t s_cold;
+
+// Etat du lien pour tout le monde, join garde son propre handler pour l'attente
+static void link_handler(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
+        s_connected = true;
+    } else if (base == WIFI_EVENT && (id == WIFI_EVENT_STA_DISCONNECTED || id == WIFI_EVENT_STA_STOP)) {
+        s_connected = false;
+    }
+}
+
+// Le seul esp_wifi_init() du firmware
+static esp_err_t driver_init(void)
+{
+    esp_err_t err = wifi_stack_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    err = esp_wifi_init(&cfg);
+    if (err == ESP_OK) {
+        err = esp_wifi_set_storage(WIFI_STORAGE_RAM);
+    }
+    if (err == ESP_OK) {
+        err = esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &link_handler, NULL);
+    }
+    if (err == ESP_OK) {
+        err = esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &link_handler, NULL);
+    }
+    if (err == ESP_OK) {
+        err = esp_wifi_set_mode(WIFI_MODE_STA);
+    }
+    return err;
+}
+
+static void timing_add(wifi_mgr_timing_t *t, int64_t us)
+{
+    t->count++;
+    t->sum_us += us;
+    if (us > t->max_us) {
+        t->max_us = us;
+    }
+}
+
+esp_err_t wifi_mgr_acquire(wifi_mgr_state_t state)
+{
+    if (state == WIFI_MGR_OFF || state >= WIFI_MGR_STATE_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int64_t t0 = esp_timer_get_time();
+    bool cold = !lazy_done(&s_driver);
+    esp_err_t err = ESP_OK;
+    if ((HELD(state) & EXCLUSIVE) && (s_held & EXCLUSIVE)) {
+        // Le scan et la capture changent tous deux de canal
+        ESP_LOGW(TAG, "%s refused, %s running", s_names[state],
+                 s_held & HELD(WIFI_MGR_SCAN) ? s_names[WIFI_MGR_SCAN] : s_names[WIFI_MGR_PROMISC]);
+        err = ESP_ERR_INVALID_STATE;
+    }
+    if (err == ESP_OK) {
+        err = lazy_once(&s_driver, driver_init);
+    }
+    if (err == ESP_OK && state == WIFI_MGR_AP && !(s_held & HELD(WIFI_MGR_AP))) {
+        err = esp_wifi_set_mode(WIFI_MODE_APSTA);
+    }
+    if (err == ESP_OK && !s_started) {
+        err = esp_wifi_start();
+        s_started = err == ESP_OK;
+    }
+    if (err == ESP_OK && state == WIFI_MGR_PROMISC) {
+        err = esp_wifi_set_promiscuous(true);
+    }
+    if (err == ESP_OK) {
+        s_held |= HELD(state);
+        timing_add(cold ? &s_cold : &s_timing[state], esp_timer_get_time() - t0);
+    } else if (err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Cannot enter %s (%s)", s_names[state], esp_err_to_name(err));
+    }
+    xSemaphoreGive(s_lock);
+    return err;
+}
+
+void wifi_mgr_release(wifi_mgr_state_t state)
+{
+    if (state == WIFI_MGR_OFF || state >= WIFI_MGR_STATE_COUNT) {
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_held & HELD(state)) {
+        s_held &= ~HELD(state);
+        if (state == WIFI_MGR_PROMISC) {
+            esp_wifi_set_promiscuous(false);
+        } else if (state == WIFI_MGR_STA) {
+            esp_wifi_disconnect();
+        } else if (state == WIFI_MGR_AP) {
+            esp_wifi_set_mode(WIFI_MODE_STA);
+        }
+        if (s_held == 0 && s_started) {
+            // Arrêté, pas désinitialisé : le prochain démarrage est à chaud
+            int64_t t0 = esp_timer_get_time();
+            esp_wifi_stop();
+            s_started = false;
+            timing_add(&s_timing[WIFI_MGR_OFF], esp_timer_get_time() - t0);
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
+
+wifi_mgr_state_t wifi_mgr_state(void)
+{
+    // L'activité la plus précise d'abord
+    static const wifi_mgr_state_t order[] = { WIFI_MGR_PROMISC, WIFI_MGR_SCAN, WIFI_MGR_AP, WIFI_MGR_STA };
+    uint32_t held = s_held;
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        if (held & HELD(order[i])) {
+            return order[i];
+        }
+    }
+    return WIFI_MGR_OFF;
+}
+
+bool wifi_mgr_holds(wifi_mgr_state_t state)
+{
+    return state < WIFI_MGR_STATE_COUNT && (s_held & HELD(state));
+}
+
+bool wifi_mgr_connected(void)
+{
+    return s_connected;
+}
+
+const char *wifi_mgr_state_name(wifi_mgr_state_t state)
+{
+    return state < WIFI_MGR_STATE_COUNT ? s_names[state] : "?";
+}
+
+void wifi_mgr_timing(wifi_mgr_state_t state, wifi_mgr_timing_t *t)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *t = state < WIFI_MGR_STATE_COUNT ? s_timing[state] : (wifi_mgr_timing_t){ 0 };
+    xSemaphoreGive(s_lock);
+}
+
+void wifi_mgr_cold_timing(wifi_mgr_timing_t *t)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *t = s_cold;
+    xSemaphoreGive(s_lock);
+}
+
+/* ---- command ---- */
+
+static void print_timing(const char *name, const wifi_mgr_timing_t *t)
+{
+    uint32_t avg = t->count ? t->sum_us / t->count : 0;
+    printf("%-12s %6" PRIu32 " %5" PRIu32 ".%" PRIu32 " %5" PRIu32 ".%" PRIu32 "\n", name, t->count,
+           avg / 1000, avg % 1000 / 100, t->max_us / 1000, t->max_us % 1000 / 100);
+}
+
+static int wifi_cmd(int argc, char **argv)
+{
+    uint32_t held = s_held;
+    wifi_mgr_state_t state = wifi_mgr_state();
+    printf("state: %s", s_names[state]);
+    for (int s = WIFI_MGR_STA; s < WIFI_MGR_STATE_COUNT; s++) {
+        if ((held & HELD(s)) && s != state) {
+            printf("+%s", s_names[s]);
+        }
+    }
+    printf("%s, driver %s\n", s_connected ? " (associated)" : "",
+           !lazy_done(&s_driver) ? "not initialized" : s_started ? "started" : "stopped");
+
+    wifi_mgr_timing_t cold, t;
+    wifi_mgr_cold_timing(&cold);
+    printf("%-12s %6s %8s %8s\n", "enter", "count", "avg ms", "max ms");
+    print_timing("cold start", &cold);
+    uint32_t warm = 0;
+    uint64_t warm_us = 0;
+    for (int s = WIFI_MGR_OFF; s < WIFI_MGR_STATE_COUNT; s++) {
+        wifi_mgr_timing(s, &t);
+        print_timing(s_names[s], &t);
+        if (s != WIFI_MGR_OFF) {
+            warm += t.count;
+            warm_us += t.sum_us;
+        }
+    }
+    // Sans le gestionnaire, chaque entrée payait un démarrage à froid
+    if (cold.count && warm) {
+        uint64_t would = (uint64_t)warm * (cold.sum_us / cold.count);
+        printf("%" PRIu32 " warm transitions: ~%" PRIu32 " ms saved over a cold start each\n",
+               warm, would > warm_us ? (uint32_t)((would - warm_us) / 1000) : 0);
+    }
+    return 0;
+}
+
+void module_wifi_mgr(void)
+{
+    s_lock = xSemaphoreCreateMutexStatic(&s_lock_buf);
+
+    const esp_console_cmd_t cmd = {
+        .command = "wifi",
+        .help = "Wi-Fi manager state and the time taken by each transition",
+        .hint = NULL,
+        .func = &wifi_cmd,
+    };
+    ESP_ERROR_CHECK(dispatch_register(&cmd));
+}
@@ -0,0 +1,68 @@
+/*
+    Wi-Fi manager: the one owner of the driver.
+
+    join, scan-wifi, sniffer_wifi and the monitor used to init, start, stop
+    and deinit the driver themselves, so running one after the other failed
+    or dropped the association. They now ask the manager for what they
+    need:
+
+        ESP_ERROR_CHECK(wifi_mgr_acquire(WIFI_MGR_SCAN));
+        ... esp_wifi_scan_start() ...
+        wifi_mgr_release(WIFI_MGR_SCAN);
+
+    The driver is initialized once (the cold start), then only started,
+    stopped and switched between modes. Activities stack on top of the
+    station: a scan or a capture runs while associated and the link stays
+    up. Scan and capture exclude each other (both own the channel), the
+    second gets ESP_ERR_INVALID_STATE. With no activity left the driver is
+    stopped, not deinitialized: state OFF, light sleep allowed again.
+
+    Every transition is timed (see `wifi`), with the cold start for
+    comparison: what a module would have paid without the manager.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    WIFI_MGR_OFF = 0,       // driver stopped (or never started)
+    WIFI_MGR_STA,           // station, associated or trying to
+    WIFI_MGR_SCAN,          // scan in progress, link kept
+    WIFI_MGR_PROMISC,       // promiscuous capture, link kept
+    WIFI_MGR_AP,            // soft-AP, with the station
+    WIFI_MGR_STATE_COUNT,
+} wifi_mgr_state_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+} wifi_mgr_timing_t;
+
+// Start what `state` needs, init the driver the first time; OFF is not an activity
+esp_err_t wifi_mgr_acquire(wifi_mgr_state_t state);
+// End an activity; the driver stops when none is left
+void wifi_mgr_release(wifi_mgr_state_t state);
+// Current state: the most specific activity running
+wifi_mgr_state_t wifi_mgr_state(void);
+// true while `state` is acquired
+bool wifi_mgr_holds(wifi_mgr_state_t state);
+// Associated and addressed (IP_EVENT_STA_GOT_IP)
+bool wifi_mgr_connected(void);
+const char *wifi_mgr_state_name(wifi_mgr_state_t state);
+// Time to enter `state`; the cold start is timed apart
+void wifi_mgr_timing(wifi_mgr_state_t state, wifi_mgr_timing_t *t);
+void wifi_mgr_cold_timing(wifi_mgr_timing_t *t);
+
+// Register the `wifi` command
+void module_wifi_mgr(void);
+
+#ifdef __cplusplus
+}
+#endif
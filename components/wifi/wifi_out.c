@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "wifi_out.h"
+
+#define JOIN_TAG "join_wifi"
+
+const char *wifi_auth_name(int authmode)
+{
+    switch (authmode) {
+    case WIFI_AUTH_OPEN:            return "OPEN";
+    case WIFI_AUTH_OWE:             return "OWE";
+    case WIFI_AUTH_WEP:             return "WEP";
+    case WIFI_AUTH_WPA_PSK:         return "WPA_PSK";
+    case WIFI_AUTH_WPA2_PSK:        return "WPA2_PSK";
+    case WIFI_AUTH_WPA_WPA2_PSK:    return "WPA_WPA2_PSK";
+    case WIFI_AUTH_ENTERPRISE:      return "ENTERPRISE";
+    case WIFI_AUTH_WPA3_PSK:        return "WPA3_PSK";
+    case WIFI_AUTH_WPA2_WPA3_PSK:   return "WPA2_WPA3_PSK";
+    case WIFI_AUTH_WPA3_ENT_192:    return "WPA3_ENT_192";
+    default:                        return "UNKNOWN";
+    }
+}
+
+static void print_bssid(const uint8_t *b)
+{
+    printf("%02x:%02x:%02x:%02x:%02x:%02x", b[0], b[1], b[2], b[3], b[4], b[5]);
+}
+
+/* ---- scan-wifi ---- */
+
+void wifi_out_ap_header(result_sink_t *sink)
+{
+    if (!sink) {
+        printf("%-32s %-17s %4s %-13s %s\n", "SSID", "BSSID", "RSSI", "AUTHMODE", "CH");
+    }
+}
+
+void wifi_out_aps(result_sink_t *sink, const wifi_ap_record_t *aps, uint16_t count)
+{
+    if (sink) {
+        result_rec_t rec;
+        for (int i = 0; i < count; i++) {
+            result_begin(&rec, sink, RESULT_WIFI_AP);
+            result_str(&rec, (const char *)aps[i].ssid);
+            result_bytes(&rec, aps[i].bssid, 6);
+            result_int(&rec, aps[i].rssi);
+            result_uint(&rec, aps[i].authmode);
+            result_uint(&rec, aps[i].primary);
+            result_end(&rec);
+        }
+        result_sink_flush(sink);
+        return;
+    }
+    // One line per AP, the channel's lines in one go
+    for (int i = 0; i < count; i++) {
+        const uint8_t *b = aps[i].bssid;
+        printf("%-32s %02x:%02x:%02x:%02x:%02x:%02x %4d %-13s %u\n",
+               aps[i].ssid[0] ? (const char *)aps[i].ssid : "<hidden>",
+               b[0], b[1], b[2], b[3], b[4], b[5], aps[i].rssi,
+               wifi_auth_name(aps[i].authmode), aps[i].primary);
+    }
+    fflush(stdout);
+}
+
+void wifi_out_scan_done(result_sink_t *sink, int total, int channels, uint32_t ms)
+{
+    if (sink) {
+        result_rec_t rec;
+        result_begin(&rec, sink, RESULT_SCAN_SUMMARY);
+        result_str(&rec, "wifi");
+        result_uint(&rec, total);
+        result_uint(&rec, ms);
+        result_end(&rec);
+        return;
+    }
+    printf("%d APs on %d channels in %" PRIu32 " ms\n", total, channels, ms);
+}
+
+/* ---- scan-wifi -w ---- */
+
+void wifi_out_event(result_sink_t *sink, uint32_t now_s, const ap_event_t *ev)
+{
+    const ap_entry_t *ap = ev->ap;
+    if (sink) {
+        result_rec_t rec;
+        result_begin(&rec, sink, RESULT_WIFI_EVENT);
+        result_str(&rec, ap_event_name(ev->type));
+        result_bytes(&rec, ap->bssid, 6);
+        result_str(&rec, ap->ssid);
+        result_int(&rec, ap->rssi_x16 / 16);
+        result_uint(&rec, ap->channel);
+        if (ev->type == AP_EVENT_CHANNEL) {
+            result_uint(&rec, ev->prev_channel);
+        } else {
+            result_null(&rec);
+        }
+        if (ev->twin) {
+            result_bytes(&rec, ev->twin->bssid, 6);
+        } else {
+            result_null(&rec);
+        }
+        result_end(&rec);
+        return;
+    }
+    printf("%6" PRIu32 "s %-11s ", now_s, ap_event_name(ev->type));
+    print_bssid(ap->bssid);
+    printf(" %-32s ch%-2u %4d %s", ap->ssid[0] ? ap->ssid : "<hidden>", ap->channel, ap->rssi_x16 / 16,
+           wifi_auth_name(ap->authmode));
+    if (ev->type == AP_EVENT_CHANNEL) {
+        printf(" (was ch%u)", ev->prev_channel);
+    } else if (ev->evicted) {
+        printf(" (table full)");
+    } else if (ev->twin) {
+        printf(" (");
+        print_bssid(ev->twin->bssid);
+        printf(" is %s)", wifi_auth_name(ev->twin->authmode));
+    }
+    printf("\n");
+}
+
+void wifi_out_watch_done(result_sink_t *sink, uint32_t rounds, uint32_t busy, uint32_t sightings,
+                         uint32_t events, const ap_table_t *table)
+{
+    if (sink) {
+        return;     // the events were the result
+    }
+    printf("%" PRIu32 " rounds (%" PRIu32 " skipped, Wi-Fi busy), %" PRIu32 " sightings, %" PRIu32 " events, "
+           "%u APs tracked (%" PRIu32 " evicted)\n",
+           rounds, busy, sightings, events, (unsigned)table->count, table->evicted);
+    printf("%-17s %-32s %3s %4s %8s %8s %6s\n", "BSSID", "SSID", "CH", "RSSI", "FIRST", "LAST", "SEEN");
+    for (size_t i = 0; i < table->capacity; i++) {
+        const ap_entry_t *e = &table->entries[i];
+        if (e->used) {
+            print_bssid(e->bssid);
+            printf(" %-32s %3u %4d %7" PRIu32 "s %7" PRIu32 "s %6" PRIu32 "\n", e->ssid[0] ? e->ssid : "<hidden>",
+                   e->channel, e->rssi_x16 / 16, e->first_seen, e->last_seen, e->sightings);
+        }
+    }
+}
+
+/* ---- sniffer_wifi ---- */
+
+void wifi_out_mgmt(result_sink_t *sink, const uint8_t *frame, uint16_t length, int8_t rssi, uint8_t channel)
+{
+    uint8_t subtype = (frame[0] >> 4) & 0x0F;
+    // SSID : premier élément du corps, après l'en-tête (24 octets) et les champs fixes (12)
+    uint8_t ssid_length = length > 37 ? frame[37] : 0;
+    if (sink) {
+        result_rec_t rec;
+        result_begin(&rec, sink, RESULT_SNIFF_MGMT);
+        result_uint(&rec, subtype);
+        result_bytes(&rec, frame + 4, 6);
+        result_bytes(&rec, frame + 10, 6);
+        result_bytes(&rec, frame + 16, 6);
+        if (subtype != 0x04 && ssid_length > 0 && 37 + ssid_length < length) {
+            result_strn(&rec, (const char *)frame + 38, ssid_length);
+        } else {
+            result_null(&rec);
+        }
+        result_int(&rec, rssi);
+        result_uint(&rec, channel);
+        result_end(&rec);
+        return;
+    }
+    // Une seule ligne par trame : un seul printf depuis le worker
+    char ssid[33] = "";
+    if (subtype != 0x04 && ssid_length > 0 && ssid_length < sizeof(ssid) && 37 + ssid_length < length) {
+        memcpy(ssid, frame + 38, ssid_length);
+        ssid[ssid_length] = '\0';
+    }
+    printf("%-14s da=%02x:%02x:%02x:%02x:%02x:%02x sa=%02x:%02x:%02x:%02x:%02x:%02x "
+           "bssid=%02x:%02x:%02x:%02x:%02x:%02x rssi=%d ch=%u ssid=%s\n",
+           (subtype == 0x08) ? "Beacon" : (subtype == 0x04) ? "Probe Request" : "Probe Response",
+           frame[4], frame[5], frame[6], frame[7], frame[8], frame[9],
+           frame[10], frame[11], frame[12], frame[13], frame[14], frame[15],
+           frame[16], frame[17], frame[18], frame[19], frame[20], frame[21],
+           rssi, channel, ssid);
+}
+
+void wifi_out_eapol(result_sink_t *sink, const uint8_t *frame, uint16_t length, int8_t rssi)
+{
+    int n = length < 64 ? length : 64;
+    if (sink) {
+        result_rec_t rec;
+        result_begin(&rec, sink, RESULT_SNIFF_EAPOL);
+        result_bytes(&rec, frame + 4, 6);
+        result_bytes(&rec, frame + 10, 6);
+        result_int(&rec, rssi);
+        result_bytes(&rec, frame, n);
+        result_end(&rec);
+        return;
+    }
+    // Trame EAPOL (handshake WPA/WPA2), payload en hexa sur une ligne
+    char hex[64 * 2 + 1];
+    for (int i = 0; i < n; i++) {
+        snprintf(hex + 2 * i, 3, "%02x", frame[i]);
+    }
+    hex[2 * n] = '\0';
+    printf("EAPOL rssi=%d %s\n", rssi, hex);
+}
+
+/* ---- join ---- */
+
+void wifi_out_link(result_sink_t *sink, const char *ssid, uint32_t ip, int8_t rssi, uint8_t channel)
+{
+    if (sink) {
+        result_rec_t rec;
+        result_begin(&rec, sink, RESULT_WIFI_LINK);
+        result_str(&rec, ssid);
+        result_bytes(&rec, (const uint8_t *)&ip, 4);
+        result_int(&rec, rssi);
+        result_uint(&rec, channel);
+        result_end(&rec);
+        return;
+    }
+    ESP_LOGI(JOIN_TAG, "Connected successfully");
+}
@@ -0,0 +1,41 @@
+/*
+    Output of the Wi-Fi commands (scan-wifi, sniffer_wifi, join).
+
+    Each function prints one result: as a record when the command has a
+    sink (agent, `output json|cbor`), otherwise as the console text line.
+    No driver call in here, so the host tests (test/host) check every
+    format against their golden files.
+*/
+#pragma once
+
+#include <stdint.h>
+#include "esp_wifi.h"
+#include "result.h"
+#include "ap_table.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const char *wifi_auth_name(int authmode);
+
+// scan-wifi: column header (text only), the APs of one channel, the summary
+void wifi_out_ap_header(result_sink_t *sink);
+void wifi_out_aps(result_sink_t *sink, const wifi_ap_record_t *aps, uint16_t count);
+void wifi_out_scan_done(result_sink_t *sink, int total, int channels, uint32_t ms);
+
+// scan-wifi -w: one change at now_s, then the table when the watch ends (text only)
+void wifi_out_event(result_sink_t *sink, uint32_t now_s, const ap_event_t *ev);
+void wifi_out_watch_done(result_sink_t *sink, uint32_t rounds, uint32_t busy, uint32_t sightings,
+                         uint32_t events, const ap_table_t *table);
+
+// sniffer_wifi: a beacon or probe (subtype 4, 5 or 8), an EAPOL frame, both from the 802.11 header
+void wifi_out_mgmt(result_sink_t *sink, const uint8_t *frame, uint16_t length, int8_t rssi, uint8_t channel);
+void wifi_out_eapol(result_sink_t *sink, const uint8_t *frame, uint16_t length, int8_t rssi);
+
+// join: the link once the station has its address (ip in network order)
+void wifi_out_link(result_sink_t *sink, const char *ssid, uint32_t ip, int8_t rssi, uint8_t channel);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,56 @@
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+#include "esp_event.h"
+#include "nvs_flash.h"
+#include "boot.h"
+#include "cmd_wifi.h"
+
+static const char *TAG = "wifi_stack";
+
+static lazy_t s_nvs = LAZY_INIT("nvs");
+static lazy_t s_stack = LAZY_INIT("wifi.stack");
+static esp_netif_t *s_sta_netif;
+
+// Le driver Wi-Fi garde sa calibration PHY et sa config en NVS
+static esp_err_t nvs_init(void)
+{
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_LOGW(TAG, "NVS partition reformatted (%s)", esp_err_to_name(err));
+        err = nvs_flash_erase();
+        if (err == ESP_OK) {
+            err = nvs_flash_init();
+        }
+    }
+    return err;
+}
+
+static esp_err_t stack_init(void)
+{
+    esp_err_t err = lazy_once(&s_nvs, nvs_init);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = esp_netif_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+    // Déjà créée par un autre composant : pas une erreur
+    err = esp_event_loop_create_default();
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        return err;
+    }
+    s_sta_netif = esp_netif_create_default_wifi_sta();
+    return s_sta_netif ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t wifi_stack_init(void)
+{
+    return lazy_once(&s_stack, stack_init);
+}
+
+esp_netif_t *wifi_stack_sta(void)
+{
+    return s_sta_netif;
+}
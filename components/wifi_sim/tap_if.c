@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "tap_if.h"
+
+#define TAP_FRAME_MAX       1518        // Ethernet frame without FCS
+#define TAP_TASK_STACK      4096
+#define TAP_TASK_PRIO       (CONFIG_LWIP_TCPIP_TASK_PRIO - 1)    // feeds the tcpip task
+#define TAP_BURST           32          // frames passed up per wake-up
+
+static const char *TAG = "tap_if";
+
+typedef struct {
+    esp_netif_driver_base_t base;       // first: esp_netif_attach() hands it to post_attach
+    int fd;
+} tap_if_t;
+
+static tap_if_t s_tap = { .fd = -1 };
+
+static esp_err_t tap_transmit(void *h, void *buffer, size_t len)
+{
+    tap_if_t *tap = h;
+    return write(tap->fd, buffer, len) == (ssize_t)len ? ESP_OK : ESP_FAIL;
+}
+
+static void tap_free_rx(void *h, void *buffer)
+{
+    free(buffer);
+}
+
+/* Host -> lwIP. The fd is non-blocking and polled once per tick: a task
+ * blocked in read() would hold the FreeRTOS simulator, and esp_netif_receive()
+ * has to be called from a task, not from a thread of our own. */
+static void tap_rx_task(void *arg)
+{
+    tap_if_t *tap = arg;
+    uint8_t frame[TAP_FRAME_MAX];
+    for (;;) {
+        int n = 0;
+        for (int i = 0; i < TAP_BURST && (n = read(tap->fd, frame, sizeof(frame))) > 0; i++) {
+            void *buf = malloc(n);
+            if (buf == NULL) {
+                continue;               // dropped, like the driver out of RX buffers
+            }
+            memcpy(buf, frame, n);
+            esp_netif_receive(tap->base.netif, buf, n, buf);
+        }
+        if (n < 0 && errno != EAGAIN) {
+            ESP_LOGE(TAG, "read: %s", strerror(errno));
+        }
+        vTaskDelay(1);
+    }
+}
+
+static esp_err_t tap_post_attach(esp_netif_t *netif, esp_netif_iodriver_handle h)
+{
+    tap_if_t *tap = h;
+    tap->base.netif = netif;
+    const esp_netif_driver_ifconfig_t driver = {
+        .handle = tap,
+        .transmit = tap_transmit,
+        .driver_free_rx_buffer = tap_free_rx,
+    };
+    esp_err_t err = esp_netif_set_driver_config(netif, &driver);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // Locally administered, from the pid: two instances on one bridge differ
+    uint32_t pid = (uint32_t)getpid();
+    uint8_t mac[6] = { 0x02, 0x5e, 0x10, pid >> 16, pid >> 8, pid };
+    return esp_netif_set_mac(netif, mac);
+}
+
+esp_err_t tap_if_attach(esp_netif_t *netif)
+{
+    if (s_tap.fd >= 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    int fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "/dev/net/tun: %s", strerror(errno));
+        return ESP_FAIL;
+    }
+    struct ifreq ifr = { .ifr_flags = IFF_TAP | IFF_NO_PI };
+    strncpy(ifr.ifr_name, CONFIG_WIFI_SIM_TAP_IF, IFNAMSIZ - 1);
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+        ESP_LOGE(TAG, "%s: %s (create it with `ip tuntap add dev %s mode tap user $USER`)",
+                 CONFIG_WIFI_SIM_TAP_IF, strerror(errno), CONFIG_WIFI_SIM_TAP_IF);
+        close(fd);
+        return ESP_FAIL;
+    }
+    s_tap.fd = fd;
+    s_tap.base.post_attach = tap_post_attach;
+    esp_err_t err = esp_netif_attach(netif, &s_tap);
+    if (err == ESP_OK && xTaskCreate(tap_rx_task, "tap_rx", TAP_TASK_STACK, &s_tap, TAP_TASK_PRIO, NULL) != pdPASS) {
+        err = ESP_ERR_NO_MEM;
+    }
+    if (err != ESP_OK) {
+        close(fd);
+        s_tap.fd = -1;
+        return err;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,19 @@
+/*
+    TAP interface of the Linux host build: the I/O driver of the station's
+    esp_netif. Ethernet frames lwIP sends are written to the host's TAP
+    device, frames the host sends to it are passed to esp_netif_receive().
+*/
+#pragma once
+
+#include "esp_netif.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Open CONFIG_WIFI_SIM_TAP_IF and attach it to netif, ESP_FAIL when the device can't be opened
+esp_err_t tap_if_attach(esp_netif_t *netif);
+
+#ifdef __cplusplus
+}
+#endif
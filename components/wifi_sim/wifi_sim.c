@@ -0,0 +1,904 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_wifi.h"
+#include "esp_netif.h"
+#include "tap_if.h"
+
+#define SIM_MAX_APS         32
+#define SIM_CHANNELS        13
+#define SIM_FRAME_MAX       2346        // largest 802.11 MPDU
+#define SIM_FCS_LEN         4           // sig_len counts the FCS on the chips
+#define SIM_TASK_STACK      4096
+#define SIM_TASK_PRIO       5
+#define SIM_BURST           32          // frames per tick at replay speed 0
+#define SIM_BEACON_US       102400      // beacon interval of the synthetic APs
+#define SIM_EAPOL_EVERY     50          // one synthetic EAPOL frame every n beacons
+
+#define PCAP_LINKTYPE_80211     105
+#define PCAP_LINKTYPE_RADIOTAP  127
+
+static const char *TAG = "wifi_sim";
+
+ESP_EVENT_DEFINE_BASE(WIFI_EVENT);
+
+typedef struct {
+    FILE *f;
+    bool swap;                  // written on a host of the other endianness
+    bool nsec;                  // nanosecond timestamps
+    uint32_t linktype;
+} sim_pcap_t;
+
+// Used when there is no capture; locally administered BSSIDs
+static const wifi_ap_record_t s_builtin[] = {
+    { .ssid = "espilon-lab",  .bssid = { 0x02, 0x5e, 0x00, 0x00, 0x00, 0x01 }, .primary = 1,  .rssi = -41, .authmode = WIFI_AUTH_WPA2_PSK },
+    { .ssid = "FreeWifi",     .bssid = { 0x02, 0x5e, 0x00, 0x00, 0x00, 0x02 }, .primary = 6,  .rssi = -63, .authmode = WIFI_AUTH_OPEN },
+    { .ssid = "Livebox-7C21", .bssid = { 0x02, 0x5e, 0x00, 0x00, 0x00, 0x03 }, .primary = 6,  .rssi = -70, .authmode = WIFI_AUTH_WPA_WPA2_PSK },
+    { .ssid = "",             .bssid = { 0x02, 0x5e, 0x00, 0x00, 0x00, 0x04 }, .primary = 11, .rssi = -78, .authmode = WIFI_AUTH_WPA2_PSK },
+    { .ssid = "cam-entrance", .bssid = { 0x02, 0x5e, 0x00, 0x00, 0x00, 0x05 }, .primary = 11, .rssi = -55, .authmode = WIFI_AUTH_WPA3_PSK },
+};
+#define NUM_BUILTIN (sizeof(s_builtin) / sizeof(s_builtin[0]))
+
+// State, short copies under s_mux; events are posted outside of it
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool s_inited, s_started, s_connected;
+static wifi_mode_t s_mode = WIFI_MODE_NULL;
+static wifi_ps_type_t s_ps = WIFI_PS_MIN_MODEM;
+static uint8_t s_channel = CONFIG_WIFI_SIM_CHANNEL;
+static wifi_sta_config_t s_sta_config;
+static wifi_ap_record_t s_ap;                   // AP the station is connected to
+static uint32_t s_conn_gen;                     // bumped to cancel a pending connect
+
+static wifi_ap_record_t s_aps[SIM_MAX_APS];     // what scans find
+static size_t s_ap_count;
+static bool s_aps_loaded;
+static wifi_ap_record_t s_results[SIM_MAX_APS];
+static uint16_t s_result_count;
+static bool s_scanning;
+static wifi_scan_config_t s_scan_config;
+static bool s_scan_has_config;
+static uint8_t s_scan_id;
+static uint32_t s_rand = 0x2545F491;            // fixed seed: same RSSI jitter on every run
+
+static volatile bool s_promisc, s_replay_run;
+static wifi_promiscuous_cb_t volatile s_rx_cb;
+static TaskHandle_t s_replay_task;
+static SemaphoreHandle_t s_replay_done;
+static StaticSemaphore_t s_replay_done_buf;
+
+static esp_netif_t *s_sta_netif;                // lwIP over the TAP interface
+
+static void post(esp_event_base_t base, int32_t id, const void *data, size_t size)
+{
+    // No default loop yet: nobody listens, like the driver
+    esp_event_post(base, id, data, size, 0);
+}
+
+static uint32_t sim_rand(void)
+{
+    s_rand = s_rand * 1103515245 + 12345;
+    return s_rand >> 16;
+}
+
+static uint16_t le16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t u32(const uint8_t *p, bool swap)
+{
+    uint32_t v = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+/* ---- pcap ---- */
+
+static const char *pcap_path(void)
+{
+    const char *env = getenv("WIFI_SIM_PCAP");
+    return env && *env ? env : CONFIG_WIFI_SIM_PCAP;
+}
+
+static bool pcap_open(sim_pcap_t *p)
+{
+    uint8_t hdr[24];
+    p->f = fopen(pcap_path(), "rb");
+    if (p->f == NULL) {
+        return false;
+    }
+    if (fread(hdr, 1, sizeof(hdr), p->f) == sizeof(hdr)) {
+        uint32_t magic = u32(hdr, false);
+        p->swap = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+        p->nsec = magic == 0xa1b23c4d || magic == 0x4d3cb2a1;
+        p->linktype = u32(hdr + 20, p->swap);
+        if ((p->swap || magic == 0xa1b2c3d4 || magic == 0xa1b23c4d) &&
+            (p->linktype == PCAP_LINKTYPE_80211 || p->linktype == PCAP_LINKTYPE_RADIOTAP)) {
+            return true;
+        }
+    }
+    ESP_LOGE(TAG, "%s: not a pcap of 802.11 or radiotap frames", pcap_path());
+    fclose(p->f);
+    p->f = NULL;
+    return false;
+}
+
+// Next record into buf, its length, 0 at the end of the file
+static size_t pcap_next(sim_pcap_t *p, uint8_t *buf, size_t size, uint64_t *ts_us)
+{
+    uint8_t rec[16];
+    while (fread(rec, 1, sizeof(rec), p->f) == sizeof(rec)) {
+        uint32_t sec = u32(rec, p->swap), frac = u32(rec + 4, p->swap), len = u32(rec + 8, p->swap);
+        *ts_us = (uint64_t)sec * 1000000 + (p->nsec ? frac / 1000 : frac);
+        if (len > size) {
+            fseek(p->f, len, SEEK_CUR);     // not an 802.11 frame we could deliver
+            continue;
+        }
+        return fread(buf, 1, len, p->f) == len ? len : 0;
+    }
+    return 0;
+}
+
+// Strip the radiotap header, keep the channel, signal and FCS flag; 0 if malformed
+static size_t radiotap_strip(const uint8_t *b, size_t len, int8_t *rssi, uint8_t *channel, bool *fcs)
+{
+    // Fields of the first present word, in bit order: TSFT, flags, rate, channel, FHSS, dBm signal
+    static const uint8_t align[] = { 8, 1, 1, 2, 2, 1 };
+    static const uint8_t size[] = { 8, 1, 1, 4, 2, 1 };
+    if (len < 8) {
+        return 0;
+    }
+    size_t hlen = le16(b + 2), off = 4;
+    uint32_t present = 0, word;
+    bool first = true;
+    do {
+        if (off + 4 > hlen || hlen > len) {
+            return 0;
+        }
+        word = u32(b + off, false);
+        if (first) {
+            present = word;
+            first = false;
+        }
+        off += 4;
+    } while (word & 0x80000000);
+    for (int i = 0; i < (int)sizeof(align); i++) {
+        if (!(present & (1u << i))) {
+            continue;
+        }
+        off = (off + align[i] - 1) & ~(size_t)(align[i] - 1);
+        if (off + size[i] > hlen) {
+            break;
+        }
+        if (i == 1) {
+            *fcs = b[off] & 0x10;
+        } else if (i == 3) {
+            uint16_t mhz = le16(b + off);
+            *channel = mhz == 2484 ? 14 : mhz >= 2412 && mhz <= 2472 ? (mhz - 2407) / 5 : *channel;
+        } else if (i == 5) {
+            *rssi = (int8_t)b[off];
+        }
+        off += size[i];
+    }
+    return hlen;
+}
+
+/* ---- access points ---- */
+
+// AP described by a beacon or probe response, false for other frames
+static bool ap_from_beacon(const uint8_t *f, size_t len, wifi_ap_record_t *ap)
+{
+    uint8_t subtype = f[0] >> 4;
+    if (len < 36 || (f[0] & 0x0c) != 0 || (subtype != 0x08 && subtype != 0x05)) {
+        return false;
+    }
+    memset(ap, 0, sizeof(*ap));
+    memcpy(ap->bssid, f + 16, 6);
+    bool privacy = le16(f + 34) & 0x0010, rsn = false, wpa = false, sae = false, psk = false;
+    for (size_t off = 36; off + 2 <= len && off + 2 + f[off + 1] <= len; off += 2 + f[off + 1]) {
+        const uint8_t *ie = f + off + 2;
+        uint8_t id = f[off], n = f[off + 1];
+        if (id == 0 && n < sizeof(ap->ssid)) {
+            memcpy(ap->ssid, ie, n);
+        } else if (id == 3 && n == 1) {
+            ap->primary = ie[0];
+        } else if (id == 48 && n >= 2) {
+            rsn = true;
+            // version, group cipher, pairwise suites, AKM suites
+            size_t at = 6;
+            if (at + 2 <= n) {
+                at += 2 + 4 * le16(ie + at);
+            }
+            if (at + 2 <= n) {
+                size_t akms = le16(ie + at);
+                for (size_t k = 0; k < akms && at + 2 + 4 * k + 4 <= n; k++) {
+                    uint8_t type = ie[at + 2 + 4 * k + 3];
+                    psk |= type == 2;
+                    sae |= type == 8;
+                }
+            }
+        } else if (id == 221 && n >= 4 && ie[0] == 0x00 && ie[1] == 0x50 && ie[2] == 0xf2 && ie[3] == 1) {
+            wpa = true;
+        }
+    }
+    ap->authmode = rsn && sae && psk ? WIFI_AUTH_WPA2_WPA3_PSK : rsn && sae ? WIFI_AUTH_WPA3_PSK :
+                   rsn && wpa ? WIFI_AUTH_WPA_WPA2_PSK : rsn ? WIFI_AUTH_WPA2_PSK :
+                   wpa ? WIFI_AUTH_WPA_PSK : privacy ? WIFI_AUTH_WEP : WIFI_AUTH_OPEN;
+    return true;
+}
+
+// Beacons of the capture, or the built-in list; once, on the first scan or connect
+static void load_aps(void)
+{
+    if (s_aps_loaded) {
+        return;
+    }
+    s_aps_loaded = true;
+    sim_pcap_t p;
+    uint8_t *buf = malloc(SIM_FRAME_MAX + 256);
+    if (buf && pcap_open(&p)) {
+        uint64_t ts;
+        size_t len;
+        while ((len = pcap_next(&p, buf, SIM_FRAME_MAX + 256, &ts)) > 0 && s_ap_count < SIM_MAX_APS) {
+            int8_t rssi = -60;
+            uint8_t channel = CONFIG_WIFI_SIM_CHANNEL;
+            bool fcs = false;
+            size_t off = p.linktype == PCAP_LINKTYPE_RADIOTAP ? radiotap_strip(buf, len, &rssi, &channel, &fcs) : 0;
+            wifi_ap_record_t ap;
+            if ((p.linktype == PCAP_LINKTYPE_RADIOTAP && off == 0) || !ap_from_beacon(buf + off, len - off, &ap)) {
+                continue;
+            }
+            size_t i = 0;
+            while (i < s_ap_count && memcmp(s_aps[i].bssid, ap.bssid, 6) != 0) {
+                i++;
+            }
+            if (i == s_ap_count) {
+                ap.rssi = rssi;
+                ap.primary = ap.primary ? ap.primary : channel;
+                s_aps[s_ap_count++] = ap;
+            }
+        }
+        fclose(p.f);
+        ESP_LOGI(TAG, "%u access points in %s", (unsigned)s_ap_count, pcap_path());
+    }
+    free(buf);
+    if (s_ap_count == 0) {
+        memcpy(s_aps, s_builtin, sizeof(s_builtin));
+        s_ap_count = NUM_BUILTIN;
+    }
+}
+
+/* ---- synthetic frames, when there is no capture ---- */
+
+static size_t put_ie(uint8_t *f, size_t at, uint8_t id, const void *data, uint8_t n)
+{
+    f[at] = id;
+    f[at + 1] = n;
+    memcpy(f + at + 2, data, n);
+    return at + 2 + n;
+}
+
+static size_t synth_beacon(uint8_t *f, const wifi_ap_record_t *ap, uint16_t seq, uint64_t ts)
+{
+    static const uint8_t rsn_psk[] = { 1, 0, 0x00, 0x0f, 0xac, 4, 1, 0, 0x00, 0x0f, 0xac, 4, 1, 0, 0x00, 0x0f, 0xac, 2, 0, 0 };
+    static const uint8_t rsn_sae[] = { 1, 0, 0x00, 0x0f, 0xac, 4, 1, 0, 0x00, 0x0f, 0xac, 4, 1, 0, 0x00, 0x0f, 0xac, 8, 0xc0, 0 };
+    static const uint8_t wpa[] = { 0x00, 0x50, 0xf2, 1, 1, 0, 0x00, 0x50, 0xf2, 2, 1, 0, 0x00, 0x50, 0xf2, 2, 1, 0, 0x00, 0x50, 0xf2, 2 };
+    static const uint8_t rates[] = { 0x82, 0x84, 0x8b, 0x96, 0x0c, 0x12, 0x18, 0x24 };
+    memset(f, 0, 36);
+    f[0] = 0x80;                                    // management, beacon
+    memset(f + 4, 0xff, 6);                         // broadcast
+    memcpy(f + 10, ap->bssid, 6);
+    memcpy(f + 16, ap->bssid, 6);
+    f[22] = seq << 4;
+    f[23] = seq >> 4;
+    for (int i = 0; i < 8; i++) {
+        f[24 + i] = ts >> (8 * i);
+    }
+    f[32] = SIM_BEACON_US / 1024;                   // interval in TU
+    f[34] = ap->authmode == WIFI_AUTH_OPEN ? 0x01 : 0x11;
+    f[35] = 0x04;
+    size_t at = put_ie(f, 36, 0, ap->ssid, strlen((const char *)ap->ssid));
+    at = put_ie(f, at, 1, rates, sizeof(rates));
+    at = put_ie(f, at, 3, &ap->primary, 1);
+    if (ap->authmode == WIFI_AUTH_WPA3_PSK) {
+        at = put_ie(f, at, 48, rsn_sae, sizeof(rsn_sae));
+    } else if (ap->authmode != WIFI_AUTH_OPEN) {
+        at = put_ie(f, at, 48, rsn_psk, sizeof(rsn_psk));
+    }
+    if (ap->authmode == WIFI_AUTH_WPA_WPA2_PSK) {
+        at = put_ie(f, at, 221, wpa, sizeof(wpa));
+    }
+    return at;
+}
+
+// Message 1 of a 4-way handshake from ap to a station, QoS data from the DS
+static size_t synth_eapol(uint8_t *f, const wifi_ap_record_t *ap, uint16_t seq)
+{
+    static const uint8_t sta[6] = { 0x02, 0x5e, 0x10, 0x00, 0x00, 0x01 };
+    static const uint8_t llc[8] = { 0xaa, 0xaa, 0x03, 0x00, 0x00, 0x00, 0x88, 0x8e };
+    memset(f, 0, 26 + sizeof(llc) + 99);
+    f[0] = 0x88;                                    // data, QoS data
+    f[1] = 0x02;                                    // from DS
+    memcpy(f + 4, sta, 6);
+    memcpy(f + 10, ap->bssid, 6);
+    memcpy(f + 16, ap->bssid, 6);
+    f[22] = seq << 4;
+    f[23] = seq >> 4;
+    memcpy(f + 26, llc, sizeof(llc));
+    uint8_t *eapol = f + 26 + sizeof(llc);
+    eapol[0] = 2;                                   // 802.1X-2004
+    eapol[1] = 3;                                   // key
+    eapol[3] = 95;
+    eapol[4] = 2;                                   // RSN key descriptor
+    eapol[5] = 0x00;
+    eapol[6] = 0x8a;                                // pairwise, ack, HMAC-SHA1/AES
+    eapol[8] = 16;
+    for (int i = 0; i < 32; i++) {
+        eapol[17 + i] = sim_rand();                 // ANonce
+    }
+    return 26 + sizeof(llc) + 99;
+}
+
+/* ---- promiscuous replay ---- */
+
+static void replay_task(void *arg)
+{
+    uint8_t *buf = malloc(sizeof(wifi_promiscuous_pkt_t) + SIM_FRAME_MAX + 256);
+    if (buf == NULL) {
+        ESP_LOGE(TAG, "No memory for the replay");
+        xSemaphoreGive(s_replay_done);
+        vTaskDelete(NULL);
+        return;
+    }
+    wifi_promiscuous_pkt_t *pkt = (wifi_promiscuous_pkt_t *)buf;
+    uint8_t *raw = pkt->payload;
+    sim_pcap_t pcap;
+    bool file = pcap_open(&pcap);
+    if (!file) {
+        ESP_LOGW(TAG, "%s not found, sending synthetic beacons", pcap_path());
+    }
+
+    uint64_t first_ts = 0, synth_ts = 0;
+    bool paced = false;
+    int64_t start_us = esp_timer_get_time();
+    uint32_t frames = 0, loops = 0, seq = 0;
+    while (s_replay_run) {
+        int8_t rssi = -60;
+        uint8_t channel = CONFIG_WIFI_SIM_CHANNEL;
+        bool fcs = false;
+        uint64_t ts;
+        size_t len, off = 0;
+        if (file) {
+            len = pcap_next(&pcap, raw, SIM_FRAME_MAX + 256, &ts);
+            if (len == 0) {
+                loops++;
+                if (!CONFIG_WIFI_SIM_REPLAY_LOOP) {
+                    break;
+                }
+                fseek(pcap.f, 24, SEEK_SET);
+                paced = false;
+                continue;
+            }
+            if (pcap.linktype == PCAP_LINKTYPE_RADIOTAP) {
+                off = radiotap_strip(raw, len, &rssi, &channel, &fcs);
+                if (off == 0) {
+                    continue;
+                }
+                memmove(raw, raw + off, len - off);
+                len -= off;
+            }
+        } else {
+            const wifi_ap_record_t *ap = &s_builtin[seq % NUM_BUILTIN];
+            seq++;
+            synth_ts += SIM_BEACON_US / NUM_BUILTIN;
+            ts = synth_ts;
+            len = seq % SIM_EAPOL_EVERY == 0 ? synth_eapol(raw, &s_builtin[0], seq) : synth_beacon(raw, ap, seq, ts);
+            rssi = ap->rssi + (int)(sim_rand() % 7) - 3;
+            channel = ap->primary;
+        }
+        if (len < 2 || len > SIM_FRAME_MAX) {
+            continue;
+        }
+
+        // Pace on the capture timestamps, relative to the first frame of the pass
+        if (!paced) {
+            first_ts = ts;
+            start_us = esp_timer_get_time();
+            paced = true;
+        }
+        if (CONFIG_WIFI_SIM_REPLAY_SPEED > 0) {
+            int64_t due = start_us + (int64_t)((ts - first_ts) * 100 / CONFIG_WIFI_SIM_REPLAY_SPEED);
+            int64_t wait = due - esp_timer_get_time();
+            if (wait >= 1000) {
+                vTaskDelay(pdMS_TO_TICKS(wait / 1000));
+            }
+        } else if (frames % SIM_BURST == 0) {
+            vTaskDelay(1);                          // let the consumers and the console run
+        }
+        if (!s_replay_run) {
+            break;
+        }
+
+        if (!fcs) {
+            memset(raw + len, 0, SIM_FCS_LEN);
+            len += SIM_FCS_LEN;
+        }
+        uint8_t type = (raw[0] >> 2) & 3;
+        pkt->rx_ctrl = (wifi_pkt_rx_ctrl_t){
+            .rssi = rssi,
+            .channel = channel,
+            .sig_len = len > 4095 ? 4095 : len,
+            .timestamp = (uint32_t)(esp_timer_get_time() - start_us),
+        };
+        wifi_promiscuous_cb_t cb = s_rx_cb;
+        if (cb) {
+            cb(pkt, type == 0 ? WIFI_PKT_MGMT : type == 1 ? WIFI_PKT_CTRL : type == 2 ? WIFI_PKT_DATA : WIFI_PKT_MISC);
+        }
+        frames++;
+    }
+
+    ESP_LOGI(TAG, "Replayed %" PRIu32 " frames, %" PRIu32 " passes", frames, loops);
+    if (file) {
+        fclose(pcap.f);
+    }
+    free(buf);
+    xSemaphoreGive(s_replay_done);
+    vTaskDelete(NULL);
+}
+
+// Called with the state just changed, not under s_mux
+static void replay_update(void)
+{
+    bool want = s_promisc && s_started;
+    if (want && s_replay_task == NULL) {
+        s_replay_run = true;
+        if (xTaskCreate(replay_task, "wifi_sim_rx", SIM_TASK_STACK, NULL, SIM_TASK_PRIO, &s_replay_task) != pdPASS) {
+            s_replay_run = false;
+            s_replay_task = NULL;
+            ESP_LOGE(TAG, "Cannot create the replay task");
+        }
+    } else if (!want && s_replay_task) {
+        // Like the driver: no callback once promiscuous mode is off
+        s_replay_run = false;
+        xSemaphoreTake(s_replay_done, portMAX_DELAY);
+        s_replay_task = NULL;
+    }
+}
+
+/* ---- station ---- */
+
+static void connect_task(void *arg)
+{
+    uint32_t gen = (uint32_t)(uintptr_t)arg;
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_WIFI_SIM_CONNECT_MS));
+
+    wifi_event_sta_disconnected_t fail = { 0 };
+    wifi_event_sta_connected_t ok = { 0 };
+    ip_event_got_ip_t ip = { 0 };
+    bool connected = false, cancelled;
+    taskENTER_CRITICAL(&s_mux);
+    cancelled = gen != s_conn_gen || !s_started;
+    if (!cancelled) {
+        const wifi_ap_record_t *ap = NULL;
+        for (size_t i = 0; i < s_ap_count && ap == NULL; i++) {
+            bool match = s_sta_config.bssid_set ? memcmp(s_aps[i].bssid, s_sta_config.bssid, 6) == 0 :
+                         strncmp((const char *)s_aps[i].ssid, (const char *)s_sta_config.ssid, 32) == 0;
+            ap = match ? &s_aps[i] : NULL;
+        }
+        size_t ssid_len = strnlen((const char *)s_sta_config.ssid, 32);
+        memcpy(fail.ssid, s_sta_config.ssid, ssid_len);
+        fail.ssid_len = ssid_len;
+        if (ap == NULL) {
+            fail.reason = WIFI_REASON_NO_AP_FOUND;
+        } else if (ap->authmode != WIFI_AUTH_OPEN && strnlen((const char *)s_sta_config.password, 64) < 8) {
+            fail.reason = WIFI_REASON_AUTH_FAIL;
+            memcpy(fail.bssid, ap->bssid, 6);
+        } else {
+            connected = s_connected = true;
+            s_ap = *ap;
+            memcpy(ok.ssid, ap->ssid, ssid_len);
+            ok.ssid_len = ssid_len;
+            memcpy(ok.bssid, ap->bssid, 6);
+            ok.channel = ap->primary;
+            ok.authmode = ap->authmode;
+            ok.aid = 1;
+        }
+    }
+    taskEXIT_CRITICAL(&s_mux);
+
+    if (!cancelled && connected) {
+        // The TAP netif keeps its address: the association only hands it out
+        ip.esp_netif = s_sta_netif;
+        esp_netif_get_ip_info(s_sta_netif, &ip.ip_info);
+        ip.ip_changed = true;
+        post(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &ok, sizeof(ok));
+        post(IP_EVENT, IP_EVENT_STA_GOT_IP, &ip, sizeof(ip));
+    } else if (!cancelled) {
+        post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &fail, sizeof(fail));
+    }
+    vTaskDelete(NULL);
+}
+
+// Drop the link, post the event if there was one
+static void sta_leave(uint8_t reason)
+{
+    wifi_event_sta_disconnected_t ev = { .reason = reason };
+    taskENTER_CRITICAL(&s_mux);
+    bool was = s_connected;
+    s_connected = false;
+    s_conn_gen++;
+    if (was) {
+        ev.ssid_len = strnlen((const char *)s_ap.ssid, 32);
+        memcpy(ev.ssid, s_ap.ssid, ev.ssid_len);
+        memcpy(ev.bssid, s_ap.bssid, 6);
+        ev.rssi = s_ap.rssi;
+    }
+    taskEXIT_CRITICAL(&s_mux);
+    if (was) {
+        post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &ev, sizeof(ev));
+    }
+}
+
+/* ---- scan ---- */
+
+static bool scan_match(const wifi_ap_record_t *ap, const wifi_scan_config_t *c)
+{
+    if (c == NULL) {
+        return ap->ssid[0] != '\0';
+    }
+    return (c->channel == 0 || c->channel == ap->primary) &&
+           (c->ssid == NULL || strcmp((const char *)c->ssid, (const char *)ap->ssid) == 0) &&
+           (c->bssid == NULL || memcmp(c->bssid, ap->bssid, 6) == 0) &&
+           (c->show_hidden || ap->ssid[0] != '\0');
+}
+
+static uint32_t scan_duration_ms(const wifi_scan_config_t *c)
+{
+    uint32_t channels = c && c->channel ? 1 : SIM_CHANNELS;
+    uint32_t dwell = 0;
+    if (c) {
+        dwell = c->scan_type == WIFI_SCAN_TYPE_PASSIVE ? c->scan_time.passive : c->scan_time.active.max;
+    }
+    return dwell ? dwell * channels : CONFIG_WIFI_SIM_SCAN_MS * channels / SIM_CHANNELS;
+}
+
+static void scan_finish(void)
+{
+    wifi_event_sta_scan_done_t done = { 0 };
+    taskENTER_CRITICAL(&s_mux);
+    const wifi_scan_config_t *c = s_scan_has_config ? &s_scan_config : NULL;
+    s_result_count = 0;
+    for (size_t i = 0; i < s_ap_count; i++) {
+        if (scan_match(&s_aps[i], c)) {
+            wifi_ap_record_t *r = &s_results[s_result_count++];
+            *r = s_aps[i];
+            r->rssi += (int)(sim_rand() % 7) - 3;
+        }
+    }
+    s_scanning = false;
+    done.number = s_result_count;
+    done.scan_id = ++s_scan_id;
+    taskEXIT_CRITICAL(&s_mux);
+    post(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &done, sizeof(done));
+}
+
+static void scan_task(void *arg)
+{
+    vTaskDelay(pdMS_TO_TICKS((uint32_t)(uintptr_t)arg));
+    scan_finish();
+    vTaskDelete(NULL);
+}
+
+/* ---- esp_wifi ---- */
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config)
+{
+    if (s_inited) {
+        return ESP_OK;
+    }
+    if (s_replay_done == NULL) {
+        s_replay_done = xSemaphoreCreateBinaryStatic(&s_replay_done_buf);
+    }
+    load_aps();
+    s_inited = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_deinit(void)
+{
+    if (!s_inited) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (s_started) {
+        return ESP_ERR_WIFI_NOT_STOPPED;
+    }
+    s_promisc = false;
+    s_rx_cb = NULL;
+    s_mode = WIFI_MODE_NULL;
+    s_inited = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode)
+{
+    if (!s_inited) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (mode >= WIFI_MODE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_mode = mode;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_mode(wifi_mode_t *mode)
+{
+    if (!s_inited) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    *mode = s_mode;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage)
+{
+    return s_inited ? ESP_OK : ESP_ERR_WIFI_NOT_INIT;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+    if (!s_inited) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (s_started) {
+        return ESP_OK;
+    }
+    s_started = true;
+    if (s_mode == WIFI_MODE_STA || s_mode == WIFI_MODE_APSTA) {
+        post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0);
+    }
+    replay_update();
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_stop(void)
+{
+    if (!s_inited) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (!s_started) {
+        return ESP_OK;
+    }
+    sta_leave(WIFI_REASON_ASSOC_LEAVE);
+    s_started = false;
+    replay_update();
+    post(WIFI_EVENT, WIFI_EVENT_STA_STOP, NULL, 0);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void)
+{
+    if (!s_inited) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (!s_started) {
+        return ESP_ERR_WIFI_NOT_STARTED;
+    }
+    if (s_mode != WIFI_MODE_STA && s_mode != WIFI_MODE_APSTA) {
+        return ESP_ERR_WIFI_MODE;
+    }
+    taskENTER_CRITICAL(&s_mux);
+    uint32_t gen = ++s_conn_gen;
+    taskEXIT_CRITICAL(&s_mux);
+    if (xTaskCreate(connect_task, "wifi_sim_conn", SIM_TASK_STACK, (void *)(uintptr_t)gen, SIM_TASK_PRIO, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_disconnect(void)
+{
+    if (!s_started) {
+        return ESP_ERR_WIFI_NOT_STARTED;
+    }
+    sta_leave(WIFI_REASON_ASSOC_LEAVE);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf)
+{
+    if (!s_inited) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (interface != WIFI_IF_STA) {
+        return ESP_ERR_WIFI_IF;
+    }
+    taskENTER_CRITICAL(&s_mux);
+    s_sta_config = conf->sta;
+    taskEXIT_CRITICAL(&s_mux);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t *conf)
+{
+    if (!s_inited) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (interface != WIFI_IF_STA) {
+        return ESP_ERR_WIFI_IF;
+    }
+    taskENTER_CRITICAL(&s_mux);
+    conf->sta = s_sta_config;
+    taskEXIT_CRITICAL(&s_mux);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t *config, bool block)
+{
+    if (!s_inited) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (!s_started) {
+        return ESP_ERR_WIFI_NOT_STARTED;
+    }
+    taskENTER_CRITICAL(&s_mux);
+    bool busy = s_scanning;
+    s_scanning = true;
+    s_scan_has_config = config != NULL;
+    if (config) {
+        s_scan_config = *config;
+    }
+    taskEXIT_CRITICAL(&s_mux);
+    if (busy) {
+        return ESP_ERR_WIFI_STATE;
+    }
+    uint32_t ms = scan_duration_ms(config);
+    if (block) {
+        vTaskDelay(pdMS_TO_TICKS(ms));
+        scan_finish();
+        return ESP_OK;
+    }
+    if (xTaskCreate(scan_task, "wifi_sim_scan", SIM_TASK_STACK, (void *)(uintptr_t)ms, SIM_TASK_PRIO, NULL) != pdPASS) {
+        s_scanning = false;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_stop(void)
+{
+    // The scan task still finishes and reports what it found, as the driver does
+    return s_started ? ESP_OK : ESP_ERR_WIFI_NOT_STARTED;
+}
+
+esp_err_t esp_wifi_scan_get_ap_num(uint16_t *number)
+{
+    if (!s_inited) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    *number = s_result_count;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t *number, wifi_ap_record_t *ap_records)
+{
+    if (!s_inited) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    taskENTER_CRITICAL(&s_mux);
+    if (*number > s_result_count) {
+        *number = s_result_count;
+    }
+    memcpy(ap_records, s_results, *number * sizeof(wifi_ap_record_t));
+    s_result_count = 0;                             // the driver frees its list here
+    taskEXIT_CRITICAL(&s_mux);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info)
+{
+    taskENTER_CRITICAL(&s_mux);
+    bool connected = s_connected;
+    if (connected) {
+        *ap_info = s_ap;
+        ap_info->rssi += (int)(sim_rand() % 7) - 3;
+    }
+    taskEXIT_CRITICAL(&s_mux);
+    return connected ? ESP_OK : ESP_ERR_WIFI_NOT_CONNECT;
+}
+
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t second)
+{
+    if (!s_inited) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (primary < 1 || primary > SIM_CHANNELS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_channel = primary;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_channel(uint8_t *primary, wifi_second_chan_t *second)
+{
+    if (!s_inited) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    *primary = s_connected ? s_ap.primary : s_channel;
+    *second = WIFI_SECOND_CHAN_NONE;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_promiscuous(bool en)
+{
+    if (!s_inited) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    s_promisc = en;
+    replay_update();
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_promiscuous_rx_cb(wifi_promiscuous_cb_t cb)
+{
+    s_rx_cb = cb;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type)
+{
+    if (!s_inited) {
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    s_ps = type;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_ps(wifi_ps_type_t *type)
+{
+    *type = s_ps;
+    return ESP_OK;
+}
+
+/* ---- esp_netif ---- */
+
+/* From esp_wifi_default.c on the chips, with the TAP as the driver. The
+ * netif has a fixed address and is up from the start: the TAP is the wire
+ * the host reaches the console through, association or not. */
+esp_netif_t *esp_netif_create_default_wifi_sta(void)
+{
+    if (s_sta_netif) {
+        return s_sta_netif;
+    }
+    static esp_netif_ip_info_t ip;
+    esp_netif_str_to_ip4(CONFIG_WIFI_SIM_IP, &ip.ip);
+    esp_netif_str_to_ip4(CONFIG_WIFI_SIM_NETMASK, &ip.netmask);
+    esp_netif_str_to_ip4(CONFIG_WIFI_SIM_GW, &ip.gw);
+
+    esp_netif_inherent_config_t base = ESP_NETIF_INHERENT_DEFAULT_WIFI_STA();
+    base.flags = ESP_NETIF_FLAG_GARP;           // no DHCP client, no GOT_IP of its own
+    base.ip_info = &ip;
+    const esp_netif_config_t config = {
+        .base = &base,
+        .stack = ESP_NETIF_NETSTACK_DEFAULT_ETH,
+    };
+    esp_netif_t *netif = esp_netif_new(&config);
+    if (netif == NULL) {
+        return NULL;
+    }
+    if (tap_if_attach(netif) != ESP_OK) {
+        esp_netif_destroy(netif);
+        return NULL;
+    }
+    esp_netif_action_start(netif, NULL, 0, NULL);
+    esp_netif_action_connected(netif, NULL, 0, NULL);
+    s_sta_netif = netif;
+    ESP_LOGI(TAG, "Station " IPSTR " on " CONFIG_WIFI_SIM_TAP_IF, IP2STR(&ip.ip));
+    return netif;
+}
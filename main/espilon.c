@@ -7,63 +7,147 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include "sdkconfig.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_console.h"
+// The FAT data partition holds the history and the scripts, either one mounts it
+#define DATA_PARTITION (CONFIG_CONSOLE_STORE_HISTORY || CONFIG_SCRIPT_STORAGE)
+#if DATA_PARTITION
 #include "esp_vfs_dev.h"
 #include "esp_vfs_fat.h"
-#include "nvs.h"
-#include "nvs_flash.h"
+#endif
 #include "cmd_system.h"
 #include "cmd_wifi.h"
+#include "wifi_mgr.h"
 #include "arpscan.h"
 #include "network.h"
+#include "jobs.h"
+#include "dispatch.h"
+#include "pipeline.h"
+#include "tcp_console.h"
+#include "script.h"
+#include "async_out.h"
+#include "monitor.h"
+#include "boot.h"
 
 //#include "cmd_ble.h"
 //#include "cmd_nvs.h"
 
 #define PROMPT_STR CONFIG_IDF_TARGET
 
-static void initialize_nvs(void)
+#if DATA_PARTITION
+#define MOUNT_PATH "/data"
+#define HISTORY_PATH MOUNT_PATH "/history.txt"
+
+// "storage" partition of partitions.csv
+static void initialize_filesystem(void)
 {
-    esp_err_t err = nvs_flash_init();
-    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK( nvs_flash_erase() );
-        err = nvs_flash_init();
+    static wl_handle_t wl_handle;
+    const esp_vfs_fat_mount_config_t mount_config = {
+        .max_files = 4,
+        .format_if_mount_failed = true
+    };
+    esp_err_t err = esp_vfs_fat_spiflash_mount_rw_wl(MOUNT_PATH, "storage", &mount_config, &wl_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE("espilon", "Failed to mount FATFS (%s)", esp_err_to_name(err));
     }
-    ESP_ERROR_CHECK(err);
 }
+#endif
+
+// No flash partition on the host: scripts are read from a local directory
+#if CONFIG_IDF_TARGET_LINUX
+#define SCRIPT_DIR CONFIG_SCRIPT_HOST_DIR
+#elif CONFIG_SCRIPT_STORAGE
+#define SCRIPT_DIR MOUNT_PATH
+#endif
 
 void app_main(void)
 {
-    esp_console_repl_t *repl = NULL;
+    boot_mark("startup");
+#if CONFIG_ASYNC_OUT_ENABLE
+    // Before any task is created: they inherit the asynchronous stdout
+    ESP_ERROR_CHECK(async_out_start());
+    boot_mark("async_out");
+#endif
     esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
     /* Prompt to be printed before each line.
      * This can be customized, made dynamic, etc.
      */
     repl_config.prompt = "striker:>";
     repl_config.max_cmdline_length = CONFIG_CONSOLE_MAX_COMMAND_LINE_LENGTH;
+    // Commands run on the application core, Wi-Fi keeps core 0
+    repl_config.task_core_id = pipeline_app_core();
+
+    // NVS, netif and the Wi-Fi driver start on first use (wifi_stack_init), not here
 
-    initialize_nvs();
-    /* Loads Modules */
-    esp_console_register_help_command();
+#if DATA_PARTITION
+    initialize_filesystem();
+#if CONFIG_CONSOLE_STORE_HISTORY
+    repl_config.history_save_path = HISTORY_PATH;
+#endif
+    boot_mark("filesystem");
+#endif
+    /* Loads Modules: registers their commands, nothing else */
+    dispatch_register_help();
 
     register_system_common();
+    module_wifi_mgr();
     register_join_wifi_cmd();
     module_sniff_wif();
     module_scan_wifi();
     module_ping();
     module_arp_scan();
+#if !CONFIG_IDF_TARGET_LINUX
+    // The simulated radio has no AP side
+    module_ap_wifi();
+#endif
     module_proxy();
+    module_proxy_pool();
+    module_socks();
+    module_agent();
+    module_jobs();
+    module_tcp_console();
+    module_async_out();
+    module_monitor();
+#ifdef SCRIPT_DIR
+    module_script(SCRIPT_DIR);
+#endif
     //register_sniffer_ble();
     //register_nvs();
+    boot_mark("modules");
 
-#if defined(CONFIG_ESP_CONSOLE_UART_DEFAULT) || defined(CONFIG_ESP_CONSOLE_UART_CUSTOM)
-    esp_console_dev_uart_config_t hw_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_console_new_repl_uart(&hw_config, &repl_config, &repl));
-#else
-#error Unsupported console type
+#if CONFIG_SCRIPT_AUTORUN
+    // In the background: the console stays usable while the script runs
+    if (access(SCRIPT_DIR "/autorun.txt", F_OK) == 0) {
+        int ret;
+        dispatch_run("bg run autorun.txt", &ret);
+        boot_mark("autorun");
+    }
+#endif
+
+#if CONFIG_IDF_TARGET_LINUX
+    // On the host the station netif is the TAP interface, the only way in: up from boot
+    if (wifi_stack_init() != ESP_OK) {
+        ESP_LOGE("espilon", "No TAP interface, see README (Linux host build)");
+    }
+    boot_mark("tap");
 #endif
 
+#if CONFIG_TCP_CONSOLE_AUTOSTART
+    ESP_ERROR_CHECK(tcp_console_start(CONFIG_TCP_CONSOLE_PORT, repl_config.prompt));
+    boot_mark("tcp_console");
+#endif
+
+// No UART on the host (linux): TCP console only
+#if !CONFIG_IDF_TARGET_LINUX && (defined(CONFIG_ESP_CONSOLE_UART_DEFAULT) || defined(CONFIG_ESP_CONSOLE_UART_CUSTOM))
+    esp_console_repl_t *repl = NULL;
+    esp_console_dev_uart_config_t hw_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_console_new_repl_uart(&hw_config, &repl_config, &repl));
     ESP_ERROR_CHECK(esp_console_start_repl(repl));
+    boot_mark("console");
+#elif !CONFIG_TCP_CONSOLE_AUTOSTART
+#error Unsupported console type, enable CONFIG_TCP_CONSOLE_AUTOSTART for a TCP-only console
+#endif
 }
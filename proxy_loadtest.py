@@ -0,0 +1,228 @@
+"""Load test for proxy_srv.py with simulated agents.
+
+Starts the server in-process, connects N fake agents over loopback (they
+speak the agent framing and answer every command like scan-arp would), then
+reports connection setup rate and command round-trip latency.
+
+    python3 proxy_loadtest.py --agents 5000 --rounds 5 [--mode zrec] [--store /tmp/results]
+
+--mode is the server's result format, zrec by default like proxy_srv.py: the
+agents answer CMDX with CBOR records, LZSS compressed across frames as
+result.c does, and the server decodes every one of them. text is the plain
+CMD/OUT path.
+
+With --store every reply is also appended to a result store (see
+result_store.py bench for the store on its own).
+"""
+import argparse
+import asyncio
+import resource
+import statistics
+import struct
+import time
+
+import proxy_srv
+from result_store import ResultStore
+from proxy_srv import (HDR, F_HELLO, F_CMD, F_OUT, F_END, F_REC, F_ZREC, F_CMDX, F_PING, F_PONG,
+                       CMDX_RECORDS, CMDX_COMPRESS, MAX_PAYLOAD)
+
+HOSTS = 8           # arp_host records per reply
+SINK_BUF = 512      # RESULT_SINK_BUF_SIZE: records are sent in blocks of this size
+
+
+def cbor(value):
+    """Encode the CBOR subset result.c emits: ints, bytes, text, arrays."""
+    def head(major, n):
+        if n < 24:
+            return bytes([major << 5 | n])
+        size = 1 if n < 0x100 else 2 if n < 0x10000 else 4
+        return bytes([major << 5 | {1: 24, 2: 25, 4: 26}[size]]) + n.to_bytes(size, "big")
+    if isinstance(value, int):
+        return head(0, value) if value >= 0 else head(1, -1 - value)
+    if isinstance(value, bytes):
+        return head(2, len(value)) + value
+    if isinstance(value, str):
+        return head(3, len(value.encode())) + value.encode()
+    return head(4, len(value)) + b"".join(cbor(v) for v in value)
+
+
+class LzEncoder:
+    """Streaming LZSS in the format of result_lz_compress(), history kept between blocks."""
+    WINDOW, MIN_MATCH, MAX_MATCH = 1024, 3, 66
+
+    def __init__(self):
+        self.hist = b""
+
+    def feed(self, block):
+        win, pos = self.hist + block, len(self.hist)
+        out, flags_at, bit = bytearray(), 0, 8
+        while pos < len(win):
+            best_len = best_dist = 0
+            for cand in range(max(0, pos - self.WINDOW), pos):
+                n = 0
+                while n < self.MAX_MATCH and pos + n < len(win) and win[cand + n] == win[pos + n]:
+                    n += 1
+                if n > best_len:
+                    best_len, best_dist = n, pos - cand
+            if bit == 8:
+                flags_at, bit = len(out), 0
+                out.append(0)
+            if best_len >= self.MIN_MATCH:
+                d = best_dist - 1
+                out += bytes([d & 0xFF, (d >> 8) << 6 | (best_len - self.MIN_MATCH)])
+                pos += best_len
+            else:
+                out[flags_at] |= 1 << bit
+                out.append(win[pos])
+                pos += 1
+            bit += 1
+        self.hist = win[-self.WINDOW:]
+        return bytes(out)
+
+
+def arp_reply(round_no):
+    """Records of a scan-arp on a /24: hosts, then the summary."""
+    recs = [cbor([2, bytes([192, 168, 1, h + 1]), bytes([0x24, 0x4b, 0xfe, round_no & 0xFF, 0x20, h])])
+            for h in range(HOSTS)]
+    recs.append(cbor([8, "arp", HOSTS, 1200 + round_no]))
+    return recs
+
+
+_blocks = {}    # (round, flags) -> encoded blocks, the same for every agent
+
+
+def reply_records(chan, flags, round_no):
+    """F_REC or F_ZREC frames, one per sink block, as result_sink_flush() sends them.
+
+    Encoded once per round: compressing in Python for every agent would
+    time the fake agents instead of the server."""
+    key = (round_no, flags & CMDX_COMPRESS)
+    if key not in _blocks:
+        _blocks[key] = encode_blocks(arp_reply(round_no), flags & CMDX_COMPRESS)
+    ftype = F_ZREC if flags & CMDX_COMPRESS else F_REC
+    return b"".join(HDR.pack(ftype, chan, len(data)) + data for data in _blocks[key])
+
+
+def encode_blocks(recs, compress):
+    blocks, block = [], b""
+    for rec in recs:
+        if len(block) + len(rec) > SINK_BUF:
+            blocks.append(block)
+            block = b""
+        block += rec
+    blocks.append(block)
+    lz = LzEncoder() if compress else None
+    out = [lz.feed(block) if lz else block for block in blocks]
+    assert all(len(data) <= MAX_PAYLOAD for data in out)
+    return out
+
+
+async def fake_agent(reader, writer, idx, stop):
+    name = f"sim-{idx:05d}".encode()
+    writer.write(HDR.pack(F_HELLO, 0, len(name)) + name)
+    round_no = 0
+    try:
+        while not stop.is_set():
+            ftype, chan, length = HDR.unpack(await reader.readexactly(HDR.size))
+            payload = await reader.readexactly(length) if length else b""
+            end = HDR.pack(F_END, chan, 4) + struct.pack(">i", 0)
+            if ftype == F_CMD:
+                out = b"ok " + payload + b"\n"
+                writer.write(HDR.pack(F_OUT, chan, len(out)) + out + end)
+            elif ftype == F_CMDX and payload and payload[0] & CMDX_RECORDS:
+                writer.write(reply_records(chan, payload[0], round_no) + end)
+                round_no += 1
+            elif ftype == F_PING:
+                writer.write(HDR.pack(F_PONG, chan, length) + payload)
+            await writer.drain()
+    except (asyncio.IncompleteReadError, ConnectionError):
+        pass
+    finally:
+        writer.close()
+
+
+def pct(samples, p):
+    samples = sorted(samples)
+    return samples[min(len(samples) - 1, int(len(samples) * p / 100))]
+
+
+async def run(n_agents, rounds, concurrency, port, store_dir, mode):
+    store = ResultStore(store_dir) if store_dir else None
+    server = proxy_srv.Server(quiet=True, store=store)
+    server.mode = mode
+    srv = await server.start("127.0.0.1", port, backlog=4096)
+    stop = asyncio.Event()
+
+    # Connection setup: bounded number of connects in flight, done once every agent said HELLO
+    t0 = time.perf_counter()
+    tasks = []
+    sem = asyncio.Semaphore(concurrency)
+
+    async def spawn(i):
+        async with sem:
+            reader, writer = await asyncio.open_connection("127.0.0.1", port)
+        tasks.append(asyncio.create_task(fake_agent(reader, writer, i, stop)))
+
+    await asyncio.gather(*(spawn(i) for i in range(n_agents)))
+    while len(server.agents) < n_agents or not all(a.hello.done() for a in server.agents.values()):
+        await asyncio.sleep(0.01)
+    setup = time.perf_counter() - t0
+    print(f"setup: {n_agents} agents in {setup:.2f} s, {n_agents / setup:.0f} conn/s")
+
+    # Round trip: broadcast a command to every agent, time each reply
+    rtts = []
+    records = wire = 0
+    for r in range(rounds):
+        t_round = time.perf_counter()
+        starts = {}
+        futures = []
+        for agent in server.agents.values():
+            fut = agent.run_command(f"scan-arp {r}", echo=False)
+            starts[fut] = time.perf_counter()
+            fut.add_done_callback(lambda f: rtts.append(time.perf_counter() - starts[f]))
+            futures.append(fut)
+        cmds = await asyncio.gather(*futures)
+        dt = time.perf_counter() - t_round
+        records += sum(len(c.records) for c in cmds)
+        wire += sum(c.wire_bytes for c in cmds)
+        print(f"round {r}: {len(futures)} commands in {dt * 1000:.0f} ms, {len(futures) / dt:.0f} cmd/s")
+
+    ms = [x * 1000 for x in rtts]
+    print(f"rtt ms: p50 {pct(ms, 50):.2f}  p99 {pct(ms, 99):.2f}  max {max(ms):.2f}"
+          f"  mean {statistics.mean(ms):.2f}")
+    replies = n_agents * rounds
+    print(f"mode {mode}: {records} records, {wire / replies:.0f} B received per reply")
+    if mode != "text":
+        bad = sum(a.bad_frames for a in server.agents.values())
+        assert records == replies * (HOSTS + 1), f"{records} records decoded, expected {replies * (HOSTS + 1)}"
+        assert bad == 0, f"{bad} frames dropped as undecodable"
+
+    if store:
+        store.close()
+        print(f"store: {store.entries} entries in {store_dir}")
+
+    stop.set()
+    for agent in list(server.agents.values()):
+        agent.writer.close()
+    srv.close()
+    await asyncio.gather(*tasks, return_exceptions=True)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--agents", type=int, default=2000)
+    parser.add_argument("--rounds", type=int, default=5)
+    parser.add_argument("--concurrency", type=int, default=256, help="connects in flight")
+    parser.add_argument("--port", type=int, default=12340)
+    parser.add_argument("--store", help="also store every result in this directory")
+    parser.add_argument("--mode", default=proxy_srv.Server().mode, choices=proxy_srv.OUTPUT_MODES,
+                        help="result format of the commands (default: the server's)")
+    args = parser.parse_args()
+
+    # Two sockets per agent on loopback
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    need = args.agents * 2 + 64
+    if soft < need:
+        resource.setrlimit(resource.RLIMIT_NOFILE, (min(need, hard), hard))
+
+    asyncio.run(run(args.agents, args.rounds, args.concurrency, args.port, args.store, args.mode))
@@ -1,78 +1,549 @@
+"""Agent server for ESPILON (proxy_start on the ESP32).
+
+Single asyncio event loop: every agent has a reader coroutine and a writer
+coroutine draining a bounded send queue, every tunnel its own task writing
+to its local socket, the operator console is read without blocking the
+loop. Frames follow components/network/agent.h.
+
+Console:
+    list                               agents and groups
+    send <id|@group|*> <command>       run a command on agents
+    group <name> <id> [<id>...]        define a group (group <name> to delete)
+    tunnel <id> <lport> <ip> <port>    forward 127.0.0.1:lport to ip:port via the agent
+    mode [text|rec|zrec]               result format of commands sent (default zrec)
+    find <name|*> [<command>|*] [<since>]  stored results, e.g. find esp-01 scan-arp 1h
+    quit
+"""
+import argparse
+import asyncio
+import itertools
 import socket
-import threading
+import struct
+import sys
 import time
 
-clients = {}
-lock = threading.Lock()
+from result_store import ResultStore, KIND_TEXT, KIND_RECORDS
 
-def handle_client(client_socket, address):
-    client_id = f"{address[0]}:{address[1]}"
-    print(f"[+] Nouveau client connecté : {client_id}")
+# Agent framing, see components/network/agent.h
+HDR = struct.Struct(">BHH")
+F_HELLO, F_CMD, F_OUT, F_END, F_REC, F_ZREC, F_CMDX = 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06
+F_OPEN, F_OPEN_OK, F_OPEN_FAIL, F_DATA, F_CLOSE, F_WINDOW = 0x10, 0x11, 0x12, 0x13, 0x14, 0x15
+F_PING, F_PONG = 0x20, 0x21
+MAX_PAYLOAD = 1460
+TUNNEL_WINDOW = 8192
+SEND_QUEUE_LEN = 256    # frames buffered per agent before producers wait
 
-    with lock:
-        clients[client_id] = client_socket
+# CMDX flags: results as CBOR records, optionally LZSS compressed
+CMDX_RECORDS, CMDX_COMPRESS = 0x01, 0x02
+OUTPUT_MODES = {"text": None, "rec": CMDX_RECORDS, "zrec": CMDX_RECORDS | CMDX_COMPRESS}
 
-    try:
-        while True:
-            data = client_socket.recv(4096)
-            if not data:
-                break
-            print(f"\n[{client_id}] {data.decode(errors='ignore')}")
-    except Exception as e:
-        print(f"[!] Erreur avec {client_id} : {e}")
-    finally:
-        with lock:
-            if client_id in clients:
-                del clients[client_id]
-        client_socket.close()
-        print(f"[-] Client déconnecté : {client_id}")
+# Field names per record type, see components/result/result.h
+RECORD_SCHEMAS = {
+    1: ("wifi_ap", ("ssid", "bssid", "rssi", "authmode", "channel")),
+    2: ("arp_host", ("ip", "mac")),
+    3: ("sniff_mgmt", ("subtype", "da", "sa", "bssid", "ssid", "rssi", "channel")),
+    4: ("sniff_eapol", ("da", "sa", "rssi", "frame")),
+    5: ("ping_reply", ("ip", "seq", "ttl", "time_ms", "size")),
+    6: ("ping_timeout", ("ip", "seq")),
+    7: ("ping_summary", ("ip", "transmitted", "received", "time_ms")),
+    8: ("scan_summary", ("kind", "count", "duration_ms")),
+    9: ("wifi_link", ("ssid", "ip", "rssi", "channel")),
+    10: ("chip", ("model", "cores", "revision", "flash_mb", "idf")),
+    11: ("heartbeat", ("uptime_s", "free_heap", "duty_permille", "avg_ua", "wakeups")),
+    12: ("wifi_event", ("event", "bssid", "ssid", "rssi", "channel", "prev_channel", "twin")),
+}
+MAC_FIELDS = {"bssid", "da", "sa", "mac", "twin"}
 
-def accept_connections(server_socket):
-    while True:
-        client_socket, addr = server_socket.accept()
-        threading.Thread(target=handle_client, args=(client_socket, addr), daemon=True).start()
 
-def command_sender():
-    last_clients_state = []
+class LzDecoder:
+    """Streaming LZSS decoder matching result_lz_compress()."""
+    WINDOW = 1024
 
-    while True:
-        time.sleep(0.5)
-        with lock:
-            client_list = list(clients.keys())
-
-        if client_list != last_clients_state:
-            print("\nClients connectés :")
-            if not client_list:
-                print("  Aucun client connecté.")
+    def __init__(self):
+        self.hist = bytearray()
+
+    def feed(self, block):
+        hist, start, i, n = self.hist, len(self.hist), 0, len(block)
+        while i < n:
+            flags = block[i]
+            i += 1
+            for bit in range(8):
+                if i >= n:
+                    break
+                if flags >> bit & 1:
+                    hist.append(block[i])
+                    i += 1
+                else:
+                    dist = (block[i] | (block[i + 1] >> 6) << 8) + 1
+                    length = (block[i + 1] & 0x3F) + 3
+                    i += 2
+                    src = len(hist) - dist
+                    for k in range(length):
+                        hist.append(hist[src + k])
+        out = bytes(hist[start:])
+        del hist[:-self.WINDOW]
+        return out
+
+
+def cbor_decode(buf, i=0):
+    """Decode one CBOR item (the subset result.c emits), returns (value, next index)."""
+    ib = buf[i]
+    major, info = ib >> 5, ib & 0x1F
+    i += 1
+    if ib == 0xF6:
+        return None, i
+    if info < 24:
+        val = info
+    else:
+        size = 1 << (info - 24)
+        val = int.from_bytes(buf[i:i + size], "big")
+        i += size
+    if major == 0:
+        return val, i
+    if major == 1:
+        return -1 - val, i
+    if major == 2:
+        return bytes(buf[i:i + val]), i + val
+    if major == 3:
+        return buf[i:i + val].decode(errors="replace"), i + val
+    if major == 4:
+        items = []
+        for _ in range(val):
+            item, i = cbor_decode(buf, i)
+            items.append(item)
+        return items, i
+    raise ValueError(f"unsupported CBOR item 0x{ib:02x}")
+
+
+def decode_records(buf):
+    """CBOR arrays [type, fields...] -> dicts named after RECORD_SCHEMAS."""
+    i, records = 0, []
+    while i < len(buf):
+        items, i = cbor_decode(buf, i)
+        name, fields = RECORD_SCHEMAS.get(items[0], (f"type{items[0]}", ()))
+        rec = {"type": name}
+        for idx, value in enumerate(items[1:]):
+            key = fields[idx] if idx < len(fields) else f"f{idx}"
+            if isinstance(value, bytes) and key in MAC_FIELDS:
+                value = ":".join(f"{b:02x}" for b in value)
+            elif isinstance(value, bytes) and key == "ip" and len(value) == 4:
+                value = ".".join(str(b) for b in value)
+            rec[key] = value
+        records.append(rec)
+    return records
+
+
+class Tunnel:
+    """Local TCP connection forwarded to ip:port on the agent's network."""
+
+    def __init__(self, agent, chan, reader, writer):
+        self.agent = agent
+        self.chan = chan
+        self.reader = reader
+        self.writer = writer
+        self.credit = TUNNEL_WINDOW
+        self.credit_event = asyncio.Event()
+        self.credit_event.set()
+        self.opened = asyncio.get_running_loop().create_future()
+        self.closed = False
+        # Agent -> local, written by its own task; the agent may not have more than
+        # TUNNEL_WINDOW bytes in flight, unacknowledged until written here
+        self.out = asyncio.Queue()
+        self.queued = 0
+        self.drainer = asyncio.create_task(self.drain())
+
+    async def pump(self):
+        """Local -> agent, bounded by the credit the agent granted."""
+        try:
+            if not await asyncio.wait_for(self.opened, 15):
+                return
+            while not self.closed:
+                await self.credit_event.wait()
+                data = await self.reader.read(min(self.credit, MAX_PAYLOAD))
+                if not data:
+                    break
+                self.credit -= len(data)
+                if self.credit == 0:
+                    self.credit_event.clear()
+                await self.agent.send(F_DATA, self.chan, data)
+        except (asyncio.TimeoutError, ConnectionError):
+            pass
+        await self.close(notify=True)
+
+    async def drain(self):
+        """Agent -> local; a slow local client only holds up its own channel."""
+        try:
+            while True:
+                data = await self.out.get()
+                self.writer.write(data)
+                await self.writer.drain()
+                self.queued -= len(data)
+                await self.agent.send(F_WINDOW, self.chan, struct.pack(">I", len(data)))
+        except ConnectionError:
+            await self.close(notify=True)
+        except asyncio.CancelledError:
+            pass
+
+    def grant(self, n):
+        self.credit += n
+        self.credit_event.set()
+
+    async def close(self, notify=False):
+        if self.closed:
+            return
+        self.closed = True
+        self.credit_event.set()
+        if self.drainer is not asyncio.current_task():
+            self.drainer.cancel()
+        self.agent.tunnels.pop(self.chan, None)
+        if notify and not self.agent.closed:
+            await self.agent.send(F_CLOSE, self.chan)
+        self.writer.close()
+
+
+class Command:
+    """A command in flight on one channel, collects its output and records."""
+
+    def __init__(self, fut, line, echo):
+        self.fut = fut
+        self.line = line
+        self.echo = echo
+        self.output = bytearray()
+        self.cbor = bytearray()     # records as received, decompressed
+        self.records = []
+        self.lz = LzDecoder()
+        self.wire_bytes = 0
+
+
+class Agent:
+    def __init__(self, server, aid, reader, writer):
+        self.server = server
+        self.id = aid
+        peer = writer.get_extra_info("peername")
+        self.addr = f"{peer[0]}:{peer[1]}" if peer else "?"
+        self.name = self.addr
+        self.reader = reader
+        self.writer = writer
+        self.queue = asyncio.Queue(SEND_QUEUE_LEN)
+        self.chans = itertools.cycle(range(1, 0x10000))
+        self.pending = {}   # chan -> Command
+        self.tunnels = {}   # chan -> Tunnel
+        self.closed = False
+        self.bad_frames = 0
+        self.hello = asyncio.get_running_loop().create_future()
+
+    async def send(self, ftype, chan, payload=b""):
+        """Queue a frame; waits when the agent is not keeping up (backpressure)."""
+        await self.queue.put(HDR.pack(ftype, chan, len(payload)) + payload)
+
+    def try_send(self, ftype, chan, payload=b""):
+        """Queue a frame without waiting, False when the agent's queue is full."""
+        try:
+            self.queue.put_nowait(HDR.pack(ftype, chan, len(payload)) + payload)
+            return True
+        except asyncio.QueueFull:
+            return False
+
+    def next_chan(self):
+        for chan in self.chans:
+            if chan not in self.pending and chan not in self.tunnels:
+                return chan
+
+    def run_command(self, line, echo=True, mode=None):
+        """Send a command, the future resolves to its Command (code set as .code)."""
+        fut = asyncio.get_running_loop().create_future()
+        chan = self.next_chan()
+        flags = OUTPUT_MODES[mode or self.server.mode]
+        if flags is None:
+            frame = (F_CMD, chan, line.encode())
+        else:
+            frame = (F_CMDX, chan, bytes([flags]) + line.encode())
+        if not self.try_send(*frame):
+            fut.set_exception(RuntimeError(f"agent {self.id} send queue full"))
+            return fut
+        self.pending[chan] = Command(fut, line, echo)
+        return fut
+
+    async def writer_loop(self):
+        try:
+            while True:
+                frame = await self.queue.get()
+                self.writer.write(frame)
+                # Coalesce whatever is already queued into the same write
+                while not self.queue.empty():
+                    self.writer.write(self.queue.get_nowait())
+                await self.writer.drain()
+        except (ConnectionError, asyncio.CancelledError):
+            pass
+
+    async def reader_loop(self):
+        try:
+            while True:
+                hdr = await self.reader.readexactly(HDR.size)
+                ftype, chan, length = HDR.unpack(hdr)
+                payload = await self.reader.readexactly(length) if length else b""
+                try:
+                    await self.handle_frame(ftype, chan, payload)
+                except (ValueError, IndexError, TypeError, struct.error) as e:
+                    # Undecodable payload: that frame is dropped, the framing itself is intact
+                    self.bad_frames += 1
+                    self.server.log(f"[!] Agent {self.id} : trame 0x{ftype:02x} canal {chan} ignorée ({e!r})")
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+
+    async def handle_frame(self, ftype, chan, payload):
+        if ftype == F_HELLO:
+            self.name = payload.decode(errors="replace")
+            if not self.hello.done():
+                self.hello.set_result(self.name)
+            self.server.log(f"[+] Agent {self.id} s'identifie comme {self.name}")
+        elif ftype == F_OUT:
+            cmd = self.pending.get(chan)
+            if cmd:
+                cmd.output += payload
+                cmd.wire_bytes += len(payload)
+                if cmd.echo:
+                    self.server.log(f"[{self.id}#{chan}] {payload.decode(errors='replace')}", end="")
+        elif ftype in (F_REC, F_ZREC):
+            cmd = self.pending.get(chan)
+            if cmd:
+                cmd.wire_bytes += len(payload)
+                data = cmd.lz.feed(payload) if ftype == F_ZREC else payload
+                records = decode_records(data)
+                cmd.cbor += data
+                cmd.records += records
+                if cmd.echo:
+                    for rec in records:
+                        self.server.log(f"[{self.id}#{chan}] {rec}")
+        elif ftype == F_END:
+            cmd = self.pending.pop(chan, None)
+            code = struct.unpack(">i", payload)[0] if len(payload) == 4 else None
+            if cmd and not cmd.fut.done():
+                cmd.code = code
+                self.server.store_result(self, cmd)
+                cmd.fut.set_result(cmd)
+                if cmd.echo:
+                    self.server.log(f"[{self.id}#{chan}] terminé, code={code},"
+                                    f" {len(cmd.records)} records, {cmd.wire_bytes} B reçus")
+        elif ftype == F_PING:
+            self.try_send(F_PONG, chan, payload)
+        elif ftype in (F_OPEN_OK, F_OPEN_FAIL):
+            tun = self.tunnels.get(chan)
+            if tun and not tun.opened.done():
+                tun.opened.set_result(ftype == F_OPEN_OK)
+                if ftype == F_OPEN_FAIL:
+                    err = struct.unpack(">I", payload)[0] if len(payload) == 4 else "?"
+                    self.server.log(f"[!] Tunnel {chan} refusé par l'agent (errno {err})")
+                    await tun.close()
+        elif ftype == F_DATA:
+            tun = self.tunnels.get(chan)
+            if tun:
+                tun.queued += len(payload)
+                if tun.queued > TUNNEL_WINDOW:
+                    self.server.log(f"[!] Tunnel {chan} : l'agent dépasse la fenêtre, fermé")
+                    await tun.close(notify=True)
+                else:
+                    tun.out.put_nowait(payload)
+        elif ftype == F_WINDOW:
+            tun = self.tunnels.get(chan)
+            if tun and len(payload) == 4:
+                tun.grant(struct.unpack(">I", payload)[0])
+        elif ftype == F_CLOSE:
+            tun = self.tunnels.get(chan)
+            if tun:
+                await tun.close()
+
+    async def close(self):
+        self.closed = True
+        for cmd in self.pending.values():
+            if not cmd.fut.done():
+                cmd.fut.set_exception(ConnectionError("agent disconnected"))
+        self.pending.clear()
+        for tun in list(self.tunnels.values()):
+            await tun.close()
+        self.writer.close()
+
+
+class Server:
+    def __init__(self, quiet=False, store=None):
+        self.agents = {}    # id -> Agent
+        self.groups = {}    # name -> set of ids
+        self.ids = itertools.count()
+        self.quiet = quiet
+        self.mode = "zrec"
+        self.listeners = []
+        self.store = store  # ResultStore or None
+
+    def log(self, msg, end="\n"):
+        if not self.quiet:
+            print(msg, end=end, flush=True)
+
+    async def handle_agent(self, reader, writer):
+        sock = writer.get_extra_info("socket")
+        if sock is not None:
+            sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        agent = Agent(self, next(self.ids), reader, writer)
+        self.agents[agent.id] = agent
+        self.log(f"[+] Nouveau client connecté : [{agent.id}] {agent.addr}")
+        wtask = asyncio.create_task(agent.writer_loop())
+        try:
+            await agent.reader_loop()
+        finally:
+            wtask.cancel()
+            del self.agents[agent.id]
+            for members in self.groups.values():
+                members.discard(agent.id)
+            await agent.close()
+            self.log(f"[-] Client déconnecté : [{agent.id}] {agent.name}")
+
+    def store_result(self, agent, cmd):
+        if self.store is None:
+            return
+        if cmd.cbor:
+            self.store.append(agent.name, cmd.line, KIND_RECORDS, bytes(cmd.cbor), cmd.code)
+        else:
+            self.store.append(agent.name, cmd.line, KIND_TEXT, bytes(cmd.output), cmd.code)
+
+    def find(self, name, command=None, since=None):
+        """Print stored results, since is '90s', '30m', '1h', '2d' or seconds."""
+        if self.store is None:
+            self.log("[!] Pas de stockage (--store)")
+            return
+        t0 = None
+        if since:
+            unit = {"s": 1, "m": 60, "h": 3600, "d": 86400}.get(since[-1])
+            t0 = time.time() - (float(since[:-1]) * unit if unit else float(since))
+        agent = None if name == "*" else name
+        command = None if command in (None, "*") else command
+        for entry in self.store.query(agent, command, since=t0):
+            stamp = time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(entry.ts))
+            self.log(f"{stamp} {entry.agent} '{entry.line}' code={entry.code}")
+            if entry.kind == KIND_RECORDS:
+                for rec in decode_records(entry.payload):
+                    self.log(f"    {rec}")
+            else:
+                self.log(entry.payload.decode(errors="replace"), end="")
+
+    def resolve(self, target):
+        """'*', '@group' or an agent id -> list of agents."""
+        if target == "*":
+            return list(self.agents.values())
+        if target.startswith("@"):
+            return [self.agents[i] for i in self.groups.get(target[1:], ()) if i in self.agents]
+        agent = self.agents.get(int(target))
+        return [agent] if agent else []
+
+    def broadcast(self, target, line, echo=True):
+        """Send a command to every agent behind target, returns their futures."""
+        return [a.run_command(line, echo) for a in self.resolve(target)]
+
+    async def open_tunnel(self, agent, lport, ip, port):
+        target = socket.inet_aton(ip) + struct.pack(">H", port)
+
+        async def on_local(reader, writer):
+            chan = agent.next_chan()
+            tun = Tunnel(agent, chan, reader, writer)
+            agent.tunnels[chan] = tun
+            await agent.send(F_OPEN, chan, target)
+            await tun.pump()
+
+        listener = await asyncio.start_server(on_local, "127.0.0.1", lport)
+        self.listeners.append(listener)
+        self.log(f"[Tunnel] 127.0.0.1:{lport} -> {ip}:{port} via [{agent.id}] {agent.name}")
+
+    def list_agents(self):
+        if not self.agents:
+            self.log("  Aucun client connecté.")
+        for agent in self.agents.values():
+            self.log(f"  [{agent.id}] {agent.name} ({agent.addr}) queue={agent.queue.qsize()}"
+                     f" cmds={len(agent.pending)} tunnels={len(agent.tunnels)} bad={agent.bad_frames}")
+        for name, members in self.groups.items():
+            self.log(f"  @{name}: {' '.join(str(i) for i in sorted(members))}")
+
+    async def operator_line(self, line):
+        parts = line.split(maxsplit=2)
+        if not parts:
+            return True
+        cmd = parts[0]
+        try:
+            if cmd == "list":
+                self.list_agents()
+            elif cmd == "send" and len(parts) == 3:
+                futures = self.broadcast(parts[1], parts[2])
+                if not futures:
+                    self.log("[!] Aucun agent ne correspond.")
+            elif cmd == "mode" and len(parts) == 2 and parts[1] in OUTPUT_MODES:
+                self.mode = parts[1]
+            elif cmd == "mode":
+                self.log(f"mode {self.mode} ({'|'.join(OUTPUT_MODES)})")
+            elif cmd == "find" and len(parts) >= 2:
+                self.find(*line.split()[1:4])
+            elif cmd == "group" and len(parts) >= 2:
+                ids = line.split()[2:]
+                if ids:
+                    self.groups[parts[1]] = {int(i) for i in ids}
+                else:
+                    self.groups.pop(parts[1], None)
+            elif cmd == "tunnel":
+                _, aid, lport, ip, port = line.split()
+                agent = self.agents[int(aid)]
+                await self.open_tunnel(agent, int(lport), ip, int(port))
+            elif cmd in ("quit", "exit"):
+                return False
             else:
-                for i, client_id in enumerate(client_list):
-                    print(f"  [{i}] {client_id}")
-            last_clients_state = client_list
-
-        if client_list:
-            try:
-                choice = input("\nChoix client (numéro ou ENTER pour ignorer) : ").strip()
-                if choice == "":
-                    continue
-
-                target = int(choice)
-                client_id = client_list[target]
-                msg = input(f"Commande à envoyer à {client_id} : ")
-                with lock:
-                    clients[client_id].sendall(msg.encode())
-            except (ValueError, IndexError):
-                print("[!] Numéro invalide.")
-            except Exception as e:
-                print(f"[Erreur] {e}")
-
-def start_server(host="0.0.0.0", port=1234):
-    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-    server.bind((host, port))
-    server.listen(5)
-    print(f"[Serveur] En écoute sur {host}:{port}")
-
-    threading.Thread(target=accept_connections, args=(server,), daemon=True).start()
-    command_sender()
+                self.log(__doc__.split("Console:")[1].rstrip())
+        except (ValueError, KeyError, OSError) as e:
+            self.log(f"[Erreur] {e}")
+        return True
+
+    async def console(self):
+        """Operator input without blocking the event loop."""
+        loop = asyncio.get_running_loop()
+        lines = asyncio.Queue()
+        loop.add_reader(sys.stdin, lambda: lines.put_nowait(sys.stdin.readline()))
+        try:
+            while True:
+                line = await lines.get()
+                if line == "" or not await self.operator_line(line.strip()):
+                    break
+        finally:
+            loop.remove_reader(sys.stdin)
+
+    async def start(self, host, port, backlog=1024):
+        return await asyncio.start_server(self.handle_agent, host, port, backlog=backlog)
+
+
+async def flush_loop(store):
+    """Bound what an idle server keeps buffered, appends flush on their own when busy."""
+    while True:
+        await asyncio.sleep(1)
+        store.flush()
+
+
+async def main(host, port, store_dir):
+    store = ResultStore(store_dir) if store_dir else None
+    server = Server(store=store)
+    srv = await server.start(host, port)
+    print(f"[Serveur] En écoute sur {host}:{port} (tapez 'help')")
+    if store:
+        print(f"[Serveur] Résultats dans {store_dir}/ ({store.entries} entrées)")
+    flusher = asyncio.create_task(flush_loop(store)) if store else None
+    try:
+        async with srv:
+            await server.console()
+    finally:
+        if store:
+            flusher.cancel()
+            store.close()
+
 
 if __name__ == "__main__":
-    start_server()
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=1234)
+    parser.add_argument("--store", default="results", help="result store directory, '' to disable")
+    args = parser.parse_args()
+    try:
+        asyncio.run(main(args.host, args.port, args.store))
+    except KeyboardInterrupt:
+        pass
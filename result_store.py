@@ -0,0 +1,303 @@
+"""Append-only result store for proxy_srv.py.
+
+Every finished command is one entry appended to the active segment
+(seg-000001.log, a new one is started past SEGMENT_SIZE). Each segment has a
+sidecar index (seg-000001.idx) of fixed-size entries, so opening the store
+reads the indexes only. In memory, postings per agent and per command are
+kept sorted by time: a query picks the shortest list, bisects the time range
+and reads the matching entries from the memory-mapped segments.
+
+Entry (little endian):  len:u32 crc32:u32 | ts:f64 code:i32 kind:u8 agent_len:u8
+                        line_len:u16 agent line payload
+Index entry:            ts:f64 offset:u32 agent:u32 command:u32
+agent/command in the index are crc32 of the agent name and of the first
+word of the command line, collisions are filtered when the entry is read.
+
+    python3 result_store.py bench --agents 1000 --entries 200000
+"""
+import argparse
+import bisect
+import mmap
+import os
+import random
+import struct
+import tempfile
+import time
+import zlib
+from array import array
+
+ENTRY = struct.Struct("<IIdiBBH")
+HEAD = struct.Struct("<diBBH")      # ENTRY after len and crc
+IDX = struct.Struct("<dIII")
+SEGMENT_SIZE = 64 << 20
+FLUSH_BYTES = 64 << 10      # buffered appends are written past this size...
+FLUSH_INTERVAL = 0.5        # ...or this many seconds after the previous write
+
+KIND_TEXT, KIND_RECORDS = 0, 1
+
+
+def key_hash(s):
+    return zlib.crc32(s.encode())
+
+
+def command_name(line):
+    return line.split(maxsplit=1)[0] if line.strip() else ""
+
+
+class Entry:
+    __slots__ = ("ts", "code", "kind", "agent", "line", "payload")
+
+    def __init__(self, ts, code, kind, agent, line, payload):
+        self.ts, self.code, self.kind = ts, code, kind
+        self.agent, self.line, self.payload = agent, line, payload
+
+
+class Postings:
+    """Time-sorted references (segment, offset) for one key."""
+    __slots__ = ("ts", "refs")
+
+    def __init__(self):
+        self.ts = array("d")
+        self.refs = []
+
+    def add(self, ts, ref):
+        if not self.ts or ts >= self.ts[-1]:
+            self.ts.append(ts)
+            self.refs.append(ref)
+        else:   # clock went back, keep the list sorted
+            i = bisect.bisect_right(self.ts, ts)
+            self.ts.insert(i, ts)
+            self.refs.insert(i, ref)
+
+    def range(self, since, until):
+        lo = bisect.bisect_left(self.ts, since) if since is not None else 0
+        hi = bisect.bisect_right(self.ts, until) if until is not None else len(self.ts)
+        return self.refs[lo:hi]
+
+
+class ResultStore:
+    def __init__(self, path):
+        self.path = path
+        os.makedirs(path, exist_ok=True)
+        self.by_agent = {}      # agent hash -> Postings
+        self.by_command = {}    # command hash -> Postings
+        self.all = Postings()
+        self.maps = {}          # segment -> (mmap, mapped size)
+        self.entries = 0
+        self.seg_buf = bytearray()
+        self.idx_buf = bytearray()
+        self.last_flush = time.monotonic()
+        segs = sorted(int(f[4:10]) for f in os.listdir(path) if f.startswith("seg-") and f.endswith(".log"))
+        for seg in segs:
+            self._load_index(seg, recover=(seg == segs[-1]))
+        self.seg = segs[-1] if segs else 1
+        self.seg_fd = os.open(self._file(self.seg, "log"), os.O_WRONLY | os.O_CREAT | os.O_APPEND, 0o644)
+        self.idx_fd = os.open(self._file(self.seg, "idx"), os.O_WRONLY | os.O_CREAT | os.O_APPEND, 0o644)
+        self.seg_size = os.fstat(self.seg_fd).st_size
+
+    def _file(self, seg, ext):
+        return os.path.join(self.path, f"seg-{seg:06d}.{ext}")
+
+    def _index(self, seg, ts, off, agent_h, cmd_h):
+        ref = (seg, off)
+        self.by_agent.setdefault(agent_h, Postings()).add(ts, ref)
+        self.by_command.setdefault(cmd_h, Postings()).add(ts, ref)
+        self.all.add(ts, ref)
+        self.entries += 1
+
+    def _load_index(self, seg, recover):
+        idx_path, log_path = self._file(seg, "idx"), self._file(seg, "log")
+        data = b""
+        if os.path.exists(idx_path):
+            with open(idx_path, "rb") as f:
+                data = f.read()
+        idx = list(IDX.iter_unpack(data[:len(data) - len(data) % IDX.size]))
+        end = 0
+        if recover:
+            # Last segment: after a crash the index may point past a torn
+            # entry or lag behind the log, drop the former, index the latter
+            log_size = os.path.getsize(log_path)
+            while idx:
+                off = idx[-1][1]
+                hdr = self._read_raw(seg, off, ENTRY.size)
+                if len(hdr) == ENTRY.size and off + ENTRY.unpack(hdr)[0] <= log_size:
+                    end = off + ENTRY.unpack(hdr)[0]
+                    break
+                idx.pop()
+        for ts, off, agent_h, cmd_h in idx:
+            self._index(seg, ts, off, agent_h, cmd_h)
+        if not recover:
+            return
+        missing = bytearray()
+        while end + ENTRY.size <= log_size:
+            hdr = self._read_raw(seg, end, ENTRY.size)
+            length, crc, ts, _, _, alen, llen = ENTRY.unpack(hdr)
+            body = self._read_raw(seg, end + 8, length - 8)
+            if length < ENTRY.size or len(body) != length - 8 or zlib.crc32(body) != crc:
+                break
+            rest = body[HEAD.size:]
+            agent_h = key_hash(rest[:alen].decode(errors="replace"))
+            cmd_h = key_hash(command_name(rest[alen:alen + llen].decode(errors="replace")))
+            self._index(seg, ts, end, agent_h, cmd_h)
+            missing += IDX.pack(ts, end, agent_h, cmd_h)
+            end += length
+        if end < log_size:
+            os.truncate(log_path, end)
+        with open(idx_path, "wb") as f:
+            f.write(b"".join(IDX.pack(*e) for e in idx) + missing)
+
+    def _read_raw(self, seg, off, n):
+        with open(self._file(seg, "log"), "rb") as f:
+            f.seek(off)
+            return f.read(n)
+
+    def append(self, agent, line, kind, payload, code=0, ts=None):
+        ts = time.time() if ts is None else ts
+        a, ln = agent.encode()[:255], line.encode()[:0xFFFF]
+        length = ENTRY.size + len(a) + len(ln) + len(payload)
+        if self.seg_size + len(self.seg_buf) + length > SEGMENT_SIZE and self.seg_size + len(self.seg_buf) > 0:
+            self._roll()
+        body = HEAD.pack(ts, -1 if code is None else code, kind, len(a), len(ln)) + a + ln + payload
+        off = self.seg_size + len(self.seg_buf)
+        self.seg_buf += struct.pack("<II", length, zlib.crc32(body)) + body
+        agent_h, cmd_h = key_hash(a.decode(errors="replace")), key_hash(command_name(ln.decode(errors="replace")))
+        self.idx_buf += IDX.pack(ts, off, agent_h, cmd_h)
+        self._index(self.seg, ts, off, agent_h, cmd_h)
+        if len(self.seg_buf) >= FLUSH_BYTES or time.monotonic() - self.last_flush >= FLUSH_INTERVAL:
+            self.flush()
+
+    def flush(self):
+        """Write buffered entries, the log before its index."""
+        if self.seg_buf:
+            os.write(self.seg_fd, self.seg_buf)
+            os.write(self.idx_fd, self.idx_buf)
+            self.seg_size += len(self.seg_buf)
+            self.seg_buf.clear()
+            self.idx_buf.clear()
+        self.last_flush = time.monotonic()
+
+    def _roll(self):
+        self.flush()
+        os.close(self.seg_fd)
+        os.close(self.idx_fd)
+        self.seg += 1
+        self.seg_fd = os.open(self._file(self.seg, "log"), os.O_WRONLY | os.O_CREAT | os.O_APPEND, 0o644)
+        self.idx_fd = os.open(self._file(self.seg, "idx"), os.O_WRONLY | os.O_CREAT | os.O_APPEND, 0o644)
+        self.seg_size = 0
+
+    def _map(self, seg, end):
+        """mmap of a segment covering at least end bytes, remapped as the active one grows."""
+        m = self.maps.get(seg)
+        if m is None or m[1] < end:
+            if m:
+                m[0].close()
+            with open(self._file(seg, "log"), "rb") as f:
+                size = os.fstat(f.fileno()).st_size
+                m = (mmap.mmap(f.fileno(), size, access=mmap.ACCESS_READ), size)
+            self.maps[seg] = m
+        return m[0]
+
+    def read(self, seg, off):
+        mm = self._map(seg, off + ENTRY.size)
+        length, _, ts, code, kind, alen, llen = ENTRY.unpack_from(mm, off)
+        mm = self._map(seg, off + length)
+        p = off + ENTRY.size
+        agent = mm[p:p + alen].decode(errors="replace")
+        line = mm[p + alen:p + alen + llen].decode(errors="replace")
+        return Entry(ts, code, kind, agent, line, mm[p + alen + llen:off + length])
+
+    def query(self, agent=None, command=None, since=None, until=None, limit=None):
+        """Entries of agent and/or command (first word of the line) in [since, until], oldest first."""
+        if self.seg_buf:
+            self.flush()
+        lists = []
+        if agent is not None:
+            lists.append(self.by_agent.get(key_hash(agent)))
+        if command is not None:
+            lists.append(self.by_command.get(key_hash(command)))
+        if None in lists:
+            return
+        postings = min(lists, key=lambda p: len(p.ts)) if lists else self.all
+        n = 0
+        for seg, off in postings.range(since, until):
+            entry = self.read(seg, off)
+            if agent is not None and entry.agent != agent:
+                continue
+            if command is not None and command_name(entry.line) != command:
+                continue
+            yield entry
+            n += 1
+            if limit is not None and n >= limit:
+                return
+
+    def close(self):
+        self.flush()
+        os.close(self.seg_fd)
+        os.close(self.idx_fd)
+        for mm, _ in self.maps.values():
+            mm.close()
+        self.maps.clear()
+
+
+def bench(path, n_agents, n_entries, n_queries):
+    """Synthetic agents reporting ARP scans over the last 24 h."""
+    rnd = random.Random(1)
+    agents = [f"esp-{i:05d}" for i in range(n_agents)]
+    commands = ["scan-arp", "scan-wifi", "ping 192.168.1.1"]
+
+    def arp_payload():
+        out = bytearray()
+        for _ in range(rnd.randrange(1, 12)):
+            out += b"\x83\x02\x44" + bytes([192, 168, 1, rnd.randrange(256)]) + b"\x46" + rnd.randbytes(6)
+        return bytes(out)
+
+    now = time.time()
+    start = now - 86400
+    payloads = [arp_payload() for _ in range(256)]
+    store = ResultStore(path)
+    t0 = time.perf_counter()
+    size0 = store.seg_size
+    for i in range(n_entries):
+        ts = start + 86400 * i / n_entries
+        store.append(rnd.choice(agents), rnd.choice(commands), KIND_RECORDS, payloads[i & 255], ts=ts)
+    store.flush()
+    dt = time.perf_counter() - t0
+    mb = (store.seg_size - size0 + (store.seg - 1) * SEGMENT_SIZE) / 1e6
+    print(f"ingest: {n_entries} entries in {dt:.2f} s, {n_entries / dt:.0f} entries/s, {mb / dt:.1f} MB/s")
+    store.close()
+
+    t0 = time.perf_counter()
+    store = ResultStore(path)
+    print(f"open: {store.entries} entries indexed in {(time.perf_counter() - t0) * 1000:.0f} ms")
+
+    def timed(label, fn):
+        lat, hits = [], 0
+        for _ in range(n_queries):
+            t = time.perf_counter()
+            hits += fn()
+            lat.append((time.perf_counter() - t) * 1000)
+        lat.sort()
+        print(f"{label}: p50 {lat[len(lat) // 2]:.3f} ms  p99 {lat[int(len(lat) * 0.99)]:.3f} ms"
+              f"  ({hits / n_queries:.1f} entries)")
+
+    timed("agent+command, last hour",
+          lambda: sum(1 for _ in store.query(rnd.choice(agents), "scan-arp", since=now - 3600)))
+    timed("agent, all time", lambda: sum(1 for _ in store.query(rnd.choice(agents))))
+    timed("everything, last minute", lambda: sum(1 for _ in store.query(since=now - 60)))
+    store.close()
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="cmd", required=True)
+    b = sub.add_parser("bench", help="ingest and query benchmark with synthetic agents")
+    b.add_argument("--dir", help="store directory (default: temporary)")
+    b.add_argument("--agents", type=int, default=1000)
+    b.add_argument("--entries", type=int, default=200000)
+    b.add_argument("--queries", type=int, default=1000)
+    args = parser.parse_args()
+    if args.dir:
+        bench(args.dir, args.agents, args.entries, args.queries)
+    else:
+        with tempfile.TemporaryDirectory() as d:
+            bench(d, args.agents, args.entries, args.queries)
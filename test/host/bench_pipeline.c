@@ -0,0 +1,214 @@
+/*
+    Frames/s of the sniffer pipeline, worker pinned and unpinned.
+
+    The same shape as sniffer_wifi: a capture thread (the promiscuous
+    callback) copies each frame into a queue of CONFIG_SNIFF_QUEUE_LEN and
+    drops it when the queue is full; a worker takes them out and prints
+    them with wifi_out_mgmt(), to /dev/null. The capture thread also burns
+    a fixed time per frame, the driver's share of the work. Pinned: the
+    capture on CPU 0 and the worker on CPU 1, like pipeline.h on the
+    ESP32; unpinned: the host scheduler places both. With a single CPU the
+    pinned run is skipped, there is nothing to compare.
+
+    A model of the pipeline, not a measurement of it: it does not run
+    sniff_wifi.c, the driver or FreeRTOS, and has no ARP or ping side. It
+    shows the output code's cost per frame on the host and whether the
+    queue keeps up. The ESP32 figures, pinned and unpinned with `affinity
+    on|off` (README, Core affinity), are still to be measured. Pass: every
+    frame captured is either processed or counted as dropped.
+        bench_pipeline [seconds per run]
+*/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "wifi_out.h"
+#include "test.h"
+
+#define QUEUE_LEN       CONFIG_SNIFF_QUEUE_LEN
+#define FRAME_BYTES     96              // SNIFF_FRAME_BYTES
+#define DRIVER_NS       2000            // capture side work per frame
+#define STOP            0xFF
+
+typedef struct {                        // sniff_frame_t
+    uint8_t type;
+    int8_t rssi;
+    uint8_t channel;
+    uint16_t length;
+    uint8_t payload[FRAME_BYTES];
+} frame_t;
+
+typedef struct {
+    bool pinned;
+    double seconds;
+    uint64_t captured;
+    uint64_t processed;
+    uint64_t dropped;
+    uint32_t max_depth;
+} run_t;
+
+static frame_t s_queue[QUEUE_LEN];
+static uint32_t s_head, s_count;
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_ready = PTHREAD_COND_INITIALIZER;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void pin(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// xQueueSend(queue, frame, 0): false when full
+static bool queue_send(const frame_t *f, bool wait)
+{
+    pthread_mutex_lock(&s_lock);
+    while (wait && s_count == QUEUE_LEN) {
+        pthread_mutex_unlock(&s_lock);
+        sched_yield();
+        pthread_mutex_lock(&s_lock);
+    }
+    bool sent = s_count < QUEUE_LEN;
+    if (sent) {
+        s_queue[(s_head + s_count++) % QUEUE_LEN] = *f;
+        pthread_cond_signal(&s_ready);
+    }
+    pthread_mutex_unlock(&s_lock);
+    return sent;
+}
+
+static uint32_t queue_receive(frame_t *f)
+{
+    pthread_mutex_lock(&s_lock);
+    while (s_count == 0) {
+        pthread_cond_wait(&s_ready, &s_lock);
+    }
+    uint32_t depth = s_count;
+    *f = s_queue[s_head];
+    s_head = (s_head + 1) % QUEUE_LEN;
+    s_count--;
+    pthread_mutex_unlock(&s_lock);
+    return depth;
+}
+
+// Beacon of one of 16 APs: header, fixed fields, SSID element
+static uint16_t beacon(uint8_t *f, unsigned n)
+{
+    static const uint8_t broadcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    const uint8_t bssid[6] = { 0x24, 0x4b, 0xfe, 0x10, 0x20, (uint8_t)(n % 16) };
+    char ssid[16];
+    int len = snprintf(ssid, sizeof(ssid), "bench-%u", n % 16);
+    memset(f, 0, FRAME_BYTES);
+    f[0] = 0x08 << 4;
+    memcpy(f + 4, broadcast, 6);
+    memcpy(f + 10, bssid, 6);
+    memcpy(f + 16, bssid, 6);
+    f[32] = 0x64;
+    f[34] = 0x31;
+    f[37] = len;
+    memcpy(f + 38, ssid, len);
+    return 38 + len;
+}
+
+static void *worker(void *arg)
+{
+    run_t *r = arg;
+    if (r->pinned) {
+        pin(1);
+    }
+    frame_t f;
+    for (;;) {
+        uint32_t depth = queue_receive(&f);
+        if (f.type == STOP) {
+            break;
+        }
+        if (depth > r->max_depth) {
+            r->max_depth = depth;
+        }
+        wifi_out_mgmt(NULL, f.payload, f.length, f.rssi, f.channel);
+        r->processed++;
+    }
+    return NULL;
+}
+
+static void run(run_t *r)
+{
+    FILE *console = stdout;
+    stdout = fopen("/dev/null", "w");
+    s_head = s_count = 0;
+    if (r->pinned) {
+        pin(0);
+    }
+    pthread_t w;
+    pthread_create(&w, NULL, worker, r);
+
+    uint64_t start = now_ns(), end = start + (uint64_t)(r->seconds * 1e9);
+    frame_t f = { .type = 0, .rssi = -50, .channel = 6 };
+    for (unsigned n = 0; now_ns() < end; n++) {
+        for (uint64_t t = now_ns(); now_ns() - t < DRIVER_NS;) {
+        }
+        f.length = beacon(f.payload, n);
+        r->captured++;
+        if (!queue_send(&f, false)) {
+            r->dropped++;
+        }
+    }
+    const frame_t stop = { .type = STOP };
+    queue_send(&stop, true);
+    pthread_join(w, NULL);
+    r->seconds = (now_ns() - start) / 1e9;
+
+    fclose(stdout);
+    stdout = console;
+    if (r->pinned) {
+        cpu_set_t all;
+        CPU_ZERO(&all);
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            CPU_SET(i, &all);
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(all), &all);
+    }
+}
+
+static void report(const run_t *r)
+{
+    printf("%-9s %8.0f frames/s captured %8.0f frames/s processed  %llu dropped (%.1f%%)  queue peak %u/%d\n",
+           r->pinned ? "pinned" : "unpinned", r->captured / r->seconds, r->processed / r->seconds,
+           (unsigned long long)r->dropped, r->captured ? 100.0 * r->dropped / r->captured : 0.0,
+           r->max_depth, QUEUE_LEN);
+    CHECK(r->processed > 0);
+    CHECK_EQ(r->processed + r->dropped, r->captured);
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    cpu_set_t cpus;
+    sched_getaffinity(0, sizeof(cpus), &cpus);
+    int ncpu = CPU_COUNT(&cpus);
+    printf("%d CPU, queue %d, %d ns capture work per frame, %.1f s per run\n", ncpu, QUEUE_LEN, DRIVER_NS, seconds);
+
+    run_t unpinned = { .pinned = false, .seconds = seconds };
+    run(&unpinned);
+    report(&unpinned);
+
+    if (ncpu >= 2 && CPU_ISSET(0, &cpus) && CPU_ISSET(1, &cpus)) {
+        run_t pinned = { .pinned = true, .seconds = seconds };
+        run(&pinned);
+        report(&pinned);
+    } else {
+        printf("pinned    n/a, needs CPUs 0 and 1\n");
+    }
+    return TEST_DONE();
+}
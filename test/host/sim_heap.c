@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim_heap.h"
+
+#define HDR     8
+#define ALIGN   8
+
+// Header in front of every block, blocks tile the region in address order
+typedef struct {
+    uint32_t size;              // whole block, header included
+    uint32_t free;
+} block_t;
+
+static uint8_t *s_mem;
+static size_t s_size;
+
+static block_t *next_of(block_t *b)
+{
+    uint8_t *n = (uint8_t *)b + b->size;
+    return n < s_mem + s_size ? (block_t *)n : NULL;
+}
+
+void sim_heap_init(size_t size)
+{
+    free(s_mem);
+    s_size = size & ~(size_t)(ALIGN - 1);
+    s_mem = aligned_alloc(ALIGN, s_size);
+    block_t *b = (block_t *)s_mem;
+    b->size = s_size;
+    b->free = 1;
+}
+
+void *sim_malloc(size_t size)
+{
+    size_t need = HDR + ((size + ALIGN - 1) & ~(size_t)(ALIGN - 1));
+    block_t *best = NULL;
+    for (block_t *b = (block_t *)s_mem; b; b = next_of(b)) {
+        if (b->free && b->size >= need && (best == NULL || b->size < best->size)) {
+            best = b;
+        }
+    }
+    if (best == NULL) {
+        return NULL;
+    }
+    if (best->size - need >= HDR + ALIGN) {
+        block_t *rest = (block_t *)((uint8_t *)best + need);
+        rest->size = best->size - need;
+        rest->free = 1;
+        best->size = need;
+    }
+    best->free = 0;
+    return (uint8_t *)best + HDR;
+}
+
+void sim_free(void *p)
+{
+    if (p == NULL) {
+        return;
+    }
+    block_t *b = (block_t *)((uint8_t *)p - HDR);
+    b->free = 1;
+    // Merge with the free blocks on both sides
+    block_t *prev = NULL;
+    for (block_t *c = (block_t *)s_mem; c != b; c = next_of(c)) {
+        prev = c;
+    }
+    block_t *n = next_of(b);
+    if (n && n->free) {
+        b->size += n->size;
+    }
+    if (prev && prev->free) {
+        prev->size += b->size;
+    }
+}
+
+void *sim_realloc(void *p, size_t size)
+{
+    if (p == NULL) {
+        return sim_malloc(size);
+    }
+    block_t *b = (block_t *)((uint8_t *)p - HDR);
+    void *n = sim_malloc(size);
+    if (n) {
+        size_t old = b->size - HDR;
+        memcpy(n, p, old < size ? old : size);
+        sim_free(p);
+    }
+    return n;
+}
+
+size_t sim_heap_free(void)
+{
+    size_t total = 0;
+    for (block_t *b = (block_t *)s_mem; b; b = next_of(b)) {
+        total += b->free ? b->size - HDR : 0;
+    }
+    return total;
+}
+
+size_t sim_heap_largest_free(void)
+{
+    size_t largest = 0;
+    for (block_t *b = (block_t *)s_mem; b; b = next_of(b)) {
+        if (b->free && b->size - HDR > largest) {
+            largest = b->size - HDR;
+        }
+    }
+    return largest;
+}
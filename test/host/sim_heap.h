@@ -0,0 +1,20 @@
+/*
+    Simulated heap for the arena soak test.
+
+    A fixed region with an 8-byte header per block, best fit (close to the
+    TLSF allocator of ESP-IDF), split on allocation, merged with free
+    neighbours on release. The arena is built with malloc, realloc and free
+    pointing here, so both its spills and the commands' own heap blocks
+    land in the region whose fragmentation is measured.
+*/
+#pragma once
+
+#include <stddef.h>
+
+void sim_heap_init(size_t size);
+void *sim_malloc(size_t size);
+void *sim_realloc(void *p, size_t size);
+void sim_free(void *p);
+
+size_t sim_heap_free(void);
+size_t sim_heap_largest_free(void);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct esp_netif_obj esp_netif_t;
+
+typedef struct {
+    uint32_t addr;                  // network byte order
+} esp_ip4_addr_t;
+
+typedef struct {
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+#define esp_ip4_addr1(ipaddr) (((uint8_t *)(ipaddr))[0])
+#define esp_ip4_addr2(ipaddr) (((uint8_t *)(ipaddr))[1])
+#define esp_ip4_addr3(ipaddr) (((uint8_t *)(ipaddr))[2])
+#define esp_ip4_addr4(ipaddr) (((uint8_t *)(ipaddr))[3])
+#define IP2STR(ipaddr) esp_ip4_addr1(ipaddr), esp_ip4_addr2(ipaddr), esp_ip4_addr3(ipaddr), esp_ip4_addr4(ipaddr)
+#define IPSTR "%d.%d.%d.%d"
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+
+// One task on the host
+static inline TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    static int task;
+    return &task;
+}
@@ -0,0 +1,2 @@
+/* The CONFIG_ values a host test needs come from its compile definitions (CMakeLists.txt) */
+#pragma once
@@ -0,0 +1,23 @@
+/* Minimal checks for the host tests: report every failure, exit status = failures */
+#pragma once
+
+#include <stdio.h>
+
+static int s_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            s_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) do { \
+        long long _a = (long long)(a), _b = (long long)(b); \
+        if (_a != _b) { \
+            printf("%s:%d: CHECK_EQ failed: %s == %lld, expected %lld\n", __FILE__, __LINE__, #a, _a, _b); \
+            s_failures++; \
+        } \
+    } while (0)
+
+#define TEST_DONE() (printf("%s\n", s_failures ? "FAILED" : "OK"), s_failures != 0)
@@ -0,0 +1,276 @@
+/*
+    AP table of scan-wifi -w: add, change, remove, aging in rounds and
+    eviction, on a fake clock. Every event is recorded and checked in order.
+*/
+#include <string.h>
+#include "ap_table.h"
+#include "test.h"
+
+#define MAX_EVENTS 16
+
+typedef struct {
+    ap_event_t ev[MAX_EVENTS];
+    uint8_t bssid[MAX_EVENTS][6];       // the entry may be reused once the callback returns
+    uint8_t twin[MAX_EVENTS][6];
+    int count;
+} events_t;
+
+static void record(const ap_event_t *ev, void *ctx)
+{
+    events_t *e = ctx;
+    if (e->count < MAX_EVENTS) {
+        e->ev[e->count] = *ev;
+        memcpy(e->bssid[e->count], ev->ap->bssid, 6);
+        if (ev->twin) {
+            memcpy(e->twin[e->count], ev->twin->bssid, 6);
+        }
+    }
+    e->count++;
+}
+
+static const uint8_t A[6] = { 0x24, 0x4b, 0xfe, 0, 0, 1 };
+static const uint8_t B[6] = { 0x24, 0x4b, 0xfe, 0, 0, 2 };
+static const uint8_t C[6] = { 0x24, 0x4b, 0xfe, 0, 0, 3 };
+static const uint8_t D[6] = { 0x24, 0x4b, 0xfe, 0, 0, 4 };
+
+static void see(ap_table_t *t, const uint8_t *bssid, const char *ssid, uint8_t auth, uint8_t channel, int8_t rssi,
+                uint32_t now)
+{
+    ap_sighting_t s = { .channel = channel, .authmode = auth, .rssi = rssi };
+    memcpy(s.bssid, bssid, 6);
+    strncpy(s.ssid, ssid, AP_TABLE_SSID_LEN);
+    ap_table_update(t, &s, now);
+}
+
+static const ap_entry_t *entry(const ap_table_t *t, const uint8_t *bssid)
+{
+    for (size_t i = 0; i < t->capacity; i++) {
+        if (t->entries[i].used && memcmp(t->entries[i].bssid, bssid, 6) == 0) {
+            return &t->entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void test_add(void)
+{
+    ap_entry_t entries[4];
+    ap_table_t t;
+    events_t ev = { 0 };
+    ap_table_init(&t, entries, 4, 3, record, &ev);
+
+    see(&t, A, "HomeNet", 3, 1, -40, 0);
+    see(&t, B, "Office", 3, 6, -60, 0);
+    CHECK_EQ(t.count, 2);
+    CHECK_EQ(ev.count, 2);
+    CHECK_EQ(ev.ev[0].type, AP_EVENT_APPEARED);
+    CHECK(memcmp(ev.bssid[0], A, 6) == 0);
+    CHECK_EQ(ev.ev[1].type, AP_EVENT_APPEARED);
+    CHECK(memcmp(ev.bssid[1], B, 6) == 0);
+
+    const ap_entry_t *a = entry(&t, A);
+    CHECK(a != NULL);
+    CHECK(strcmp(a->ssid, "HomeNet") == 0);
+    CHECK_EQ(a->rssi_x16, -40 * 16);
+    CHECK_EQ(a->first_seen, 0);
+    CHECK_EQ(a->sightings, 1);
+
+    // Seen again, same channel and auth: no event, counters only
+    see(&t, A, "HomeNet", 3, 1, -40, 5);
+    CHECK_EQ(ev.count, 2);
+    CHECK_EQ(a->sightings, 2);
+    CHECK_EQ(a->last_seen, 5);
+    CHECK_EQ(a->first_seen, 0);
+
+    // Same SSID and auth on another BSSID: a multi-AP network, not a twin
+    see(&t, C, "HomeNet", 3, 11, -70, 5);
+    CHECK_EQ(ev.count, 3);
+    CHECK_EQ(ev.ev[2].type, AP_EVENT_APPEARED);
+}
+
+static void test_change(void)
+{
+    ap_entry_t entries[4];
+    ap_table_t t;
+    events_t ev = { 0 };
+    ap_table_init(&t, entries, 4, 3, record, &ev);
+
+    see(&t, A, "HomeNet", 3, 1, -40, 0);
+    ev.count = 0;
+
+    // RSSI: EWMA, a quarter of the difference per sighting
+    see(&t, A, "HomeNet", 3, 1, -80, 1);
+    const ap_entry_t *a = entry(&t, A);
+    CHECK_EQ(a->rssi_x16, -40 * 16 + (-80 * 16 - -40 * 16) / 4);
+    CHECK_EQ(ev.count, 0);
+
+    // Channel
+    see(&t, A, "HomeNet", 3, 11, -40, 2);
+    CHECK_EQ(ev.count, 1);
+    CHECK_EQ(ev.ev[0].type, AP_EVENT_CHANNEL);
+    CHECK_EQ(ev.ev[0].prev_channel, 1);
+    CHECK_EQ(a->channel, 11);
+    CHECK_EQ(a->channel_changes, 1);
+
+    // Same BSSID, security downgraded: rogue twin of its own previous state
+    see(&t, A, "HomeNet", 0, 11, -40, 3);
+    CHECK_EQ(ev.count, 2);
+    CHECK_EQ(ev.ev[1].type, AP_EVENT_ROGUE_TWIN);
+    CHECK(memcmp(ev.twin[1], A, 6) == 0);
+    CHECK_EQ(a->authmode, 0);
+    CHECK_EQ(a->auth_changes, 1);
+
+    // Another BSSID copying the SSID with another auth: appeared, then rogue twin
+    see(&t, B, "HomeNet", 3, 6, -30, 4);
+    CHECK_EQ(ev.count, 4);
+    CHECK_EQ(ev.ev[2].type, AP_EVENT_APPEARED);
+    CHECK_EQ(ev.ev[3].type, AP_EVENT_ROGUE_TWIN);
+    CHECK(memcmp(ev.bssid[3], B, 6) == 0);
+    CHECK(memcmp(ev.twin[3], A, 6) == 0);
+
+    // Hidden AP named by a directed probe: the name is kept, no twin check on hidden ones
+    see(&t, C, "", 3, 1, -50, 5);
+    CHECK_EQ(ev.count, 5);
+    see(&t, C, "Lab", 3, 1, -50, 6);
+    CHECK(strcmp(entry(&t, C)->ssid, "Lab") == 0);
+    CHECK_EQ(ev.count, 5);
+}
+
+static void test_remove_and_aging(void)
+{
+    ap_entry_t entries[4];
+    ap_table_t t;
+    events_t ev = { 0 };
+    ap_table_init(&t, entries, 4, 3, record, &ev);
+
+    // Round 0: both seen
+    see(&t, A, "HomeNet", 3, 1, -40, 0);
+    see(&t, B, "Office", 3, 6, -60, 0);
+    ap_table_expire(&t);
+    ev.count = 0;
+
+    // Rounds 1 and 2: only A, B missed twice is not lost yet
+    for (uint32_t now = 10; now <= 20; now += 10) {
+        see(&t, A, "HomeNet", 3, 1, -40, now);
+        ap_table_expire(&t);
+    }
+    CHECK_EQ(ev.count, 0);
+    CHECK_EQ(t.count, 2);
+
+    // Round 3: B missed three rounds in a row, disappeared, not evicted, slot free again
+    see(&t, A, "HomeNet", 3, 1, -40, 30);
+    ap_table_expire(&t);
+    CHECK_EQ(ev.count, 1);
+    CHECK_EQ(ev.ev[0].type, AP_EVENT_DISAPPEARED);
+    CHECK(!ev.ev[0].evicted);
+    CHECK(memcmp(ev.bssid[0], B, 6) == 0);
+    CHECK_EQ(t.count, 1);
+    CHECK(entry(&t, B) == NULL);
+    CHECK(entry(&t, A) != NULL);
+
+    // Coming back is a new appearance, with fresh counters
+    see(&t, B, "Office", 3, 6, -60, 41);
+    CHECK_EQ(ev.count, 2);
+    CHECK_EQ(ev.ev[1].type, AP_EVENT_APPEARED);
+    CHECK_EQ(entry(&t, B)->first_seen, 41);
+    CHECK_EQ(entry(&t, B)->sightings, 1);
+
+    // Everything lost: 3 empty rounds after round 4
+    for (int i = 0; i < 4; i++) {
+        ap_table_expire(&t);
+    }
+    CHECK_EQ(t.count, 0);
+    CHECK_EQ(ev.count, 4);
+    CHECK_EQ(t.evicted, 0);
+}
+
+// scan-wifi -w 1 with a passive scan: a round takes ~6 s, far more than the
+// period. The loss still needs three missed rounds, whatever they last.
+static void test_long_rounds(void)
+{
+    ap_entry_t entries[4];
+    ap_table_t t;
+    events_t ev = { 0 };
+    ap_table_init(&t, entries, 4, 3, record, &ev);
+
+    uint32_t now = 0;
+    see(&t, A, "HomeNet", 3, 1, -40, now);
+    see(&t, B, "Office", 3, 6, -60, now);
+    ap_table_expire(&t);
+    ev.count = 0;
+
+    // Two rounds of 1 s period + 5 s of scan without B: 12 s, not lost
+    for (int i = 0; i < 2; i++) {
+        now += 6;
+        see(&t, A, "HomeNet", 3, 1, -40, now);
+        ap_table_expire(&t);
+    }
+    CHECK_EQ(ev.count, 0);
+    CHECK(entry(&t, B) != NULL);
+
+    // B seen again: its count of missed rounds starts over
+    now += 6;
+    see(&t, A, "HomeNet", 3, 1, -40, now);
+    see(&t, B, "Office", 3, 6, -60, now);
+    ap_table_expire(&t);
+    for (int i = 0; i < 2; i++) {
+        now += 6;
+        ap_table_expire(&t);
+    }
+    CHECK_EQ(ev.count, 0);
+    CHECK_EQ(t.count, 2);
+
+    // Third missed round in a row, 18 s later: both gone
+    now += 6;
+    ap_table_expire(&t);
+    CHECK_EQ(ev.count, 2);
+    CHECK_EQ(ev.ev[0].type, AP_EVENT_DISAPPEARED);
+    CHECK_EQ(ev.ev[1].type, AP_EVENT_DISAPPEARED);
+    CHECK_EQ(t.count, 0);
+}
+
+static void test_eviction(void)
+{
+    ap_entry_t entries[3];
+    ap_table_t t;
+    events_t ev = { 0 };
+    ap_table_init(&t, entries, 3, 3, record, &ev);
+
+    see(&t, A, "a", 3, 1, -40, 0);
+    see(&t, B, "b", 3, 1, -40, 1);
+    see(&t, C, "c", 3, 1, -40, 2);
+    see(&t, A, "a", 3, 1, -40, 3);      // B is now the one seen the longest ago
+    ev.count = 0;
+
+    // Full: B is reported gone (evicted) before D takes its slot
+    see(&t, D, "d", 3, 1, -40, 4);
+    CHECK_EQ(ev.count, 2);
+    CHECK_EQ(ev.ev[0].type, AP_EVENT_DISAPPEARED);
+    CHECK(ev.ev[0].evicted);
+    CHECK(memcmp(ev.bssid[0], B, 6) == 0);
+    CHECK_EQ(ev.ev[1].type, AP_EVENT_APPEARED);
+    CHECK(memcmp(ev.bssid[1], D, 6) == 0);
+    CHECK_EQ(t.count, 3);
+    CHECK_EQ(t.evicted, 1);
+    CHECK(entry(&t, B) == NULL);
+
+    // Capacity 0: sightings are dropped without events
+    ap_table_t none;
+    events_t ev0 = { 0 };
+    ap_table_init(&none, entries, 0, 3, record, &ev0);
+    see(&none, A, "a", 3, 1, -40, 0);
+    CHECK_EQ(ev0.count, 0);
+    CHECK_EQ(none.count, 0);
+}
+
+int main(void)
+{
+    test_add();
+    test_change();
+    test_remove_and_aging();
+    test_long_rounds();
+    test_eviction();
+    CHECK(strcmp(ap_event_name(AP_EVENT_ROGUE_TWIN), "rogue_twin") == 0);
+    CHECK(strcmp(ap_event_name(99), "?") == 0);
+    return TEST_DONE();
+}
@@ -0,0 +1,215 @@
+/*
+    Arena soak: 10k commands on a simulated ESP32 heap, with and without
+    the command arena, and the fragmentation each leaves.
+
+    The command mix and buffer sizes are the ones of the components
+    (scan-wifi, scan-wifi -w, scan-arp, sniffer_wifi, proxy, small
+    commands). While a command runs, other code keeps heap blocks that
+    outlive it (history, sockets, jobs, pooled connections): that is what
+    leaves holes when the command's own buffers are freed. Both runs use
+    the same random sequence. The arena run has a heap smaller by the
+    arena's static memory (CONFIG_ARENA_COUNT x CONFIG_ARENA_SIZE), which
+    comes out of the same internal RAM.
+
+    Run on a comfortable heap (128 KB free) and a tight one (32 KB). Pass:
+    with the arena, fewer free bytes are stranded in holes (free minus
+    largest free block) on both, and fewer allocations fail on the tight
+    one. The largest free block itself is printed, not checked: the arena
+    memory is taken from the heap up front, see the ARENA_COUNT help.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "arena.h"
+#include "sim_heap.h"
+#include "test.h"
+
+#define COMMANDS        10000
+#define HEAP_ROOMY      (128 * 1024)    // free internal heap of an ESP32 with Wi-Fi and lwIP up, no PSRAM
+#define HEAP_TIGHT      (32 * 1024)     // a loaded device, little heap left
+#define KEEP_MAX        256
+#define SAMPLE_EVERY    1000
+
+// Scratch sizes of the commands (see the arena_alloc callers)
+#define AP_RECORD       80              // wifi_ap_record_t
+#define AP_ENTRY        60              // ap_entry_t
+#define ARP_DEVICE      12              // deviceInfo
+#define SNIFF_FRAME     104             // sniff_frame_t
+#define PROXY_PAYLOAD   4096
+#define PROXY_RX        1460
+#define PROXY_SINK      4120            // proxy_sink_t on the ESP32 (32-bit)
+
+typedef struct {
+    void *p;
+    uint32_t until;                     // command index it is released at
+} keep_t;
+
+typedef struct {
+    size_t heap;
+    size_t min_largest;
+    size_t final_largest;
+    size_t final_free;
+    uint64_t stranded_sum;              // free - largest, after every command
+    uint32_t failures;
+    size_t samples[COMMANDS / SAMPLE_EVERY];
+} soak_t;
+
+static uint32_t s_rand;
+static keep_t s_keep[KEEP_MAX];
+
+static uint32_t rnd(uint32_t n)
+{
+    s_rand ^= s_rand << 13;
+    s_rand ^= s_rand >> 17;
+    s_rand ^= s_rand << 5;
+    return s_rand % n;
+}
+
+// Some other module takes a heap block for a while, in the middle of the command
+static void maybe_keep(uint32_t now, soak_t *r)
+{
+    if (rnd(4) != 0) {
+        return;
+    }
+    for (int i = 0; i < KEEP_MAX; i++) {
+        if (s_keep[i].p == NULL) {
+            s_keep[i].p = sim_malloc(48 + rnd(464));
+            s_keep[i].until = now + 20 + rnd(380);
+            r->failures += s_keep[i].p == NULL;
+            return;
+        }
+    }
+}
+
+static void release_kept(uint32_t now)
+{
+    for (int i = 0; i < KEEP_MAX; i++) {
+        if (s_keep[i].p && s_keep[i].until <= now) {
+            sim_free(s_keep[i].p);
+            s_keep[i].p = NULL;
+        }
+    }
+}
+
+static void *take(size_t size, soak_t *r)
+{
+    void *p = arena_alloc(size);
+    r->failures += p == NULL;
+    return p;
+}
+
+// One command: its scratch buffers, a kept block in between, everything released at the end
+static void command(uint32_t now, soak_t *r)
+{
+    void *b[3] = { NULL };
+    uint32_t kind = rnd(100);
+    if (kind < 30) {                    // scan-wifi: 20 records, grown when more APs answer
+        b[0] = arena_calloc(20, AP_RECORD);
+        r->failures += b[0] == NULL;
+        maybe_keep(now, r);
+        if (b[0] && rnd(2)) {
+            void *grown = arena_realloc(b[0], (20 + rnd(20)) * AP_RECORD);
+            r->failures += grown == NULL;
+            b[0] = grown ? grown : b[0];
+        }
+    } else if (kind < 35) {             // scan-wifi -w
+        b[0] = arena_calloc(64, AP_ENTRY);
+        r->failures += b[0] == NULL;
+        maybe_keep(now, r);
+    } else if (kind < 45) {             // scan-arp on a /24
+        b[0] = arena_calloc(254, ARP_DEVICE);
+        r->failures += b[0] == NULL;
+        maybe_keep(now, r);
+    } else if (kind < 55) {             // sniffer_wifi frame queue
+        b[0] = take(32 * SNIFF_FRAME, r);
+        maybe_keep(now, r);
+    } else if (kind < 70) {             // proxy
+        b[0] = take(PROXY_PAYLOAD, r);
+        b[1] = take(PROXY_RX, r);
+        maybe_keep(now, r);
+        b[2] = take(PROXY_SINK, r);
+    } else {                            // small commands
+        b[0] = take(64 + rnd(448), r);
+        maybe_keep(now, r);
+    }
+    for (int i = 2; i >= 0; i--) {
+        arena_free(b[i]);
+    }
+}
+
+static void soak(bool with_arena, size_t heap, soak_t *r)
+{
+    memset(r, 0, sizeof(*r));
+    memset(s_keep, 0, sizeof(s_keep));
+    s_rand = 0x2545F491;
+    // The arena's static memory is internal RAM the heap no longer has
+    r->heap = with_arena ? heap - CONFIG_ARENA_COUNT * CONFIG_ARENA_SIZE : heap;
+    sim_heap_init(r->heap);
+    r->min_largest = sim_heap_largest_free();
+
+    for (uint32_t now = 0; now < COMMANDS; now++) {
+        arena_scope_t scope;
+        if (with_arena) {
+            arena_enter(&scope);
+        }
+        command(now, r);
+        if (with_arena) {
+            arena_leave(&scope);
+        }
+        release_kept(now);
+        size_t largest = sim_heap_largest_free();
+        r->stranded_sum += sim_heap_free() - largest;
+        if (largest < r->min_largest) {
+            r->min_largest = largest;
+        }
+        if (now % SAMPLE_EVERY == SAMPLE_EVERY - 1) {
+            r->samples[now / SAMPLE_EVERY] = largest;
+        }
+    }
+    r->final_largest = sim_heap_largest_free();
+    r->final_free = sim_heap_free();
+    for (int i = 0; i < KEEP_MAX; i++) {
+        sim_free(s_keep[i].p);
+        s_keep[i].p = NULL;
+    }
+}
+
+static void report(const char *name, const soak_t *r)
+{
+    printf("%-10s heap %6zu  largest free: min %6zu end %6zu  free at end %6zu  stranded: mean %5zu end %5zu  "
+           "failed allocs %u\n", name, r->heap, r->min_largest, r->final_largest, r->final_free,
+           (size_t)(r->stranded_sum / COMMANDS), r->final_free - r->final_largest, r->failures);
+    printf("%-10s largest free every %d commands:", "", SAMPLE_EVERY);
+    for (int i = 0; i < COMMANDS / SAMPLE_EVERY; i++) {
+        printf(" %zu", r->samples[i]);
+    }
+    printf("\n");
+}
+
+int main(void)
+{
+    static soak_t heap, arena;
+    printf("%d commands, arena %d x %d B\n", COMMANDS, CONFIG_ARENA_COUNT, CONFIG_ARENA_SIZE);
+
+    soak(false, HEAP_ROOMY, &heap);
+    soak(true, HEAP_ROOMY, &arena);
+    report("heap only", &heap);
+    report("arena", &arena);
+    CHECK(arena.stranded_sum < heap.stranded_sum);
+    CHECK(arena.final_free - arena.final_largest < heap.final_free - heap.final_largest);
+    CHECK_EQ(arena.failures, 0);
+
+    soak(false, HEAP_TIGHT, &heap);
+    soak(true, HEAP_TIGHT, &arena);
+    report("heap only", &heap);
+    report("arena", &arena);
+    CHECK(arena.stranded_sum < heap.stranded_sum);
+    CHECK(arena.failures < heap.failures);
+
+    arena_stats_t stats;
+    arena_get_stats(&stats);
+    printf("arena high water %u B, spills %u (%u B)\n", stats.high, stats.spills, stats.spill_bytes);
+    CHECK(stats.high <= CONFIG_ARENA_SIZE);
+    CHECK_EQ(stats.spills, 0);
+    return TEST_DONE();
+}
@@ -0,0 +1,121 @@
+/*
+    Duty-cycle scheduler of the monitor on a simulated clock: which task
+    is due, coalescing, skipped periods, duty cycle and average current.
+*/
+#include "monitor_sched.h"
+#include "test.h"
+
+static void test_add(void)
+{
+    monitor_sched_t s;
+    monitor_sched_init(&s, 0);
+    CHECK_EQ(monitor_sched_add(&s, "zero", 0, 0), -1);
+    for (int i = 0; i < MONITOR_SCHED_MAX_TASKS; i++) {
+        CHECK_EQ(monitor_sched_add(&s, "t", 1000, 0), i);
+    }
+    CHECK_EQ(monitor_sched_add(&s, "full", 1000, 0), -1);
+    CHECK_EQ(s.count, MONITOR_SCHED_MAX_TASKS);
+}
+
+static void test_due(void)
+{
+    monitor_sched_t s;
+    monitor_sched_init(&s, 0);
+    CHECK_EQ(monitor_sched_due(&s, 0), -1);
+    CHECK(monitor_sched_wait_ms(&s, 0) == UINT64_MAX);
+
+    int hb = monitor_sched_add(&s, "heartbeat", 60000, 60000);
+    int scan = monitor_sched_add(&s, "scan", 30000, 20000);
+
+    // Nothing within the window yet
+    CHECK_EQ(monitor_sched_due(&s, 10000), -1);
+    CHECK_EQ(monitor_sched_wait_ms(&s, 10000), 10000);
+
+    // Due within the coalescing window counts as due
+    CHECK_EQ(monitor_sched_due(&s, 20000 - MONITOR_SCHED_COALESCE_MS - 1), -1);
+    CHECK_EQ(monitor_sched_due(&s, 20000 - MONITOR_SCHED_COALESCE_MS), scan);
+    CHECK_EQ(monitor_sched_wait_ms(&s, 25000), 0);
+
+    monitor_sched_done(&s, scan, 20100);
+    CHECK(s.tasks[scan].next_ms == 50000);
+    CHECK_EQ(s.tasks[scan].runs, 1);
+    CHECK_EQ(s.tasks[scan].skipped, 0);
+
+    // Both due: the most overdue first
+    CHECK_EQ(monitor_sched_due(&s, 61000), scan);
+    monitor_sched_done(&s, scan, 61000);        // late by 11 s, still inside its period
+    CHECK(s.tasks[scan].next_ms == 80000);
+    CHECK_EQ(s.tasks[scan].skipped, 0);
+    CHECK_EQ(monitor_sched_due(&s, 61000), hb);
+
+    // Heartbeat at 60 s, scan 1.5 s later: one wake-up runs both
+    monitor_sched_t c;
+    monitor_sched_init(&c, 0);
+    int a = monitor_sched_add(&c, "a", 60000, 60000);
+    int b = monitor_sched_add(&c, "b", 60000, 61500);
+    CHECK_EQ(monitor_sched_due(&c, 60000), a);
+    monitor_sched_done(&c, a, 60050);
+    CHECK_EQ(monitor_sched_due(&c, 60050), b);
+    monitor_sched_done(&c, b, 60100);
+    CHECK_EQ(monitor_sched_due(&c, 60100), -1);
+    CHECK_EQ(monitor_sched_wait_ms(&c, 60100), 60000 - 100);
+}
+
+static void test_skipped(void)
+{
+    monitor_sched_t s;
+    monitor_sched_init(&s, 0);
+    int t = monitor_sched_add(&s, "slow", 1000, 0);
+
+    // Ran 3.5 periods: 1000, 2000 and 3000 are skipped, next on the grid at 4000
+    monitor_sched_done(&s, t, 3500);
+    CHECK(s.tasks[t].next_ms == 4000);
+    CHECK_EQ(s.tasks[t].skipped, 3);
+    CHECK_EQ(s.tasks[t].runs, 1);
+
+    // Finished exactly on the next due time: that period is gone too (next is after now)
+    monitor_sched_done(&s, t, 5000);
+    CHECK(s.tasks[t].next_ms == 6000);
+    CHECK_EQ(s.tasks[t].skipped, 4);
+
+    // On time: nothing skipped
+    monitor_sched_done(&s, t, 6200);
+    CHECK(s.tasks[t].next_ms == 7000);
+    CHECK_EQ(s.tasks[t].skipped, 4);
+    CHECK_EQ(s.tasks[t].runs, 3);
+}
+
+static void test_power(void)
+{
+    // ESP32-ish currents: radio on, modem sleep, light sleep
+    const uint32_t ua[MONITOR_STATE_COUNT] = { 100000, 20000, 800 };
+    monitor_sched_t s;
+    monitor_sched_init(&s, 0);
+
+    // No time elapsed: the current of the state it is in, awake
+    CHECK_EQ(monitor_sched_avg_ua(&s, 0, ua), 20000);
+    CHECK_EQ(monitor_sched_duty_permille(&s, 0), 1000);
+
+    // 1 s idle, 0.5 s active, then light sleep up to 10 s
+    monitor_sched_enter(&s, MONITOR_STATE_ACTIVE, 1000);
+    monitor_sched_enter(&s, MONITOR_STATE_SLEEP, 1500);
+    CHECK_EQ(monitor_sched_duty_permille(&s, 10000), 150);
+    // (500 x 100000 + 1000 x 20000 + 8500 x 800) / 10000
+    CHECK_EQ(monitor_sched_avg_ua(&s, 10000, ua), 7680);
+    // The state in progress counts up to now, without being closed
+    CHECK(s.state_ms[MONITOR_STATE_SLEEP] == 0);
+
+    // A clock behind the state start adds nothing
+    monitor_sched_enter(&s, MONITOR_STATE_IDLE, 1000);
+    CHECK(s.state_ms[MONITOR_STATE_SLEEP] == 0);
+    CHECK_EQ(monitor_sched_duty_permille(&s, 1000), 1000);
+}
+
+int main(void)
+{
+    test_add();
+    test_due();
+    test_skipped();
+    test_power();
+    return TEST_DONE();
+}
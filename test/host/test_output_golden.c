@@ -0,0 +1,322 @@
+/*
+    Golden output of the commands.
+
+    Every command's output functions (wifi_out, arp_out, ping_out,
+    system_out) run on fixed data in the three console modes, as the
+    dispatcher does it: output mode set, result_console_open() around the
+    command, stdout captured. The bytes are compared with
+    golden/<command>.txt, .json and .cbor.hex (CBOR as hex, 32 bytes per
+    line). UPDATE_GOLDEN=1 rewrites the files instead, review the diff.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "result.h"
+#include "ap_table.h"
+#include "wifi_out.h"
+#include "arp_out.h"
+#include "ping_out.h"
+#include "system_out.h"
+#include "test.h"
+
+/* ---- scenarios: what each command prints, with its data ---- */
+
+static const uint8_t AP_HOME[6] = { 0x24, 0x4b, 0xfe, 0x10, 0x20, 0x30 };
+static const uint8_t AP_OFFICE[6] = { 0x9c, 0x53, 0x22, 0x01, 0x02, 0x03 };
+static const uint8_t AP_TWIN[6] = { 0x02, 0x11, 0x22, 0x33, 0x44, 0x55 };
+static const uint8_t AP_GUEST[6] = { 0x24, 0x4b, 0xfe, 0x10, 0x20, 0x31 };
+static const uint8_t PHONE[6] = { 0xa4, 0xc3, 0xf0, 0x85, 0x7e, 0x01 };
+static const uint8_t BROADCAST[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+static wifi_ap_record_t ap_record(const char *ssid, const uint8_t *bssid, int8_t rssi, wifi_auth_mode_t auth,
+                                  uint8_t channel)
+{
+    wifi_ap_record_t ap = { .primary = channel, .rssi = rssi, .authmode = auth };
+    memcpy(ap.bssid, bssid, 6);
+    strncpy((char *)ap.ssid, ssid, sizeof(ap.ssid) - 1);
+    return ap;
+}
+
+static void scan_wifi(result_sink_t *sink)
+{
+    const wifi_ap_record_t ch1[] = {
+        ap_record("HomeNet", AP_HOME, -42, WIFI_AUTH_WPA2_PSK, 1),
+        ap_record("", AP_TWIN, -77, WIFI_AUTH_WPA_WPA2_PSK, 1),
+    };
+    const wifi_ap_record_t ch6[] = {
+        ap_record("Office", AP_OFFICE, -63, WIFI_AUTH_WPA2_WPA3_PSK, 6),
+    };
+    wifi_out_ap_header(sink);
+    wifi_out_aps(sink, ch1, 2);
+    wifi_out_aps(sink, ch6, 1);
+    wifi_out_scan_done(sink, 3, 13, 1587);
+}
+
+typedef struct {
+    result_sink_t *sink;
+    uint32_t now;
+    uint32_t events;
+} watch_t;
+
+static void watch_event(const ap_event_t *ev, void *ctx)
+{
+    watch_t *w = ctx;
+    w->events++;
+    wifi_out_event(w->sink, w->now, ev);
+}
+
+static void watch_see(ap_table_t *t, const char *ssid, const uint8_t *bssid, int8_t rssi, uint8_t auth,
+                      uint8_t channel, uint32_t now)
+{
+    ap_sighting_t s = { .channel = channel, .authmode = auth, .rssi = rssi };
+    memcpy(s.bssid, bssid, 6);
+    strncpy(s.ssid, ssid, AP_TABLE_SSID_LEN);
+    ap_table_update(t, &s, now);
+}
+
+// scan-wifi -w 10, three APs tracked: every kind of event, then the table
+static void scan_wifi_watch(result_sink_t *sink)
+{
+    ap_entry_t entries[3];
+    ap_table_t t;
+    watch_t w = { .sink = sink };
+    ap_table_init(&t, entries, 3, 3, watch_event, &w);
+    watch_see(&t, "HomeNet", AP_HOME, -42, WIFI_AUTH_WPA2_PSK, 1, w.now);
+    watch_see(&t, "Office", AP_OFFICE, -63, WIFI_AUTH_WPA2_WPA3_PSK, 6, w.now);
+    ap_table_expire(&t);
+    w.now = 10;
+    watch_see(&t, "HomeNet", AP_HOME, -50, WIFI_AUTH_WPA2_PSK, 11, w.now);
+    watch_see(&t, "HomeNet", AP_TWIN, -30, WIFI_AUTH_OPEN, 1, w.now);
+    watch_see(&t, "", AP_GUEST, -70, WIFI_AUTH_WPA2_PSK, 11, w.now);    // table full: Office goes
+    ap_table_expire(&t);
+    w.now = 20;
+    watch_see(&t, "HomeNet", AP_HOME, -48, WIFI_AUTH_WPA2_PSK, 11, w.now);
+    ap_table_expire(&t);
+    w.now = 30;
+    watch_see(&t, "HomeNet", AP_HOME, -48, WIFI_AUTH_WPA2_PSK, 11, w.now);
+    ap_table_expire(&t);
+    w.now = 40;                         // twin and guest missed 3 rounds: gone
+    watch_see(&t, "HomeNet", AP_HOME, -46, WIFI_AUTH_WPA2_PSK, 11, w.now);
+    ap_table_expire(&t);
+    wifi_out_watch_done(sink, 6, 1, 8, w.events, &t);
+}
+
+// Management frame: header, fixed fields of a beacon or probe response, SSID element
+static uint16_t mgmt_frame(uint8_t *f, uint8_t subtype, const uint8_t *da, const uint8_t *sa, const char *ssid)
+{
+    memset(f, 0, 96);
+    f[0] = subtype << 4;
+    memcpy(f + 4, da, 6);
+    memcpy(f + 10, sa, 6);
+    memcpy(f + 16, subtype == 0x04 ? BROADCAST : sa, 6);
+    if (subtype == 0x04) {
+        f[25] = strlen(ssid);       // probe request: the element comes right after the header
+        memcpy(f + 26, ssid, strlen(ssid));
+        return 26 + strlen(ssid);
+    }
+    f[32] = 0x64;                   // beacon interval 100 TU
+    f[34] = 0x31;                   // capabilities: ESS, privacy
+    f[37] = strlen(ssid);
+    memcpy(f + 38, ssid, strlen(ssid));
+    return 38 + strlen(ssid);
+}
+
+static void sniffer_wifi(result_sink_t *sink)
+{
+    uint8_t f[96];
+    uint16_t len = mgmt_frame(f, 0x08, BROADCAST, AP_HOME, "HomeNet");
+    wifi_out_mgmt(sink, f, len, -41, 1);
+    len = mgmt_frame(f, 0x04, BROADCAST, PHONE, "HomeNet");
+    wifi_out_mgmt(sink, f, len, -58, 1);
+    len = mgmt_frame(f, 0x05, PHONE, AP_HOME, "HomeNet");
+    wifi_out_mgmt(sink, f, len, -43, 1);
+    len = mgmt_frame(f, 0x08, BROADCAST, AP_TWIN, "");    // hidden SSID
+    wifi_out_mgmt(sink, f, len, -80, 6);
+
+    // EAPOL message 1 of the 4-way handshake, QoS data + LLC/SNAP
+    memset(f, 0, sizeof(f));
+    f[0] = 0x88;
+    f[1] = 0x02;
+    memcpy(f + 4, PHONE, 6);
+    memcpy(f + 10, AP_HOME, 6);
+    memcpy(f + 16, AP_HOME, 6);
+    const uint8_t llc[] = { 0xaa, 0xaa, 0x03, 0x00, 0x00, 0x00, 0x88, 0x8e, 0x02, 0x03, 0x00, 0x5f, 0x02, 0x00, 0x8a };
+    memcpy(f + 26, llc, sizeof(llc));
+    for (int i = 41; i < 96; i++) {
+        f[i] = i;                   // replay counter, nonce
+    }
+    wifi_out_eapol(sink, f, 96, -44);
+}
+
+static void join(result_sink_t *sink)
+{
+    const uint8_t ip[4] = { 192, 168, 1, 42 };
+    uint32_t addr;
+    memcpy(&addr, ip, 4);
+    wifi_out_link(sink, "HomeNet", addr, -51, 11);
+}
+
+static void scan_arp(result_sink_t *sink)
+{
+    const uint8_t hosts[][4] = { { 192, 168, 1, 1 }, { 192, 168, 1, 17 } };
+    const uint8_t macs[][6] = { { 0x24, 0x4b, 0xfe, 0x10, 0x20, 0x30 }, { 0xa4, 0xc3, 0xf0, 0x85, 0x7e, 0x01 } };
+    for (int i = 0; i < 2; i++) {
+        uint32_t addr;
+        memcpy(&addr, hosts[i], 4);
+        arp_out_host(sink, addr, macs[i]);
+    }
+    arp_out_done(sink, 2, 254, 5130);
+}
+
+static void ping(result_sink_t *sink)
+{
+    ping_ip_t ip = { .addr = { 192, 168, 1, 1 }, .len = 4, .text = "192.168.1.1" };
+    ping_out_reply(sink, &ip, 1, 64, 3, 64);
+    ping_out_timeout(sink, &ip, 2);
+    ping_out_reply(sink, &ip, 3, 64, 12, 64);
+    ping_out_done(sink, &ip, 3, 2, 3021);
+    ping_ip_t ip6 = { .addr = { 0xfe, 0x80, [15] = 0x01 }, .len = 16, .text = "FE80::1" };
+    ping_out_reply(sink, &ip6, 1, 255, 1, 64);
+}
+
+static void version(result_sink_t *sink)
+{
+    const esp_chip_info_t info = {
+        .model = CHIP_ESP32,
+        .features = CHIP_FEATURE_WIFI_BGN | CHIP_FEATURE_BLE | CHIP_FEATURE_BT,
+        .revision = 301,
+        .cores = 2,
+    };
+    system_out_chip(sink, "ESP32", &info, 4 * 1024 * 1024, "v5.3.2");
+}
+
+static const struct {
+    const char *name;
+    void (*run)(result_sink_t *sink);
+} s_commands[] = {
+    { "scan-wifi", scan_wifi },
+    { "scan-wifi-watch", scan_wifi_watch },
+    { "sniffer_wifi", sniffer_wifi },
+    { "join", join },
+    { "scan-arp", scan_arp },
+    { "ping", ping },
+    { "version", version },
+};
+
+/* ---- capture and compare ---- */
+
+static const struct {
+    result_output_t mode;
+    const char *ext;
+} s_modes[] = {
+    { RESULT_OUTPUT_TEXT, "txt" },
+    { RESULT_OUTPUT_JSON, "json" },
+    { RESULT_OUTPUT_CBOR, "cbor.hex" },
+};
+
+// Runs the command as the dispatcher does, returns what it wrote to stdout
+static char *capture(void (*run)(result_sink_t *), result_output_t mode, size_t *len)
+{
+    char *buf = NULL;
+    FILE *saved = stdout;
+    stdout = open_memstream(&buf, len);
+    result_output_set(mode);
+    result_sink_t *console = result_console_open();
+    CHECK((console == NULL) == (mode == RESULT_OUTPUT_TEXT));
+    run(result_sink_current());
+    result_console_close(console);
+    fclose(stdout);
+    stdout = saved;
+    return buf;
+}
+
+static char *hex_lines(const char *data, size_t len, size_t *out_len)
+{
+    char *out = malloc(len * 2 + len / 32 + 2);
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        n += sprintf(out + n, "%02x", (uint8_t)data[i]);
+        if (i % 32 == 31 || i == len - 1) {
+            out[n++] = '\n';
+        }
+    }
+    out[n] = '\0';
+    *out_len = n;
+    return out;
+}
+
+static char *read_file(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buf = malloc(size + 1);
+    *len = fread(buf, 1, size, f);
+    buf[*len] = '\0';
+    fclose(f);
+    return buf;
+}
+
+// First differing line, to see what changed without a diff tool
+static void show_diff(const char *want, const char *got)
+{
+    const char *want_line = want, *got_line = got;
+    int line = 1;
+    for (; *want && *want == *got; want++, got++) {
+        if (*want == '\n') {
+            line++;
+            want_line = want + 1;
+            got_line = got + 1;
+        }
+    }
+    printf("  line %d\n  want: %.*s\n  got:  %.*s\n", line, (int)strcspn(want_line, "\n"), want_line,
+           (int)strcspn(got_line, "\n"), got_line);
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : "golden";
+    bool update = getenv("UPDATE_GOLDEN") != NULL;
+
+    for (size_t c = 0; c < sizeof(s_commands) / sizeof(s_commands[0]); c++) {
+        for (size_t m = 0; m < sizeof(s_modes) / sizeof(s_modes[0]); m++) {
+            size_t len;
+            char *got = capture(s_commands[c].run, s_modes[m].mode, &len);
+            if (s_modes[m].mode == RESULT_OUTPUT_CBOR) {
+                char *hex = hex_lines(got, len, &len);
+                free(got);
+                got = hex;
+            }
+            char path[256];
+            snprintf(path, sizeof(path), "%s/%s.%s", dir, s_commands[c].name, s_modes[m].ext);
+            if (update) {
+                FILE *f = fopen(path, "wb");
+                CHECK(f != NULL);
+                if (f) {
+                    fwrite(got, 1, len, f);
+                    fclose(f);
+                }
+                free(got);
+                continue;
+            }
+            size_t want_len;
+            char *want = read_file(path, &want_len);
+            if (want == NULL) {
+                printf("%s: missing, run with UPDATE_GOLDEN=1\n", path);
+                s_failures++;
+            } else if (want_len != len || memcmp(want, got, len) != 0) {
+                printf("%s: output differs\n", path);
+                show_diff(want, got);
+                s_failures++;
+            }
+            free(want);
+            free(got);
+        }
+    }
+    return TEST_DONE();
+}